@@ -0,0 +1,535 @@
+// @language: c++14
+static char const* USAGE_PATTERN = "%s {--help,--quick}";
+#include "uu_focus_audio_backend.hpp"
+#include "uu_focus_audio_clock.hpp"
+#include "uu_focus_audio_convert.hpp"
+#include "uu_focus_audio_resampler.hpp"
+#include "uu_focus_audio_ring.hpp"
+#include "uu_focus_effects.hpp"
+#include "uu_focus_platform.hpp"
+#include "uu_focus_render_pool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static uint64_t now_micros();
+
+// the benchmarks reach into the implementation:
+#include "uu_focus_audio_convert.cpp"
+#include "uu_focus_audio_dsp.cpp"
+#include "uu_focus_effects.cpp"
+#include "uu_focus_render_pool.cpp"
+#include "uu_focus_audio_backend.cpp"
+#include "uu_focus_audio_ring.cpp"
+#include "uu_focus_audio_resampler.cpp"
+#include "uu_focus_audio_clock.cpp"
+
+struct BenchOptions
+{
+    bool is_valid;
+    bool help_on;
+    bool quick_on;
+};
+
+static BenchOptions parse_bench_options(char const* const * args_f,
+                                        char const* const * const args_l)
+{
+    BenchOptions options = {};
+    while (args_f != args_l) {
+        if (0 == strcmp("--quick", *args_f)) {
+            options.quick_on = true;
+        } else if (0 == strcmp("--help", *args_f)) {
+            options.help_on = true;
+        } else {
+            return options; // invalid
+        }
+        ++args_f;
+    }
+    options.is_valid = true;
+    return options;
+}
+
+BenchOptions global_bench_options;
+
+static double bench_now_seconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs `fn` for at least the minimum duration, returns seconds per call.
+template <typename Fn>
+static double bench_seconds_per_call(Fn fn)
+{
+    double const duration_min_s = global_bench_options.quick_on ? 0.02 : 0.25;
+    fn(); // warm up
+    int call_n = 1;
+    while (true) {
+        auto const start_s = bench_now_seconds();
+        for (int i = 0; i < call_n; ++i) fn();
+        auto const elapsed_s = bench_now_seconds() - start_s;
+        if (elapsed_s >= duration_min_s) return elapsed_s / call_n;
+        call_n *= 2;
+    }
+}
+
+// Fraction of the real time budget used to process `frame_count` frames at 48khz
+static double bench_realtime_fraction(double seconds, int frame_count)
+{
+    return seconds / (double(frame_count) / 48000.0);
+}
+
+static void bench_report(char const* name, double seconds, int frame_count)
+{
+    std::printf("BENCH: %-48s %10.1f ns/frame %8.4f%% of realtime\n",
+                name,
+                1e9 * seconds / frame_count,
+                100.0 * bench_realtime_fraction(seconds, frame_count));
+    fflush(stdout);
+}
+
+static void bench_convert()
+{
+    enum { FRAME_COUNT = 48000 / 60 + 2 * 48, CHANNEL_COUNT = 2 };
+    std::vector<float> samples(FRAME_COUNT * CHANNEL_COUNT);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = float(0.5 * std::sin(0.01 * double(i)));
+    }
+    std::vector<uint8_t> dst(samples.size() * 4);
+
+    struct { AudioSampleFormat format; char const* name; } const formats[] = {
+        { AudioSampleFormat_S16, "s16" },
+        { AudioSampleFormat_S24_Packed, "s24 packed" },
+        { AudioSampleFormat_S32, "s32" },
+    };
+    struct { AudioDither dither; char const* name; } const dithers[] = {
+        { AudioDither_None, "no dither" },
+        { AudioDither_Tpdf, "tpdf" },
+        { AudioDither_TpdfShaped, "shaped tpdf" },
+    };
+    char const* const isa_names[] = { "scalar", "sse2", "avx2" };
+
+    for (auto const& format : formats) {
+        for (auto const& dither : dithers) {
+            for (int isa = 0; isa <= audio_convert_isa_max(); ++isa) {
+                auto kernel = audio_convert_select_isa(
+                    format.format, dither.dither, AudioConvertIsa(isa));
+                AudioDitherState state;
+                audio_dither_init(&state, 1, CHANNEL_COUNT);
+                auto const seconds = bench_seconds_per_call([&]() {
+                    kernel(&state, samples.data(), int(samples.size()), dst.data());
+                });
+                char name[128];
+                std::snprintf(name, sizeof name, "convert %s %s %s",
+                              format.name, dither.name, isa_names[isa]);
+                bench_report(name, seconds, FRAME_COUNT);
+            }
+        }
+    }
+}
+
+static void bench_noise_channels()
+{
+    enum { FRAME_COUNT = 48000 / 60 + 2 * 48 };
+    std::vector<float> samples(FRAME_COUNT * AUDIO_CHANNEL_MAX);
+    auto audio = audio_make();
+    audio_start(audio);
+    int const channel_counts[] = { 1, 2, 4, 6, 8 };
+    for (auto channel_count : channel_counts) {
+        auto const seconds = bench_seconds_per_call([&]() {
+            audio_thread_render(audio, samples.data(), channel_count, FRAME_COUNT);
+        });
+        char name[128];
+        std::snprintf(name, sizeof name, "noise %d channels", channel_count);
+        bench_report(name, seconds, FRAME_COUNT);
+        std::printf("BENCH: %-48s %10.1f ns\n", "  per channel frame",
+                    1e9 * seconds / FRAME_COUNT / channel_count);
+    }
+    audio_destroy(audio);
+}
+
+static void bench_dsp_execution()
+{
+    enum { FRAME_COUNT = 48000 / 60 + 2 * 48 };
+    std::vector<float> samples(FRAME_COUNT * AUDIO_CHANNEL_MAX);
+    auto audio = audio_make();
+    audio_start(audio);
+    // the fade starts once the audio thread has received it:
+    audio_thread_render(audio, samples.data(), 2, 1);
+
+    // both chains render past the end of their fade
+    struct { char const* name; AudioChainProc* chain; int channel_count; } const cases[] = {
+        { "noise chain 2 channels", noise_chain_n<1>, 2 },
+        { "noise chain 8 channels", noise_chain_n<2>, 8 },
+        { "reference tone chain 2 channels", reference_tone_chain_n<1>, 2 },
+    };
+    struct { AudioDspExecution execution; char const* name; } const executions[] = {
+        { AudioDspExecution_Staged, "staged" },
+        { AudioDspExecution_Fused, "fused" },
+    };
+    for (auto const& c : cases) {
+        AudioDspBlock block = {};
+        block.chime_samples = audio->chime_samples;
+        block.chime_frame_count = AUDIO_CHIME_FRAME_COUNT;
+        block.separation_ms = global_separation_ms;
+        // NOTE(nicolas): alternating runs, keeping the best of each, so that
+        // the order of the runs and the noise of the machine do not decide
+        double seconds[2] = { 1e9, 1e9 };
+        for (int run_i = 0; run_i < 5; ++run_i) {
+            for (int execution_i = 0; execution_i < 2; ++execution_i) {
+                global_audio_dsp_execution = executions[execution_i].execution;
+                auto const run_seconds = bench_seconds_per_call([&]() {
+                    for (int first = 0; first < FRAME_COUNT; first += AUDIO_CHUNK_FRAMES) {
+                        auto const n = std::min(int(AUDIO_CHUNK_FRAMES), FRAME_COUNT - first);
+                        c.chain(audio->dsp_state, block,
+                                samples.data() + first*c.channel_count, c.channel_count, n);
+                    }
+                });
+                seconds[execution_i] = std::min(seconds[execution_i], run_seconds);
+            }
+        }
+        for (int execution_i = 0; execution_i < 2; ++execution_i) {
+            auto const& execution = executions[execution_i];
+            char name[128];
+            std::snprintf(name, sizeof name, "%s %s", c.name, execution.name);
+            bench_report(name, seconds[execution_i], FRAME_COUNT);
+        }
+        std::printf("BENCH: %-48s %10.2fx\n", "  fused speedup", seconds[0] / seconds[1]);
+    }
+    global_audio_dsp_execution = AudioDspExecution_Fused;
+    audio_destroy(audio);
+}
+
+// What a mode transition costs over rendering one mode, for the length
+// of the crossfade and the worst case of the longest one.
+static void bench_mode_transition()
+{
+    enum { BLOCK_FRAME_COUNT = 480 };
+    std::vector<float> samples(BLOCK_FRAME_COUNT * 2);
+    auto const mode = global_audio_mode.load();
+    auto const crossfade_ms = global_audio_mode_crossfade_ms;
+    double const crossfade_mss[] = { crossfade_ms, 1000.0 * AUDIO_MODE_CROSSFADE_FRAMES_MAX / 48000 };
+    for (auto const ms : crossfade_mss) {
+        global_audio_mode_crossfade_ms = ms;
+        auto const frame_count = int(ms * 48000 / 1000);
+        auto audio = audio_make();
+        audio_start(audio);
+        auto const render = [&]() {
+            for (int first = 0; first < frame_count; first += BLOCK_FRAME_COUNT) {
+                auto const n = std::min(int(BLOCK_FRAME_COUNT), frame_count - first);
+                audio_thread_render(audio, samples.data(), 2, n);
+            }
+        };
+        auto const steady_seconds = bench_seconds_per_call(render);
+        auto const transition_seconds = bench_seconds_per_call([&]() {
+            // NOTE(nicolas): modes past the built-in ones render the
+            // default, which costs as much as any other
+            global_audio_mode = global_audio_mode == mode ? mode + 1 : mode;
+            render();
+        });
+        char name[128];
+        std::snprintf(name, sizeof name, "one mode, %.0fms", ms);
+        bench_report(name, steady_seconds, frame_count);
+        std::snprintf(name, sizeof name, "mode transition, %.0fms crossfade", ms);
+        bench_report(name, transition_seconds, frame_count);
+        std::printf("BENCH: %-48s %10.2fx\n", "  transition cost", transition_seconds / steady_seconds);
+        audio_destroy(audio);
+        global_audio_mode = mode;
+    }
+    global_audio_mode_crossfade_ms = crossfade_ms;
+}
+
+static void bench_render_pool()
+{
+    enum { FRAME_COUNT = 1024, CHANNEL_COUNT = 2, STREAM_COUNT = 48 };
+    std::vector<float> frames(STREAM_COUNT*FRAME_COUNT*CHANNEL_COUNT);
+    RenderStream streams[STREAM_COUNT];
+    for (int i = 0; i < STREAM_COUNT; ++i) {
+        streams[i].audio = audio_make();
+        streams[i].frames = &frames[i*FRAME_COUNT*CHANNEL_COUNT];
+        streams[i].channel_count = CHANNEL_COUNT;
+        audio_start(streams[i].audio);
+    }
+    int const core_count = std::max(1, int(std::thread::hardware_concurrency()));
+    std::printf("BENCH: %-48s %10d\n", "render pool cores", core_count);
+    // doubling the workers, up to every core
+    std::vector<int> worker_counts;
+    for (int n = 1; n < core_count; n *= 2) worker_counts.push_back(n);
+    worker_counts.push_back(core_count);
+
+    double one_worker_seconds = 0.0;
+    for (auto worker_count : worker_counts) {
+        auto pool = render_pool_make(worker_count, STREAM_COUNT);
+        int steal_n = 0, block_n = 0;
+        auto const seconds = bench_seconds_per_call([&]() {
+            auto const result = render_pool_render(pool, streams, STREAM_COUNT,
+                                                   FRAME_COUNT, UINT64_MAX);
+            steal_n += result.steal_n;
+            ++block_n;
+        });
+        render_pool_destroy(pool);
+        if (worker_count == 1) one_worker_seconds = seconds;
+
+        char name[128];
+        std::snprintf(name, sizeof name, "render pool %d streams %d workers",
+                      STREAM_COUNT, worker_count);
+        bench_report(name, seconds, FRAME_COUNT);
+        std::printf("BENCH: %-48s %10.1f\n", "  streams in realtime",
+                    STREAM_COUNT / bench_realtime_fraction(seconds, FRAME_COUNT));
+        std::printf("BENCH: %-48s %10.2fx\n", "  speedup", one_worker_seconds / seconds);
+        std::printf("BENCH: %-48s %10.1f\n", "  steals per block", double(steal_n) / block_n);
+    }
+    for (auto const& stream : streams) audio_destroy(stream.audio);
+}
+
+// when set, the clock of this device is the bench clock
+static AudioSimDevice* global_bench_sim_device;
+
+// From our rate to the rate of common devices, per frame we render.
+static void bench_resampler()
+{
+    enum { FRAME_COUNT = 48000 / 60 };
+    struct { int output_hz; int channel_count; double drift; char const* name; } const cases[] = {
+        { 44100, 2, 0.0, "resample to 44100 stereo" },
+        { 44100, 2, 0.001, "resample to 44100 stereo, drifting" },
+        { 44100, 6, 0.0, "resample to 44100 5.1" },
+        { 96000, 2, 0.0, "resample to 96000 stereo" },
+        { 22050, 2, 0.0, "resample to 22050 stereo" },
+    };
+    for (auto const& c : cases) {
+        auto resampler = audio_resampler_make(c.channel_count, 48000, c.output_hz);
+        audio_resampler_set_drift(resampler, c.drift);
+        auto const output_frame_count = uint32_t(FRAME_COUNT * int64_t(c.output_hz) / 48000);
+        std::vector<float> input(size_t(c.channel_count)*(FRAME_COUNT + 8));
+        for (size_t i = 0; i < input.size(); ++i) {
+            input[i] = float(0.5 * std::sin(0.01 * double(i)));
+        }
+        std::vector<float> output(size_t(c.channel_count)*output_frame_count);
+        auto const seconds = bench_seconds_per_call([&]() {
+            audio_resampler_process(resampler, input.data(), output.data(), output_frame_count);
+        });
+        bench_report(c.name, seconds, FRAME_COUNT);
+        audio_resampler_destroy(resampler);
+    }
+}
+
+// Underruns against the depth of the device buffer, on a simulated device
+// waking us up to 2ms late and stalling 25ms every 5s on average. Then the
+// latency the controller settles on, for that same device.
+static void bench_device_underruns()
+{
+    uint64_t const duration_micros = global_bench_options.quick_on ? 30'000'000 : 600'000'000;
+    std::vector<float> render_samples(AUDIO_CHANNEL_MAX*8*480);
+    AudioDitherState dither;
+    audio_dither_init(&dither, 1, 2);
+    // 0 periods for the latency controller on a 100ms buffer
+    for (uint32_t period_n : { 2, 3, 4, 6, 8, 0 }) {
+        bool const is_controlled = period_n == 0;
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        config.buffer_frames = is_controlled ? 4800 : period_n*480;
+        config.jitter_micros = 2'000;
+        config.stall_micros = 25'000;
+        config.stall_every_n_periods = 500;
+        config.seed = 1;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        audio_stream_open(&stream, &backend, 48000, 0);
+        AudioLatencyController latency;
+        audio_latency_init(&latency, 48000, 48, config.buffer_frames);
+        auto audio = audio_make();
+        audio_start(audio);
+        global_bench_sim_device = device;
+        while (device->now_micros < duration_micros) {
+            audio_stream_render(&stream, audio, is_controlled ? &latency : nullptr, nullptr,
+                                &dither, render_samples.data(), uint32_t(render_samples.size()),
+                                config.buffer_frames);
+        }
+        global_bench_sim_device = nullptr;
+        char name[128];
+        if (is_controlled) {
+            std::snprintf(name, sizeof name, "underruns per minute, controlled latency");
+        } else {
+            std::snprintf(name, sizeof name, "underruns per minute, %2ums buffer",
+                          config.buffer_frames/48);
+        }
+        std::printf("BENCH: %-48s %10.1f\n", name,
+                    double(device->underrun_n) * 60e6 / double(duration_micros));
+        if (is_controlled) {
+            std::printf("BENCH: %-48s %10.1f\n", "  controlled latency ms",
+                        audio_latency_frames(&latency) / 48.0);
+        }
+        audio_stream_close(&stream);
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+}
+
+// Time to play again after the device went away, against how long it
+// stayed away.
+static void bench_device_migration()
+{
+    std::vector<float> render_samples(AUDIO_CHANNEL_MAX*4800);
+    AudioDitherState dither;
+    audio_dither_init(&dither, 1, 2);
+    for (uint64_t away_micros : { 0, 30'000, 250'000, 1'000'000 }) {
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        config.buffer_frames = 3*480;
+        config.seed = 1;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        audio_stream_open(&stream, &backend, 48000, 0);
+        AudioStreamMigration migration;
+        audio_stream_migration_init(&migration, &backend, 48000, 0);
+        auto audio = audio_make();
+        audio_start(audio);
+        global_bench_sim_device = device;
+        for (int lost_i = 0; lost_i < 10; ++lost_i) {
+            auto const lost_micros = device->now_micros + 1'000'000;
+            while (stream.header.error == AudioStreamError_Success) {
+                if (device->now_micros >= lost_micros) device->is_disconnected = true;
+                audio_stream_render(&stream, audio, nullptr, nullptr, &dither,
+                                    render_samples.data(), uint32_t(render_samples.size()),
+                                    config.buffer_frames);
+            }
+            audio_stream_migration_begin(&migration, device->now_micros);
+            while (true) {
+                if (device->now_micros >= lost_micros + away_micros) {
+                    device->is_disconnected = false;
+                }
+                while (auto frame_count = audio_stream_migration_drop(&migration,
+                                                                      device->now_micros, 480)) {
+                    audio_thread_render(audio, render_samples.data(), 2, int(frame_count));
+                }
+                if (audio_stream_migration_reopen(&stream, &migration, device->now_micros)) break;
+                audio_sim_advance(device, 10'000);
+            }
+        }
+        global_bench_sim_device = nullptr;
+        char name[128];
+        std::snprintf(name, sizeof name, "recovery ms at most, device away for %4ums",
+                      unsigned(away_micros/1000));
+        std::printf("BENCH: %-48s %10.1f (attempts: %.1f per migration)\n", name,
+                    migration.recovery_micros_max / 1e3,
+                    double(migration.attempt_n) / double(migration.migration_n));
+        audio_stream_close(&stream);
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+}
+
+// From audio_start to the first sound out of audio_thread_render, with
+// the device thread of win32_unit_uu_focus_main.cpp: starting from idle,
+// the audio thread parked and the device closed, or prewarmed some time
+// before. The simulated device takes 20ms to open, and wakes us up to 2ms
+// late.
+static void bench_start_latency()
+{
+    int const trial_n = global_bench_options.quick_on ? 100 : 2000;
+    std::vector<float> render_samples(AUDIO_CHANNEL_MAX*4800);
+    AudioDitherState dither;
+    audio_dither_init(&dither, 1, 2);
+    for (bool is_prewarmed : { false, true }) {
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        config.buffer_frames = 3*480;
+        config.jitter_micros = 2'000;
+        config.open_micros = 20'000;
+        config.seed = 1;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        auto audio = audio_make();
+        auto const render = [&]() {
+            audio_stream_render(&stream, audio, nullptr, nullptr, &dither,
+                                render_samples.data(), uint32_t(render_samples.size()),
+                                config.buffer_frames);
+        };
+        std::vector<uint64_t> latencies;
+        uint32_t rng = 1;
+        global_bench_sim_device = device;
+        for (int trial_i = 0; trial_i < trial_n; ++trial_i) {
+            rng = rng*1664525 + 1013904223;
+            audio_sim_advance(device, 1'000'000 + rng % 1'000'000); // idle
+            if (is_prewarmed) {
+                audio_prewarm(audio);
+                audio_thread_park(audio); // woken up by the event
+                audio_stream_open(&stream, &backend, 48000, 0);
+                // the pointer hovered the window for a moment
+                auto const start_micros = device->now_micros + 100'000 + rng % 1'000'000;
+                while (device->now_micros + 10'000 < start_micros) render();
+                if (device->now_micros < start_micros) {
+                    audio_sim_advance(device, start_micros - device->now_micros);
+                }
+                audio_start(audio);
+            } else {
+                audio_start(audio);
+                audio_thread_park(audio);
+                audio_stream_open(&stream, &backend, 48000, 0);
+            }
+            do render(); while (audio->is_start_pending);
+            latencies.push_back(audio_start_latency_micros(audio));
+            audio_stop(audio);
+            while (!audio_thread_is_silent(audio)) render();
+            audio_stream_close(&stream);
+        }
+        global_bench_sim_device = nullptr;
+        std::sort(latencies.begin(), latencies.end());
+        auto const percentile = [&](double p) {
+            return latencies[size_t(p*double(latencies.size() - 1))] / 1e3;
+        };
+        char name[128];
+        std::snprintf(name, sizeof name, "start to sound ms, %s", is_prewarmed ? "prewarmed" : "idle");
+        std::printf("BENCH: %-48s %10.1f (p90: %.1f, max: %.1f)\n", name,
+                    percentile(0.5), percentile(0.9), percentile(1.0));
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    auto options = parse_bench_options(argv + 1, argv + argc);
+    if (options.help_on || !options.is_valid) {
+        std::printf(USAGE_PATTERN, *argv);
+        exit(options.is_valid ? 0 : 1);
+    }
+    global_bench_options = options;
+
+    bench_convert();
+    bench_noise_channels();
+    bench_dsp_execution();
+    bench_mode_transition();
+    bench_render_pool();
+    bench_resampler();
+    bench_device_underruns();
+    bench_device_migration();
+    bench_start_latency();
+}
+
+static uint64_t now_micros()
+{
+    if (global_bench_sim_device) return global_bench_sim_device->now_micros;
+    return 0;
+}
+
+void platform_render_async(Platform*) {}
+void platform_notify(Platform*, UIText) {}
+Civil_Time_Of_Day platform_get_time_of_day() { return {}; }
+UIText ui_text_temp(char const*, ...) { return {}; }
+void temp_allocator_reset() {}
@@ -0,0 +1,453 @@
+// @language: c++14
+static char const* USAGE_PATTERN = "%s {--help,--quick}";
+#include "uu_focus_journal.hpp"
+#include "uu_focus_main.hpp"
+#include "uu_focus_schedule.hpp"
+#include "uu_focus_sessions.hpp"
+#include "uu_focus_sim.hpp"
+#include "uu_focus_timing_wheel.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// The clock every effect tells time with.
+static SimClock global_bench_clock;
+
+static uint64_t now_micros()
+{
+    return global_bench_clock.now_micros(global_bench_clock.user);
+}
+
+// Effects of the simulation: they keep the time and count, and nothing else.
+
+struct TimerEffect
+{
+    int on_count;
+    uint64_t start_micros;
+    uint64_t end_micros;
+    uint64_t render_n;
+    uint64_t celebrate_n;
+};
+
+struct AudioEffect
+{
+    uint64_t start_n;
+    uint64_t stop_n;
+    uint64_t chime_n;
+    uint64_t chime_cancel_n;
+    uint64_t prewarm_n;
+};
+
+#include "uu_focus_effects.hpp"
+
+void audio_start(AudioEffect* audio) { ++audio->start_n; }
+void audio_stop(AudioEffect* audio) { ++audio->stop_n; }
+void audio_preset(AudioEffect*, AudioPreset) {}
+void audio_prewarm(AudioEffect* audio) { ++audio->prewarm_n; }
+void audio_chime_at(AudioEffect* audio, uint64_t) { ++audio->chime_n; }
+void audio_chime_cancel(AudioEffect* audio) { ++audio->chime_cancel_n; }
+void audio_ticks_until(AudioEffect*, uint64_t) {}
+void audio_ticks_cancel(AudioEffect*) {}
+
+void timer_update_and_render(TimerEffect* timer) { ++timer->render_n; }
+
+void timer_reset(TimerEffect* _timer, uint64_t duration_micros)
+{
+    auto& timer = *_timer;
+    timer.end_micros = now_micros() + duration_micros;
+    timer_update_and_render(&timer);
+}
+
+void timer_start(TimerEffect* _timer, uint64_t duration_micros)
+{
+    auto& timer = *_timer;
+    ++timer.on_count;
+    timer_reset(&timer, duration_micros);
+    timer.start_micros = now_micros();
+}
+
+void timer_stop(TimerEffect* _timer)
+{
+    auto& timer = *_timer;
+    --timer.on_count;
+    timer_update_and_render(&timer);
+}
+
+bool timer_is_active(TimerEffect* timer) { return timer->on_count > 0; }
+uint64_t timer_end_micros(TimerEffect* timer) { return timer->end_micros; }
+bool timer_expired(TimerEffect* timer, uint64_t micros) { return micros >= timer->end_micros; }
+
+void timer_celebrate(TimerEffect* _timer)
+{
+    auto& timer = *_timer;
+    timer.on_count = 0;
+    ++timer.celebrate_n;
+    timer_update_and_render(&timer);
+}
+
+#include "uu_focus_main.cpp"
+#include "uu_focus_journal.cpp"
+#include "uu_focus_schedule.cpp"
+#include "uu_focus_sessions.cpp"
+#include "uu_focus_sim.cpp"
+#include "uu_focus_timing_wheel.cpp"
+
+struct BenchOptions
+{
+    bool is_valid;
+    bool help_on;
+    bool quick_on;
+};
+
+static BenchOptions parse_bench_options(char const* const * args_f,
+                                        char const* const * const args_l)
+{
+    BenchOptions options = {};
+    while (args_f != args_l) {
+        if (0 == strcmp("--quick", *args_f)) {
+            options.quick_on = true;
+        } else if (0 == strcmp("--help", *args_f)) {
+            options.help_on = true;
+        } else {
+            return options; // invalid
+        }
+        ++args_f;
+    }
+    options.is_valid = true;
+    return options;
+}
+
+BenchOptions global_bench_options;
+
+static double bench_now_seconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Years of sessions, fast forwarded.
+static void bench_simulated_years()
+{
+    uint64_t const year_micros = 365ull*24*3600*1'000'000;
+    int const year_n = global_bench_options.quick_on ? 1 : 25;
+    struct { char const* name; SimUser user; } const cases[] = {
+        { "focused user", { 1, 5*60'000'000ull, 2'000'000, 0.0, 0.0 } },
+        { "distracted user", { 2, 5*60'000'000ull, 2'000'000, 0.3, 0.2 } },
+    };
+    for (auto const& c : cases) {
+        SimVirtualClock virtual_clock = {};
+        global_bench_clock = sim_virtual_clock(&virtual_clock);
+        TimerEffect timer = {};
+        AudioEffect audio = {};
+        UUFocusMainCoroutine program = {};
+        program.timer_effect = &timer;
+        program.audio_effect = &audio;
+        uu_focus_main(&program);
+
+        auto const start_s = bench_now_seconds();
+        auto const stats = sim_run(&program, global_bench_clock, c.user, year_n*year_micros);
+        auto const elapsed_s = bench_now_seconds() - start_s;
+
+        // whatever the schedule, the program and its effects agree
+        assert(stats.cycle_n == timer.celebrate_n);
+        assert(audio.start_n == audio.stop_n + (timer.on_count > 0 ? 1 : 0));
+        assert(audio.chime_n == audio.start_n + stats.restart_n);
+        assert(audio.chime_cancel_n == stats.stop_n);
+        assert(virtual_clock.now_micros == year_n*year_micros);
+        if (c.user.stop_probability == 0.0) assert(stats.stop_n == 0);
+
+        std::printf("BENCH: %-48s %10.0f cycles/s %8.1f simulated years/s\n",
+                    c.name, double(stats.cycle_n) / elapsed_s, year_n / elapsed_s);
+        std::printf("BENCH: %-48s %10.0f cycles %8.2f resumes/cycle\n",
+                    "", double(stats.cycle_n), double(stats.resume_n) / double(stats.cycle_n));
+    }
+}
+
+static void bench_journal_write(void* user, uint8_t const* bytes, size_t size)
+{
+    auto& journal_bytes = *static_cast<std::vector<uint8_t>*>(user);
+    journal_bytes.insert(journal_bytes.end(), bytes, bytes + size);
+}
+
+// What recording the inputs costs the program, and replaying them.
+static void bench_journal()
+{
+    uint64_t const year_micros = 365ull*24*3600*1'000'000;
+    SimUser const user = { 3, 5*60'000'000ull, 2'000'000, 0.3, 0.2 };
+    struct Run
+    {
+        SimVirtualClock clock;
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+    };
+    auto const run_make = [](Run* _run) {
+        auto& run = *_run;
+        run = {};
+        global_bench_clock = sim_virtual_clock(&run.clock);
+        run.program.timer_effect = &run.timer;
+        run.program.audio_effect = &run.audio;
+    };
+
+    Run unrecorded;
+    run_make(&unrecorded);
+    auto start_s = bench_now_seconds();
+    sim_run(&unrecorded.program, global_bench_clock, user, year_micros);
+    auto const unrecorded_s = bench_now_seconds() - start_s;
+
+    std::vector<uint8_t> journal_bytes;
+    journal_bytes.reserve(1 << 20);
+    Journal journal;
+    journal_init(&journal, { &journal_bytes, bench_journal_write });
+    Run recorded;
+    run_make(&recorded);
+    recorded.program.journal = &journal;
+    start_s = bench_now_seconds();
+    sim_run(&recorded.program, global_bench_clock, user, year_micros);
+    journal_flush(&journal);
+    auto const recorded_s = bench_now_seconds() - start_s;
+
+    Run replayed;
+    run_make(&replayed);
+    JournalReplay replay;
+    start_s = bench_now_seconds();
+    auto const is_replayed = journal_replay(&replayed.program, journal_bytes.data(),
+                                            journal_bytes.size(), &replay);
+    auto const replayed_s = bench_now_seconds() - start_s;
+    assert(is_replayed);
+    assert(replayed.timer.celebrate_n == recorded.timer.celebrate_n);
+    assert(replayed.audio.chime_n == recorded.audio.chime_n);
+    assert(replayed.audio.prewarm_n == recorded.audio.prewarm_n);
+
+    auto const record_n = double(journal.record_n);
+    std::printf("BENCH: %-48s %10.1f ns/record %8.2f bytes/record\n", "journal, a year of sessions",
+                1e9 * (recorded_s - unrecorded_s) / record_n, double(journal.byte_n) / record_n);
+    std::printf("BENCH: %-48s %10.0f calls/s %8.0f kB/year\n", "journal replay",
+                double(replay.call_n) / replayed_s, double(journal.byte_n) / 1024.0);
+}
+
+// A host of many sessions, woken up every second: what finding and moving
+// on the expired sessions costs, per session.
+static void bench_sessions()
+{
+    int const advance_n = global_bench_options.quick_on ? 60 : 1800;
+    uint32_t const session_ns[] = { 10, 100, 1'000, 10'000, 100'000, 1'000'000 };
+    for (auto const session_n : session_ns) {
+        for (int scalar_on = 1; scalar_on >= 0; --scalar_on) {
+            Sessions sessions;
+            sessions_init(&sessions, session_n, &schedule_classic);
+            sessions.scalar_on = scalar_on != 0;
+            // started at any time of the last half hour
+            uint32_t random_state = 11;
+            uint64_t const start_micros = 3600'000'000ull;
+            for (uint32_t session_i = 0; session_i < session_n; ++session_i) {
+                sessions_add(&sessions);
+                random_state ^= random_state << 13;
+                random_state ^= random_state >> 17;
+                random_state ^= random_state << 5;
+                auto const micros = start_micros - random_state % 1800'000'000u;
+                sessions_command(&sessions, session_i, { Command_timer_start, micros });
+            }
+
+            uint64_t expired_n = 0;
+            double advance_s = 0.0;
+            auto now = start_micros;
+            for (int advance_i = 0; advance_i < advance_n; ++advance_i) {
+                now += 1'000'000;
+                auto const start_s = bench_now_seconds();
+                sessions_advance(&sessions, now);
+                advance_s += bench_now_seconds() - start_s;
+                expired_n += sessions.expired_n;
+                // the users go on with their next phase at once
+                for (uint32_t expired_i = 0; expired_i < sessions.expired_n; ++expired_i) {
+                    sessions_command(&sessions, sessions.expired[expired_i],
+                                     { Command_timer_start, now });
+                }
+            }
+            assert(expired_n > 0 || session_n < 1'000);
+
+            char name[64];
+            std::snprintf(name, sizeof name, "sessions, %u of them, %s", session_n,
+                          scalar_on ? "scalar" : "simd");
+            auto const scan_n = double(session_n) * advance_n;
+            std::printf("BENCH: %-48s %10.3f ns/session %8.1f us/advance\n", name,
+                        1e9 * advance_s / scan_n, 1e6 * advance_s / advance_n);
+            sessions_destroy(&sessions);
+        }
+    }
+}
+
+// A binary heap of deadlines, indexed by timer so that it re-arms and
+// cancels in place: what bench_timing_wheel compares the wheel to.
+struct BenchHeap
+{
+    std::vector<uint32_t> timers; // heap order
+    std::vector<uint32_t> position; // of each timer in `timers`, or UINT32_MAX
+    std::vector<uint64_t> deadline_micros; // of each timer
+};
+
+static void bench_heap_swap(BenchHeap* _heap, uint32_t a, uint32_t b)
+{
+    auto& heap = *_heap;
+    std::swap(heap.timers[a], heap.timers[b]);
+    heap.position[heap.timers[a]] = a;
+    heap.position[heap.timers[b]] = b;
+}
+
+static void bench_heap_fix(BenchHeap* _heap, uint32_t i)
+{
+    auto& heap = *_heap;
+    auto const key = [&](uint32_t j) { return heap.deadline_micros[heap.timers[j]]; };
+    while (i > 0 && key(i) < key((i - 1) / 2)) {
+        bench_heap_swap(&heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    auto const n = uint32_t(heap.timers.size());
+    while (true) {
+        auto smallest = i;
+        auto const left = 2 * i + 1;
+        auto const right = left + 1;
+        if (left < n && key(left) < key(smallest)) smallest = left;
+        if (right < n && key(right) < key(smallest)) smallest = right;
+        if (smallest == i) break;
+        bench_heap_swap(&heap, i, smallest);
+        i = smallest;
+    }
+}
+
+static void bench_heap_remove(BenchHeap* _heap, uint32_t timer_i)
+{
+    auto& heap = *_heap;
+    auto const i = heap.position[timer_i];
+    if (i == UINT32_MAX) return;
+    auto const last = uint32_t(heap.timers.size() - 1);
+    if (i != last) bench_heap_swap(&heap, i, last);
+    heap.timers.pop_back();
+    heap.position[timer_i] = UINT32_MAX;
+    if (i != last) bench_heap_fix(&heap, i);
+}
+
+static void bench_heap_arm(BenchHeap* _heap, uint32_t timer_i, uint64_t deadline_micros)
+{
+    auto& heap = *_heap;
+    heap.deadline_micros[timer_i] = deadline_micros;
+    if (heap.position[timer_i] == UINT32_MAX) {
+        heap.position[timer_i] = uint32_t(heap.timers.size());
+        heap.timers.push_back(timer_i);
+    }
+    bench_heap_fix(&heap, heap.position[timer_i]);
+}
+
+// Many timers of sessions woken up every second, a share of which the users
+// restart or stop each second: what arming, cancelling and expiring a timer
+// costs in a timing wheel, and in a binary heap.
+static void bench_timing_wheel()
+{
+    int const second_n = global_bench_options.quick_on ? 60 : 600;
+    uint64_t const phase_micros = 25 * 60'000'000ull;
+    uint32_t const timer_ns[] = { 10'000, 100'000, 1'000'000 };
+    double const churn_rates[] = { 0.01, 0.1 }; // of the timers, per second
+    for (auto const timer_n : timer_ns) {
+        for (auto const churn_rate : churn_rates) {
+            uint64_t results[2] = {};
+            for (int heap_on = 0; heap_on < 2; ++heap_on) {
+                uint64_t const start_micros = 3600'000'000ull;
+                TimingWheel wheel;
+                BenchHeap heap;
+                if (heap_on) {
+                    heap.timers.reserve(timer_n);
+                    heap.position.assign(timer_n, UINT32_MAX);
+                    heap.deadline_micros.assign(timer_n, 0);
+                } else {
+                    timing_wheel_init(&wheel, timer_n, 1'000, start_micros);
+                }
+                std::vector<uint32_t> expired;
+                expired.reserve(timer_n);
+                uint32_t random_state = 13;
+                auto const random_next = [&]() {
+                    random_state ^= random_state << 13;
+                    random_state ^= random_state >> 17;
+                    random_state ^= random_state << 5;
+                    return random_state;
+                };
+                auto const arm = [&](uint32_t i, uint64_t deadline_micros) {
+                    if (heap_on) {
+                        bench_heap_arm(&heap, i, deadline_micros);
+                    } else {
+                        timing_wheel_arm(&wheel, i, deadline_micros);
+                    }
+                };
+                // started at any time of the last phase
+                for (uint32_t i = 0; i < timer_n; ++i) {
+                    arm(i, start_micros + phase_micros - random_next() % phase_micros);
+                }
+
+                uint64_t op_n = 0;
+                uint64_t expired_n = 0;
+                auto const churn_n = uint32_t(churn_rate * timer_n);
+                auto now = start_micros;
+                auto const start_s = bench_now_seconds();
+                for (int second_i = 0; second_i < second_n; ++second_i) {
+                    now += 1'000'000;
+                    for (uint32_t churn_i = 0; churn_i < churn_n; ++churn_i) {
+                        auto const i = random_next() % timer_n;
+                        if (churn_i % 2) {
+                            arm(i, now + phase_micros); // a restart
+                        } else if (heap_on) {
+                            bench_heap_remove(&heap, i); // a stop
+                        } else {
+                            timing_wheel_cancel(&wheel, i);
+                        }
+                    }
+                    expired.clear();
+                    if (heap_on) {
+                        while (!heap.timers.empty() &&
+                               heap.deadline_micros[heap.timers[0]] <= now) {
+                            auto const i = heap.timers[0];
+                            bench_heap_remove(&heap, i);
+                            expired.push_back(i);
+                        }
+                    } else {
+                        timing_wheel_advance(&wheel, now);
+                        expired.assign(wheel.expired, wheel.expired + wheel.expired_n);
+                    }
+                    // the users go on with their next phase at once
+                    for (auto const i : expired) arm(i, now + phase_micros);
+                    op_n += churn_n + 2 * expired.size();
+                    expired_n += expired.size();
+                }
+                auto const elapsed_s = bench_now_seconds() - start_s;
+                results[heap_on] = expired_n;
+                if (!heap_on) timing_wheel_destroy(&wheel);
+
+                char name[64];
+                std::snprintf(name, sizeof name, "timers, %u of them, %4.1f%% churn/s, %s",
+                              timer_n, 100.0 * churn_rate, heap_on ? "heap" : "wheel");
+                std::printf("BENCH: %-48s %10.1f ns/op %8.1f us/second\n", name,
+                            1e9 * elapsed_s / double(op_n), 1e6 * elapsed_s / second_n);
+            }
+            // the same timers expired either way
+            assert(results[0] == results[1]);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    auto options = parse_bench_options(argv + 1, argv + argc);
+    if (options.help_on || !options.is_valid) {
+        std::printf(USAGE_PATTERN, *argv);
+        exit(options.is_valid ? 0 : 1);
+    }
+    global_bench_options = options;
+
+    bench_simulated_years();
+    bench_journal();
+    bench_sessions();
+    bench_timing_wheel();
+}
@@ -11,6 +11,7 @@ REM @clang -fsyntax-only win32_unit_uu_focus_main.cpp %ClangWarnings%
 REM @clang -fsyntax-only uu_focus_main.cpp %ClangWarnings%
 REM @clang -fsyntax-only uu_focus_effects.cpp %ClangWarning%
 REM @clang -fsyntax-only test_unit_uu_focus_main.cpp %ClangWarnings%
+REM @clang -fsyntax-only test_unit_uu_focus_audio.cpp %ClangWarnings%
 REM @clang -fsyntax-only unit_make_ico.cpp -D_CRT_SECURE_NO_WARNINGS
 
 REM Build tests:
@@ -24,6 +25,26 @@ echo TEST	test_uu_focus_exe
 	exit /b %ERRORLEVEL%
 )
 
+cl -nologo -EHsc -Od -Z7 -W3 test_unit_uu_focus_audio.cpp -Fo%BuildObjDir%\ ^
+  -Fe%BuildDir%\test_uu_focus_audio.exe
+echo TEST	test_uu_focus_audio_exe
+%BuildDir%\test_uu_focus_audio.exe --quiet >%BuildDir%\test_uu_focus_audio.txt
+@if %ERRORLEVEL% neq 0 (
+	echo ERROR: test_uu_focus_audio.exe
+	type %BuildDir%\test_uu_focus_audio.txt
+	exit /b %ERRORLEVEL%
+)
+
+REM Build benchmarks:
+cl -nologo -EHsc -O2 -Z7 -W3 bench_unit_uu_focus_audio.cpp -Fo%BuildObjDir%\ ^
+  -Fe%BuildDir%\bench_uu_focus_audio.exe
+@if %ERRORLEVEL% neq 0 goto in_error_end
+echo BENCH	%BuildDir%\bench_uu_focus_audio.exe
+cl -nologo -EHsc -O2 -Z7 -W3 bench_unit_uu_focus_main.cpp -Fo%BuildObjDir%\ ^
+  -Fe%BuildDir%\bench_uu_focus_main.exe
+@if %ERRORLEVEL% neq 0 goto in_error_end
+echo BENCH	%BuildDir%\bench_uu_focus_main.exe
+
 REM Build program:
 REM
 
@@ -45,6 +66,23 @@ cl -DUU_FOCUS_INTERNAL=1 ^
 @attrib -R %DllPdbPath%
 @del %DllPrefixPath%_dll.lock
 
+REM the dsp code of the audio, swapped in while playing
+set DllPrefixPath=%BuildDir%\uu_focus_audio
+set DllPdbPath=%DllPrefixPath%_dll_%random%.pdb
+echo --- WAITING FOR PDB > %DllPrefixPath%_dll.lock
+cl -DUU_FOCUS_INTERNAL=1 ^
+  -Fe%DllPrefixPath%.dll win32_unit_uu_focus_audio.cpp ^
+  -O2 -EHsc -Z7 -W3 -Fo%BuildObjDir%\ -nologo ^
+  -LD -link -PDB:%DllPdbPath% ^
+  -EXPORT:win32_uu_focus_audio_render ^
+  -EXPORT:win32_uu_focus_audio_handover
+
+@if %ERRORLEVEL% neq 0 goto in_error_end
+@attrib +R %DllPdbPath%
+@del %DllPrefixPath%_dll_*.pdb > NUL 2> NUL
+@attrib -R %DllPdbPath%
+@del %DllPrefixPath%_dll.lock
+
 rc.exe /nologo /fo %BuildDir%\uu_focus.res ^
    win32_unit_uu_focus_main.rc
 if %ERRORLEVEL% neq 0 goto in_error_end
@@ -1,4 +1,11 @@
 #!/bin/sh
+set -e
 mkdir -p builds
 c++ -std=c++14 -Wall -Wextra test_unit_uu_focus_main.cpp -o builds/test_uu_focus
 builds/test_uu_focus
+c++ -std=c++14 -Wall -Wextra -pthread test_unit_uu_focus_audio.cpp -o builds/test_uu_focus_audio
+builds/test_uu_focus_audio
+c++ -std=c++14 -Wall -Wextra -O2 -pthread bench_unit_uu_focus_audio.cpp -o builds/bench_uu_focus_audio
+builds/bench_uu_focus_audio --quick
+c++ -std=c++14 -Wall -Wextra -O2 bench_unit_uu_focus_main.cpp -o builds/bench_uu_focus_main
+builds/bench_uu_focus_main --quick
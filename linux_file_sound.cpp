@@ -0,0 +1,122 @@
+// @language: c++14
+// @os: linux
+#include "linux_file_sound.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+struct LinuxFileSoundStream
+{
+    int fd;
+    uint32_t frame_bytes;
+    uint8_t* bytes; // period_frames frames
+    uint64_t deadline_nanos; // of the next period, when paced
+};
+static_assert(sizeof (LinuxFileSoundStream) <= sizeof (AudioStream::data),
+              "AudioStream is too small");
+
+static LinuxFileSoundStream& linux_file_sound_stream(AudioStream* stream)
+{
+    return *reinterpret_cast<LinuxFileSoundStream*>(stream->data);
+}
+
+static uint64_t linux_monotonic_nanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1'000'000'000ull + uint64_t(ts.tv_nsec);
+}
+
+static UU_FOCUS_AUDIO_BACKEND_OPEN_PROC(linux_file_sound_open)
+{
+    auto const& config = *reinterpret_cast<LinuxFileSoundConfig*>(stream->backend->user);
+    auto& file = linux_file_sound_stream(stream);
+    auto& header = stream->header;
+    header.sample_format = config.sample_format;
+    header.channel_count = channel_count ? channel_count : config.channel_count;
+    header.audio_hz = audio_hz;
+
+    if (0 == strcmp(config.path, "-")) {
+        file.fd = dup(STDOUT_FILENO);
+    } else {
+        // NOTE(nicolas): opening a fifo waits for its reader
+        file.fd = open(config.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (file.fd < 0) {
+        header.error = AudioStreamError_SystemError;
+        header.error_string = "could not open the file";
+        return header.error;
+    }
+    file.frame_bytes = uint32_t(header.channel_count *
+                                audio_sample_format_bytes(header.sample_format));
+    file.bytes = new uint8_t[size_t(config.period_frames)*file.frame_bytes];
+    file.deadline_nanos = linux_monotonic_nanos();
+    header.error = AudioStreamError_Success;
+    return header.error;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_CLOSE_PROC(linux_file_sound_close)
+{
+    auto& file = linux_file_sound_stream(stream);
+    close(file.fd);
+    file.fd = -1;
+    delete[] file.bytes;
+    file.bytes = nullptr;
+    stream->header.error = AudioStreamError_Closed;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_BLOCK_ACQUIRE_PROC(linux_file_sound_buffer_block_acquire)
+{
+    auto const& config = *reinterpret_cast<LinuxFileSoundConfig*>(stream->backend->user);
+    auto& file = linux_file_sound_stream(stream);
+    if (config.is_paced) {
+        timespec deadline;
+        deadline.tv_sec = time_t(file.deadline_nanos / 1'000'000'000ull);
+        deadline.tv_nsec = long(file.deadline_nanos % 1'000'000'000ull);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {}
+        file.deadline_nanos += uint64_t(config.period_frames)*1'000'000'000ull /
+            uint64_t(stream->header.audio_hz);
+    }
+    AudioBuffer buffer;
+    buffer.bytes_first = file.bytes;
+    buffer.padding_frames = 0;
+    buffer.frame_count = config.period_frames < max_frame_count ?
+        config.period_frames : max_frame_count;
+    return buffer;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_RELEASE_PROC(linux_file_sound_buffer_release)
+{
+    auto& file = linux_file_sound_stream(stream);
+    auto bytes = buffer.bytes_first;
+    auto bytes_n = size_t(buffer.frame_count)*file.frame_bytes;
+    while (bytes_n) {
+        auto const written_n = write(file.fd, bytes, bytes_n);
+        if (written_n < 0) {
+            if (errno == EINTR) continue;
+            bool const is_reader_gone = errno == EPIPE;
+            linux_file_sound_close(stream);
+            if (!is_reader_gone) stream->header.error = AudioStreamError_SystemError;
+            stream->header.error_string = is_reader_gone ?
+                "the reader went away" : "could not write to the file";
+            return;
+        }
+        bytes += written_n;
+        bytes_n -= size_t(written_n);
+    }
+}
+
+AudioBackend linux_file_sound_backend(LinuxFileSoundConfig* config)
+{
+    AudioBackend backend = {};
+    backend.name = "file";
+    backend.user = config;
+    backend.open = linux_file_sound_open;
+    backend.close = linux_file_sound_close;
+    backend.buffer_block_acquire = linux_file_sound_buffer_block_acquire;
+    backend.buffer_release = linux_file_sound_buffer_release;
+    return backend;
+}
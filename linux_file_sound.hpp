@@ -0,0 +1,26 @@
+#pragma once
+#define LINUX_FILE_SOUND
+
+/*
+ * An audio backend writing raw interleaved samples to a file or a pipe,
+ * for instance to be played with:
+ *   aplay -t raw -f FLOAT_LE -c 2 -r 48000
+ *
+ * A file takes buffers as fast as they come, unless the sink is paced to
+ * the monotonic clock. A pipe paces the audio thread by blocking it while
+ * full. When its reader goes away the stream is closed, provided the
+ * program ignores SIGPIPE.
+ */
+
+#include "uu_focus_audio_backend.hpp"
+
+struct LinuxFileSoundConfig
+{
+    char const* path; // "-" for the standard output
+    AudioSampleFormat sample_format;
+    int channel_count; // the layout of the "device"
+    uint32_t period_frames;
+    bool is_paced; // release a period every period of the monotonic clock
+};
+
+AudioBackend linux_file_sound_backend(LinuxFileSoundConfig*);
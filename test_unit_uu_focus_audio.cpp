@@ -0,0 +1,1515 @@
+// @language: c++14
+static char const* USAGE_PATTERN = "%s {--help,--quiet}";
+#include "uu_focus_audio_backend.hpp"
+#include "uu_focus_audio_clock.hpp"
+#include "uu_focus_audio_convert.hpp"
+#include "uu_focus_audio_resampler.hpp"
+#include "uu_focus_audio_ring.hpp"
+#include "uu_focus_effects.hpp"
+#include "uu_focus_platform.hpp"
+#include "uu_focus_render_pool.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include "linux_file_sound.hpp"
+#include <unistd.h>
+#endif
+
+static uint64_t now_micros();
+
+// the test reaches into the implementation:
+#include "uu_focus_audio_convert.cpp"
+#include "uu_focus_audio_dsp.cpp"
+#include "uu_focus_effects.cpp"
+#include "uu_focus_render_pool.cpp"
+#include "uu_focus_audio_backend.cpp"
+#include "uu_focus_audio_ring.cpp"
+#include "uu_focus_audio_resampler.cpp"
+#include "uu_focus_audio_clock.cpp"
+#if defined(__linux__)
+#include "linux_file_sound.cpp"
+#endif
+
+struct Scenario
+{
+    Scenario(char const* name) {
+        std::printf("TEST: %s\n", name);
+        fflush(stdout);
+    }
+    ~Scenario() {
+        std::printf("TEST END\n");
+        fflush(stdout);
+    };
+};
+
+struct TestOptions
+{
+    bool is_valid;
+    bool help_on;
+    bool console_output_off;
+};
+
+static TestOptions parse_test_options(char const* const * args_f,
+                                      char const* const * const args_l)
+{
+    TestOptions options = {};
+    while (args_f != args_l) {
+        if (0 == strcmp("--quiet", *args_f)) {
+            options.console_output_off = true;
+        } else if (0 == strcmp("--help", *args_f)) {
+            options.help_on = true;
+        } else {
+            return options; // invalid
+        }
+        ++args_f;
+    }
+    options.is_valid = true;
+    return options;
+}
+
+TestOptions global_test_options;
+
+static std::atomic<uint64_t> global_test_now_micros; // read by device threads
+static int global_test_allocation_n; // counts calls to operator new
+
+void* operator new(std::size_t size)
+{
+    ++global_test_allocation_n;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static void trace(char const* pattern, double x)
+{
+    if (!global_test_options.console_output_off) {
+        std::printf(pattern, x);
+        std::printf("\n");
+        fflush(stdout);
+    }
+}
+
+static std::vector<float> test_signal(int sample_count)
+{
+    std::vector<float> y(sample_count);
+    for (int i = 0; i < sample_count; ++i) {
+        // a sweep that goes slightly out of range to exercise saturation
+        y[i] = float(1.1 * std::sin(0.001 * double(i) * double(i)));
+    }
+    return y;
+}
+
+static void fft_n(std::complex<double>* x, int n)
+{
+    // iterative radix-2, n must be a power of two
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(x[i], x[j]);
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        auto const w_len = std::polar(1.0, -6.2831853071795864769252 / len);
+        for (int i = 0; i < n; i += len) {
+            std::complex<double> w = 1.0;
+            for (int k = 0; k < len/2; ++k) {
+                auto const u = x[i + k];
+                auto const v = x[i + k + len/2] * w;
+                x[i + k] = u + v;
+                x[i + k + len/2] = u - v;
+                w *= w_len;
+            }
+        }
+    }
+}
+
+enum { SPECTRUM_N = 4096 };
+
+// Averaged power spectrum of the first channel, hann windowed.
+static std::vector<double> power_spectrum(std::vector<float> const& samples, int channel_count)
+{
+    std::vector<double> power(SPECTRUM_N/2);
+    std::vector<std::complex<double>> x(SPECTRUM_N);
+    int const frame_count = int(samples.size())/channel_count;
+    for (int first = 0; first + SPECTRUM_N <= frame_count; first += SPECTRUM_N) {
+        for (int i = 0; i < SPECTRUM_N; ++i) {
+            auto const w = 0.5 - 0.5*std::cos(6.2831853071795864769252 * i / SPECTRUM_N);
+            x[i] = w * samples[channel_count*(first + i)];
+        }
+        fft_n(x.data(), SPECTRUM_N);
+        for (int i = 0; i < SPECTRUM_N/2; ++i) power[i] += std::norm(x[i]);
+    }
+    return power;
+}
+
+static double band_power(std::vector<double> const& power, double lo_hz, double hi_hz,
+                         double audio_hz = 48000.0)
+{
+    double sum = 0.0;
+    for (int i = 0; i < int(power.size()); ++i) {
+        auto const hz = audio_hz * i / SPECTRUM_N;
+        if (hz >= lo_hz && hz < hi_hz) sum += power[i];
+    }
+    return sum;
+}
+
+static double db(double power_ratio)
+{
+    return 10.0 * std::log10(power_ratio);
+}
+
+// Renders in odd sized blocks, advancing the test clock like a device would.
+static void render_blocks(AudioEffect* audio, float* frames, int channel_count, int frame_count)
+{
+    for (int first = 0; first < frame_count; first += 1031) {
+        auto const n = std::min(1031, frame_count - first);
+        audio_thread_render(audio, frames + channel_count*first, channel_count, n);
+        global_test_now_micros += uint64_t(n)*1'000'000/48000;
+    }
+}
+
+static int first_non_silent_frame(std::vector<float> const& samples, int channel_count)
+{
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (samples[i] != 0.0f) return int(i)/channel_count;
+    }
+    return -1;
+}
+
+static std::vector<float> render_noise(int channel_count, int frame_count)
+{
+    auto audio = audio_make();
+    audio_start(audio);
+    int const fade_frame_count = 1 << 16;
+    std::vector<float> fade(channel_count*fade_frame_count);
+    audio_thread_render(audio, fade.data(), channel_count, fade_frame_count);
+
+    std::vector<float> y(channel_count*frame_count);
+    for (int first = 0; first < frame_count; first += 1031) {
+        auto const n = std::min(1031, frame_count - first);
+        audio_thread_render(audio, y.data() + channel_count*first, channel_count, n);
+    }
+    audio_destroy(audio);
+    return y;
+}
+
+// Correlation of the first differences of two channels. Differences
+// whiten the pink noise, whose low frequencies would otherwise dominate
+// the estimate.
+static double channel_correlation(std::vector<float> const& samples,
+                                  int channel_count, int a, int b)
+{
+    double aa = 0.0, bb = 0.0, ab = 0.0;
+    for (size_t i = channel_count; i < samples.size(); i += channel_count) {
+        double const x = samples[i + a] - samples[i - channel_count + a];
+        double const y = samples[i + b] - samples[i - channel_count + b];
+        aa += x*x;
+        bb += y*y;
+        ab += x*y;
+    }
+    return ab / std::sqrt(aa*bb);
+}
+
+// A device asking for a period of frames at a time, from its own thread
+// like a real one, with the test clock for its clock. Its thread parks
+// whenever the audio is silent.
+struct FakeDevice
+{
+    AudioEffect* audio;
+    std::atomic<bool> must_quit;
+    std::atomic<bool> is_parked;
+    std::atomic<uint64_t> wakeup_n;
+    std::thread thread;
+};
+
+enum { FAKE_DEVICE_PERIOD_FRAMES = 480 /* 10ms */ };
+
+static void fake_device_main(FakeDevice* _device)
+{
+    auto& device = *_device;
+    float frames[2*FAKE_DEVICE_PERIOD_FRAMES];
+    while (!device.must_quit) {
+        audio_thread_render(device.audio, frames, 2, FAKE_DEVICE_PERIOD_FRAMES);
+        ++device.wakeup_n;
+        global_test_now_micros += FAKE_DEVICE_PERIOD_FRAMES*1'000'000/48000;
+        if (audio_thread_is_silent(device.audio)) {
+            device.is_parked = true;
+            audio_thread_park(device.audio);
+            device.is_parked = false;
+        }
+    }
+}
+
+// waits for the device thread to be parked
+static void fake_device_wait_parked(FakeDevice const& device)
+{
+    while (!device.is_parked) std::this_thread::yield();
+}
+
+// when set, the clock of this device is the test clock
+static AudioSimDevice* global_test_sim_device;
+
+// plays `audio` on a simulated device for `duration_micros` of its clock
+static void sim_device_play(AudioSimDevice* device, AudioStream* stream,
+                            AudioEffect* audio, uint64_t duration_micros,
+                            AudioLatencyController* latency = nullptr,
+                            AudioResampler* resampler = nullptr)
+{
+    auto const frame_count_max = device->config.buffer_frames;
+    std::vector<float> render_samples(AUDIO_CHANNEL_MAX*frame_count_max);
+    AudioDitherState dither;
+    audio_dither_init(&dither, 1, 2);
+    auto const end_micros = device->now_micros + duration_micros;
+    global_test_sim_device = device;
+    while (device->now_micros < end_micros &&
+           stream->header.error == AudioStreamError_Success) {
+        audio_stream_render(stream, audio, latency, resampler, &dither, render_samples.data(),
+                            uint32_t(render_samples.size()), frame_count_max);
+    }
+    global_test_sim_device = nullptr;
+    global_test_now_micros = device->now_micros;
+}
+
+// Resamples a stereo tone in odd sized blocks, changing the drift of the
+// resampler to the next of `drifts` at each block. Returns the output past
+// the start of the filter.
+static std::vector<float> resample_tone(int input_hz, int output_hz, double tone_hz,
+                                        int frame_count,
+                                        std::vector<double> const& drifts = { 0.0 })
+{
+    auto resampler = audio_resampler_make(2, input_hz, output_hz);
+    std::vector<float> input;
+    std::vector<float> output(2*size_t(frame_count + AUDIO_RESAMPLER_TAPS));
+    uint64_t input_frame_n = 0;
+    int block_i = 0;
+    for (int first = 0; first < frame_count + AUDIO_RESAMPLER_TAPS; first += 437, ++block_i) {
+        audio_resampler_set_drift(resampler, drifts[block_i % drifts.size()]);
+        auto const n = uint32_t(std::min(437, frame_count + AUDIO_RESAMPLER_TAPS - first));
+        input.resize(2*audio_resampler_input_count(resampler, n));
+        for (size_t i = 0; i < input.size(); i += 2) {
+            auto const t = double(input_frame_n++) / input_hz;
+            input[i] = input[i + 1] = float(0.5 * std::sin(6.2831853071795864769252*tone_hz*t));
+        }
+        audio_resampler_process(resampler, input.data(), &output[2*size_t(first)], n);
+    }
+    audio_resampler_destroy(resampler);
+    output.erase(output.begin(), output.begin() + 2*AUDIO_RESAMPLER_TAPS);
+    return output;
+}
+
+// Stands for a newer version of the dsp module, rendering a constant.
+static UU_FOCUS_AUDIO_DSP_RENDER_PROC(test_dsp_constant_render)
+{
+    (void)state;
+    (void)block;
+    for (int i = 0; i < channel_count*frame_count; ++i) frames[i] = 0.25f;
+}
+
+// Renders a constant for each mode, to tell them apart.
+static UU_FOCUS_AUDIO_DSP_RENDER_PROC(test_dsp_mode_render)
+{
+    (void)state;
+    for (int i = 0; i < channel_count*frame_count; ++i) frames[i] = 0.25f*float(block->mode + 1);
+}
+
+static UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(test_dsp_constant_handover)
+{
+    (void)seed;
+    dst->stable = src->stable;
+    dst->stable.version = AUDIO_DSP_STATE_VERSION + 1;
+}
+
+int main(int argc, char** argv)
+{
+    auto options = parse_test_options(argv + 1, argv + argc);
+    if (options.help_on || !options.is_valid) {
+        std::printf(USAGE_PATTERN, *argv);
+        exit(options.is_valid ? 0 : 1);
+    }
+    global_test_options = options;
+
+    {
+        Scenario _("conversion without dither is exact");
+        float const x[] = { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 2.0f, -2.0f, 0.25f };
+        int16_t y16[8];
+        audio_convert_select(AudioSampleFormat_S16, AudioDither_None)(
+            nullptr, x, 8, reinterpret_cast<uint8_t*>(y16));
+        int16_t const expected16[] = { 0, 16384, -16384, 32767, -32768, 32767, -32768, 8192 };
+        assert(0 == memcmp(y16, expected16, sizeof y16));
+
+        uint8_t y24[3*8];
+        audio_convert_select(AudioSampleFormat_S24_Packed, AudioDither_None)(
+            nullptr, x, 8, y24);
+        assert(y24[3*1 + 0] == 0x00 && y24[3*1 + 1] == 0x00 && y24[3*1 + 2] == 0x40);
+        assert(y24[3*3 + 0] == 0xff && y24[3*3 + 1] == 0xff && y24[3*3 + 2] == 0x7f);
+        assert(y24[3*4 + 0] == 0x00 && y24[3*4 + 1] == 0x00 && y24[3*4 + 2] == 0x80);
+
+        int32_t y32[8];
+        audio_convert_select(AudioSampleFormat_S32, AudioDither_None)(
+            nullptr, x, 8, reinterpret_cast<uint8_t*>(y32));
+        assert(y32[1] == 0x40000000);
+        assert(y32[3] == 0x7fffff00);
+        assert(y32[4] == int32_t(0x80000000));
+        assert(nullptr == audio_convert_select(AudioSampleFormat_F32, AudioDither_Tpdf));
+    }
+
+    {
+        Scenario _("vector kernels match the scalar kernel");
+        AudioSampleFormat const formats[] = {
+            AudioSampleFormat_S16,
+            AudioSampleFormat_S24_Packed,
+            AudioSampleFormat_S24_In32,
+            AudioSampleFormat_S32,
+        };
+        AudioDither const dithers[] = {
+            AudioDither_None, AudioDither_Tpdf, AudioDither_TpdfShaped,
+        };
+        int const sample_count = 2*1013; // leaves a tail for every kernel
+        auto const x = test_signal(sample_count);
+        for (auto format : formats) {
+            auto const bytes_n = sample_count*audio_sample_format_bytes(format);
+            for (auto dither : dithers) {
+                // every channel count shapes the dither from another lane
+                for (int channel_count = 1; channel_count <= AUDIO_DITHER_LANES; ++channel_count) {
+                    std::vector<uint8_t> expected(bytes_n);
+                    AudioDitherState expected_state;
+                    audio_dither_init(&expected_state, 1234, channel_count);
+                    auto scalar = audio_convert_select_isa(format, dither, AudioConvertIsa_Scalar);
+                    // two calls, to check the state carries over
+                    scalar(&expected_state, x.data(), 100, expected.data());
+                    scalar(&expected_state, x.data() + 100, sample_count - 100,
+                           expected.data() + 100*audio_sample_format_bytes(format));
+
+                    for (int isa = AudioConvertIsa_SSE2; isa <= audio_convert_isa_max(); ++isa) {
+                        std::vector<uint8_t> y(bytes_n);
+                        AudioDitherState state;
+                        audio_dither_init(&state, 1234, channel_count);
+                        auto kernel = audio_convert_select_isa(format, dither, AudioConvertIsa(isa));
+                        assert(kernel);
+                        kernel(&state, x.data(), 100, y.data());
+                        kernel(&state, x.data() + 100, sample_count - 100,
+                               y.data() + 100*audio_sample_format_bytes(format));
+                        assert(y == expected);
+                        assert(0 == memcmp(&state, &expected_state, sizeof state));
+                    }
+                }
+            }
+        }
+    }
+
+    {
+        Scenario _("tpdf dither is unbiased and bounded");
+        int const sample_count = 1 << 16;
+        std::vector<float> x(sample_count, 0.3f/32768.0f); // below 1 lsb
+        std::vector<int16_t> y(sample_count);
+        // shaped: the error of the previous sample, up to 1.5 lsb, comes on top
+        struct { AudioDither dither; int bound; } const dithers[] = {
+            { AudioDither_Tpdf, 1 },
+            { AudioDither_TpdfShaped, 3 },
+        };
+        for (auto const& dither : dithers) {
+            AudioDitherState state;
+            audio_dither_init(&state, 42, 1);
+            audio_convert_select(AudioSampleFormat_S16, dither.dither)(
+                &state, x.data(), sample_count, reinterpret_cast<uint8_t*>(y.data()));
+            double sum = 0.0;
+            for (auto v : y) {
+                assert(v >= -dither.bound && v <= dither.bound);
+                sum += v;
+            }
+            // the sub-lsb signal survives quantization on average
+            auto const mean = sum / sample_count;
+            trace("mean: %f lsb", mean);
+            assert(std::fabs(mean - 0.3) < 0.02);
+        }
+    }
+
+    {
+        Scenario _("shaped dither moves energy to high frequencies");
+        int const channel_count = 2;
+        int const sample_count = channel_count << 16;
+        std::vector<float> x(sample_count, 0.0f);
+        std::vector<int32_t> y(sample_count);
+        AudioDither const dithers[] = { AudioDither_Tpdf, AudioDither_TpdfShaped };
+        double high_to_mid_db[2];
+        for (int dither_i = 0; dither_i < 2; ++dither_i) {
+            AudioDitherState state;
+            audio_dither_init(&state, 7, channel_count);
+            audio_convert_select(AudioSampleFormat_S24_In32, dithers[dither_i])(
+                &state, x.data(), sample_count, reinterpret_cast<uint8_t*>(y.data()));
+            // every channel on its own, in lsb units
+            high_to_mid_db[dither_i] = 0.0;
+            for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+                std::vector<float> channel(sample_count / channel_count);
+                for (size_t i = 0; i < channel.size(); ++i) {
+                    channel[i] = float(y[channel_count*i + channel_i] >> 8);
+                }
+                auto const power = power_spectrum(channel, 1);
+                auto const ratio_db = db(band_power(power, 17000.0, 19000.0) /
+                                         band_power(power, 5000.0, 7000.0));
+                trace("18khz over 6khz: %f db", ratio_db);
+                if (channel_i == 0 || ratio_db < high_to_mid_db[dither_i]) {
+                    high_to_mid_db[dither_i] = ratio_db;
+                }
+            }
+        }
+        assert(std::fabs(high_to_mid_db[0]) < 1.0); // flat
+        // NOTE(nicolas): the error goes out through a first difference along
+        // the channel, rising by 7.7db from 6khz to 18khz
+        assert(high_to_mid_db[1] > 6.0);
+    }
+
+    {
+        Scenario _("surround sinks get decorrelated noise on every speaker");
+        int const frame_count = 1 << 17;
+        int const channel_counts[] = { 6 /* 5.1 */, 8 /* 7.1 */ };
+        for (auto channel_count : channel_counts) {
+            auto const y = render_noise(channel_count, frame_count);
+            auto const stereo = render_noise(2, frame_count);
+            double stereo_energy = 0.0;
+            for (size_t i = 0; i < stereo.size(); i += 2) stereo_energy += stereo[i]*stereo[i];
+
+            for (int a = 0; a < channel_count; ++a) {
+                double energy = 0.0;
+                for (size_t i = a; i < y.size(); i += channel_count) energy += y[i]*y[i];
+                // every speaker plays at about the level of the stereo noise
+                auto const level_db = db(energy/stereo_energy);
+                trace("level: %f db", level_db);
+                assert(std::fabs(level_db) < 1.5);
+
+                for (int b = a + 1; b < channel_count; ++b) {
+                    auto const r = channel_correlation(y, channel_count, a, b);
+                    trace("correlation: %f", r);
+                    if (a == 0 && b == 1) {
+                        // front pair is mixed with its crossfeed
+                        assert(r > 0.2);
+                    } else {
+                        assert(std::fabs(r) < 0.05);
+                    }
+                }
+            }
+        }
+
+        // speakers past what we support stay silent
+        int const channel_count = AUDIO_CHANNEL_MAX + 2;
+        auto const y = render_noise(channel_count, 4096);
+        for (size_t i = 0; i < y.size(); i += channel_count) {
+            assert(y[i + AUDIO_CHANNEL_MAX - 1] != 0.0f);
+            assert(y[i + AUDIO_CHANNEL_MAX] == 0.0f);
+            assert(y[i + AUDIO_CHANNEL_MAX + 1] == 0.0f);
+        }
+    }
+
+    {
+        Scenario _("chime rings at the exact frame of expiry");
+        global_test_now_micros = 1'000'000;
+        auto audio = audio_make();
+        int const channel_count = 2;
+        int const frame_count = 3*48000;
+        std::vector<float> y(channel_count*frame_count);
+        // 1s from now, or frame 48000 of the audio clock
+        audio_chime_at(audio, global_test_now_micros + 1'000'000);
+
+        auto const allocation_n = global_test_allocation_n;
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(global_test_allocation_n == allocation_n);
+
+        // the voice starts at that frame, with its first sample
+        int const start_i = 48000;
+        trace("first audible frame: %f", first_non_silent_frame(y, channel_count));
+        assert(first_non_silent_frame(y, channel_count) > start_i - 2);
+        for (int i = 0; i < 1000; ++i) {
+            assert(y[channel_count*(start_i + i)] == audio->chime_samples[i]);
+            assert(y[channel_count*(start_i + i) + 1] == audio->chime_samples[i]);
+        }
+        // and it ends
+        assert(y[channel_count*(frame_count - 1)] == 0.0f);
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("chime mixes with the noise fade out");
+        global_test_now_micros = 0;
+        auto audio = audio_make();
+        int const channel_count = 2;
+        std::vector<float> fade_in(channel_count*2*48000);
+        audio_start(audio);
+        render_blocks(audio, fade_in.data(), channel_count, 2*48000);
+
+        // session ends: the chime rings as the noise fades out over 1s
+        audio_chime_at(audio, global_test_now_micros);
+        audio_stop(audio);
+        int const frame_count = 3*48000;
+        std::vector<float> y(channel_count*frame_count);
+        auto const allocation_n = global_test_allocation_n;
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(global_test_allocation_n == allocation_n);
+
+        float peak = 0.0f;
+        for (auto x : y) peak = std::max(peak, std::fabs(x));
+        trace("peak: %f", peak);
+        assert(peak < 1.0f);
+        // the chime is added on top of the fading noise, which carries on
+        // at its level without clicks (compared on first differences, which
+        // are dominated by the high, stable part of the spectrum)
+        auto const chime = audio->chime_samples;
+        int const window_n = 2400;
+        double energy_before = 0.0, energy_after = 0.0;
+        auto const before_l = fade_in.size() - channel_count;
+        for (int i = 0; i < window_n; ++i) {
+            auto const before = fade_in[before_l - channel_count*i] -
+                fade_in[before_l - channel_count*(i + 1)];
+            auto const after = (y[channel_count*(i + 1)] - chime[i + 1]) -
+                (y[channel_count*i] - chime[i]);
+            energy_before += before*before;
+            energy_after += after*after;
+        }
+        auto const level_change_db = db(energy_after/energy_before);
+        trace("noise level change: %f db", level_change_db);
+        assert(std::fabs(level_change_db) < 1.5);
+        // only the chime remains once the noise is gone
+        int const after_fade_i = 48000 + 4096;
+        for (int i = after_fade_i; i < AUDIO_CHIME_FRAME_COUNT; ++i) {
+            assert(y[channel_count*i] == chime[i]);
+        }
+        assert(y.back() == 0.0f);
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("cancelled chime stays silent");
+        global_test_now_micros = 0;
+        auto audio = audio_make();
+        audio_chime_at(audio, 500'000);
+        audio_chime_at(audio, 1'000'000); // moves it
+        std::vector<float> y(2*48000);
+        render_blocks(audio, y.data(), 2, 48000);
+        assert(first_non_silent_frame(y, 2) == -1);
+        audio_chime_cancel(audio);
+        render_blocks(audio, y.data(), 2, 48000);
+        assert(first_non_silent_frame(y, 2) == -1);
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("dsp state is handed over to the next version of the code");
+        std::vector<AudioDspState> states(3);
+        audio_dsp_handover(&states[0], nullptr, 1234);
+        AudioEvent fade = {};
+        fade.type = AudioEventType_Fade;
+        fade.amp_target = 1.0;
+        fade.fade_frame_count = 100;
+        AudioDspBlock block = {};
+        block.events = &fade;
+        block.event_count = 1;
+        block.separation_ms = global_separation_ms;
+        int const channel_count = 2;
+        std::vector<float> y(channel_count*2000), y_next(channel_count*2000);
+        audio_dsp_render(&states[0], &block, y.data(), channel_count, 2000);
+        block.event_count = 0;
+        block.frame_position = 2000;
+
+        // same version: the new code carries on exactly where the old was
+        audio_dsp_handover(&states[1], &states[0], 5678);
+        audio_dsp_render(&states[0], &block, y.data(), channel_count, 2000);
+        audio_dsp_render(&states[1], &block, y_next.data(), channel_count, 2000);
+        assert(y == y_next);
+
+        // other versions only keep the stable part of the state
+        states[1].stable.version = AUDIO_DSP_STATE_VERSION + 1;
+        audio_dsp_handover(&states[2], &states[1], 5678);
+        assert(states[2].stable.version == AUDIO_DSP_STATE_VERSION);
+        assert(states[2].stable.amp == 1.0);
+        audio_dsp_render(&states[0], &block, y.data(), channel_count, 2000);
+        audio_dsp_render(&states[2], &block, y_next.data(), channel_count, 2000);
+        assert(y != y_next);
+    }
+
+    {
+        Scenario _("fused and staged chains render the same frames");
+        auto audio = audio_make();
+        struct { AudioChainProc* chain; int channel_count; } const cases[] = {
+            { noise_chain_n<1>, 2 },
+            { noise_chain_n<2>, 8 },
+            { reference_tone_chain_n<1>, 2 },
+        };
+        AudioEvent events[2] = {};
+        events[0].type = AudioEventType_Fade;
+        events[0].amp_target = 1.0;
+        events[0].fade_frame_count = 700;
+        events[1].type = AudioEventType_Chime;
+        events[1].frame = 300;
+        int const frame_count = 4*AUDIO_CHUNK_FRAMES;
+        for (auto const& c : cases) {
+            std::vector<AudioDspState> states(2);
+            audio_dsp_handover(&states[0], nullptr, 1234);
+            AudioDspBlock block = {};
+            block.events = events;
+            block.event_count = 2;
+            block.chime_samples = audio->chime_samples;
+            block.chime_frame_count = AUDIO_CHIME_FRAME_COUNT;
+            block.separation_ms = global_separation_ms;
+            audio_dsp_events_apply(&states[0].stable, block);
+            block.event_count = 0;
+            states[1] = states[0];
+
+            int const executions[] = { AudioDspExecution_Fused, AudioDspExecution_Staged };
+            std::vector<float> y[2];
+            for (int i = 0; i < 2; ++i) {
+                global_audio_dsp_execution = executions[i];
+                y[i].resize(c.channel_count*frame_count);
+                auto chunk = block;
+                for (int first = 0; first < frame_count; first += AUDIO_CHUNK_FRAMES) {
+                    c.chain(&states[i], chunk, y[i].data() + first*c.channel_count,
+                            c.channel_count, AUDIO_CHUNK_FRAMES);
+                    chunk.frame_position += AUDIO_CHUNK_FRAMES;
+                }
+            }
+            global_audio_dsp_execution = AudioDspExecution_Fused;
+
+            double error = 0.0;
+            for (size_t i = 0; i < y[0].size(); ++i) {
+                error = std::max(error, double(std::fabs(y[0][i] - y[1][i])));
+            }
+            trace("max error: %g", error);
+            assert(error < 1e-7);
+            assert(first_non_silent_frame(y[0], c.channel_count) != -1);
+        }
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("swapping the dsp code crossfades from the old code to the new one");
+        global_test_now_micros = 0;
+        auto audio = audio_make();
+        int const channel_count = 2;
+        int const frame_count = 4*AUDIO_DSP_CROSSFADE_FRAMES;
+        std::vector<float> y(channel_count*frame_count);
+        audio_dsp_swap(audio, { test_dsp_constant_render, test_dsp_constant_handover });
+        auto const allocation_n = global_test_allocation_n;
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(global_test_allocation_n == allocation_n);
+        assert(audio_dsp_swap_count(audio) == 1);
+
+        // from the silence of the old code, to the constant of the new one
+        for (int i = 0; i < frame_count; ++i) {
+            auto const expected = i < AUDIO_DSP_CROSSFADE_FRAMES ?
+                0.25f*float(i + 1)/AUDIO_DSP_CROSSFADE_FRAMES : 0.25f;
+            assert(std::fabs(y[channel_count*i] - expected) < 1e-6f);
+            assert(y[channel_count*i + 1] == y[channel_count*i]);
+        }
+
+        // and back, to a fresh state of the built-in code
+        audio_dsp_swap(audio, { audio_dsp_render, audio_dsp_handover });
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(audio_dsp_swap_count(audio) == 2);
+        assert(y[channel_count*(AUDIO_DSP_CROSSFADE_FRAMES/2)] > 0.0f);
+        for (int i = AUDIO_DSP_CROSSFADE_FRAMES; i < frame_count; ++i) {
+            assert(y[channel_count*i] == 0.0f);
+        }
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("changing the mode crossfades from the old mode to the new one");
+        global_test_now_micros = 0;
+        auto const mode = global_audio_mode.load();
+        auto const crossfade_ms = global_audio_mode_crossfade_ms;
+        global_audio_mode_crossfade_ms = 50.0;
+        int const crossfade_frame_count = 48000/20;
+        auto audio = audio_make();
+        int const channel_count = 2;
+        int const frame_count = 2*crossfade_frame_count;
+        std::vector<float> y(channel_count*frame_count);
+        audio_dsp_swap(audio, { test_dsp_mode_render, test_dsp_constant_handover });
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(audio_dsp_swap_count(audio) == 1);
+
+        // from the constant of mode 0 to the one of mode 1, without a jump
+        global_audio_mode = mode + 1;
+        auto const allocation_n = global_test_allocation_n;
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(global_test_allocation_n == allocation_n);
+        assert(audio->mode_transition_n == 1);
+        assert(audio->dsp_previous_state == nullptr);
+        auto const y0 = 0.25f*float(mode + 1);
+        for (int i = 0; i < frame_count; ++i) {
+            auto const expected = i < crossfade_frame_count ?
+                y0 + 0.25f*float(i + 1)/crossfade_frame_count : y0 + 0.25f;
+            assert(std::fabs(y[channel_count*i] - expected) < 1e-6f);
+            assert(y[channel_count*i + 1] == y[channel_count*i]);
+        }
+
+        // changes during a transition wait for its end
+        global_audio_mode = mode + 2;
+        render_blocks(audio, y.data(), channel_count, 480);
+        assert(audio->crossfade_position >= 0);
+        global_audio_mode = mode;
+        render_blocks(audio, y.data(), channel_count, 480);
+        assert(audio->mode == mode + 2);
+        render_blocks(audio, y.data(), channel_count, frame_count);
+        assert(audio->mode_transition_n == 3);
+        assert(audio->mode == mode);
+        assert(y[channel_count*(frame_count - 1)] == y0);
+
+        audio_destroy(audio);
+        global_audio_mode = mode;
+        global_audio_mode_crossfade_ms = crossfade_ms;
+    }
+
+    {
+        Scenario _("idle audio thread parks until the next event");
+        global_test_now_micros = 0;
+        FakeDevice device;
+        device.audio = audio_make();
+        device.must_quit = false;
+        device.is_parked = false;
+        device.wakeup_n = 0;
+        device.thread = std::thread(fake_device_main, &device);
+
+        // never started: silent from the first period
+        fake_device_wait_parked(device);
+        assert(device.wakeup_n == 1);
+        global_test_now_micros += 3600'000'000ull;
+        assert(device.wakeup_n == 1);
+
+        // a session plays until stopped, then fades out and parks again
+        auto const start_micros = global_test_now_micros.load();
+        audio_start(device.audio);
+        while (global_test_now_micros < start_micros + 10'000'000) std::this_thread::yield();
+        audio_stop(device.audio);
+        fake_device_wait_parked(device);
+        auto const active_wakeup_n = device.wakeup_n.load();
+        trace("wakeups while playing: %f", double(active_wakeup_n));
+        assert(active_wakeup_n >= 1 + (10 + 1)*100);
+
+        auto const idle_start_micros = global_test_now_micros.load();
+        global_test_now_micros += 3600'000'000ull;
+        trace("wakeups per idle hour: %f", double(device.wakeup_n - active_wakeup_n));
+        assert(device.wakeup_n == active_wakeup_n);
+
+        // the audio clock went on during the idle hour
+        audio_start(device.audio);
+        while (device.is_parked) std::this_thread::yield();
+        audio_stop(device.audio);
+        fake_device_wait_parked(device);
+        auto const frame_at_start = audio_clock_frame_at(device.audio->clock, idle_start_micros);
+        auto const expected_frame = idle_start_micros*48000/1'000'000;
+        trace("audio clock error after the idle hour: %f frames",
+              double(int64_t(frame_at_start - expected_frame)));
+        assert(frame_at_start + 2*FAKE_DEVICE_PERIOD_FRAMES >= expected_frame);
+        assert(frame_at_start <= expected_frame + 2*FAKE_DEVICE_PERIOD_FRAMES);
+
+        device.must_quit = true;
+        audio_thread_unpark(device.audio);
+        device.thread.join();
+        audio_destroy(device.audio);
+    }
+
+    {
+        Scenario _("prewarmed audio stays awake, silent, and sounds as soon as started");
+        global_test_now_micros = 0;
+        auto audio = audio_make();
+        std::vector<float> y(2*48000);
+        render_blocks(audio, y.data(), 2, 480);
+        assert(audio_thread_is_silent(audio));
+
+        // the pointer moves over the window
+        audio_prewarm(audio);
+        audio_prewarm(audio);
+        assert(audio->prewarm_sent_n == 1);
+        render_blocks(audio, y.data(), 2, 48000);
+        assert(!audio_thread_is_silent(audio));
+        assert(first_non_silent_frame(y, 2) < 0);
+        assert(audio_start_latency_micros(audio) == 0);
+
+        // measured up to the render of the first sound
+        audio_start(audio);
+        global_test_now_micros += 1'234;
+        render_blocks(audio, y.data(), 2, 480);
+        assert(first_non_silent_frame(y, 2) == 1); // the fade starts from 0
+        assert(audio_start_latency_micros(audio) == 1'234);
+
+        // once stopped, silent after the prewarm ran out
+        audio_stop(audio);
+        render_blocks(audio, y.data(), 2, 48000);
+        assert(!audio_thread_is_silent(audio));
+        render_blocks(audio, y.data(), 2, 48000);
+        assert(audio_thread_is_silent(audio));
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("simulated device paces the audio thread and counts its underruns");
+        global_test_now_micros = 0;
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        config.buffer_frames = 2*480;
+        config.seed = 1234;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_Success);
+        assert(stream.header.channel_count == 2);
+        auto audio = audio_make();
+        audio_start(audio);
+
+        // a punctual device is woken up once per period, and never starves
+        sim_device_play(device, &stream, audio, 10'000'000);
+        assert(device->underrun_n == 0);
+        assert(device->period_n >= 999 && device->period_n <= 1000);
+        assert(device->wakeup_n == device->period_n + 1);
+        assert(device->late_micros_max == 0);
+
+        // jitter within the buffer is absorbed
+        device->config.jitter_micros = 5'000;
+        sim_device_play(device, &stream, audio, 10'000'000);
+        assert(device->underrun_n == 0);
+        assert(device->late_micros_max <= 5'000);
+
+        // while stalls longer than the buffer are not
+        device->config.stall_micros = 30'000;
+        device->config.stall_every_n_periods = 50;
+        sim_device_play(device, &stream, audio, 10'000'000);
+        auto const shallow_underrun_n = device->underrun_n;
+        trace("underruns in 10s with a 20ms buffer: %f", double(shallow_underrun_n));
+        assert(shallow_underrun_n > 0);
+        audio_stream_close(&stream);
+        assert(stream.header.error == AudioStreamError_Closed);
+
+        // unless the buffer is deeper
+        config.jitter_micros = device->config.jitter_micros;
+        config.stall_micros = device->config.stall_micros;
+        config.stall_every_n_periods = device->config.stall_every_n_periods;
+        uint64_t underrun_n[3];
+        uint32_t const buffer_frames[3] = { 2*480, 2*480, 10*480 };
+        for (int run_i = 0; run_i < 3; ++run_i) {
+            config.buffer_frames = buffer_frames[run_i];
+            auto other_device = audio_sim_make(config);
+            auto other_backend = audio_sim_backend(other_device);
+            audio_stream_open(&stream, &other_backend, 48000, 0);
+            sim_device_play(other_device, &stream, audio, 30'000'000);
+            underrun_n[run_i] = other_device->underrun_n;
+            audio_stream_close(&stream);
+            audio_sim_destroy(other_device);
+        }
+        trace("underruns in 30s with a 100ms buffer: %f", double(underrun_n[2]));
+        assert(underrun_n[0] > 0);
+        assert(underrun_n[2] == 0);
+        // the same seed stalls the same way
+        assert(underrun_n[0] == underrun_n[1]);
+
+        // a device that goes away closes its stream
+        audio_stream_open(&stream, &backend, 48000, 0);
+        sim_device_play(device, &stream, audio, 100'000);
+        device->is_disconnected = true;
+        sim_device_play(device, &stream, audio, 100'000);
+        assert(stream.header.error == AudioStreamError_Closed);
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_SystemError);
+
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+
+    {
+        Scenario _("latency follows the jitter and render time of the machine");
+        struct Machine { char const* name; uint64_t jitter_micros, render_micros, stall_micros; };
+        Machine const machines[] = {
+            { "quiet", 500, 1'000, 0 },
+            { "loaded", 5'000, 3'000, 20'000 },
+        };
+        uint32_t latency_frames[2];
+        for (int machine_i = 0; machine_i < 2; ++machine_i) {
+            auto const& machine = machines[machine_i];
+            global_test_now_micros = 0;
+            AudioSimDeviceConfig config = {};
+            config.sample_format = AudioSampleFormat_F32;
+            config.channel_count = 2;
+            config.period_frames = 480;
+            config.buffer_frames = 4800;
+            config.jitter_micros = machine.jitter_micros;
+            config.render_micros = machine.render_micros;
+            config.stall_micros = machine.stall_micros;
+            config.stall_every_n_periods = machine.stall_micros ? 200 : 0;
+            config.seed = 1;
+            auto device = audio_sim_make(config);
+            auto backend = audio_sim_backend(device);
+            AudioStream stream;
+            audio_stream_open(&stream, &backend, 48000, 0);
+            AudioLatencyController latency;
+            audio_latency_init(&latency, 48000, 48, config.buffer_frames);
+            assert(audio_latency_frames(&latency) == config.buffer_frames);
+            auto audio = audio_make();
+            audio_start(audio);
+
+            sim_device_play(device, &stream, audio, 60'000'000, &latency);
+            latency_frames[machine_i] = audio_latency_frames(&latency);
+            char name[128];
+            snprintf(name, sizeof name, "%s machine, latency: %%f ms", machine.name);
+            trace(name, latency_frames[machine_i] / 48.0);
+            snprintf(name, sizeof name, "%s machine, underruns: %%f", machine.name);
+            trace(name, double(device->underrun_n));
+            assert(device->underrun_n == 0);
+            assert(latency.starved_n == 0);
+
+            audio_stream_close(&stream);
+            audio_destroy(audio);
+            audio_sim_destroy(device);
+        }
+        // a period, plus what it takes
+        assert(latency_frames[0] <= 48*(10 + 4));
+        assert(latency_frames[1] >= 48*(10 + 20));
+        assert(latency_frames[1] < 4800);
+    }
+
+#if defined(__linux__)
+    {
+        Scenario _("file sink writes every frame it is given");
+        global_test_now_micros = 0;
+        char path[] = "/tmp/uu_focus_test_XXXXXX";
+        close(mkstemp(path));
+        LinuxFileSoundConfig config = {};
+        config.path = path;
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        auto backend = linux_file_sound_backend(&config);
+        AudioStream stream;
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_Success);
+        auto audio = audio_make();
+        audio_start(audio);
+        std::vector<float> render_samples(AUDIO_CHANNEL_MAX*480);
+        AudioDitherState dither;
+        audio_dither_init(&dither, 1, 2);
+        for (int period_i = 0; period_i < 10; ++period_i) {
+            auto const frame_count = audio_stream_render(
+                &stream, audio, nullptr, nullptr, &dither, render_samples.data(),
+                uint32_t(render_samples.size()), 1024);
+            assert(frame_count == 480);
+        }
+        audio_stream_close(&stream);
+        audio_destroy(audio);
+
+        auto file = fopen(path, "rb");
+        std::vector<int16_t> samples(2*10*480 + 1);
+        auto const sample_n = fread(samples.data(), sizeof samples[0], samples.size(), file);
+        fclose(file);
+        unlink(path);
+        assert(sample_n == 2*10*480);
+        int non_zero_n = 0;
+        for (size_t i = 0; i < sample_n; ++i) non_zero_n += samples[i] != 0;
+        assert(non_zero_n > int(sample_n/2));
+    }
+#endif
+
+    {
+        Scenario _("audio ring counts the frames it could not deliver");
+        enum { CAPACITY = 1000, CHANNEL_COUNT = 2 };
+        auto ring = audio_ring_make(CHANNEL_COUNT, CAPACITY);
+        float next_written = 1.0f, next_read = 1.0f;
+        auto write = [&](uint32_t frame_count) {
+            while (frame_count) {
+                auto n = frame_count;
+                auto frames = audio_ring_write_begin(ring, &n);
+                assert(n > 0);
+                for (uint32_t i = 0; i < n; ++i) {
+                    frames[CHANNEL_COUNT*i] = frames[CHANNEL_COUNT*i + 1] = next_written++;
+                }
+                audio_ring_write_end(ring, n);
+                frame_count -= n;
+            }
+        };
+        std::vector<float> y(CHANNEL_COUNT*CAPACITY);
+
+        // around the end of the ring, many times over
+        for (int turn_i = 0; turn_i < 10; ++turn_i) {
+            write(300);
+            audio_ring_read(ring, y.data(), 300);
+            for (int i = 0; i < 300; ++i) {
+                assert(y[CHANNEL_COUNT*i] == next_read);
+                assert(y[CHANNEL_COUNT*i + 1] == next_read);
+                ++next_read;
+            }
+        }
+        assert(audio_ring_stats(ring).underrun_n == 0);
+
+        // full
+        write(CAPACITY);
+        assert(audio_ring_write_available(ring) == 0);
+        uint32_t n = 1;
+        audio_ring_write_begin(ring, &n);
+        assert(n == 0);
+        audio_ring_read(ring, y.data(), CAPACITY);
+        assert(y[0] == next_read);
+        next_read += CAPACITY;
+
+        // short by 100 frames, delivered silent
+        write(200);
+        audio_ring_read(ring, y.data(), 300);
+        assert(y[CHANNEL_COUNT*199] == next_read + 199);
+        for (int i = CHANNEL_COUNT*200; i < CHANNEL_COUNT*300; ++i) assert(y[i] == 0.0f);
+        next_read += 200;
+        audio_ring_read(ring, y.data(), 50);
+        auto stats = audio_ring_stats(ring);
+        assert(stats.underrun_n == 2);
+        assert(stats.underrun_frame_n == 150);
+        assert(stats.read_frame_n == 10*300 + CAPACITY + 300 + 50);
+
+        // what comes next was delayed, not lost
+        write(10);
+        audio_ring_read(ring, y.data(), 10);
+        assert(y[0] == next_read);
+        audio_ring_destroy(ring);
+    }
+
+    {
+        Scenario _("render ahead feeds the device thread until the audio is idle");
+        global_test_now_micros = 0;
+        enum { DEPTH = 4800, BLOCK = 480, CHANNEL_COUNT = 2 };
+        auto audio = audio_make();
+        audio_start(audio);
+        auto ahead = audio_render_ahead_make(audio, CHANNEL_COUNT, DEPTH, BLOCK);
+        auto ring = audio_render_ahead_ring(ahead);
+        std::vector<float> y(CHANNEL_COUNT*DEPTH);
+
+        // the device may take all the headroom at once
+        while (audio_ring_read_available(ring) < DEPTH) std::this_thread::yield();
+        audio_render_ahead_read(ahead, y.data(), DEPTH);
+        assert(first_non_silent_frame(y, CHANNEL_COUNT) >= 0);
+        assert(audio_ring_stats(ring).underrun_n == 0);
+        // the device hears the frames of the audio in the order they were read
+        audio_render_ahead_heard(ahead, global_test_now_micros, BLOCK);
+        assert(audio_correlation_mapping(&audio->correlation).frame == DEPTH - BLOCK);
+        while (audio_ring_read_available(ring) < DEPTH) std::this_thread::yield();
+
+        // once stopped and faded out, the dsp thread parks and the device
+        // plays what is left
+        audio_stop(audio);
+        while (!audio_render_ahead_is_idle(ahead)) {
+            auto frame_count = audio_ring_read_available(ring);
+            if (frame_count == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (frame_count > BLOCK) frame_count = BLOCK;
+            audio_render_ahead_read(ahead, y.data(), frame_count);
+        }
+        assert(audio_ring_stats(ring).underrun_n == 0);
+
+        // reading past it is an underrun
+        audio_render_ahead_read(ahead, y.data(), BLOCK);
+        auto const stats = audio_ring_stats(ring);
+        assert(stats.underrun_n == 1);
+        assert(stats.underrun_frame_n == BLOCK);
+
+        // the device thread waits for the next event
+        std::atomic<bool> is_awake(false);
+        std::thread device_thread([&]() {
+            audio_render_ahead_wait(ahead);
+            is_awake = true;
+        });
+        audio_start(audio);
+        device_thread.join();
+        assert(is_awake);
+        while (audio_ring_read_available(ring) == 0) std::this_thread::yield();
+        assert(!audio_render_ahead_is_idle(ahead));
+
+        audio_render_ahead_destroy(ahead);
+        audio_destroy(audio);
+    }
+
+    {
+        Scenario _("resampler converts between rates without noise nor aliasing");
+        enum { FRAME_COUNT = 8*SPECTRUM_N };
+        // power of the tone, against the power of everything else
+        auto const tone_snr_db = [](std::vector<float> const& output, double audio_hz,
+                                    double tone_hz) {
+            auto const power = power_spectrum(output, 2);
+            auto const tone = band_power(power, tone_hz - 100.0, tone_hz + 100.0, audio_hz);
+            auto const rest = band_power(power, 20.0, 0.5*audio_hz, audio_hz) - tone;
+            return db(tone / rest);
+        };
+        struct { int input_hz; int output_hz; } const conversions[] = {
+            { 48000, 44100 }, { 44100, 48000 }, { 48000, 37853 }, { 48000, 96000 },
+        };
+        for (auto const& conversion : conversions) {
+            for (double tone_hz : { 1000.0, 10000.0, 17000.0 }) {
+                // NOTE(nicolas): on a bin of the output spectrum, not to leak out of it
+                tone_hz = std::round(tone_hz * SPECTRUM_N / conversion.output_hz) *
+                    conversion.output_hz / SPECTRUM_N;
+                auto const output = resample_tone(conversion.input_hz, conversion.output_hz,
+                                                  tone_hz, FRAME_COUNT);
+                auto const snr_db = tone_snr_db(output, conversion.output_hz, tone_hz);
+                trace("snr: %f dB", snr_db);
+                assert(snr_db > 95.0);
+            }
+        }
+
+        // within the pass band, the gain is unity
+        {
+            auto const output = resample_tone(48000, 44100, 1000.0, FRAME_COUNT);
+            double peak = 0.0;
+            for (auto x : output) peak = std::max(peak, std::fabs(double(x)));
+            trace("gain: %f dB", 20.0*std::log10(peak / 0.5));
+            assert(std::fabs(peak / 0.5 - 1.0) < 1e-3);
+        }
+
+        // nothing folds back below the nyquist frequency of the output, and
+        // no image of the input appears above its own
+        {
+            auto const reference_db = [&](int output_hz) {
+                auto const output = resample_tone(48000, output_hz, 1000.0, FRAME_COUNT);
+                return db(band_power(power_spectrum(output, 2), 20.0, 0.5*output_hz, output_hz));
+            };
+            auto const aliased = resample_tone(48000, 44100, 23000.0, FRAME_COUNT);
+            auto const alias_db = db(band_power(power_spectrum(aliased, 2), 20.0, 22050.0, 44100.0)) -
+                reference_db(44100);
+            trace("aliasing: %f dB", alias_db);
+            assert(alias_db < -85.0);
+
+            auto const imaged = resample_tone(44100, 48000, 21000.0, FRAME_COUNT);
+            auto const image_db = db(band_power(power_spectrum(imaged, 2), 22050.0, 24000.0)) -
+                reference_db(48000);
+            trace("imaging: %f dB", image_db);
+            assert(image_db < -85.0);
+        }
+
+        // drifting bends the pitch, without a click
+        {
+            auto const drift_max = AUDIO_RESAMPLER_DRIFT_MAX;
+            auto const output = resample_tone(48000, 44100, 1000.0, FRAME_COUNT,
+                                              { 0.0, drift_max, -drift_max });
+            // of a sine at the highest pitch, its curvature
+            auto const w = 6.2831853071795864769252 * 1000.0 * (1.0 + drift_max) / 44100.0;
+            double curvature_max = 0.0;
+            for (size_t i = 2; i + 2 < output.size(); i += 2) {
+                auto const curvature = std::fabs(double(output[i + 2]) - 2.0*output[i] + output[i - 2]);
+                curvature_max = std::max(curvature_max, curvature);
+            }
+            trace("curvature, relative to the tone: %f", curvature_max / (0.5*w*w));
+            assert(curvature_max < 1.01 * 0.5*w*w);
+
+            // and makes the input last as much shorter or longer
+            auto resampler = audio_resampler_make(2, 48000, 44100);
+            audio_resampler_set_drift(resampler, drift_max);
+            auto const fast_n = audio_resampler_input_count(resampler, 44100);
+            audio_resampler_set_drift(resampler, -drift_max);
+            auto const slow_n = audio_resampler_input_count(resampler, 44100);
+            audio_resampler_set_drift(resampler, 1.0);
+            assert(audio_resampler_input_count(resampler, 44100) == fast_n);
+            audio_resampler_destroy(resampler);
+            assert(std::fabs(fast_n - 48000.0*(1.0 + drift_max)) <= 2.0);
+            assert(std::fabs(slow_n - 48000.0*(1.0 - drift_max)) <= 2.0);
+        }
+    }
+
+    {
+        Scenario _("a device at another rate plays what we render at ours");
+        global_test_now_micros = 0;
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_S16;
+        config.channel_count = 2;
+        config.audio_hz = 44100;
+        config.period_frames = 441;
+        config.buffer_frames = 3*441;
+        config.seed = 1;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_Success);
+        assert(stream.header.audio_hz == 44100);
+        auto resampler = audio_stream_resampler_update(&stream, nullptr, 48000);
+        assert(resampler);
+        // reopening on the same device keeps it
+        audio_stream_close(&stream);
+        audio_stream_open(&stream, &backend, 48000, 0);
+        assert(audio_stream_resampler_update(&stream, resampler, 48000) == resampler);
+
+        auto audio = audio_make();
+        audio_start(audio);
+        sim_device_play(device, &stream, audio, 10'000'000, nullptr, resampler);
+        assert(device->underrun_n == 0);
+        // our clock ran at our rate, in step with the device's
+        auto const rendered_frame_n = audio->frame_position;
+        auto const expected_frame_n = device->written_frame_n * 48000 / 44100;
+        trace("frames rendered, beyond those played: %f",
+              double(int64_t(rendered_frame_n - expected_frame_n)));
+        assert(rendered_frame_n + 2 >= expected_frame_n &&
+               rendered_frame_n <= expected_frame_n + 2);
+
+        audio_stream_close(&stream);
+        config.audio_hz = 0;
+        device->config = config;
+        audio_stream_open(&stream, &backend, 48000, 0);
+        assert(audio_stream_resampler_update(&stream, resampler, 48000) == nullptr);
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+
+    {
+        Scenario _("the audio clock follows the clock of a drifting device");
+        struct { int audio_hz; double drift_ppm; } const cases[] = {
+            { 48000, 0.0 }, { 48000, 150.0 }, { 48000, -250.0 }, { 44100, 80.0 },
+        };
+        for (auto const& c : cases) {
+            global_test_now_micros = 0;
+            AudioSimDeviceConfig config = {};
+            config.sample_format = AudioSampleFormat_F32;
+            config.channel_count = 2;
+            config.audio_hz = c.audio_hz;
+            config.drift_ppm = c.drift_ppm;
+            config.period_frames = uint32_t(c.audio_hz/100);
+            config.buffer_frames = 4*config.period_frames;
+            config.jitter_micros = 2'000;
+            config.seed = 7;
+            auto device = audio_sim_make(config);
+            auto backend = audio_sim_backend(device);
+            AudioStream stream;
+            audio_stream_open(&stream, &backend, 48000, 0);
+            auto resampler = audio_stream_resampler_update(&stream, nullptr, 48000);
+            auto audio = audio_make();
+            audio_start(audio);
+            sim_device_play(device, &stream, audio, 60'000'000, nullptr, resampler);
+            assert(device->underrun_n == 0);
+
+            // when the device plays the frames we render now
+            auto const device_hz = c.audio_hz * (1.0 + c.drift_ppm*1e-6);
+            auto const delay_frames = resampler ?
+                audio_resampler_delay_micros(resampler)*48000/1e6 : 0.0;
+            auto const frame = audio->frame_position;
+            auto const heard_micros = device->start_micros +
+                (double(frame) + delay_frames)*c.audio_hz/48000 * 1e6/device_hz;
+            auto const mapping = audio_correlation_mapping(&audio->correlation);
+            auto const rate_error_ppm =
+                (audio_clock_mapping_rate_hz(mapping)*c.audio_hz/48000/device_hz - 1.0)*1e6;
+            auto const error_micros = double(audio_micros_at(audio, frame)) - heard_micros;
+            trace("device drift: %f ppm", c.drift_ppm);
+            trace("  rate error: %f ppm", rate_error_ppm);
+            trace("  heard at: %f ms late", error_micros/1e3);
+            assert(std::fabs(rate_error_ppm) < 2.0);
+            // observations are late by the jitter of the wakeups, at most
+            assert(error_micros >= -100.0 && error_micros <= config.jitter_micros);
+            assert(audio->correlation.lock_n == 1);
+            // and back, we hear the frames that were rendered a buffer ago
+            auto const heard_frame = audio_frame_at(audio, device->now_micros);
+            assert(heard_frame < frame);
+            assert(heard_frame + 48000/10 > frame);
+
+            // without a device, frames are heard as they are rendered
+            audio_stream_close(&stream);
+            global_test_now_micros += AUDIO_CORRELATION_STALE_MICROS;
+            assert(audio_frame_at(audio, global_test_now_micros) ==
+                   audio_clock_frame_at(audio->clock, global_test_now_micros));
+
+            audio_stream_resampler_update(&stream, resampler, 48000);
+            audio_destroy(audio);
+            audio_sim_destroy(device);
+        }
+    }
+
+    {
+        Scenario _("ticks are heard as the countdown shows each second");
+        global_test_now_micros = 0;
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_F32;
+        config.channel_count = 2;
+        config.drift_ppm = 120.0;
+        config.period_frames = 480;
+        config.buffer_frames = 4*480;
+        config.jitter_micros = 2'000;
+        config.seed = 25;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_Success);
+        auto audio = audio_make();
+        audio_start(audio);
+        global_test_sim_device = device;
+        uint64_t const end_micros = device->now_micros + 25*60'000'000ull;
+        audio_ticks_until(audio, end_micros);
+
+        // the onsets of the ticks, as they are rendered
+        auto const frame_count_max = config.buffer_frames;
+        std::vector<float> render_samples(AUDIO_CHANNEL_MAX*frame_count_max);
+        AudioDitherState dither;
+        audio_dither_init(&dither, 1, 2);
+        std::vector<uint64_t> tick_frames;
+        while (device->now_micros < end_micros + 1'000'000) {
+            audio_stream_render(&stream, audio, nullptr, nullptr, &dither, render_samples.data(),
+                                uint32_t(render_samples.size()), frame_count_max);
+            if (audio->tick_n != tick_frames.size()) {
+                assert(audio->tick_n == tick_frames.size() + 1);
+                tick_frames.push_back(audio->tick_start_frame);
+            }
+        }
+        global_test_sim_device = nullptr;
+        global_test_now_micros = device->now_micros;
+        assert(device->underrun_n == 0);
+
+        // one per second, the last a second before the end
+        assert(tick_frames.size() == 25*60 - 1);
+        auto const device_hz = 48000 * (1.0 + config.drift_ppm*1e-6);
+        double error_micros_max = 0.0;
+        for (size_t tick_i = 0; tick_i < tick_frames.size(); ++tick_i) {
+            auto const second_n = tick_frames.size() - tick_i;
+            auto const boundary_micros = double(end_micros - second_n*1'000'000);
+            auto const heard_micros = device->start_micros + double(tick_frames[tick_i])*1e6/device_hz;
+            auto const error_micros = std::fabs(heard_micros - boundary_micros);
+            if (error_micros > error_micros_max) error_micros_max = error_micros;
+            // within a period of the device
+            assert(error_micros <= 1e6*config.period_frames/48000);
+        }
+        trace("tick error, max: %f ms", error_micros_max/1e3);
+        assert(audio->ticks_end_micros == 0);
+        assert(audio->tick_position < 0);
+
+        // a cancel stops them
+        audio_ticks_until(audio, global_test_now_micros + 10'000'000);
+        audio_ticks_cancel(audio);
+        sim_device_play(device, &stream, audio, 2'000'000);
+        assert(audio->tick_n == tick_frames.size());
+
+        audio_stream_close(&stream);
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+
+    {
+        Scenario _("audio goes on while the stream migrates to a device that came back");
+        global_test_now_micros = 0;
+        AudioSimDeviceConfig config = {};
+        config.sample_format = AudioSampleFormat_F32;
+        config.channel_count = 2;
+        config.period_frames = 480;
+        config.buffer_frames = 3*480;
+        config.seed = 1;
+        auto device = audio_sim_make(config);
+        auto backend = audio_sim_backend(device);
+        AudioStream stream;
+        assert(audio_stream_open(&stream, &backend, 48000, 0) == AudioStreamError_Success);
+        AudioStreamMigration migration;
+        audio_stream_migration_init(&migration, &backend, 48000, 0);
+        auto audio = audio_make();
+        audio_start(audio);
+        sim_device_play(device, &stream, audio, 1'000'000);
+
+        // the device goes away for half a second
+        device->is_disconnected = true;
+        auto const lost_micros = device->now_micros;
+        auto const back_micros = lost_micros + 500'000;
+        std::vector<float> scratch(2*480);
+        AudioDitherState dither;
+        audio_dither_init(&dither, 1, 2);
+        global_test_sim_device = device;
+        audio_stream_render(&stream, audio, nullptr, nullptr, &dither, scratch.data(),
+                            uint32_t(scratch.size()), 480);
+        assert(stream.header.error == AudioStreamError_Closed);
+        audio_stream_migration_begin(&migration, device->now_micros);
+        while (true) {
+            if (device->now_micros >= back_micros) device->is_disconnected = false;
+            while (auto frame_count = audio_stream_migration_drop(&migration, now_micros(), 480)) {
+                audio_thread_render(audio, scratch.data(), 2, int(frame_count));
+            }
+            if (audio_stream_migration_reopen(&stream, &migration, now_micros())) break;
+            audio_sim_advance(device, 10'000);
+        }
+        global_test_sim_device = nullptr;
+        trace("recovery time: %f ms", migration.recovery_micros_last / 1e3);
+        assert(migration.migration_n == 1);
+        assert(migration.recovery_micros_last >= 500'000);
+        assert(migration.recovery_micros_last <= 500'000 + AUDIO_STREAM_MIGRATION_RETRY_MAX_MICROS);
+        assert(migration.recovery_micros_max == migration.recovery_micros_last);
+
+        // the audio went on meanwhile, as ahead of the clock as the device
+        // buffer, and resumes from where it is now
+        auto const expected_frame_n = device->now_micros*48000/1'000'000;
+        trace("audio clock ahead of the device clock: %f frames",
+              double(int64_t(audio->frame_position - expected_frame_n)));
+        assert(audio->frame_position >= expected_frame_n);
+        assert(audio->frame_position <= expected_frame_n + config.buffer_frames);
+        global_test_sim_device = device;
+        audio_stream_render(&stream, audio, nullptr, nullptr, &dither, scratch.data(),
+                            uint32_t(scratch.size()), 480);
+        global_test_sim_device = nullptr;
+        // fading in from silence
+        auto const resumed = reinterpret_cast<float const*>(device->bytes);
+        assert(resumed[0] == 0.0f && resumed[1] == 0.0f);
+        auto const fade_in_frame_count = 48000*AUDIO_STREAM_MIGRATION_FADE_IN_MICROS/1'000'000;
+        for (int i = 0; i < fade_in_frame_count; ++i) {
+            assert(std::fabs(resumed[2*i]) <= float(i + 1) / fade_in_frame_count);
+        }
+        assert(resumed[2*(480 - 1)] != 0.0f);
+        sim_device_play(device, &stream, audio, 1'000'000);
+        assert(device->underrun_n == 0);
+
+        audio_stream_close(&stream);
+        audio_destroy(audio);
+        audio_sim_destroy(device);
+    }
+
+    {
+        Scenario _("render pool renders every stream of a block once");
+        global_test_now_micros = 0;
+        enum { STREAM_COUNT = 37, FRAME_COUNT = 480, CHANNEL_COUNT = 2 };
+        auto pool = render_pool_make(3, STREAM_COUNT);
+        std::vector<float> frames(STREAM_COUNT*FRAME_COUNT*CHANNEL_COUNT);
+        RenderStream streams[STREAM_COUNT];
+        for (int i = 0; i < STREAM_COUNT; ++i) {
+            streams[i].audio = audio_make();
+            streams[i].frames = &frames[i*FRAME_COUNT*CHANNEL_COUNT];
+            streams[i].channel_count = CHANNEL_COUNT;
+            audio_start(streams[i].audio);
+        }
+        for (int block_i = 1; block_i <= 8; ++block_i) {
+            auto const result = render_pool_render(pool, streams, STREAM_COUNT,
+                                                   FRAME_COUNT, UINT64_MAX);
+            assert(result.rendered_n == STREAM_COUNT);
+            assert(result.late_n == 0);
+            for (auto const& stream : streams) {
+                assert(stream.audio->frame_position == uint64_t(block_i*FRAME_COUNT));
+            }
+        }
+        for (auto const& stream : streams) {
+            std::vector<float> y(stream.frames, stream.frames + FRAME_COUNT*CHANNEL_COUNT);
+            assert(first_non_silent_frame(y, CHANNEL_COUNT) == 0);
+        }
+
+        // past the deadline, every stream is delivered silent
+        global_test_now_micros = 10'000;
+        auto const result = render_pool_render(pool, streams, STREAM_COUNT,
+                                               FRAME_COUNT, 5'000);
+        assert(result.rendered_n == 0);
+        assert(result.late_n == STREAM_COUNT);
+        for (auto x : frames) assert(x == 0.0f);
+        for (auto const& stream : streams) {
+            assert(stream.audio->frame_position == uint64_t(8*FRAME_COUNT));
+            audio_destroy(stream.audio);
+        }
+        render_pool_destroy(pool);
+    }
+}
+
+static uint64_t now_micros()
+{
+    if (global_test_sim_device) return global_test_sim_device->now_micros;
+    return global_test_now_micros;
+}
+
+void platform_render_async(Platform*) {}
+void platform_notify(Platform*, UIText) {}
+Civil_Time_Of_Day platform_get_time_of_day() { return {}; }
+UIText ui_text_temp(char const*, ...) { return {}; }
+void temp_allocator_reset() {}
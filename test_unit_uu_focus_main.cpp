@@ -1,6 +1,11 @@
 // @language: c++14
 static char const* USAGE_PATTERN = "%s {--help,--quiet}";
+#include "uu_focus_journal.hpp"
 #include "uu_focus_main.hpp"
+#include "uu_focus_schedule.hpp"
+#include "uu_focus_sessions.hpp"
+#include "uu_focus_snapshot.hpp"
+#include "uu_focus_timing_wheel.hpp"
 
 #include <cassert>
 #include <cstring>
@@ -12,11 +17,22 @@ struct TimerEffect
 {
     int on_count = 0;
     std::vector<std::string> actions; // trace
+    // when on, sessions last what the program asked for from now_micros,
+    // otherwise they only expire once stopped
+    bool expires_on = false;
+    uint64_t duration_micros = 0; // asked for
+
+    uint64_t now_micros = 0;
+    uint64_t end_micros = 0;
+    // kept by snapshots
+    uint64_t start_micros = 0;
+    struct { int hours; int minutes; } start_time = {};
 };
 
 struct AudioEffect
 {
     std::vector<std::string> actions;
+    AudioPreset preset = {};
 };
 
 struct Scenario
@@ -33,6 +49,12 @@ struct Scenario
 
 static char const* CommandName(Command x);
 
+static void journal_test_write(void* user, uint8_t const* bytes, size_t size)
+{
+    auto& journal_bytes = *static_cast<std::vector<uint8_t>*>(user);
+    journal_bytes.insert(journal_bytes.end(), bytes, bytes + size);
+}
+
 template <typename BoundedRange>
 std::size_t count_range(BoundedRange r, typename BoundedRange::value_type const& x)
 {
@@ -78,7 +100,7 @@ int main(int argc, char** argv)
 
     auto const input = [](UUFocusMainCoroutine* _program, Command x) {
         auto &program = *_program;
-        program.input.command.type = x;
+        command_push(&program.input.commands, { x, program.input.time_micros });
         if (!global_test_options.console_output_off) {
             std::printf("INPUT: %s\n", CommandName(x));
             fflush(stdout);
@@ -137,6 +159,8 @@ int main(int argc, char** argv)
                == count_range(audio.actions, "audio stop")
                == 1);
         assert(count_range(timer.actions, "timer celebrate") == 0);
+        assert(count_range(audio.actions, "audio chime at") == 1);
+        assert(count_range(audio.actions, "audio chime cancel") == 1);
         assert(program.timer_elapsed_n == 0);
     }
 
@@ -196,6 +220,8 @@ int main(int argc, char** argv)
             assert(timer.on_count == 1);
             assert(count_range(timer.actions, "timer celebrate") == 0);
             assert(program.timer_elapsed_n == 0);
+            // the chime follows the new end of the session
+            assert(count_range(audio.actions, "audio chime at") == 2);
         }
     }
 
@@ -221,10 +247,686 @@ int main(int argc, char** argv)
 
         assert(1 == count_range(timer.actions, "timer celebrate"));
         assert(program.timer_elapsed_n == TIMER_ELAPSED_START + 1);
+        // the chime was scheduled at start, and left to ring
+        assert(1 == count_range(audio.actions, "audio chime at"));
+        assert(0 == count_range(audio.actions, "audio chime cancel"));
+    }
+
+    {
+        Scenario _("hovering prewarms the audio, only while waiting for a start");
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+        }
+
+        input(&program, Command_timer_prewarm);
+        uu_focus_main(&program);
+        assert(1 == count_range(audio.actions, "audio prewarm"));
+        assert(0 == count_range(audio.actions, "audio start"));
+        assert(timer.on_count == 0);
+
+        input(&program, Command_timer_start);
+        uu_focus_main(&program);
+        assert(1 == count_range(audio.actions, "audio start"));
+
+        // already playing, nor anything new to show
+        auto const render_n = count_range(timer.actions, "timer update_and_render");
+        auto const deadline_micros = program.deadline_micros;
+        input(&program, Command_timer_prewarm);
+        uu_focus_main(&program);
+        assert(1 == count_range(audio.actions, "audio prewarm"));
+        assert(render_n == count_range(timer.actions, "timer update_and_render"));
+        assert(deadline_micros == program.deadline_micros);
+        assert(timer.on_count == 1);
+    }
+
+    {
+        Scenario _("ticks follow the countdown, when on");
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+        }
+
+        input(&program, Command_timer_start);
+        uu_focus_main(&program);
+        assert(0 == count_range(audio.actions, "audio ticks until"));
+
+        program.tick_on = true;
+        input(&program, Command_timer_start);
+        uu_focus_main(&program);
+        assert(1 == count_range(audio.actions, "audio ticks until"));
+        // a reset counts down from the start again
+        input(&program, Command_timer_start);
+        uu_focus_main(&program);
+        assert(2 == count_range(audio.actions, "audio ticks until"));
+
+        // ticks turned off during the session still stop with it
+        program.tick_on = false;
+        input(&program, Command_timer_stop);
+        uu_focus_main(&program);
+        assert(1 == count_range(audio.actions, "audio ticks cancel"));
+    }
+
+    {
+        Scenario _("commands arriving together are all handled, in order, in one call");
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+        }
+
+        program.input.time_micros = 100;
+        input(&program, Command_timer_start);
+        program.input.time_micros = 200;
+        input(&program, Command_timer_stop);
+        program.input.time_micros = 300;
+        input(&program, Command_timer_start);
+        program.input.time_micros = 400;
+        assert(uu_focus_main(&program) == CoroutineState_Waiting);
+        assert(2 == count_range(timer.actions, "timer start"));
+        assert(1 == count_range(timer.actions, "timer stop"));
+        assert(timer.on_count == 1);
+        assert(program.input.commands.read_n == program.input.commands.write_n);
+        // steps are timed by the command that led to them
+        assert(program.step == 20);
+        assert(program.step_micros == 300);
+
+        // a burst past the capacity is counted, and the stop still gets through
+        for (int i = 0; i < COMMAND_QUEUE_CAPACITY + 3; ++i) {
+            input(&program, Command_timer_prewarm);
+        }
+        input(&program, Command_application_stop);
+        assert(program.input.commands.overflow_n == 4);
+        assert(uu_focus_main(&program) == CoroutineState_Done);
+        assert(2 == count_range(timer.actions, "timer stop"));
+        assert(timer.on_count == 0);
+    }
+
+    {
+        Scenario _("the program sleeps until its deadline or the next command");
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+            program.schedule = &schedule_work_only;
+            timer.expires_on = true;
+        }
+
+        // a frontend that wakes up for commands, and at deadlines
+        uint64_t resume_n = 0;
+        auto const wake_at = [&](uint64_t micros) {
+            timer.now_micros = micros;
+            program.input.time_micros = micros;
+            uu_focus_main(&program);
+            ++resume_n;
+        };
+        enum { CYCLE_N = 4 };
+        uint64_t now = 1'000'000;
+        for (int cycle_i = 0; cycle_i < CYCLE_N; ++cycle_i) {
+            program.input.time_micros = now;
+            input(&program, Command_timer_start);
+            wake_at(now);
+            assert(program.deadline_micros == now + timer.duration_micros);
+            if (cycle_i == 1) {
+                // restarting midway moves the deadline
+                now += 10*60'000'000ull;
+                program.input.time_micros = now;
+                input(&program, Command_timer_start);
+                wake_at(now);
+                assert(program.deadline_micros == now + timer.duration_micros);
+            }
+            now = program.deadline_micros;
+            wake_at(now);
+            assert(program.deadline_micros == 0);
+            // a short break, where nothing is due
+            now += 5*60'000'000ull;
+        }
+        if (!global_test_options.console_output_off) {
+            std::printf("resumes per cycle: %f\n", double(resume_n)/CYCLE_N);
+        }
+        assert(program.timer_elapsed_n == CYCLE_N);
+        assert(resume_n == 2*CYCLE_N + 1);
+
+        // a timer firing early finds nothing to do, and the same deadline
+        input(&program, Command_timer_start);
+        wake_at(now);
+        auto const deadline_micros = program.deadline_micros;
+        wake_at(deadline_micros - 1'000);
+        assert(program.deadline_micros == deadline_micros);
+        assert(program.timer_elapsed_n == CYCLE_N);
+        wake_at(deadline_micros);
+        assert(program.timer_elapsed_n == CYCLE_N + 1);
+    }
+
+    {
+        Scenario _("a journal replays into the same effects");
+        struct Run
+        {
+            TimerEffect timer;
+            AudioEffect audio;
+            UUFocusMainCoroutine program;
+            Journal journal;
+            std::vector<uint8_t> journal_bytes;
+        };
+        auto const run_make = [](Run* _run) {
+            auto& run = *_run;
+            run.program = {};
+            run.program.timer_effect = &run.timer;
+            run.program.audio_effect = &run.audio;
+            run.program.tick_on = true;
+            journal_init(&run.journal, { &run.journal_bytes, journal_test_write });
+            run.program.journal = &run.journal;
+        };
+
+        Run recorded;
+        run_make(&recorded);
+        recorded.timer.expires_on = true;
+        auto const call_at = [&](uint64_t micros) {
+            recorded.timer.now_micros = micros;
+            recorded.program.input.time_micros = micros;
+            uu_focus_main(&recorded.program);
+        };
+        uint64_t now = 123'456;
+        input(&recorded.program, Command_timer_prewarm);
+        call_at(now);
+        recorded.program.input.time_micros = now += 2'000'000;
+        input(&recorded.program, Command_timer_start);
+        call_at(now);
+        call_at(now += 300'000'000);
+        recorded.program.input.time_micros = now;
+        input(&recorded.program, Command_timer_start);
+        input(&recorded.program, Command_timer_prewarm);
+        call_at(now);
+        call_at(now = recorded.program.deadline_micros);
+        recorded.program.input.time_micros = now += 60'000'000;
+        input(&recorded.program, Command_timer_start);
+        call_at(now);
+        recorded.program.input.time_micros = now += 60'000'000;
+        input(&recorded.program, Command_application_stop);
+        call_at(now);
+        journal_flush(&recorded.journal);
+        assert(recorded.program.timer_elapsed_n == 1);
+        // a couple of bytes per record
+        assert(recorded.journal.byte_n < JOURNAL_HEADER_SIZE + 3*recorded.journal.record_n);
+
+        // offline, the effects answer nothing: the journal does
+        Run replayed;
+        run_make(&replayed);
+        JournalReplay replay;
+        assert(journal_replay(&replayed.program, recorded.journal_bytes.data(),
+                              recorded.journal_bytes.size(), &replay));
+        journal_flush(&replayed.journal);
+        assert(replay.call_n == 7);
+        assert(replayed.timer.actions == recorded.timer.actions);
+        assert(replayed.audio.actions == recorded.audio.actions);
+        assert(replayed.program.timer_elapsed_n == recorded.program.timer_elapsed_n);
+        assert(replayed.journal_bytes == recorded.journal_bytes);
+
+        // a program that asks something else does not follow the journal
+        Run other;
+        run_make(&other);
+        other.program.tick_on = false;
+        assert(!journal_replay(&other.program, recorded.journal_bytes.data(),
+                               recorded.journal_bytes.size(), &replay));
+        assert(replay.is_diverging);
+        assert(!journal_replay(&other.program, recorded.journal_bytes.data(), 3, &replay));
+    }
+
+    {
+        Scenario _("commands are handled, and journaled once, as they were issued");
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        Journal journal;
+        std::vector<uint8_t> journal_bytes;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+            program.schedule = &schedule_work_only;
+            timer.expires_on = true;
+            journal_init(&journal, { &journal_bytes, journal_test_write });
+            program.journal = &journal;
+        }
+
+        // a stop issued before the end of the session, handled after it
+        timer.now_micros = program.input.time_micros = 1'000;
+        input(&program, Command_timer_start);
+        uu_focus_main(&program);
+        auto const end_micros = program.deadline_micros;
+        program.input.time_micros = end_micros - 1'000;
+        input(&program, Command_timer_stop);
+        timer.now_micros = program.input.time_micros = end_micros + 1'000;
+        uu_focus_main(&program);
+        assert(program.timer_elapsed_n == 0);
+        assert(0 == count_range(timer.actions, "timer celebrate"));
+        assert(1 == count_range(timer.actions, "timer stop"));
+
+        // the stop overflowing the queue takes the place of a command that
+        // was never journaled: the call, the commands of the queue, and
+        // whether the timer is active
+        for (int i = 0; i < COMMAND_QUEUE_CAPACITY + 3; ++i) {
+            input(&program, Command_timer_prewarm);
+        }
+        input(&program, Command_application_stop);
+        auto const record_n = journal.record_n;
+        assert(uu_focus_main(&program) == CoroutineState_Done);
+        assert(journal.record_n == record_n + 1 + COMMAND_QUEUE_CAPACITY + 1);
+    }
+
+    {
+        Scenario _("sessions go through the phases of their schedule, in cycles");
+        static constexpr Schedule schedule = {
+            3,
+            {
+                { SchedulePhaseKind_Work, 20*60'000'000ull, { AudioMode_Noise, 1.0f } },
+                { SchedulePhaseKind_ShortBreak, 4*60'000'000ull, { AudioMode_Noise, 0.5f } },
+                { SchedulePhaseKind_LongBreak, 10*60'000'000ull, { AudioMode_Noise, 0.0f } },
+            },
+        };
+        TimerEffect timer;
+        AudioEffect audio;
+        UUFocusMainCoroutine program;
+        {
+            program = {};
+            program.timer_effect = &timer;
+            program.audio_effect = &audio;
+            program.schedule = &schedule;
+            timer.expires_on = true;
+        }
+        auto const call_at = [&](uint64_t micros) {
+            timer.now_micros = micros;
+            program.input.time_micros = micros;
+            uu_focus_main(&program);
+        };
+
+        uint64_t now = 1'000'000;
+        for (uint32_t phase_n = 0; phase_n < 2*schedule.phase_n; ++phase_n) {
+            auto const& phase = schedule.phases[phase_n % schedule.phase_n];
+            assert(program.phase_i == phase_n % schedule.phase_n);
+            program.input.time_micros = now;
+            input(&program, Command_timer_start);
+            call_at(now);
+            assert(program.deadline_micros == now + phase.duration_micros);
+            assert(audio.preset.amp == phase.audio.amp);
+            call_at(now = program.deadline_micros);
+            // the next phase is ready to start
+            assert(timer.duration_micros == schedule.phases[program.phase_i].duration_micros);
+            now += 30'000'000;
+        }
+        assert(program.timer_elapsed_n == 2*schedule.phase_n);
+
+        // a phase stopped midway starts over
+        program.input.time_micros = now;
+        input(&program, Command_timer_start);
+        call_at(now);
+        program.input.time_micros = now += 60'000'000;
+        input(&program, Command_timer_stop);
+        call_at(now);
+        assert(program.phase_i == 0);
+        program.input.time_micros = now += 60'000'000;
+        input(&program, Command_timer_start);
+        call_at(now);
+        assert(program.deadline_micros == now + schedule.phases[0].duration_micros);
+
+        // without one, the classic schedule
+        UUFocusMainCoroutine classic = {};
+        classic.timer_effect = &timer;
+        classic.audio_effect = &audio;
+        uu_focus_main(&classic);
+        assert(classic.schedule == &schedule_classic);
+        assert(timer.duration_micros == schedule_classic.phases[0].duration_micros);
+    }
+
+    {
+        Scenario _("schedules load into the layout of the compiled ones");
+        char const text[] =
+            "# kind      minutes mode  volume\n"
+            "work        25      noise 1.0\n"
+            "short_break 5       noise 0.4\n"
+            "\n"
+            "  work 25 noise 1\r\n"
+            "short_break 5 noise 0.4\n"
+            "work 25 noise 1.0\n"
+            "short_break 5 noise .4\n"
+            "work 25 noise 1.0\n"
+            "long_break\t15 noise 0";
+        Schedule schedule = {};
+        assert(schedule_parse(&schedule, text, sizeof text - 1));
+        assert(schedule.phase_n == schedule_classic.phase_n);
+        for (uint32_t phase_i = 0; phase_i < schedule.phase_n; ++phase_i) {
+            auto const& x = schedule.phases[phase_i];
+            auto const& y = schedule_classic.phases[phase_i];
+            assert(x.kind == y.kind);
+            assert(x.duration_micros == y.duration_micros);
+            assert(x.audio.mode == y.audio.mode && x.audio.amp == y.audio.amp);
+        }
+
+        char const* const invalid_texts[] = {
+            "",
+            "# only comments\n",
+            "lunch_break 60 noise 1.0\n",
+            "work 25 noise\n",
+            "work 25 noise 1.0 loud\n",
+            "work 0 noise 1.0\n",
+            "work 25 noise 1.5\n",
+            "work 25min noise 1.0\n",
+            "work 25 silence 1.0\n",
+        };
+        for (auto const invalid_text : invalid_texts) {
+            assert(!schedule_parse(&schedule, invalid_text, strlen(invalid_text)));
+        }
+        std::string too_long;
+        for (int phase_i = 0; phase_i <= SCHEDULE_PHASE_CAPACITY; ++phase_i) {
+            too_long += "work 1 noise 1.0\n";
+        }
+        assert(!schedule_parse(&schedule, too_long.data(), too_long.size()));
+        // left alone
+        assert(schedule.phase_n == schedule_classic.phase_n);
+    }
+
+    {
+        Scenario _("a snapshot resumes the countdown in the next process");
+        UUFocusSnapshot snapshot = {};
+        UUFocusMainCoroutine program = {};
+        program.step = 20;
+        program.step_micros = 1'000;
+        program.timer_elapsed_n = 3;
+        program.phase_i = 5;
+        TimerEffect timer = {};
+        timer.on_count = 1;
+        timer.start_micros = 1'000;
+        timer.end_micros = 1'000 + 25*60'000'000ull;
+        timer.start_time.hours = 9;
+        timer.start_time.minutes = 30;
+        uint64_t const wall_micros = 1'700'000'000'000'000ull;
+
+        // written on transitions only
+        assert(snapshot_update(&snapshot, &program, &timer, 2'000, wall_micros));
+        assert(!snapshot_update(&snapshot, &program, &timer, 500'000, wall_micros + 498'000));
+        timer.end_micros = 600'000 + 25*60'000'000ull; // restarted
+        assert(snapshot_update(&snapshot, &program, &timer, 600'000, wall_micros + 598'000));
+        auto const remaining_micros = timer.end_micros - 600'000;
+
+        // a minute later, in a process whose clock started from zero
+        UUFocusMainCoroutine restored_program = {};
+        TimerEffect restored_timer = {};
+        uint64_t const now_micros = 40'000;
+        assert(snapshot_restore(&snapshot, &restored_program, &restored_timer, now_micros,
+                                wall_micros + 598'000 + 60'000'000));
+        assert(restored_program.step == 20);
+        assert(restored_program.timer_elapsed_n == 3);
+        assert(restored_program.phase_i == 5);
+        assert(restored_timer.on_count == 1);
+        assert(restored_timer.start_time.hours == 9 && restored_timer.start_time.minutes == 30);
+        assert(restored_timer.end_micros - now_micros == remaining_micros - 60'000'000);
+        assert(restored_timer.now_micros == now_micros);
+
+        // torn, other versions, or cleared: we start afresh
+        auto torn = snapshot;
+        torn.timer_end_micros ^= 1;
+        UUFocusMainCoroutine untouched_program = {};
+        TimerEffect untouched_timer = {};
+        assert(!snapshot_restore(&torn, &untouched_program, &untouched_timer, now_micros, wall_micros));
+        auto other = snapshot;
+        other.version = UU_FOCUS_SNAPSHOT_VERSION + 1;
+        assert(!snapshot_restore(&other, &untouched_program, &untouched_timer, now_micros, wall_micros));
+        // steps the program does not resume at, in a snapshot that is whole
+        int const bad_steps[] = { -1, 15, 200, 1 << 20 };
+        for (auto const step : bad_steps) {
+            auto bad = snapshot;
+            auto bad_program = program;
+            bad_program.step = step;
+            assert(snapshot_update(&bad, &bad_program, &timer, 700'000, wall_micros + 698'000));
+            assert(!snapshot_restore(&bad, &untouched_program, &untouched_timer, now_micros, wall_micros));
+        }
+        snapshot_clear(&snapshot);
+        assert(!snapshot_restore(&snapshot, &untouched_program, &untouched_timer, now_micros, wall_micros));
+        assert(untouched_program.step == 0 && untouched_timer.end_micros == 0);
+    }
+
+    {
+        Scenario _("many sessions advance together, each through its schedule");
+        static constexpr Schedule schedule = {
+            2,
+            {
+                { SchedulePhaseKind_Work, 10*60'000'000ull, { AudioMode_Noise, 1.0f } },
+                { SchedulePhaseKind_ShortBreak, 2*60'000'000ull, { AudioMode_Noise, 0.5f } },
+            },
+        };
+        enum { SESSION_N = 37 }; // not a whole number of vectors
+        Sessions sessions;
+        sessions_init(&sessions, SESSION_N, &schedule);
+        for (uint32_t session_i = 0; session_i < SESSION_N; ++session_i) {
+            assert(sessions_add(&sessions) == session_i);
+        }
+        assert(sessions_add(&sessions) == UINT32_MAX);
+        assert(sessions_advance(&sessions, 0) == 0);
+        assert(sessions.expired_n == 0);
+
+        // started a second apart
+        for (uint32_t session_i = 0; session_i < SESSION_N; ++session_i) {
+            sessions_command(&sessions, session_i, { Command_timer_start, session_i*1'000'000ull });
+        }
+        auto const first_deadline_micros = schedule.phases[0].duration_micros;
+        assert(sessions_advance(&sessions, first_deadline_micros - 1) == first_deadline_micros);
+        assert(sessions.expired_n == 0);
+        auto now = first_deadline_micros + 10'000'000;
+        assert(sessions_advance(&sessions, now) == now + 1'000'000);
+        assert(sessions.expired_n == 11);
+        for (uint32_t expired_i = 0; expired_i < sessions.expired_n; ++expired_i) {
+            auto const session_i = sessions.expired[expired_i];
+            assert(session_i == expired_i);
+            assert(sessions.step[session_i] == SessionStep_Waiting);
+            assert(sessions.on_count[session_i] == 0);
+            assert(sessions.phase_i[session_i] == 1);
+            assert(sessions.elapsed_n[session_i] == 1);
+        }
+        assert(sessions.step[11] == SessionStep_Counting && sessions.on_count[11] == 1);
+
+        // stopping drops the deadline, restarting moves it
+        sessions_command(&sessions, 11, { Command_timer_stop, now });
+        sessions_command(&sessions, 12, { Command_timer_start, now });
+        sessions_command(&sessions, 0, { Command_timer_start, now });
+        assert(sessions.stop_n[11] == 1);
+        assert(sessions_advance(&sessions, now) == now + 3'000'000 /* of 13 */);
+        assert(sessions.expired_n == 0);
+        // 0 is on a break, 12 back at work
+        assert(sessions_advance(&sessions, now + schedule.phases[1].duration_micros) ==
+               now + schedule.phases[0].duration_micros);
+        assert(sessions.expired_n == 1 + SESSION_N - 13);
+        assert(sessions.expired[0] == 0 && sessions.expired[1] == 13);
+        assert(sessions.phase_i[0] == 0 && sessions.elapsed_n[0] == 2);
+        sessions_destroy(&sessions);
+
+        // the vector scan, against one session at a time
+        Sessions scalar;
+        sessions_init(&sessions, SESSION_N, &schedule);
+        sessions_init(&scalar, SESSION_N, &schedule);
+        scalar.scalar_on = true;
+        for (uint32_t session_i = 0; session_i < SESSION_N; ++session_i) {
+            sessions_add(&sessions);
+            sessions_add(&scalar);
+        }
+        uint32_t random_state = 7;
+        auto const random = [&]() {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 17;
+            random_state ^= random_state << 5;
+            return random_state;
+        };
+        now = 0;
+        uint64_t expired_n = 0;
+        for (int round_i = 0; round_i < 2000; ++round_i) {
+            for (auto command_n = random() % 4; command_n--;) {
+                auto const session_i = random() % SESSION_N;
+                Command const types[] = { Command_timer_start, Command_timer_start, Command_timer_stop };
+                CommandMsg const command = { types[random() % 3], now };
+                sessions_command(&sessions, session_i, command);
+                sessions_command(&scalar, session_i, command);
+            }
+            now += random() % 60'000'000;
+            assert(sessions_advance(&sessions, now) == sessions_advance(&scalar, now));
+            assert(sessions.expired_n == scalar.expired_n);
+            assert(0 == std::memcmp(sessions.expired, scalar.expired,
+                                    sessions.expired_n * sizeof *sessions.expired));
+            expired_n += sessions.expired_n;
+        }
+        assert(0 == std::memcmp(sessions.deadline_micros, scalar.deadline_micros,
+                                SESSION_N * sizeof *sessions.deadline_micros));
+        assert(0 == std::memcmp(sessions.phase_i, scalar.phase_i, SESSION_N * sizeof *sessions.phase_i));
+        assert(0 == std::memcmp(sessions.elapsed_n, scalar.elapsed_n,
+                                SESSION_N * sizeof *sessions.elapsed_n));
+        assert(expired_n > 100);
+        sessions_destroy(&sessions);
+        sessions_destroy(&scalar);
+    }
+
+    {
+        Scenario _("the timing wheel expires its timers at their deadline, near or far");
+        enum { TIMER_N = 64 };
+        uint64_t const tick_micros = 1'000;
+        uint64_t now = 5'000'000'123;
+        TimingWheel wheel;
+        timing_wheel_init(&wheel, TIMER_N, tick_micros, now);
+        assert(timing_wheel_next_micros(&wheel) == 0);
+
+        // what the wheel should hold
+        uint64_t deadlines[TIMER_N];
+        bool is_armed[TIMER_N] = {};
+        uint32_t random_state = 3;
+        auto const random = [&]() {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 17;
+            random_state ^= random_state << 5;
+            return random_state;
+        };
+        // from a microsecond to years, past or not
+        auto const random_span = [&]() { return uint64_t(random()) >> (random() % 32) << (random() % 24); };
+        uint64_t expired_n = 0;
+        for (int round_i = 0; round_i < 20'000; ++round_i) {
+            auto const timer_i = random() % TIMER_N;
+            auto const x = random() % 8;
+            if (x < 4) {
+                // armed, or re-armed, sometimes in the past
+                deadlines[timer_i] = x == 0 && now > 10'000 ? now - random() % 10'000 : now + random_span();
+                timing_wheel_arm(&wheel, timer_i, deadlines[timer_i]);
+                is_armed[timer_i] = true;
+            } else if (x < 5) {
+                timing_wheel_cancel(&wheel, timer_i);
+                is_armed[timer_i] = false;
+            }
+
+            auto next_micros = UINT64_MAX;
+            uint32_t armed_n = 0;
+            for (int i = 0; i < TIMER_N; ++i) {
+                if (is_armed[i] && deadlines[i] < next_micros) next_micros = deadlines[i];
+                armed_n += is_armed[i];
+                assert(timing_wheel_is_armed(&wheel, i) == is_armed[i]);
+            }
+            assert(wheel.armed_n == armed_n);
+            auto const wake_micros = timing_wheel_next_micros(&wheel);
+            assert(armed_n ? wake_micros && wake_micros <= next_micros : wake_micros == 0);
+
+            // to their next wake up, or some time later
+            if (random() % 2 && wake_micros > now) {
+                now = wake_micros;
+            } else {
+                now += random_span() >> (random() % 16);
+            }
+            timing_wheel_advance(&wheel, now);
+            bool is_expired[TIMER_N] = {};
+            for (uint32_t expired_i = 0; expired_i < wheel.expired_n; ++expired_i) {
+                auto const i = wheel.expired[expired_i];
+                assert(is_armed[i] && !is_expired[i]);
+                is_expired[i] = true;
+            }
+            for (int i = 0; i < TIMER_N; ++i) {
+                assert(is_expired[i] == (is_armed[i] && deadlines[i] <= now));
+                if (is_expired[i]) is_armed[i] = false;
+            }
+            expired_n += wheel.expired_n;
+        }
+        assert(expired_n > 5'000);
+        timing_wheel_destroy(&wheel);
+    }
+
+    {
+        Scenario _("sessions on a timing wheel expire as when scanned");
+        static constexpr Schedule schedule = {
+            2,
+            {
+                { SchedulePhaseKind_Work, 10*60'000'000ull, { AudioMode_Noise, 1.0f } },
+                { SchedulePhaseKind_ShortBreak, 2*60'000'000ull, { AudioMode_Noise, 0.5f } },
+            },
+        };
+        enum { SESSION_N = 100 };
+        uint64_t now = 1'000'000;
+        Sessions scanned, wheeled;
+        TimingWheel wheel;
+        sessions_init(&scanned, SESSION_N, &schedule);
+        sessions_init(&wheeled, SESSION_N, &schedule);
+        timing_wheel_init(&wheel, SESSION_N, 1'000, now);
+        wheeled.wheel = &wheel;
+        for (uint32_t session_i = 0; session_i < SESSION_N; ++session_i) {
+            sessions_add(&scanned);
+            sessions_add(&wheeled);
+        }
+        uint32_t random_state = 5;
+        auto const random = [&]() {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 17;
+            random_state ^= random_state << 5;
+            return random_state;
+        };
+        uint64_t expired_n = 0;
+        for (int round_i = 0; round_i < 2000; ++round_i) {
+            for (auto command_n = random() % 8; command_n--;) {
+                auto const session_i = random() % SESSION_N;
+                Command const types[] = { Command_timer_start, Command_timer_start, Command_timer_stop };
+                CommandMsg const command = { types[random() % 3], now + random() % 1'000'000 };
+                sessions_command(&scanned, session_i, command);
+                sessions_command(&wheeled, session_i, command);
+            }
+            auto const next_micros = sessions_advance(&scanned, now);
+            auto const wake_micros = sessions_advance(&wheeled, now);
+            assert(wake_micros <= next_micros);
+            assert((wake_micros == 0) == (next_micros == 0));
+            std::sort(wheeled.expired, wheeled.expired + wheeled.expired_n);
+            assert(wheeled.expired_n == scanned.expired_n);
+            assert(0 == std::memcmp(wheeled.expired, scanned.expired,
+                                    scanned.expired_n * sizeof *scanned.expired));
+            expired_n += scanned.expired_n;
+            now = random() % 2 && wake_micros ? wake_micros : now + random() % 30'000'000;
+        }
+        assert(0 == std::memcmp(wheeled.phase_i, scanned.phase_i, SESSION_N * sizeof *scanned.phase_i));
+        assert(expired_n > 1'000);
+        sessions_destroy(&scanned);
+        sessions_destroy(&wheeled);
+        timing_wheel_destroy(&wheel);
     }
 }
 
 #include "uu_focus_main.cpp"
+#include "uu_focus_journal.cpp"
+#include "uu_focus_schedule.cpp"
+#include "uu_focus_sessions.cpp"
+#include "uu_focus_snapshot.cpp"
+#include "uu_focus_timing_wheel.cpp"
 
 #include <cstdio>
 
@@ -236,6 +938,7 @@ static char const* CommandName(Command x)
         E(Command_application_stop);
         E(Command_timer_start);
         E(Command_timer_stop);
+        E(Command_timer_prewarm);
     }
 #undef E
     return "Command_<unknown>";
@@ -257,14 +960,47 @@ void audio_start(AudioEffect* y)
     effect_log(&y->actions, "audio start");
 }
 
+void audio_preset(AudioEffect* y, AudioPreset preset)
+{
+    y->preset = preset;
+    effect_log(&y->actions, "audio preset");
+}
+
 void audio_stop(AudioEffect* y)
 {
     effect_log(&y->actions, "audio stop");
 }
 
-void timer_start(TimerEffect* y)
+void audio_prewarm(AudioEffect* y)
+{
+    effect_log(&y->actions, "audio prewarm");
+}
+
+void audio_chime_at(AudioEffect* y, uint64_t)
+{
+    effect_log(&y->actions, "audio chime at");
+}
+
+void audio_chime_cancel(AudioEffect* y)
+{
+    effect_log(&y->actions, "audio chime cancel");
+}
+
+void audio_ticks_until(AudioEffect* y, uint64_t)
+{
+    effect_log(&y->actions, "audio ticks until");
+}
+
+void audio_ticks_cancel(AudioEffect* y)
+{
+    effect_log(&y->actions, "audio ticks cancel");
+}
+
+void timer_start(TimerEffect* y, uint64_t duration_micros)
 {
     ++y->on_count;
+    y->duration_micros = duration_micros;
+    y->end_micros = y->now_micros + duration_micros;
     effect_log(&y->actions, "timer start");
 }
 
@@ -279,9 +1015,14 @@ bool timer_is_active(TimerEffect* y)
     return y->on_count;
 }
 
-bool timer_expired(TimerEffect* y)
+uint64_t timer_end_micros(TimerEffect* y)
+{
+    return y->end_micros;
+}
+
+bool timer_expired(TimerEffect* y, uint64_t micros)
 {
-  return !y->on_count;
+  return !y->on_count || (y->expires_on && micros >= y->end_micros);
 }
 
 void timer_celebrate(TimerEffect* y)
@@ -294,8 +1035,10 @@ void timer_update_and_render(TimerEffect* y)
     effect_log(&y->actions, "timer update_and_render");
 }
 
-void timer_reset(TimerEffect* y)
+void timer_reset(TimerEffect* y, uint64_t duration_micros)
 {
+    y->duration_micros = duration_micros;
+    y->end_micros = y->now_micros + duration_micros;
     effect_log(&y->actions, "timer reset");
 }
 
@@ -0,0 +1,531 @@
+// @language: c++14
+#include "uu_focus_audio_backend.hpp"
+
+#include "uu_focus_audio_resampler.hpp"
+#include "uu_focus_audio_ring.hpp"
+#include "uu_focus_effects.hpp"
+
+#include <cmath>
+
+AudioStreamError audio_stream_open(AudioStream* _stream, AudioBackend const* backend,
+                                   int audio_hz, int channel_count)
+{
+    auto& stream = *_stream;
+    stream.header = {};
+    stream.backend = backend;
+    stream.fade_in_frame_count = 0;
+    stream.fade_in_frame_i = 0;
+    return backend->open(&stream, audio_hz, channel_count);
+}
+
+void audio_stream_close(AudioStream* _stream)
+{
+    auto& stream = *_stream;
+    if (stream.header.error != AudioStreamError_Success) return;
+    stream.backend->close(&stream);
+}
+
+AudioBuffer audio_stream_buffer_block_acquire(AudioStream* _stream, uint32_t max_frame_count)
+{
+    auto& stream = *_stream;
+    if (stream.header.error != AudioStreamError_Success) return {};
+    return stream.backend->buffer_block_acquire(&stream, max_frame_count);
+}
+
+void audio_stream_buffer_release(AudioStream* _stream, AudioBuffer buffer)
+{
+    auto& stream = *_stream;
+    if (stream.header.error != AudioStreamError_Success) return;
+    stream.backend->buffer_release(&stream, buffer);
+}
+
+// # Latency
+
+enum {
+    AUDIO_LATENCY_MARGIN_MICROS = 1'000,
+    AUDIO_LATENCY_WINDOW_MICROS = 10'000'000,
+    AUDIO_LATENCY_DECAY_MICROS = 2'000'000, // time constant of the decay
+};
+
+void audio_latency_init(AudioLatencyController* _latency, int audio_hz,
+                        uint32_t min_frames, uint32_t max_frames)
+{
+    auto& latency = *_latency;
+    latency.audio_hz = audio_hz;
+    latency.min_frames = min_frames;
+    latency.max_frames = max_frames;
+    latency.wakeup_n = 0;
+    latency.starved_n = 0;
+    latency.last_wakeup_micros = 0;
+    latency.period_micros = 0.0;
+    // NOTE(nicolas): as if we had seen the worst, until a window of
+    // measures proves otherwise
+    latency.jitter_peak_micros = 1e6*max_frames/audio_hz;
+    latency.render_peak_micros = 0.0;
+    latency.window_start_micros = 0;
+    latency.jitter_window_micros[0] = 0.0;
+    latency.jitter_window_micros[1] = latency.jitter_peak_micros;
+    latency.render_window_micros[0] = 0.0;
+    latency.render_window_micros[1] = 0.0;
+    latency.target_frames.store(max_frames, std::memory_order_relaxed);
+}
+
+uint32_t audio_latency_wakeup(AudioLatencyController* _latency, uint64_t wakeup_micros,
+                              uint32_t padding_frames)
+{
+    auto& latency = *_latency;
+    auto& jitter_window = latency.jitter_window_micros;
+    auto& render_window = latency.render_window_micros;
+    if (latency.wakeup_n == 0) {
+        latency.window_start_micros = wakeup_micros;
+    } else {
+        if (wakeup_micros - latency.window_start_micros > AUDIO_LATENCY_WINDOW_MICROS) {
+            jitter_window[1] = jitter_window[0];
+            jitter_window[0] = 0.0;
+            render_window[1] = render_window[0];
+            render_window[0] = 0.0;
+            latency.window_start_micros = wakeup_micros;
+        }
+        auto const interval_micros = double(wakeup_micros - latency.last_wakeup_micros);
+        if (latency.wakeup_n == 1) {
+            latency.period_micros = interval_micros;
+        } else {
+            latency.period_micros += (interval_micros - latency.period_micros) / 64.0;
+        }
+        auto jitter_micros = interval_micros - latency.period_micros;
+        if (padding_frames == 0) {
+            // we were later than we thought we could be
+            ++latency.starved_n;
+            jitter_micros = latency.jitter_peak_micros + latency.period_micros;
+        }
+        if (jitter_micros > jitter_window[0]) jitter_window[0] = jitter_micros;
+
+        auto const decay = std::exp(-interval_micros / AUDIO_LATENCY_DECAY_MICROS);
+        auto const jitter_floor = jitter_window[0] > jitter_window[1] ?
+            jitter_window[0] : jitter_window[1];
+        auto const render_floor = render_window[0] > render_window[1] ?
+            render_window[0] : render_window[1];
+        latency.jitter_peak_micros *= decay;
+        if (latency.jitter_peak_micros < jitter_floor) latency.jitter_peak_micros = jitter_floor;
+        latency.render_peak_micros *= decay;
+        if (latency.render_peak_micros < render_floor) latency.render_peak_micros = render_floor;
+    }
+    latency.last_wakeup_micros = wakeup_micros;
+    ++latency.wakeup_n;
+
+    auto const target_micros = latency.period_micros + latency.jitter_peak_micros +
+        latency.render_peak_micros + AUDIO_LATENCY_MARGIN_MICROS;
+    auto target_frames = uint32_t(std::ceil(target_micros * latency.audio_hz / 1e6));
+    if (target_frames < latency.min_frames) target_frames = latency.min_frames;
+    if (target_frames > latency.max_frames) target_frames = latency.max_frames;
+    latency.target_frames.store(target_frames, std::memory_order_relaxed);
+    return target_frames > padding_frames ? target_frames - padding_frames : 0;
+}
+
+void audio_latency_rendered(AudioLatencyController* _latency, uint64_t rendered_micros)
+{
+    auto& latency = *_latency;
+    auto const render_micros = double(rendered_micros - latency.last_wakeup_micros);
+    auto& render_window = latency.render_window_micros;
+    if (render_micros > render_window[0]) render_window[0] = render_micros;
+    if (render_micros > latency.render_peak_micros) latency.render_peak_micros = render_micros;
+}
+
+uint32_t audio_latency_frames(AudioLatencyController const* latency)
+{
+    return latency->target_frames.load(std::memory_order_relaxed);
+}
+
+void audio_latency_restart(AudioLatencyController* _latency)
+{
+    auto& latency = *_latency;
+    // NOTE(nicolas): the next wakeup is the first of the windows
+    latency.wakeup_n = 0;
+}
+
+// # Rendering
+
+AudioResampler* audio_stream_resampler_update(AudioStream const* _stream,
+                                              AudioResampler* resampler,
+                                              int render_hz)
+{
+    auto& stream = *_stream;
+    auto const& header = stream.header;
+    bool const is_needed = header.error == AudioStreamError_Success &&
+        header.audio_hz != render_hz;
+    if (resampler && is_needed &&
+        audio_resampler_channel_count(resampler) == header.channel_count &&
+        audio_resampler_input_hz(resampler) == render_hz &&
+        audio_resampler_output_hz(resampler) == header.audio_hz) {
+        audio_resampler_reset(resampler);
+        return resampler;
+    }
+    if (resampler) audio_resampler_destroy(resampler);
+    if (!is_needed) return nullptr;
+    return audio_resampler_make(header.channel_count, render_hz, header.audio_hz);
+}
+
+enum { AUDIO_STREAM_RESAMPLE_INPUT_FRAMES = 1024 };
+
+// `fill` at the input rate of `resampler`, in blocks
+template <typename Fill>
+static void audio_stream_resample(AudioResampler* resampler,
+                                  float* frames, int channel_count, uint32_t frame_count,
+                                  Fill fill)
+{
+    float input[AUDIO_CHANNEL_MAX*AUDIO_STREAM_RESAMPLE_INPUT_FRAMES];
+    while (frame_count) {
+        auto block_frame_count = frame_count;
+        auto input_count = audio_resampler_input_count(resampler, block_frame_count);
+        while (input_count > AUDIO_STREAM_RESAMPLE_INPUT_FRAMES) {
+            block_frame_count /= 2;
+            input_count = audio_resampler_input_count(resampler, block_frame_count);
+        }
+        fill(input, channel_count, input_count);
+        audio_resampler_process(resampler, input, frames, block_frame_count);
+        frames += size_t(channel_count)*block_frame_count;
+        frame_count -= block_frame_count;
+    }
+}
+
+static void audio_stream_fade_in(AudioStream* _stream, float* frames, int channel_count,
+                                 uint32_t frame_count)
+{
+    auto& stream = *_stream;
+    auto const fade_frame_count = stream.fade_in_frame_count;
+    auto frame_i = stream.fade_in_frame_i;
+    for (uint32_t i = 0; i < frame_count && frame_i < fade_frame_count; ++i, ++frame_i) {
+        auto const gain = float(frame_i) / float(fade_frame_count);
+        for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+            frames[i*channel_count + channel_i] *= gain;
+        }
+    }
+    stream.fade_in_frame_i = frame_i;
+}
+
+// Fills a buffer of the device with `fill(float* frames, channel_count,
+// frame_count)`, after telling `heard(micros, queued_frames)` how many
+// frames at our rate are not heard yet.
+template <typename Fill, typename Heard>
+static uint32_t audio_stream_fill(AudioStream* _stream,
+                                  AudioLatencyController* latency,
+                                  AudioResampler* resampler,
+                                  AudioDitherState* dither,
+                                  float* render_samples, uint32_t render_sample_max,
+                                  uint32_t max_frame_count,
+                                  Fill _fill, Heard heard)
+{
+    auto& stream = *_stream;
+    auto fill = [resampler, &_fill](float* frames, int channel_count, uint32_t frame_count) {
+        if (resampler) {
+            audio_stream_resample(resampler, frames, channel_count, frame_count, _fill);
+        } else {
+            _fill(frames, channel_count, frame_count);
+        }
+    };
+    auto const channel_count = stream.header.channel_count;
+    auto const convert = audio_convert_select(stream.header.sample_format,
+                                              AudioDither_TpdfShaped);
+    // our scratch buffer bounds the frames we ask for
+    if (convert && channel_count > 0 &&
+        uint64_t(channel_count)*max_frame_count > render_sample_max) {
+        max_frame_count = render_sample_max / uint32_t(channel_count);
+    }
+    auto buffer = audio_stream_buffer_block_acquire(&stream, max_frame_count);
+    bool const is_playing = stream.header.error == AudioStreamError_Success;
+    if (is_playing) {
+        auto const wakeup_micros = now_micros();
+        double queued_frames = buffer.padding_frames;
+        if (resampler) {
+            auto const input_hz = audio_resampler_input_hz(resampler);
+            queued_frames = queued_frames*input_hz/audio_resampler_output_hz(resampler) +
+                audio_resampler_delay_micros(resampler)*input_hz/1e6;
+        }
+        heard(wakeup_micros, uint32_t(queued_frames + 0.5));
+        if (latency) {
+            auto const frame_count = audio_latency_wakeup(latency, wakeup_micros,
+                                                          buffer.padding_frames);
+            if (buffer.frame_count > frame_count) buffer.frame_count = frame_count;
+        }
+    }
+    auto const frames = convert ? render_samples : reinterpret_cast<float*>(buffer.bytes_first);
+    fill(frames, channel_count, buffer.frame_count);
+    if (stream.fade_in_frame_i < stream.fade_in_frame_count) {
+        audio_stream_fade_in(&stream, frames, channel_count, buffer.frame_count);
+    }
+    if (convert) {
+        if (dither && dither->channel_count != channel_count) {
+            // a device with another layout, whose channels the shaped
+            // dither follows
+            audio_dither_init(dither, dither->rng[0], channel_count);
+        }
+        convert(dither, render_samples, channel_count * int(buffer.frame_count),
+                buffer.bytes_first);
+    }
+    audio_stream_buffer_release(&stream, buffer);
+    if (is_playing && latency) audio_latency_rendered(latency, now_micros());
+    return buffer.frame_count;
+}
+
+uint32_t audio_stream_render(AudioStream* stream, AudioEffect* audio,
+                             AudioLatencyController* latency,
+                             AudioResampler* resampler,
+                             AudioDitherState* dither,
+                             float* render_samples, uint32_t render_sample_max,
+                             uint32_t max_frame_count)
+{
+    return audio_stream_fill(
+        stream, latency, resampler, dither, render_samples, render_sample_max, max_frame_count,
+        [audio](float* frames, int channel_count, uint32_t frame_count) {
+            audio_thread_render(audio, frames, channel_count, int(frame_count));
+        },
+        [audio](uint64_t micros, uint32_t queued_frames) {
+            audio_thread_heard(audio, audio_thread_frame_position(audio) - queued_frames, micros);
+        });
+}
+
+uint32_t audio_stream_copy(AudioStream* stream, AudioRenderAhead* ahead,
+                           AudioLatencyController* latency,
+                           AudioResampler* resampler,
+                           AudioDitherState* dither,
+                           float* render_samples, uint32_t render_sample_max,
+                           uint32_t max_frame_count)
+{
+    return audio_stream_fill(
+        stream, latency, resampler, dither, render_samples, render_sample_max, max_frame_count,
+        [ahead](float* frames, int, uint32_t frame_count) {
+            audio_render_ahead_read(ahead, frames, frame_count);
+        },
+        [ahead](uint64_t micros, uint32_t queued_frames) {
+            audio_render_ahead_heard(ahead, micros, queued_frames);
+        });
+}
+
+// # Migration
+
+void audio_stream_migration_init(AudioStreamMigration* _migration, AudioBackend const* backend,
+                                 int render_hz, int channel_count)
+{
+    auto& migration = *_migration;
+    migration = {};
+    migration.backend = backend;
+    migration.render_hz = render_hz;
+    migration.channel_count = channel_count;
+}
+
+void audio_stream_migration_begin(AudioStreamMigration* _migration, uint64_t now_micros)
+{
+    auto& migration = *_migration;
+    migration.is_migrating = true;
+    migration.lost_micros = now_micros;
+    migration.dropped_frame_n = 0;
+    migration.attempt_micros = now_micros; // right away
+    migration.retry_micros = AUDIO_STREAM_MIGRATION_RETRY_MIN_MICROS;
+    ++migration.migration_n;
+}
+
+uint32_t audio_stream_migration_drop(AudioStreamMigration* _migration, uint64_t now_micros,
+                                     uint32_t max_frame_count)
+{
+    auto& migration = *_migration;
+    if (!migration.is_migrating || now_micros < migration.lost_micros) return 0;
+    auto const due_frame_n =
+        (now_micros - migration.lost_micros)*uint64_t(migration.render_hz)/1'000'000;
+    auto frame_count = due_frame_n - migration.dropped_frame_n;
+    if (frame_count > max_frame_count) frame_count = max_frame_count;
+    migration.dropped_frame_n += frame_count;
+    return uint32_t(frame_count);
+}
+
+bool audio_stream_migration_reopen(AudioStream* _stream, AudioStreamMigration* _migration,
+                                   uint64_t now_micros)
+{
+    auto& stream = *_stream;
+    auto& migration = *_migration;
+    if (now_micros < migration.attempt_micros) return false;
+    ++migration.attempt_n;
+    if (audio_stream_open(&stream, migration.backend, migration.render_hz,
+                          migration.channel_count) != AudioStreamError_Success) {
+        migration.attempt_micros = now_micros + migration.retry_micros;
+        migration.retry_micros *= 2;
+        if (migration.retry_micros > AUDIO_STREAM_MIGRATION_RETRY_MAX_MICROS) {
+            migration.retry_micros = AUDIO_STREAM_MIGRATION_RETRY_MAX_MICROS;
+        }
+        return false;
+    }
+    stream.fade_in_frame_count =
+        uint32_t(uint64_t(stream.header.audio_hz)*AUDIO_STREAM_MIGRATION_FADE_IN_MICROS/1'000'000);
+    migration.is_migrating = false;
+    auto const recovery_micros = now_micros - migration.lost_micros;
+    migration.recovery_micros_last = recovery_micros;
+    if (recovery_micros > migration.recovery_micros_max) {
+        migration.recovery_micros_max = recovery_micros;
+    }
+    return true;
+}
+
+// # Simulated device
+
+static uint32_t audio_sim_random(AudioSimDevice* _device)
+{
+    auto& device = *_device;
+    auto x = device.rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    device.rng = x;
+    return x;
+}
+
+// when period `tick_i` of the playback ends
+static uint64_t audio_sim_tick_micros(AudioSimDevice const& device, uint64_t tick_i)
+{
+    auto const audio_hz = device.audio_hz * (1.0 + device.config.drift_ppm*1e-6);
+    return device.start_micros +
+        uint64_t(double(tick_i*device.config.period_frames)*1e6/audio_hz);
+}
+
+static void audio_sim_play_until(AudioSimDevice* _device, uint64_t until_micros)
+{
+    auto& device = *_device;
+    if (!device.is_playing) return;
+    auto const period_frames = device.config.period_frames;
+    while (audio_sim_tick_micros(device, device.tick_n + 1) <= until_micros) {
+        ++device.tick_n;
+        ++device.period_n;
+        auto const padding = device.written_frame_n - device.played_frame_n;
+        if (padding < period_frames) {
+            ++device.underrun_n;
+            device.underrun_frame_n += period_frames - padding;
+            // the silence we played takes the place of the missing frames
+            device.written_frame_n = device.played_frame_n + period_frames;
+        }
+        device.played_frame_n += period_frames;
+    }
+}
+
+static UU_FOCUS_AUDIO_BACKEND_OPEN_PROC(audio_sim_open)
+{
+    auto& device = *reinterpret_cast<AudioSimDevice*>(stream->backend->user);
+    // NOTE(nicolas): the simulated device only knows its own layout
+    (void)channel_count;
+    audio_sim_advance(&device, device.config.open_micros);
+    auto& header = stream->header;
+    header.sample_format = device.config.sample_format;
+    header.channel_count = device.config.channel_count;
+    header.audio_hz = device.config.audio_hz ? device.config.audio_hz : audio_hz;
+    if (device.is_disconnected) {
+        header.error = AudioStreamError_SystemError;
+        header.error_string = "no device";
+        return header.error;
+    }
+    device.audio_hz = header.audio_hz;
+    device.is_playing = false;
+    device.tick_n = 0;
+    device.wakeup_tick_n = 0;
+    device.played_frame_n = 0;
+    device.written_frame_n = 0;
+    header.error = AudioStreamError_Success;
+    return header.error;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_CLOSE_PROC(audio_sim_close)
+{
+    auto& device = *reinterpret_cast<AudioSimDevice*>(stream->backend->user);
+    device.is_playing = false;
+    stream->header.error = AudioStreamError_Closed;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_BLOCK_ACQUIRE_PROC(audio_sim_buffer_block_acquire)
+{
+    auto& device = *reinterpret_cast<AudioSimDevice*>(stream->backend->user);
+    if (device.is_disconnected) {
+        audio_sim_close(stream);
+        stream->header.error_string = "device disconnected";
+        return {};
+    }
+    if (device.is_playing) {
+        audio_sim_play_until(&device, device.now_micros);
+        if (device.tick_n == device.wakeup_tick_n) {
+            // nothing was played since our last wakeup, wait for it
+            auto wake_micros = audio_sim_tick_micros(device, device.tick_n + 1);
+            if (device.config.jitter_micros) {
+                wake_micros += audio_sim_random(&device) % (device.config.jitter_micros + 1);
+            }
+            if (device.config.stall_every_n_periods &&
+                audio_sim_random(&device) % device.config.stall_every_n_periods == 0) {
+                wake_micros += device.config.stall_micros;
+            }
+            device.now_micros = wake_micros;
+            audio_sim_play_until(&device, device.now_micros);
+        }
+        auto const late_micros =
+            device.now_micros - audio_sim_tick_micros(device, device.tick_n);
+        if (late_micros > device.late_micros_max) device.late_micros_max = late_micros;
+        device.wakeup_tick_n = device.tick_n;
+    }
+    ++device.wakeup_n;
+
+    AudioBuffer buffer;
+    buffer.bytes_first = device.bytes;
+    buffer.padding_frames = audio_sim_padding(&device);
+    buffer.frame_count = device.config.buffer_frames - buffer.padding_frames;
+    if (buffer.frame_count > max_frame_count) buffer.frame_count = max_frame_count;
+    return buffer;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_RELEASE_PROC(audio_sim_buffer_release)
+{
+    auto& device = *reinterpret_cast<AudioSimDevice*>(stream->backend->user);
+    audio_sim_advance(&device, device.config.render_micros);
+    if (buffer.frame_count == 0) return;
+    if (!device.is_playing) {
+        device.is_playing = true;
+        device.start_micros = device.now_micros;
+    }
+    device.written_frame_n += buffer.frame_count;
+}
+
+AudioSimDevice* audio_sim_make(AudioSimDeviceConfig config)
+{
+    auto _device = new AudioSimDevice();
+    auto& device = *_device;
+    device.config = config;
+    device.rng = config.seed | 1;
+    device.audio_hz = 48000;
+    device.bytes = new uint8_t[size_t(config.buffer_frames) * size_t(config.channel_count) *
+                               size_t(audio_sample_format_bytes(config.sample_format))];
+    return _device;
+}
+
+void audio_sim_destroy(AudioSimDevice* _device)
+{
+    auto& device = *_device;
+    delete[] device.bytes;
+    delete &device;
+}
+
+AudioBackend audio_sim_backend(AudioSimDevice* device)
+{
+    AudioBackend backend = {};
+    backend.name = "simulated device";
+    backend.user = device;
+    backend.open = audio_sim_open;
+    backend.close = audio_sim_close;
+    backend.buffer_block_acquire = audio_sim_buffer_block_acquire;
+    backend.buffer_release = audio_sim_buffer_release;
+    return backend;
+}
+
+void audio_sim_advance(AudioSimDevice* _device, uint64_t micros)
+{
+    auto& device = *_device;
+    device.now_micros += micros;
+    audio_sim_play_until(&device, device.now_micros);
+}
+
+uint32_t audio_sim_padding(AudioSimDevice const* _device)
+{
+    auto& device = *_device;
+    return uint32_t(device.written_frame_n - device.played_frame_n);
+}
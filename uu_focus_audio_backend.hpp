@@ -0,0 +1,306 @@
+#pragma once
+#define UU_FOCUS_AUDIO_BACKEND
+
+/*
+ * The output devices the audio thread renders to, behind one interface.
+ *
+ * A backend opens a stream, then the audio thread loops: it blocks until
+ * the device wants more frames, acquires a buffer, fills it and releases
+ * it. A stream that its device dropped reads as AudioStreamError_Closed
+ * and may be opened again.
+ *
+ * Backends:
+ * - WASAPI (win32_wasapi_sound.cpp, see win32_unit_uu_focus_main.cpp)
+ * - a file or pipe sink (linux_file_sound.cpp)
+ * - a simulated device paced by a virtual clock (AudioSimDevice, below)
+ */
+
+#include "uu_focus_audio_convert.hpp"
+
+#include <atomic>
+#include <stdint.h>
+
+enum AudioStreamError
+{
+    AudioStreamError_Success,
+    AudioStreamError_Closed,
+    AudioStreamError_SystemError,
+};
+
+struct AudioStreamHeader
+{
+    AudioStreamError error;
+    char const* error_string;
+    AudioSampleFormat sample_format; // as negotiated with the device
+    int channel_count; // interleaved samples per frame
+    int audio_hz;
+};
+
+struct AudioBuffer
+{
+    uint8_t* bytes_first;
+    uint32_t frame_count;
+    uint32_t padding_frames; // queued in the device, not played yet
+};
+
+struct AudioStream;
+
+// channel_count of 0 follows the speaker layout of the device
+#define UU_FOCUS_AUDIO_BACKEND_OPEN_PROC(name_expr) \
+  AudioStreamError name_expr(AudioStream* stream, int audio_hz, int channel_count)
+
+#define UU_FOCUS_AUDIO_BACKEND_CLOSE_PROC(name_expr) \
+  void name_expr(AudioStream* stream)
+
+// waits until the stream needs a refill then acquires a render buffer
+#define UU_FOCUS_AUDIO_BACKEND_BUFFER_BLOCK_ACQUIRE_PROC(name_expr) \
+  AudioBuffer name_expr(AudioStream* stream, uint32_t max_frame_count)
+
+#define UU_FOCUS_AUDIO_BACKEND_BUFFER_RELEASE_PROC(name_expr) \
+  void name_expr(AudioStream* stream, AudioBuffer buffer)
+
+typedef UU_FOCUS_AUDIO_BACKEND_OPEN_PROC(AudioBackendOpenProc);
+typedef UU_FOCUS_AUDIO_BACKEND_CLOSE_PROC(AudioBackendCloseProc);
+typedef UU_FOCUS_AUDIO_BACKEND_BUFFER_BLOCK_ACQUIRE_PROC(AudioBackendBufferBlockAcquireProc);
+typedef UU_FOCUS_AUDIO_BACKEND_BUFFER_RELEASE_PROC(AudioBackendBufferReleaseProc);
+
+struct AudioBackend
+{
+    char const* name;
+    void* user; // configuration of the backend, outlives its streams
+    AudioBackendOpenProc* open;
+    AudioBackendCloseProc* close;
+    AudioBackendBufferBlockAcquireProc* buffer_block_acquire;
+    AudioBackendBufferReleaseProc* buffer_release;
+};
+
+struct AudioStream
+{
+    AudioStreamHeader header;
+    AudioBackend const* backend;
+    // frames of the device to fade in from silence, as it resumes midway
+    // through the audio
+    uint32_t fade_in_frame_count;
+    uint32_t fade_in_frame_i;
+    char data[128]; // owned by the backend
+};
+
+AudioStreamError audio_stream_open(AudioStream*, AudioBackend const*,
+                                   int audio_hz, int channel_count);
+void audio_stream_close(AudioStream*);
+AudioBuffer audio_stream_buffer_block_acquire(AudioStream*, uint32_t max_frame_count);
+void audio_stream_buffer_release(AudioStream*, AudioBuffer);
+
+// # Latency
+//
+// Chooses how full the audio thread keeps the device buffer: the fuller,
+// the later what we render is heard, but the later we may wake up or the
+// longer we may take to render before the device runs dry.
+//
+// At every wakeup the controller measures the interval since the previous
+// one, and the time taken to render. The fill level covers a period plus
+// the peaks of the wakeup jitter and of the render time. Peaks are taken
+// at once, then decay down to the worst seen within the last window or so,
+// so that latency grows as soon as the machine gets loaded, and shrinks
+// back once it has been quiet for some time. Finding the device starved
+// also grows it.
+
+struct AudioLatencyController
+{
+    int audio_hz;
+    uint32_t min_frames;
+    uint32_t max_frames;
+
+    uint64_t wakeup_n;
+    uint64_t starved_n; // wakeups that found the device buffer empty
+    uint64_t last_wakeup_micros;
+    double period_micros; // mean interval between wakeups
+    double jitter_peak_micros; // of the interval, above the mean
+    double render_peak_micros;
+    // the worst seen in the current and the previous window
+    uint64_t window_start_micros;
+    double jitter_window_micros[2];
+    double render_window_micros[2];
+
+    std::atomic<uint32_t> target_frames; // may be read by any thread
+};
+
+// The fill level stays within [min_frames, max_frames] and starts out
+// cautious, until the controller had time to measure.
+void audio_latency_init(AudioLatencyController*, int audio_hz,
+                        uint32_t min_frames, uint32_t max_frames);
+
+// At a wakeup, with `padding_frames` still queued in the device: returns
+// how many frames to write.
+uint32_t audio_latency_wakeup(AudioLatencyController*, uint64_t wakeup_micros,
+                              uint32_t padding_frames);
+
+// Once the frames of the wakeup are written.
+void audio_latency_rendered(AudioLatencyController*, uint64_t rendered_micros);
+
+// The fill level the controller aims for, in frames of the device.
+uint32_t audio_latency_frames(AudioLatencyController const*);
+
+// After a gap in the wakeups, as when the device changed: measures the
+// intervals anew, but keeps the peaks seen on this machine.
+void audio_latency_restart(AudioLatencyController*);
+
+// # Rendering
+//
+// We render at 48khz. Backends may open their device at another rate,
+// which they tell in the header of the stream: the frames we render are
+// then resampled to the rate of the device.
+
+struct AudioResampler;
+
+// The resampler a stream needs, given the one it had: nullptr when the
+// device plays at the rate we render at. Reuses `resampler` when it fits,
+// and destroys it otherwise.
+AudioResampler* audio_stream_resampler_update(AudioStream const*, AudioResampler* resampler,
+                                              int render_hz);
+
+struct AudioEffect;
+
+// One turn of the audio thread: waits for the device, renders a buffer of
+// `audio` into it and releases it. Devices that do not take floats get our
+// own dithered conversion from `render_samples`, which holds
+// `render_sample_max` samples. Returns the frames delivered.
+//
+// With a latency controller, only fills the device up to its level. With
+// a resampler, renders at its input rate. Tells `audio` which of its frames
+// the device is playing (see audio_thread_heard).
+uint32_t audio_stream_render(AudioStream*, AudioEffect* audio,
+                             AudioLatencyController* latency,
+                             AudioResampler* resampler,
+                             AudioDitherState* dither,
+                             float* render_samples, uint32_t render_sample_max,
+                             uint32_t max_frame_count);
+
+struct AudioRenderAhead;
+
+// The same, for a device thread that copies what a dsp thread rendered
+// ahead (see uu_focus_audio_ring.hpp). The channel count of the ring must
+// be that of the stream.
+uint32_t audio_stream_copy(AudioStream*, AudioRenderAhead* ahead,
+                           AudioLatencyController* latency,
+                           AudioResampler* resampler,
+                           AudioDitherState* dither,
+                           float* render_samples, uint32_t render_sample_max,
+                           uint32_t max_frame_count);
+
+// # Migration
+//
+// When its device goes away, or the default device changes, a stream is
+// opened again on whatever device is the default by then. Meanwhile the
+// audio goes on: the audio thread renders what the device would have
+// played into a scratch buffer and drops it, so that the fades, filters
+// and clock of the audio carry on in real time. The new device resumes
+// where the audio is by then, fading in.
+
+struct AudioStreamMigration
+{
+    AudioBackend const* backend;
+    int render_hz;
+    int channel_count; // to open the stream with
+
+    bool is_migrating;
+    uint64_t lost_micros;
+    uint64_t dropped_frame_n; // since lost_micros
+    uint64_t attempt_micros; // of the next attempt to reopen
+    uint64_t retry_micros; // after that attempt
+
+    // statistics
+    uint64_t migration_n;
+    uint64_t attempt_n;
+    uint64_t recovery_micros_last; // from losing the stream to playing again
+    uint64_t recovery_micros_max;
+};
+
+// Attempts to reopen start at once, then back off from the shortest to
+// the longest retry period.
+enum {
+    AUDIO_STREAM_MIGRATION_RETRY_MIN_MICROS = 10'000,
+    AUDIO_STREAM_MIGRATION_RETRY_MAX_MICROS = 100'000,
+    AUDIO_STREAM_MIGRATION_FADE_IN_MICROS = 5'000,
+};
+
+void audio_stream_migration_init(AudioStreamMigration*, AudioBackend const* backend,
+                                 int render_hz, int channel_count);
+
+// The stream was found closed at `now_micros`.
+void audio_stream_migration_begin(AudioStreamMigration*, uint64_t now_micros);
+
+// Frames at our rate the device would have played up to `now_micros`,
+// at most `max_frame_count`: to render and drop.
+uint32_t audio_stream_migration_drop(AudioStreamMigration*, uint64_t now_micros,
+                                     uint32_t max_frame_count);
+
+// Tries to open the stream again, when an attempt is due. True once the
+// stream is open, which ends the migration.
+bool audio_stream_migration_reopen(AudioStream*, AudioStreamMigration*, uint64_t now_micros);
+
+// # Simulated device
+//
+// A device that plays `period_frames` frames out of its buffer every
+// period of a virtual clock, and wakes the audio thread some time after
+// each period: late by up to `jitter_micros`, and now and then stalled for
+// `stall_micros` more. Time only passes when the audio thread waits for
+// the device, renders for `render_micros`, or when audio_sim_advance says
+// it did something else.
+//
+// Its crystal may run `drift_ppm` parts per million faster than the one
+// of the virtual clock. Opening a stream takes `open_micros`.
+//
+// Playback starts with the first buffer released. A period that finds
+// fewer frames than it plays is an underrun: it plays silence instead.
+// The device keeps the sample format, layout and rate of its
+// configuration, whatever its streams ask for.
+
+struct AudioSimDeviceConfig
+{
+    AudioSampleFormat sample_format;
+    int channel_count;
+    int audio_hz; // 0 for the rate its streams ask for
+    double drift_ppm;
+    uint32_t period_frames;
+    uint32_t buffer_frames; // capacity of the device buffer
+    uint64_t jitter_micros;
+    uint64_t stall_micros;
+    uint32_t stall_every_n_periods; // on average, 0 for never
+    uint64_t render_micros; // between each acquire and release
+    uint64_t open_micros;
+    uint32_t seed;
+};
+
+struct AudioSimDevice
+{
+    AudioSimDeviceConfig config;
+    uint64_t now_micros; // the virtual clock
+    bool is_disconnected; // closes its streams at their next acquire
+
+    // statistics
+    uint64_t wakeup_n;
+    uint64_t period_n; // played
+    uint64_t underrun_n; // periods that played some silence
+    uint64_t underrun_frame_n;
+    uint64_t late_micros_max; // of a wakeup, after its period
+
+    // playback
+    bool is_playing;
+    int audio_hz;
+    uint64_t start_micros;
+    uint64_t tick_n; // periods played since the start
+    uint64_t wakeup_tick_n; // tick_n at the last wakeup
+    uint64_t played_frame_n;
+    uint64_t written_frame_n;
+    uint32_t rng;
+    uint8_t* bytes; // buffer_frames frames
+};
+
+AudioSimDevice* audio_sim_make(AudioSimDeviceConfig config);
+void audio_sim_destroy(AudioSimDevice*);
+AudioBackend audio_sim_backend(AudioSimDevice*);
+// lets virtual time pass, as when the audio thread is busy rendering
+void audio_sim_advance(AudioSimDevice*, uint64_t micros);
+// frames of the device buffer not yet played
+uint32_t audio_sim_padding(AudioSimDevice const*);
@@ -0,0 +1,132 @@
+// @language: c++14
+#include "uu_focus_audio_clock.hpp"
+
+#include <cmath>
+
+double audio_clock_mapping_micros_at(AudioClockMapping mapping, uint64_t frame)
+{
+    return mapping.micros + double(int64_t(frame - mapping.frame))*mapping.period_micros;
+}
+
+uint64_t audio_clock_mapping_frame_at(AudioClockMapping mapping, uint64_t micros)
+{
+    auto const frames = (double(micros) - mapping.micros) / mapping.period_micros;
+    auto const frame = double(mapping.frame) + std::floor(frames + 0.5);
+    return frame > 0.0 ? uint64_t(frame) : 0;
+}
+
+double audio_clock_mapping_rate_hz(AudioClockMapping mapping)
+{
+    return 1e6 / mapping.period_micros;
+}
+
+static void audio_correlation_publish(AudioClockCorrelation* _correlation, uint64_t micros)
+{
+    auto& correlation = *_correlation;
+    auto const sequence = correlation.sequence.load(std::memory_order_relaxed);
+    correlation.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    correlation.published_frame.store(correlation.frame, std::memory_order_relaxed);
+    correlation.published_micros.store(correlation.micros, std::memory_order_relaxed);
+    correlation.published_period_micros.store(correlation.period_micros,
+                                               std::memory_order_relaxed);
+    correlation.published_observed_micros.store(micros, std::memory_order_relaxed);
+    correlation.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+static void audio_correlation_lock(AudioClockCorrelation* _correlation, uint64_t frame,
+                                   uint64_t micros)
+{
+    auto& correlation = *_correlation;
+    correlation.is_locked = true;
+    correlation.frame = frame;
+    correlation.micros = double(micros);
+    correlation.outlier_n = 0;
+    correlation.observation_n = 0;
+    ++correlation.lock_n;
+}
+
+void audio_correlation_init(AudioClockCorrelation* _correlation, int audio_hz)
+{
+    auto& correlation = *_correlation;
+    correlation.audio_hz = audio_hz;
+    correlation.is_locked = false;
+    correlation.frame = 0;
+    correlation.micros = 0.0;
+    correlation.period_micros = 1e6 / audio_hz;
+    correlation.outlier_n = 0;
+    correlation.observation_n = 0;
+    correlation.lock_n = 0;
+    correlation.outlier_total_n = 0;
+    audio_correlation_publish(&correlation, 0);
+}
+
+void audio_correlation_observe(AudioClockCorrelation* _correlation, uint64_t frame,
+                               uint64_t micros)
+{
+    auto& correlation = *_correlation;
+    if (!correlation.is_locked) {
+        audio_correlation_lock(&correlation, frame, micros);
+        audio_correlation_publish(&correlation, micros);
+        return;
+    }
+    auto const frame_n = int64_t(frame - correlation.frame);
+    auto const predicted_micros = correlation.micros + double(frame_n)*correlation.period_micros;
+    auto const error_micros = double(micros) - predicted_micros;
+    if (std::fabs(error_micros) > AUDIO_CORRELATION_OUTLIER_MICROS || frame_n < 0) {
+        ++correlation.outlier_total_n;
+        if (++correlation.outlier_n >= AUDIO_CORRELATION_OUTLIER_N) {
+            audio_correlation_lock(&correlation, frame, micros);
+            audio_correlation_publish(&correlation, micros);
+        }
+        return;
+    }
+    correlation.outlier_n = 0;
+    // nothing was heard since the last observation
+    if (frame_n == 0) return;
+
+    // NOTE(nicolas): a second order loop, critically damped, with its
+    // coefficients computed for the interval since the last observation
+    double const pi = 3.1415926535897932384626;
+    auto bandwidth_hz = AUDIO_CORRELATION_LOCK_BANDWIDTH_HZ /
+        (1.0 + double(correlation.observation_n)/AUDIO_CORRELATION_LOCK_OBSERVATION_N);
+    if (bandwidth_hz < AUDIO_CORRELATION_BANDWIDTH_HZ) {
+        bandwidth_hz = AUDIO_CORRELATION_BANDWIDTH_HZ;
+    }
+    auto omega = 2.0*pi*bandwidth_hz * double(frame_n)*correlation.period_micros/1e6;
+    if (omega > 0.5) omega = 0.5;
+    correlation.micros = predicted_micros + std::sqrt(2.0)*omega*error_micros;
+    correlation.frame = frame;
+    correlation.period_micros += omega*omega*error_micros/double(frame_n);
+
+    // crystals are not that far off
+    auto const nominal_period_micros = 1e6 / correlation.audio_hz;
+    if (correlation.period_micros > 1.01*nominal_period_micros) {
+        correlation.period_micros = 1.01*nominal_period_micros;
+    }
+    if (correlation.period_micros < 0.99*nominal_period_micros) {
+        correlation.period_micros = 0.99*nominal_period_micros;
+    }
+    ++correlation.observation_n;
+    audio_correlation_publish(&correlation, micros);
+}
+
+AudioClockMapping audio_correlation_mapping(AudioClockCorrelation const* _correlation)
+{
+    auto& correlation = *_correlation;
+    AudioClockMapping mapping;
+    while (true) {
+        auto const sequence = correlation.sequence.load(std::memory_order_acquire);
+        mapping.frame = correlation.published_frame.load(std::memory_order_relaxed);
+        mapping.micros = correlation.published_micros.load(std::memory_order_relaxed);
+        mapping.period_micros =
+            correlation.published_period_micros.load(std::memory_order_relaxed);
+        mapping.observed_micros =
+            correlation.published_observed_micros.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(sequence & 1) && sequence == correlation.sequence.load(std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    return mapping;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#define UU_FOCUS_AUDIO_CLOCK
+
+/*
+ * Correlation of the audio clock with the now_micros() clock.
+ *
+ * Timers expire on the now_micros() clock, while the audio advances in
+ * frames of the device, whose crystal runs a little faster or slower than
+ * the one of the machine. At every wakeup the device thread observes which
+ * frame is being heard at that instant, and a delay locked loop filters
+ * these observations into a line: the time at which a frame is heard,
+ * as an anchor and a period.
+ *
+ * Observations are late by the wakeup jitter of the device thread, by half
+ * of it on average. The loop averages it out with a narrow bandwidth, but
+ * starts wide to lock quickly, then narrows down as observations come. Observations far off the line are ignored, unless they
+ * keep coming: then the audio or its device jumped, and the loop locks
+ * again from there, keeping the period it measured.
+ */
+
+#include <atomic>
+#include <stdint.h>
+
+// Maps frames to instants of the now_micros() clock, and back.
+struct AudioClockMapping
+{
+    uint64_t frame;
+    double micros; // when `frame` is heard
+    double period_micros; // of a frame
+    uint64_t observed_micros; // of the last observation, 0 for none
+};
+
+double audio_clock_mapping_micros_at(AudioClockMapping mapping, uint64_t frame);
+uint64_t audio_clock_mapping_frame_at(AudioClockMapping mapping, uint64_t micros);
+// frames per second of the now_micros() clock
+double audio_clock_mapping_rate_hz(AudioClockMapping mapping);
+
+enum {
+    AUDIO_CORRELATION_LOCK_OBSERVATION_N = 100, // halve the lock bandwidth
+    AUDIO_CORRELATION_OUTLIER_MICROS = 20'000,
+    AUDIO_CORRELATION_OUTLIER_N = 3, // in a row, to lock again
+    AUDIO_CORRELATION_STALE_MICROS = 250'000, // without observations
+};
+
+// of the loop, while locking then once locked
+static constexpr double AUDIO_CORRELATION_LOCK_BANDWIDTH_HZ = 1.0;
+static constexpr double AUDIO_CORRELATION_BANDWIDTH_HZ = 0.02;
+
+struct AudioClockCorrelation
+{
+    int audio_hz; // nominal
+    // owned by the observing thread:
+    bool is_locked;
+    uint64_t frame;
+    double micros;
+    double period_micros;
+    uint32_t outlier_n; // in a row
+
+    // statistics
+    uint64_t observation_n; // since locked
+    uint64_t lock_n;
+    uint64_t outlier_total_n;
+
+    // the mapping, published for any thread
+    std::atomic<uint32_t> sequence; // odd while being written
+    std::atomic<uint64_t> published_frame;
+    std::atomic<double> published_micros;
+    std::atomic<double> published_period_micros;
+    std::atomic<uint64_t> published_observed_micros;
+};
+
+void audio_correlation_init(AudioClockCorrelation*, int audio_hz);
+
+// For the observing thread: `frame` is heard at `micros`.
+void audio_correlation_observe(AudioClockCorrelation*, uint64_t frame, uint64_t micros);
+
+// The latest mapping, from any thread.
+AudioClockMapping audio_correlation_mapping(AudioClockCorrelation const*);
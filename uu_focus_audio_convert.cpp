@@ -0,0 +1,519 @@
+// @language: c++14
+#include "uu_focus_audio_convert.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUDIO_CONVERT_X86 1
+#else
+#define AUDIO_CONVERT_X86 0
+#endif
+
+#if AUDIO_CONVERT_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// NOTE(nicolas): kernels are compiled for their instruction set regardless
+// of the compiler flags, and picked at runtime after checking the cpu.
+#if defined(__GNUC__) || defined(__clang__)
+#define AUDIO_CONVERT_TARGET_SSE2 __attribute__((target("sse2")))
+#define AUDIO_CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define AUDIO_CONVERT_TARGET_SSE2
+#define AUDIO_CONVERT_TARGET_AVX2
+#endif
+
+int audio_sample_format_bytes(AudioSampleFormat format)
+{
+    switch (format) {
+        case AudioSampleFormat_F32: return 4;
+        case AudioSampleFormat_S16: return 2;
+        case AudioSampleFormat_S24_Packed: return 3;
+        case AudioSampleFormat_S24_In32: return 4;
+        case AudioSampleFormat_S32: return 4;
+    }
+    return 0;
+}
+
+static uint32_t xorshift32(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+void audio_dither_init(AudioDitherState* _state, uint32_t seed, int channel_count)
+{
+    auto& state = *_state;
+    uint32_t x = seed ? seed : 0x9e3779b9;
+    for (int lane_i = 0; lane_i < AUDIO_DITHER_LANES; ++lane_i) {
+        // decorrelate lanes, xorshift never leaves a non zero state
+        x = xorshift32(x + 0x9e3779b9);
+        if (!x) x = 1;
+        state.rng[lane_i] = x;
+    }
+    state.channel_count = channel_count < 1 ? 1 :
+        channel_count > AUDIO_DITHER_CHANNEL_MAX ? AUDIO_DITHER_CHANNEL_MAX : channel_count;
+    state.channel_i = 0;
+    for (auto& error : state.error) error = 0.0f;
+}
+
+// The float source only carries 24 bits of precision, so 32 bits outputs
+// are dithered at the 24 bits level and left aligned.
+enum ConvertTarget
+{
+    ConvertTarget_S16,
+    ConvertTarget_S24_Packed,
+    ConvertTarget_S24_In32,
+    ConvertTarget_Count,
+};
+
+static int convert_target(AudioSampleFormat format)
+{
+    switch (format) {
+        case AudioSampleFormat_F32: return -1;
+        case AudioSampleFormat_S16: return ConvertTarget_S16;
+        case AudioSampleFormat_S24_Packed: return ConvertTarget_S24_Packed;
+        case AudioSampleFormat_S24_In32: return ConvertTarget_S24_In32;
+        case AudioSampleFormat_S32: return ConvertTarget_S24_In32;
+    }
+    return -1;
+}
+
+template <int Target> static inline float target_scale()
+{
+    return Target == ConvertTarget_S16 ? 32768.0f : 8388608.0f;
+}
+
+template <int Target> static inline float target_max()
+{
+    return Target == ConvertTarget_S16 ? 32767.0f : 8388607.0f;
+}
+
+template <int Target> static inline float target_min()
+{
+    return Target == ConvertTarget_S16 ? -32768.0f : -8388608.0f;
+}
+
+static inline float uniform_next(uint32_t* _x)
+{
+    auto& x = *_x;
+    x = xorshift32(x);
+    return float(int32_t(x >> 8)) * (1.0f/16777216.0f);
+}
+
+// Dither in lsb units
+template <int Dither>
+static inline float dither_next(AudioDitherState* _state, int lane_i)
+{
+    auto& state = *_state;
+    if (Dither == AudioDither_None) return 0.0f;
+    auto const u0 = uniform_next(&state.rng[lane_i]);
+    auto const u1 = uniform_next(&state.rng[lane_i]);
+    return u0 - u1;
+}
+
+// nearest integer, ties to even like cvtps2dq in the default rounding mode
+static inline int32_t round_to_int(float x)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    return _mm_cvtss_si32(_mm_set_ss(x)); // nearbyint is a library call
+#else
+    return int32_t(std::nearbyint(x));
+#endif
+}
+
+// Quantizes `x`, in lsb units, dithered by `d`, after taking out the error
+// of the previous sample of its channel. The error is bounded so that
+// clipping does not feed back.
+//
+// NOTE(nicolas): the feedback runs one sample after the other in every
+// kernel, the vector kernels only computing `x` and `d`, so that they all
+// produce the same output.
+template <int Target>
+static inline int32_t shaped_quantize(AudioDitherState* _state, int* _channel_i,
+                                      float x, float d)
+{
+    auto& state = *_state;
+    auto& channel_i = *_channel_i;
+    auto& error = state.error[channel_i];
+    auto const v = x - error;
+    float y = v + d;
+    y = y > target_min<Target>() ? y : target_min<Target>();
+    y = y < target_max<Target>() ? y : target_max<Target>();
+    auto const q = round_to_int(y);
+    auto const e = float(q) - v;
+    error = e > -2.0f ? (e < 2.0f ? e : 2.0f) : -2.0f;
+    if (++channel_i == state.channel_count) channel_i = 0;
+    return q;
+}
+
+template <int Target>
+static inline void store_sample(uint8_t* dst_bytes, int sample_i, int32_t y)
+{
+    if (Target == ConvertTarget_S16) {
+        auto const v = int16_t(y);
+        memcpy(dst_bytes + 2*sample_i, &v, sizeof v);
+    } else if (Target == ConvertTarget_S24_Packed) {
+        auto const v = uint32_t(y);
+        auto dst = dst_bytes + 3*sample_i;
+        dst[0] = uint8_t(v);
+        dst[1] = uint8_t(v >> 8);
+        dst[2] = uint8_t(v >> 16);
+    } else {
+        auto const v = uint32_t(y) << 8;
+        memcpy(dst_bytes + 4*sample_i, &v, sizeof v);
+    }
+}
+
+template <int Target, int Dither>
+static void convert_scalar_range(AudioDitherState* state,
+                                 float const* samples,
+                                 int sample_first,
+                                 int sample_last,
+                                 uint8_t* dst_bytes)
+{
+    auto const scale = target_scale<Target>();
+    auto const lo = target_min<Target>();
+    auto const hi = target_max<Target>();
+    int channel_i = Dither == AudioDither_TpdfShaped ? state->channel_i : 0;
+    for (int i = sample_first; i < sample_last; ++i) {
+        auto const d = dither_next<Dither>(state, i % AUDIO_DITHER_LANES);
+        if (Dither == AudioDither_TpdfShaped) {
+            store_sample<Target>(dst_bytes, i,
+                                 shaped_quantize<Target>(state, &channel_i, samples[i]*scale, d));
+            continue;
+        }
+        float y = samples[i]*scale + d;
+        // same operand order as maxps/minps, for identical results
+        y = y > lo ? y : lo;
+        y = y < hi ? y : hi;
+        store_sample<Target>(dst_bytes, i, int32_t(std::nearbyint(y)));
+    }
+    if (Dither == AudioDither_TpdfShaped) state->channel_i = channel_i;
+}
+
+template <int Target, int Dither>
+static void convert_scalar(AudioDitherState* state,
+                           float const* samples,
+                           int sample_count,
+                           uint8_t* dst_bytes)
+{
+    convert_scalar_range<Target, Dither>(state, samples, 0, sample_count, dst_bytes);
+}
+
+#if AUDIO_CONVERT_X86
+
+AUDIO_CONVERT_TARGET_SSE2
+static inline __m128i xorshift32_sse2(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    return x;
+}
+
+AUDIO_CONVERT_TARGET_SSE2
+static inline __m128 uniform_next_sse2(__m128i* _x)
+{
+    auto& x = *_x;
+    x = xorshift32_sse2(x);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)),
+                      _mm_set1_ps(1.0f/16777216.0f));
+}
+
+// Dither of the next two vectors, of lanes [0,4) and [4,8)
+template <int Dither>
+AUDIO_CONVERT_TARGET_SSE2
+static inline void dither_next_sse2(__m128i* rng, __m128* d)
+{
+    if (Dither == AudioDither_None) {
+        d[0] = d[1] = _mm_setzero_ps();
+        return;
+    }
+    auto const u0 = uniform_next_sse2(&rng[0]);
+    auto const u1 = uniform_next_sse2(&rng[1]);
+    d[0] = _mm_sub_ps(u0, uniform_next_sse2(&rng[0]));
+    d[1] = _mm_sub_ps(u1, uniform_next_sse2(&rng[1]));
+}
+
+template <int Target, int Dither>
+AUDIO_CONVERT_TARGET_SSE2
+static void convert_sse2(AudioDitherState* _state,
+                         float const* samples,
+                         int sample_count,
+                         uint8_t* dst_bytes)
+{
+    AudioDitherState no_state = {};
+    auto& state = _state ? *_state : no_state;
+    auto const scale = _mm_set1_ps(target_scale<Target>());
+    auto const lo = _mm_set1_ps(target_min<Target>());
+    auto const hi = _mm_set1_ps(target_max<Target>());
+
+    // lanes [0,4) and [4,8) of the dither state
+    __m128i rng[2] = {
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.rng)),
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(state.rng + 4)),
+    };
+    int channel_i = state.channel_i;
+
+    int i = 0;
+    for (; i + AUDIO_DITHER_LANES <= sample_count; i += AUDIO_DITHER_LANES) {
+        __m128 d[2];
+        dither_next_sse2<Dither>(rng, d);
+        if (Dither == AudioDither_TpdfShaped) {
+            float xs[AUDIO_DITHER_LANES], ds[AUDIO_DITHER_LANES];
+            for (int half_i = 0; half_i < 2; ++half_i) {
+                _mm_storeu_ps(xs + 4*half_i, _mm_mul_ps(_mm_loadu_ps(samples + i + 4*half_i), scale));
+                _mm_storeu_ps(ds + 4*half_i, d[half_i]);
+            }
+            for (int lane_i = 0; lane_i < AUDIO_DITHER_LANES; ++lane_i) {
+                store_sample<Target>(dst_bytes, i + lane_i,
+                                     shaped_quantize<Target>(&state, &channel_i, xs[lane_i], ds[lane_i]));
+            }
+            continue;
+        }
+        __m128i y[2];
+        for (int half_i = 0; half_i < 2; ++half_i) {
+            auto x = _mm_loadu_ps(samples + i + 4*half_i);
+            x = _mm_add_ps(_mm_mul_ps(x, scale), d[half_i]);
+            x = _mm_min_ps(_mm_max_ps(x, lo), hi);
+            y[half_i] = _mm_cvtps_epi32(x);
+        }
+        if (Target == ConvertTarget_S16) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_bytes + 2*i),
+                             _mm_packs_epi32(y[0], y[1]));
+        } else if (Target == ConvertTarget_S24_In32) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_bytes + 4*i),
+                             _mm_slli_epi32(y[0], 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_bytes + 4*i + 16),
+                             _mm_slli_epi32(y[1], 8));
+        } else {
+            int32_t ys[AUDIO_DITHER_LANES];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ys), y[0]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ys + 4), y[1]);
+            for (int lane_i = 0; lane_i < AUDIO_DITHER_LANES; ++lane_i) {
+                store_sample<Target>(dst_bytes, i + lane_i, ys[lane_i]);
+            }
+        }
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state.rng), rng[0]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state.rng + 4), rng[1]);
+    state.channel_i = channel_i;
+
+    convert_scalar_range<Target, Dither>(&state, samples, i, sample_count, dst_bytes);
+}
+
+AUDIO_CONVERT_TARGET_AVX2
+static inline __m256i xorshift32_avx2(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    return x;
+}
+
+AUDIO_CONVERT_TARGET_AVX2
+static inline __m256 uniform_next_avx2(__m256i* _x)
+{
+    auto& x = *_x;
+    x = xorshift32_avx2(x);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)),
+                         _mm256_set1_ps(1.0f/16777216.0f));
+}
+
+template <int Dither>
+AUDIO_CONVERT_TARGET_AVX2
+static inline __m256 dither_next_avx2(__m256i* rng)
+{
+    if (Dither == AudioDither_None) return _mm256_setzero_ps();
+    auto const u0 = uniform_next_avx2(rng);
+    auto const u1 = uniform_next_avx2(rng);
+    return _mm256_sub_ps(u0, u1);
+}
+
+template <int Target, int Dither>
+AUDIO_CONVERT_TARGET_AVX2
+static inline __m256i convert_avx2_step(float const* samples, __m256i* rng)
+{
+    auto const d = dither_next_avx2<Dither>(rng);
+    auto x = _mm256_loadu_ps(samples);
+    x = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(target_scale<Target>())), d);
+    x = _mm256_max_ps(x, _mm256_set1_ps(target_min<Target>()));
+    x = _mm256_min_ps(x, _mm256_set1_ps(target_max<Target>()));
+    return _mm256_cvtps_epi32(x);
+}
+
+// The low 3 bytes of the 8 samples of `y`, 24 bytes
+AUDIO_CONVERT_TARGET_AVX2
+static inline void store_s24_packed_avx2(uint8_t* dst, __m256i y)
+{
+    // 12 bytes at the start of each 128 bits lane, then the two side by side
+    auto const bytes = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    auto const packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(y, bytes),
+                                                    _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 16), _mm256_extracti128_si256(packed, 1));
+}
+
+template <int Target, int Dither>
+AUDIO_CONVERT_TARGET_AVX2
+static void convert_avx2(AudioDitherState* _state,
+                         float const* samples,
+                         int sample_count,
+                         uint8_t* dst_bytes)
+{
+    AudioDitherState no_state = {};
+    auto& state = _state ? *_state : no_state;
+    auto rng = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(state.rng));
+    int channel_i = state.channel_i;
+
+    int i = 0;
+    if (Dither == AudioDither_TpdfShaped) {
+        for (; i + AUDIO_DITHER_LANES <= sample_count; i += AUDIO_DITHER_LANES) {
+            auto const d = dither_next_avx2<Dither>(&rng);
+            auto const x = _mm256_mul_ps(_mm256_loadu_ps(samples + i),
+                                         _mm256_set1_ps(target_scale<Target>()));
+            float xs[AUDIO_DITHER_LANES], ds[AUDIO_DITHER_LANES];
+            _mm256_storeu_ps(xs, x);
+            _mm256_storeu_ps(ds, d);
+            for (int lane_i = 0; lane_i < AUDIO_DITHER_LANES; ++lane_i) {
+                store_sample<Target>(dst_bytes, i + lane_i,
+                                     shaped_quantize<Target>(&state, &channel_i, xs[lane_i], ds[lane_i]));
+            }
+        }
+    } else if (Target == ConvertTarget_S16) {
+        // pack two vectors at a time, packs works within 128 bits lanes
+        for (; i + 2*AUDIO_DITHER_LANES <= sample_count; i += 2*AUDIO_DITHER_LANES) {
+            auto const y0 = convert_avx2_step<Target, Dither>(samples + i, &rng);
+            auto const y1 = convert_avx2_step<Target, Dither>(samples + i + AUDIO_DITHER_LANES, &rng);
+            auto const y = _mm256_permute4x64_epi64(_mm256_packs_epi32(y0, y1),
+                                                    0xd8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_bytes + 2*i), y);
+        }
+    } else {
+        for (; i + AUDIO_DITHER_LANES <= sample_count; i += AUDIO_DITHER_LANES) {
+            auto const y = convert_avx2_step<Target, Dither>(samples + i, &rng);
+            if (Target == ConvertTarget_S24_In32) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_bytes + 4*i),
+                                    _mm256_slli_epi32(y, 8));
+            } else {
+                store_s24_packed_avx2(dst_bytes + 3*i, y);
+            }
+        }
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(state.rng), rng);
+    state.channel_i = channel_i;
+
+    convert_scalar_range<Target, Dither>(&state, samples, i, sample_count, dst_bytes);
+}
+
+static bool cpu_has_sse2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool const os_saves_ymm = (info[2] & (1 << 27)) != 0 &&
+        (_xgetbv(0) & 6) == 6;
+    if (!os_saves_ymm) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // AUDIO_CONVERT_X86
+
+AudioConvertIsa audio_convert_isa_max()
+{
+#if AUDIO_CONVERT_X86
+    static AudioConvertIsa const isa =
+        cpu_has_avx2() ? AudioConvertIsa_AVX2 :
+        cpu_has_sse2() ? AudioConvertIsa_SSE2 :
+        AudioConvertIsa_Scalar;
+    return isa;
+#else
+    return AudioConvertIsa_Scalar;
+#endif
+}
+
+#define AUDIO_CONVERT_TABLE(kernel) {                                       \
+    { kernel<ConvertTarget_S16, AudioDither_None>,                          \
+      kernel<ConvertTarget_S16, AudioDither_Tpdf>,                          \
+      kernel<ConvertTarget_S16, AudioDither_TpdfShaped> },                  \
+    { kernel<ConvertTarget_S24_Packed, AudioDither_None>,                   \
+      kernel<ConvertTarget_S24_Packed, AudioDither_Tpdf>,                   \
+      kernel<ConvertTarget_S24_Packed, AudioDither_TpdfShaped> },           \
+    { kernel<ConvertTarget_S24_In32, AudioDither_None>,                     \
+      kernel<ConvertTarget_S24_In32, AudioDither_Tpdf>,                     \
+      kernel<ConvertTarget_S24_In32, AudioDither_TpdfShaped> },             \
+}
+
+enum { DITHER_COUNT = AudioDither_TpdfShaped + 1 };
+
+static AudioConvertProc* const global_convert_scalar[ConvertTarget_Count][DITHER_COUNT] =
+    AUDIO_CONVERT_TABLE(convert_scalar);
+#if AUDIO_CONVERT_X86
+static AudioConvertProc* const global_convert_sse2[ConvertTarget_Count][DITHER_COUNT] =
+    AUDIO_CONVERT_TABLE(convert_sse2);
+static AudioConvertProc* const global_convert_avx2[ConvertTarget_Count][DITHER_COUNT] =
+    AUDIO_CONVERT_TABLE(convert_avx2);
+#endif
+
+#undef AUDIO_CONVERT_TABLE
+
+AudioConvertProc* audio_convert_select_isa(AudioSampleFormat format,
+                                           AudioDither dither,
+                                           AudioConvertIsa isa)
+{
+    auto const target = convert_target(format);
+    if (target < 0) return nullptr;
+    if (int(dither) < 0 || int(dither) >= DITHER_COUNT) return nullptr;
+    if (isa > audio_convert_isa_max()) return nullptr;
+
+    switch (isa) {
+        case AudioConvertIsa_Scalar: return global_convert_scalar[target][dither];
+#if AUDIO_CONVERT_X86
+        case AudioConvertIsa_SSE2: return global_convert_sse2[target][dither];
+        case AudioConvertIsa_AVX2: return global_convert_avx2[target][dither];
+#else
+        case AudioConvertIsa_SSE2: return nullptr;
+        case AudioConvertIsa_AVX2: return nullptr;
+#endif
+    }
+    return nullptr;
+}
+
+AudioConvertProc* audio_convert_select(AudioSampleFormat format,
+                                       AudioDither dither)
+{
+    return audio_convert_select_isa(format, dither, audio_convert_isa_max());
+}
+
+#undef AUDIO_CONVERT_TARGET_SSE2
+#undef AUDIO_CONVERT_TARGET_AVX2
@@ -0,0 +1,72 @@
+#pragma once
+#define UU_FOCUS_AUDIO_CONVERT
+
+/*
+ * Conversion of rendered float32 interleaved samples to the integer
+ * formats an output device may negotiate.
+ */
+
+#include <stdint.h>
+
+enum AudioSampleFormat
+{
+    AudioSampleFormat_F32,
+    AudioSampleFormat_S16,
+    AudioSampleFormat_S24_Packed, // 3 bytes per sample, little endian
+    AudioSampleFormat_S24_In32,   // 24 valid bits, msb aligned in 32 bits
+    AudioSampleFormat_S32,
+};
+
+int audio_sample_format_bytes(AudioSampleFormat);
+
+enum AudioDither
+{
+    AudioDither_None,
+    AudioDither_Tpdf,        // flat triangular pdf dither, +/- 1 lsb
+    AudioDither_TpdfShaped,  // tpdf dither, its error shaped towards high frequencies
+};
+
+enum AudioConvertIsa
+{
+    AudioConvertIsa_Scalar,
+    AudioConvertIsa_SSE2,
+    AudioConvertIsa_AVX2,
+};
+
+enum { AUDIO_DITHER_LANES = 8, AUDIO_DITHER_CHANNEL_MAX = 32 };
+
+// Dither generator state, one independent generator per vector lane.
+// Sample i of a conversion call is dithered by lane (i % AUDIO_DITHER_LANES),
+// so every kernel produces the same output for the same state.
+//
+// Shaped dither feeds the total quantization error of a sample, dither
+// included, back into the next sample of its channel: the error reaches
+// the output through a first difference, rising 6db/octave up to nyquist.
+struct AudioDitherState
+{
+    uint32_t rng[AUDIO_DITHER_LANES];
+    int32_t channel_count; // of the interleaved samples, up to AUDIO_DITHER_CHANNEL_MAX
+    int32_t channel_i; // of the next sample
+    float error[AUDIO_DITHER_CHANNEL_MAX]; // of the last sample of each channel, in lsb
+};
+
+void audio_dither_init(AudioDitherState*, uint32_t seed, int channel_count);
+
+// Converts `sample_count` interleaved samples from [-1, 1] floats to the
+// destination format, saturating out of range values. The dither state
+// may be null for AudioDither_None.
+typedef void AudioConvertProc(AudioDitherState*,
+                              float const* samples,
+                              int sample_count,
+                              uint8_t* dst_bytes);
+
+// Best kernel for the running cpu. Returns nullptr for AudioSampleFormat_F32,
+// where the render buffer can be handed to the device as is.
+AudioConvertProc* audio_convert_select(AudioSampleFormat, AudioDither);
+
+// Kernel for a specific instruction set, nullptr when unsupported by the cpu.
+AudioConvertProc* audio_convert_select_isa(AudioSampleFormat,
+                                           AudioDither,
+                                           AudioConvertIsa);
+
+AudioConvertIsa audio_convert_isa_max();
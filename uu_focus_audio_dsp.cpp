@@ -0,0 +1,550 @@
+// @language: c++14
+#include "uu_focus_audio_module.hpp"
+#include "uu_focus_effects.hpp"
+
+#include "uu_focus_dsp.hpp"
+
+#include <cmath>
+#include <cstring>
+
+static double
+db_to_amp (double volume_in_db)
+{
+    return pow (exp (volume_in_db), log (10.0) / 20.0);
+}
+
+static constexpr double TAU = 6.2831853071795864769252;
+
+// Filter by Paul Kellet (pk3 = (Black))
+// paul.kellett@maxim.abel.co.uk
+//
+// Filter to make pink noise from white  (updated March 2000)
+// ------------------------------------
+//
+// This is an approximation to a -10dB/decade filter using a weighted sum
+// of first order filters. It is accurate to within +/-0.05dB above 9.2Hz
+// (44100Hz sampling rate). Unity gain is at Nyquist, but can be adjusted
+// by scaling the numbers at the end of each line.
+//
+// If 'white' consists of uniform random numbers, such as those generated
+// by the rand() function, 'pink' will have an almost gaussian level
+// distribution.
+struct PinkNoiseFilter
+{
+    double poles[6];
+    double gains[6];
+    double delayed_gain;
+    double direct_gain;
+};
+
+static PinkNoiseFilter const pink_noise_filter_pk3 = {
+    { 0.99886, 0.99332, 0.96900, 0.86650, 0.55000, -0.7616 },
+    { 0.0555179, 0.0750759, 0.1538520, 0.3104856, 0.5329522, -0.0168980 },
+    0.115926,
+    0.5362,
+};
+
+enum {
+    AUDIO_CHUNK_FRAMES = 256,
+    AUDIO_GROUP_MAX = AUDIO_CHANNEL_MAX / AUDIO_LANES,
+};
+static_assert(AUDIO_CHANNEL_MAX % AUDIO_LANES == 0,
+              "channels are processed in groups of lanes");
+
+// Pink noise generators, one independent generator per channel. The state
+// is laid out as structure of arrays, to compute AUDIO_LANES channels at
+// once.
+struct NoiseBank
+{
+    uint32_t white[AUDIO_CHANNEL_MAX]; // xorshift32 state
+    float b[7][AUDIO_CHANNEL_MAX];
+};
+
+static void noise_bank_make(NoiseBank* _bank, uint32_t seed)
+{
+    auto& bank = *_bank;
+    bank = {};
+    uint32_t x = seed;
+    for (auto& white : bank.white) {
+        // splitmix32 style scrambling, to decorrelate channels
+        x += 0x9e3779b9;
+        uint32_t z = x;
+        z = (z ^ (z >> 16)) * 0x85ebca6b;
+        z = (z ^ (z >> 13)) * 0xc2b2ae35;
+        z ^= z >> 16;
+        white = z ? z : 1;
+    }
+}
+
+// # Chime
+//
+// A struck bell, synthesized into a preloaded buffer when the effect is
+// made, so that playing it allocates nothing.
+
+enum { AUDIO_CHIME_FRAME_COUNT = 48000 * 3 / 2 };
+
+static void chime_synthesize(float* samples, int frame_count)
+{
+    struct { double ratio; double amp; double decay_s; } const partials[] = {
+        { 1.00, 1.00, 1.10 },
+        { 2.00, 0.45, 0.70 },
+        { 2.76, 0.35, 0.45 },
+        { 5.40, 0.18, 0.25 },
+        { 8.93, 0.08, 0.15 },
+    };
+    double const base_hz = 880.0;
+    double const attack_s = 0.002;
+    double const release_s = 0.020;
+    double peak = 0.0;
+    for (int i = 0; i < frame_count; ++i) {
+        double const t = i / 48000.0;
+        double y = 0.0;
+        for (auto const& partial : partials) {
+            y += partial.amp * std::exp(-t/partial.decay_s) *
+                std::sin(TAU*base_hz*partial.ratio*t);
+        }
+        auto const t_end = (frame_count - i) / 48000.0;
+        if (t < attack_s) y *= t / attack_s;
+        if (t_end < release_s) y *= t_end / release_s;
+        samples[i] = float(y);
+        peak = std::fmax(peak, std::fabs(y));
+    }
+    // leaves room for the noise it is mixed with
+    auto const scale = float(db_to_amp(-9.0) / peak);
+    for (int i = 0; i < frame_count; ++i) samples[i] *= scale;
+}
+
+// # Tick
+//
+// The soft tick of a clock, preloaded like the chime.
+
+enum { AUDIO_TICK_FRAME_COUNT = 48000 * 25 / 1000 };
+
+static void tick_synthesize(float* samples, int frame_count)
+{
+    double const attack_s = 0.0005;
+    double const decay_s = 0.004;
+    double peak = 0.0;
+    for (int i = 0; i < frame_count; ++i) {
+        double const t = i / 48000.0;
+        double y = std::exp(-t/decay_s) *
+            (std::sin(TAU*2200.0*t) + 0.6*std::sin(TAU*3700.0*t + 0.3));
+        if (t < attack_s) y *= t / attack_s;
+        samples[i] = float(y);
+        peak = std::fmax(peak, std::fabs(y));
+    }
+    // in the background, under the noise
+    auto const scale = float(db_to_amp(-30.0) / peak);
+    for (int i = 0; i < frame_count; ++i) samples[i] *= scale;
+}
+
+// # State
+//
+// Everything the dsp carries from one block to the next, with no pointer
+// to outside of itself so that it can be copied to another version of the
+// code.
+
+enum { AUDIO_DELAY_LENGTH = 1024 /* power of two, above 15ms */ };
+
+struct AudioDspState
+{
+    AudioDspStateStable stable;
+
+    NoiseBank noise;
+    // crossfeed of the front pair: the first group of lanes, delayed
+    int crossfeed_delay_i; // of the next frame
+    AudioLanes crossfeed_delay[AUDIO_DELAY_LENGTH];
+
+    double tone_phase;
+
+    // scratch block for staged execution
+    AudioLanes staged_lanes[AUDIO_CHUNK_FRAMES * AUDIO_GROUP_MAX];
+};
+static_assert(sizeof(AudioDspState) <= AUDIO_DSP_STATE_CAPACITY,
+              "the state fits what the host allocates");
+
+UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(audio_dsp_handover)
+{
+    auto& state = *dst;
+    std::memset(&state, 0, sizeof state);
+    state.stable.chime_position = -1;
+    if (src && src->stable.version == AUDIO_DSP_STATE_VERSION) {
+        state = *src;
+    } else {
+        if (src) state.stable = src->stable;
+        noise_bank_make(&state.noise, seed);
+    }
+    state.stable.version = AUDIO_DSP_STATE_VERSION;
+    state.stable.size = sizeof state;
+}
+
+// # DSP stages (see uu_focus_dsp.hpp)
+//
+// Stages copy the state they touch per frame into members at make time,
+// and write it back in finish(), so that a fused chain may keep it in
+// registers.
+
+struct NoiseSource
+{
+    NoiseBank* bank;
+    AudioLanesBits white[AUDIO_GROUP_MAX];
+    AudioLanes b[AUDIO_GROUP_MAX][7];
+    AudioLanes poles[6];
+    AudioLanes gains[6];
+    AudioLanes direct_gain;
+    AudioLanes delayed_gain;
+    AudioLanes amps[AUDIO_GROUP_MAX]; // per speaker output level
+
+    template <int G> void process(AudioFrame<G>* frame, int)
+    {
+        for (int g = 0; g < G; ++g) {
+            auto x = white[g];
+            x = x ^ (x << 13);
+            x = x ^ (x >> 17);
+            x = x ^ (x << 5);
+            white[g] = x;
+            auto const w = audio_lanes_from_int(x) * audio_lanes_set1(1.0f/2147483648.0f);
+            auto& bg = b[g];
+            for (int j = 0; j < 6; ++j) bg[j] = poles[j] * bg[j] + w * gains[j];
+            auto const pink = ((bg[0] + bg[1]) + (bg[2] + bg[3]))
+                + ((bg[4] + bg[5]) + (bg[6] + w * direct_gain));
+            bg[6] = w * delayed_gain;
+            frame->groups[g] = pink * amps[g];
+        }
+    }
+
+    void finish()
+    {
+        for (int g = 0; g < AUDIO_GROUP_MAX; ++g) {
+            audio_lanes_bits_store(&bank->white[AUDIO_LANES*g], white[g]);
+            for (int j = 0; j < 7; ++j) audio_lanes_store(&bank->b[j][AUDIO_LANES*g], b[g][j]);
+        }
+    }
+};
+
+static NoiseSource noise_source_make(NoiseBank* _bank, PinkNoiseFilter const& filter, int channel_count)
+{
+    auto& bank = *_bank;
+    NoiseSource result;
+    result.bank = &bank;
+    for (int g = 0; g < AUDIO_GROUP_MAX; ++g) {
+        result.white[g] = audio_lanes_bits_load(&bank.white[AUDIO_LANES*g]);
+        for (int j = 0; j < 7; ++j) result.b[g][j] = audio_lanes_load(&bank.b[j][AUDIO_LANES*g]);
+    }
+    for (int j = 0; j < 6; ++j) {
+        result.poles[j] = audio_lanes_set1(float(filter.poles[j]));
+        result.gains[j] = audio_lanes_set1(float(filter.gains[j]));
+    }
+    result.direct_gain = audio_lanes_set1(float(filter.direct_gain));
+    result.delayed_gain = audio_lanes_set1(float(filter.delayed_gain));
+
+    // other speakers than the front pair get their noise at the level the
+    // crossfeed gives to the front pair:
+    auto const pink_noise_amp = float(db_to_amp(-26));
+    float amps[AUDIO_CHANNEL_MAX];
+    for (int channel_i = 0; channel_i < AUDIO_CHANNEL_MAX; ++channel_i) {
+        amps[channel_i] = pink_noise_amp * (channel_i < 2 && channel_count >= 2 ? 1.0f : 0.65f);
+    }
+    for (int g = 0; g < AUDIO_GROUP_MAX; ++g) {
+        result.amps[g] = audio_lanes_load(&amps[AUDIO_LANES*g]);
+    }
+    return result;
+}
+
+// delayed crossfeed to shape the image of the front pair
+struct CrossfeedStage
+{
+    AudioDspState* state;
+    int delay_i;
+    int separation_n;
+    bool is_enabled;
+    // per lane, for the front pair (other lanes pass through):
+    AudioLanes direct_gain;  // of the speaker itself
+    AudioLanes opposite_gain; // of the other speaker
+    AudioLanes delayed_gain; // of the other speaker, delayed
+
+    template <int G> void process(AudioFrame<G>* frame, int)
+    {
+        if (!is_enabled) return;
+        auto& delay = state->crossfeed_delay;
+        auto const x = frame->groups[0];
+        delay[delay_i] = x;
+        auto const delayed = delay[(delay_i - separation_n) & (AUDIO_DELAY_LENGTH - 1)];
+        delay_i = (delay_i + 1) & (AUDIO_DELAY_LENGTH - 1);
+        frame->groups[0] = x * direct_gain
+            + audio_lanes_swap_pairs(x) * opposite_gain
+            + audio_lanes_swap_pairs(delayed) * delayed_gain;
+    }
+
+    void finish() { state->crossfeed_delay_i = delay_i; }
+};
+
+static CrossfeedStage crossfeed_make(AudioDspState* _state, double separation_ms,
+                                     double audio_hz, int channel_count)
+{
+    auto& state = *_state;
+    int separation_n = int(separation_ms*audio_hz/1000.0);
+    if (separation_n >= AUDIO_DELAY_LENGTH) separation_n = AUDIO_DELAY_LENGTH - 1;
+    if (separation_n < 0) separation_n = 0;
+    float const direct_gain[AUDIO_LANES] = { 0.55f, 0.55f, 1.0f, 1.0f };
+    float const opposite_gain[AUDIO_LANES] = { 0.20f, 0.20f, 0.0f, 0.0f };
+    float const delayed_gain[AUDIO_LANES] = { 0.25f, 0.25f, 0.0f, 0.0f };
+    return {
+        &state, state.crossfeed_delay_i, separation_n, channel_count >= 2,
+        audio_lanes_load(direct_gain),
+        audio_lanes_load(opposite_gain),
+        audio_lanes_load(delayed_gain),
+    };
+}
+
+static const auto reference_hz = 1000;
+
+struct ToneSource
+{
+    double* phase_state;
+    double phase;
+    double phase_delta;
+    double amp;
+
+    template <int G> void process(AudioFrame<G>* frame, int)
+    {
+        auto const y = audio_lanes_set1(float(amp * std::sin(TAU*phase)));
+        for (int g = 0; g < G; ++g) frame->groups[g] = y;
+        phase += phase_delta;
+        if (phase >= 1.0) phase -= 1.0;
+    }
+
+    void finish() { *phase_state = phase; }
+};
+
+static ToneSource tone_source_make(double* phase, double hz)
+{
+    return { phase, *phase, hz / 48000.0, db_to_amp(-20.0) };
+}
+
+// main fade, towards the target of the last fade event
+struct FadeStage
+{
+    AudioDspStateStable* stable;
+    double amp;
+    double amp_target;
+    double amp_inc;
+    uint64_t fade_remaining_samples;
+
+    template <int G> void process(AudioFrame<G>* frame, int)
+    {
+        auto const gain = audio_lanes_set1(float(amp));
+        for (int g = 0; g < G; ++g) frame->groups[g] = frame->groups[g] * gain;
+        if (fade_remaining_samples == 0) {
+            amp = amp_target;
+        } else {
+            amp += amp_inc;
+            --fade_remaining_samples;
+        }
+    }
+
+    void finish()
+    {
+        stable->amp = amp;
+        stable->fade_remaining_samples = fade_remaining_samples;
+    }
+};
+
+static FadeStage fade_make(AudioDspStateStable* _stable)
+{
+    auto& stable = *_stable;
+    FadeStage result;
+    result.stable = &stable;
+    result.amp = stable.amp;
+    result.amp_target = stable.amp_target;
+    result.fade_remaining_samples = stable.fade_remaining_samples;
+    result.amp_inc = 0.0;
+    if (result.fade_remaining_samples != 0) {
+        result.amp_inc = (result.amp_target - result.amp) / double(result.fade_remaining_samples);
+    }
+    return result;
+}
+
+// Mixes the chime into every speaker, after the fade so that it rings
+// through the end of a session.
+struct ChimeStage
+{
+    AudioDspStateStable* stable;
+    float const* samples;
+    int sample_count;
+    int position;
+    int start_i; // frame of the block where the chime starts, or -1
+
+    template <int G> void process(AudioFrame<G>* frame, int frame_i)
+    {
+        if (frame_i == start_i) position = 0;
+        if (position < 0) return;
+        auto const y = audio_lanes_set1(samples[position]);
+        for (int g = 0; g < G; ++g) frame->groups[g] = frame->groups[g] + y;
+        if (++position == sample_count) position = -1;
+    }
+
+    void finish() { stable->chime_position = position; }
+};
+
+static ChimeStage chime_make(AudioDspStateStable* _stable, AudioDspBlock const& block, int frame_count)
+{
+    auto& stable = *_stable;
+    ChimeStage result = {
+        &stable, block.chime_samples, block.chime_frame_count, stable.chime_position, -1
+    };
+    auto const block_end_frame = block.frame_position + frame_count;
+    if (stable.chime_is_pending && stable.chime_start_frame < block_end_frame) {
+        // late events start with the block
+        result.start_i = stable.chime_start_frame > block.frame_position ?
+            int(stable.chime_start_frame - block.frame_position) : 0;
+        stable.chime_is_pending = false;
+    }
+    return result;
+}
+
+// Writes interleaved frames for the device, speakers we do not render
+// being silent.
+struct InterleavedSink
+{
+    float* frames;
+    int channel_count;
+
+    template <int G> void process(AudioFrame<G>* frame, int frame_i)
+    {
+        float x[AUDIO_LANES*G];
+        for (int g = 0; g < G; ++g) audio_lanes_store(&x[AUDIO_LANES*g], frame->groups[g]);
+        auto const dst = frames + frame_i*channel_count;
+        int channel_i = 0;
+        for (; channel_i < channel_count && channel_i < AUDIO_LANES*G; ++channel_i) {
+            dst[channel_i] = x[channel_i];
+        }
+        for (; channel_i < channel_count; ++channel_i) dst[channel_i] = 0.0f;
+    }
+
+    void finish() {}
+};
+
+// # Chains
+//
+// Each audio mode is a chain instantiation, for 1 or 2 groups of lanes.
+
+// NOTE(nicolas): fused wins on every chain we have (see
+// bench_dsp_execution): 1.1-1.8x for the noise, with stereo and 7.1, and
+// about 1.1x for the reference tone. Staged stays, for comparison.
+enum AudioDspExecution
+{
+    AudioDspExecution_Fused,
+    AudioDspExecution_Staged, // for comparison
+};
+static int global_audio_dsp_execution = AudioDspExecution_Fused;
+
+template <int G, typename Chain>
+static void audio_chain_run(AudioDspState* _state, Chain chain, int frame_count)
+{
+    auto& state = *_state;
+    if (global_audio_dsp_execution == AudioDspExecution_Staged) {
+        auto const scratch = reinterpret_cast<AudioFrame<G>*>(state.staged_lanes);
+        dsp_run_staged<G>(&chain, scratch, frame_count);
+    } else {
+        dsp_run_fused<G>(&chain, frame_count);
+    }
+}
+
+// `frame_count` <= AUDIO_CHUNK_FRAMES, from block.frame_position
+typedef void AudioChainProc(AudioDspState*, AudioDspBlock const& block,
+                            float* frames, int channel_count, int frame_count);
+
+template <int G>
+static void noise_chain_n(AudioDspState* _state, AudioDspBlock const& block,
+                          float* frames, int channel_count, int frame_count)
+{
+    auto& state = *_state;
+    auto const noise = noise_source_make(&state.noise, pink_noise_filter_pk3, channel_count);
+    auto const crossfeed = crossfeed_make(&state, block.separation_ms,
+                                          48000.0, channel_count);
+    auto const fade = fade_make(&state.stable);
+    auto const chime = chime_make(&state.stable, block, frame_count);
+    auto const sink = InterleavedSink{ frames, channel_count };
+    audio_chain_run<G>(&state, dsp_chain(noise, crossfeed, fade, chime, sink), frame_count);
+}
+
+template <int G>
+static void reference_tone_chain_n(AudioDspState* _state, AudioDspBlock const& block,
+                                   float* frames, int channel_count, int frame_count)
+{
+    auto& state = *_state;
+    auto const chain = dsp_chain(tone_source_make(&state.tone_phase, reference_hz),
+                                 fade_make(&state.stable),
+                                 chime_make(&state.stable, block, frame_count),
+                                 InterleavedSink{ frames, channel_count });
+    audio_chain_run<G>(&state, chain, frame_count);
+}
+
+static AudioChainProc* const audio_chains[AudioMode_Last][AUDIO_GROUP_MAX] = {
+    { noise_chain_n<1>, noise_chain_n<2> },
+#if UU_FOCUS_INTERNAL
+    { reference_tone_chain_n<1>, reference_tone_chain_n<2> },
+#endif
+};
+static_assert(AUDIO_GROUP_MAX == 2, "one chain instantiation per group count");
+
+static void audio_dsp_events_apply(AudioDspStateStable* _stable, AudioDspBlock const& block)
+{
+    auto& stable = *_stable;
+    for (int event_i = 0; event_i < block.event_count; ++event_i) {
+        auto const& event = block.events[event_i];
+        switch (event.type) {
+            case AudioEventType_Fade: {
+                stable.amp_target = event.amp_target;
+                stable.fade_remaining_samples = event.fade_frame_count;
+            } break;
+            case AudioEventType_Chime: {
+                stable.chime_is_pending = true;
+                stable.chime_start_frame = event.frame;
+            } break;
+            case AudioEventType_ChimeCancel: {
+                stable.chime_is_pending = false;
+            } break;
+            case AudioEventType_DspSwap: break;
+            case AudioEventType_Prewarm: break;
+            case AudioEventType_Ticks: break;
+            case AudioEventType_TicksCancel: break;
+        }
+    }
+}
+
+UU_FOCUS_AUDIO_DSP_RENDER_PROC(audio_dsp_render)
+{
+    auto& stable = state->stable;
+    if (channel_count <= 0) return;
+    audio_dsp_events_apply(&stable, *block);
+
+    bool const is_silent = stable.fade_remaining_samples == 0 && stable.amp_target == 0.0 &&
+        stable.chime_position < 0 &&
+        !(stable.chime_is_pending &&
+          stable.chime_start_frame < block->frame_position + frame_count);
+    if (is_silent && !block->is_warming) {
+        stable.amp = 0.0; // the end of the fade may have left it a hair above
+        memset(frames, 0, frame_count * channel_count * sizeof(float));
+        return;
+    }
+
+    // speakers beyond what we support are kept silent by the sink
+    int const rendered_channel_count =
+        channel_count < AUDIO_CHANNEL_MAX ? channel_count : int(AUDIO_CHANNEL_MAX);
+    int const group_count = (rendered_channel_count + AUDIO_LANES - 1) / AUDIO_LANES;
+    int mode = block->mode;
+    if (mode < 0 || mode >= AudioMode_Last) mode = AudioMode_Noise;
+    auto const chain = audio_chains[mode][group_count - 1];
+
+    auto chunk = *block;
+    while (frame_count > 0) {
+        int const chunk_frame_count =
+            frame_count < AUDIO_CHUNK_FRAMES ? frame_count : int(AUDIO_CHUNK_FRAMES);
+        chain(state, chunk, frames, channel_count, chunk_frame_count);
+        chunk.frame_position += chunk_frame_count;
+        frames += chunk_frame_count * channel_count;
+        frame_count -= chunk_frame_count;
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#define UU_FOCUS_AUDIO_MODULE
+
+/*
+ * The dsp code of the effects, as a module that may be replaced while the
+ * audio plays (see win32_unit_uu_focus_audio.cpp).
+ *
+ * The module keeps its state in an AudioDspState, allocated by the host
+ * with AUDIO_DSP_STATE_CAPACITY bytes. When the code is replaced, the new
+ * code initializes its own state from the state of the old code, then
+ * both render for a short crossfade.
+ *
+ * The state starts with AudioDspStateStable, whose layout every version
+ * keeps. Changing the layout of the rest bumps AUDIO_DSP_STATE_VERSION:
+ * the handover then only carries over the stable part.
+ */
+
+#include <stdint.h>
+
+enum AudioMode {
+    AudioMode_Noise,
+#if UU_FOCUS_INTERNAL
+    AudioMode_ReferenceTone,
+#endif
+    AudioMode_Last,
+};
+
+struct AudioDspState;
+struct AudioDspBlock;
+
+#define UU_FOCUS_AUDIO_DSP_RENDER_PROC(name_expr) \
+  void name_expr(AudioDspState* state, \
+                 AudioDspBlock const* block, \
+                 float* frames, \
+                 int channel_count, \
+                 int frame_count)
+
+// Initializes `dst` from `src`, the state of any version of the code, or
+// a fresh state when `src` is null. `seed` seeds the noise of fresh states.
+#define UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(name_expr) \
+  void name_expr(AudioDspState* dst, AudioDspState const* src, uint32_t seed)
+
+typedef UU_FOCUS_AUDIO_DSP_RENDER_PROC(AudioDspRenderProc);
+typedef UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(AudioDspHandoverProc);
+
+struct AudioDspProcs
+{
+    AudioDspRenderProc* render;
+    AudioDspHandoverProc* handover;
+};
+
+// the code built into the program:
+UU_FOCUS_AUDIO_DSP_RENDER_PROC(audio_dsp_render);
+UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(audio_dsp_handover);
+
+enum AudioEventType
+{
+    AudioEventType_Fade,
+    AudioEventType_Chime,
+    AudioEventType_ChimeCancel,
+    AudioEventType_DspSwap, // handled by the host
+    AudioEventType_Prewarm, // handled by the host
+    AudioEventType_Ticks, // handled by the host
+    AudioEventType_TicksCancel, // handled by the host
+};
+
+struct AudioEvent
+{
+    AudioEventType type;
+    uint64_t frame; // when it happens, on the audio clock
+    uint64_t sent_micros; // on the now_micros() clock
+    double amp_target; // Fade
+    uint64_t fade_frame_count; // Fade
+    uint64_t end_micros; // Ticks, on the now_micros() clock
+    AudioDspProcs dsp; // DspSwap
+};
+
+// What the host hands to the dsp for one block.
+struct AudioDspBlock
+{
+    uint64_t frame_position; // of the first frame
+    AudioEvent const* events; // to apply before rendering
+    int event_count;
+    float const* chime_samples;
+    int chime_frame_count;
+    int mode;
+    double separation_ms;
+    // to render even when silent, so that the code and its state are
+    // ready for when the audio starts
+    int is_warming;
+};
+
+enum {
+    AUDIO_DSP_STATE_VERSION = 3, /* 3: crossfeed delay of lanes */
+    AUDIO_DSP_STATE_CAPACITY = 64*1024,
+};
+
+struct AudioDspStateStable
+{
+    uint32_t version;
+    uint32_t size;
+    double amp;
+    double amp_target;
+    uint64_t fade_remaining_samples;
+    uint64_t chime_start_frame;
+    int32_t chime_is_pending;
+    int32_t chime_position; // -1 when silent
+};
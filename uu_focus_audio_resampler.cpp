@@ -0,0 +1,211 @@
+// @language: c++14
+#include "uu_focus_audio_resampler.hpp"
+
+#include "uu_focus_dsp.hpp"
+#include "uu_focus_effects.hpp"
+
+#include <cmath>
+
+enum {
+    AUDIO_RESAMPLER_FRACTION_BITS = 32, // of the position between two input frames
+    AUDIO_RESAMPLER_PHASE_BITS = 8, // log2(AUDIO_RESAMPLER_PHASE_N)
+};
+static_assert(1 << AUDIO_RESAMPLER_PHASE_BITS == AUDIO_RESAMPLER_PHASE_N,
+              "AUDIO_RESAMPLER_PHASE_BITS");
+static_assert(AUDIO_RESAMPLER_TAPS % AUDIO_LANES == 0, "AUDIO_RESAMPLER_TAPS");
+
+// of the kaiser window, for ~90dB of stopband attenuation
+static constexpr double AUDIO_RESAMPLER_STOPBAND_DB = 90.0;
+
+struct AudioResampler
+{
+    int channel_count;
+    int input_hz;
+    int output_hz;
+    double ratio; // input frames per output frame, nominal
+    uint64_t step; // of the position, per output frame
+    // of the next output frame, in input frames past the center of the
+    // filter, with AUDIO_RESAMPLER_FRACTION_BITS bits of fraction. Whole
+    // frames are inputs to consume before it.
+    uint64_t position;
+
+    // phases[p][t]: tap t of the output at p/AUDIO_RESAMPLER_PHASE_N of the
+    // way between two inputs, applied to the t-th oldest of the last
+    // AUDIO_RESAMPLER_TAPS inputs. One more phase closes the last interval.
+    float* phases;
+
+    // input history of each channel, written twice so that the most recent
+    // inputs are always contiguous from history_i.
+    int history_i;
+    float history[AUDIO_CHANNEL_MAX][2*AUDIO_RESAMPLER_TAPS];
+};
+
+static double audio_resampler_bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (0.5*x/k) * (0.5*x/k);
+        sum += term;
+        if (term < sum * 1e-17) break;
+    }
+    return sum;
+}
+
+static void audio_resampler_phases_make(float* phases, double ratio)
+{
+    int const tap_n = AUDIO_RESAMPLER_TAPS;
+    double const pi = 3.1415926535897932384626;
+    double const beta = 0.1102 * (AUDIO_RESAMPLER_STOPBAND_DB - 8.7);
+    double const window_norm = 1.0 / audio_resampler_bessel_i0(beta);
+    // NOTE(nicolas): the transition band of the window ends at the nyquist
+    // frequency of the slower side: relative to the input nyquist frequency
+    double const transition = 2.0 * (AUDIO_RESAMPLER_STOPBAND_DB - 7.95) / (14.36 * tap_n);
+    double const stop = ratio > 1.0 ? 1.0 / ratio : 1.0;
+    double const cutoff = stop - 0.5 * transition;
+    double const half_width = 0.5 * tap_n;
+
+    for (int p = 0; p <= AUDIO_RESAMPLER_PHASE_N; ++p) {
+        auto const row = phases + p*tap_n;
+        double const fraction = double(p) / AUDIO_RESAMPLER_PHASE_N;
+        double sum = 0.0;
+        for (int t = 0; t < tap_n; ++t) {
+            // from the output frame, in input frames
+            double const x = double(t) - (half_width - 1.0) - fraction;
+            double const u = x / half_width;
+            double const w = u*u < 1.0 ?
+                audio_resampler_bessel_i0(beta * std::sqrt(1.0 - u*u)) * window_norm : 0.0;
+            double const y = pi * cutoff * x;
+            double const sinc = y == 0.0 ? 1.0 : std::sin(y) / y;
+            double const h = cutoff * sinc * w;
+            row[t] = float(h);
+            sum += h;
+        }
+        // unity dc gain for every phase
+        for (int t = 0; t < tap_n; ++t) row[t] = float(row[t] / sum);
+    }
+}
+
+AudioResampler* audio_resampler_make(int channel_count, int input_hz, int output_hz)
+{
+    auto _resampler = new AudioResampler();
+    auto& resampler = *_resampler;
+    resampler.channel_count = channel_count;
+    resampler.input_hz = input_hz;
+    resampler.output_hz = output_hz;
+    resampler.ratio = double(input_hz) / double(output_hz);
+    resampler.phases = new float[(AUDIO_RESAMPLER_PHASE_N + 1)*AUDIO_RESAMPLER_TAPS];
+    audio_resampler_phases_make(resampler.phases, resampler.ratio);
+    audio_resampler_set_drift(&resampler, 0.0);
+    audio_resampler_reset(&resampler);
+    return _resampler;
+}
+
+void audio_resampler_destroy(AudioResampler* _resampler)
+{
+    auto& resampler = *_resampler;
+    delete[] resampler.phases;
+    delete &resampler;
+}
+
+int audio_resampler_channel_count(AudioResampler const* resampler)
+{
+    return resampler->channel_count;
+}
+
+int audio_resampler_input_hz(AudioResampler const* resampler)
+{
+    return resampler->input_hz;
+}
+
+int audio_resampler_output_hz(AudioResampler const* resampler)
+{
+    return resampler->output_hz;
+}
+
+void audio_resampler_reset(AudioResampler* _resampler)
+{
+    auto& resampler = *_resampler;
+    resampler.position = 0;
+    resampler.history_i = 0;
+    for (auto& channel_history : resampler.history) {
+        for (auto& x : channel_history) x = 0.0f;
+    }
+}
+
+void audio_resampler_set_drift(AudioResampler* _resampler, double drift)
+{
+    auto& resampler = *_resampler;
+    if (drift > AUDIO_RESAMPLER_DRIFT_MAX) drift = AUDIO_RESAMPLER_DRIFT_MAX;
+    if (drift < -AUDIO_RESAMPLER_DRIFT_MAX) drift = -AUDIO_RESAMPLER_DRIFT_MAX;
+    resampler.step = uint64_t(std::llround(std::ldexp(resampler.ratio * (1.0 + drift),
+                                                      AUDIO_RESAMPLER_FRACTION_BITS)));
+}
+
+uint32_t audio_resampler_input_count(AudioResampler const* _resampler, uint32_t frame_count)
+{
+    auto& resampler = *_resampler;
+    if (frame_count == 0) return 0;
+    return uint32_t((resampler.position + (frame_count - 1)*resampler.step) >>
+                    AUDIO_RESAMPLER_FRACTION_BITS);
+}
+
+void audio_resampler_process(AudioResampler* _resampler, float const* input,
+                             float* output, uint32_t frame_count)
+{
+    auto& resampler = *_resampler;
+    int const tap_n = AUDIO_RESAMPLER_TAPS;
+    int const channel_count = resampler.channel_count;
+    uint64_t const one = uint64_t(1) << AUDIO_RESAMPLER_FRACTION_BITS;
+    int const weight_bits = AUDIO_RESAMPLER_FRACTION_BITS - AUDIO_RESAMPLER_PHASE_BITS;
+    float const weight_scale = 1.0f / float(uint32_t(1) << weight_bits);
+    auto position = resampler.position;
+    auto history_i = resampler.history_i;
+
+    for (uint32_t frame_i = 0; frame_i < frame_count; ++frame_i) {
+        for (; position >= one; position -= one) {
+            for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+                auto& history = resampler.history[channel_i];
+                history[history_i] = history[history_i + tap_n] = input[channel_i];
+            }
+            input += channel_count;
+            history_i = history_i + 1 == tap_n ? 0 : history_i + 1;
+        }
+
+        // taps for this position, between two tabulated phases
+        auto const fraction = uint32_t(position);
+        auto const phase_i = fraction >> weight_bits;
+        auto const weight = float(fraction & ((uint32_t(1) << weight_bits) - 1)) * weight_scale;
+        auto const row0 = resampler.phases + phase_i*tap_n;
+        auto const row1 = row0 + tap_n;
+        auto const w0 = audio_lanes_set1(1.0f - weight);
+        auto const w1 = audio_lanes_set1(weight);
+        float taps[AUDIO_RESAMPLER_TAPS];
+        for (int t = 0; t < tap_n; t += AUDIO_LANES) {
+            audio_lanes_store(taps + t, audio_lanes_load(row0 + t)*w0 +
+                              audio_lanes_load(row1 + t)*w1);
+        }
+
+        for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+            auto const history = resampler.history[channel_i] + history_i;
+            auto sum = audio_lanes_set1(0.0f);
+            for (int t = 0; t < tap_n; t += AUDIO_LANES) {
+                sum = sum + audio_lanes_load(history + t)*audio_lanes_load(taps + t);
+            }
+            float lanes[AUDIO_LANES];
+            audio_lanes_store(lanes, sum);
+            output[channel_i] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+        output += channel_count;
+        position += resampler.step;
+    }
+    resampler.position = position;
+    resampler.history_i = history_i;
+}
+
+double audio_resampler_delay_micros(AudioResampler const* _resampler)
+{
+    auto& resampler = *_resampler;
+    // to the center of the filter, half a frame past it on average
+    return 1e6 * (0.5*AUDIO_RESAMPLER_TAPS - 0.5) / resampler.input_hz;
+}
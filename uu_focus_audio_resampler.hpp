@@ -0,0 +1,53 @@
+#pragma once
+#define UU_FOCUS_AUDIO_RESAMPLER
+
+/*
+ * Sample rate conversion, so that we render at our own rate whatever
+ * rate the device plays at.
+ *
+ * A polyphase windowed sinc: the kaiser windowed sinc is tabulated for
+ * AUDIO_RESAMPLER_PHASE_N positions between two input frames, and an
+ * output frame falling between two tabulated positions interpolates their
+ * taps. Any ratio works, and it may drift a little around its nominal
+ * value without rebuilding the tables, to follow another clock.
+ *
+ * The low-pass stops below the lower of the two nyquist frequencies, so
+ * that nothing aliases back into the output.
+ */
+
+#include <stdint.h>
+
+enum {
+    AUDIO_RESAMPLER_TAPS = 64, // per output frame, a multiple of 4
+    AUDIO_RESAMPLER_PHASE_N = 256,
+};
+
+// the most the ratio may drift from its nominal value
+static constexpr double AUDIO_RESAMPLER_DRIFT_MAX = 0.005;
+
+struct AudioResampler;
+
+AudioResampler* audio_resampler_make(int channel_count, int input_hz, int output_hz);
+void audio_resampler_destroy(AudioResampler*);
+int audio_resampler_channel_count(AudioResampler const*);
+int audio_resampler_input_hz(AudioResampler const*);
+int audio_resampler_output_hz(AudioResampler const*);
+
+// forgets the past input, as for a new stream
+void audio_resampler_reset(AudioResampler*);
+
+// Consumes the input (1 + drift) times as fast as the nominal ratio says,
+// with drift clamped to AUDIO_RESAMPLER_DRIFT_MAX. Takes effect from the
+// next output frame on.
+void audio_resampler_set_drift(AudioResampler*, double drift);
+
+// input frames that make the next `frame_count` output frames
+uint32_t audio_resampler_input_count(AudioResampler const*, uint32_t frame_count);
+
+// Resamples interleaved frames: `input` holds audio_resampler_input_count
+// frames for the `frame_count` frames of `output`.
+void audio_resampler_process(AudioResampler*, float const* input,
+                             float* output, uint32_t frame_count);
+
+// between an input frame and the output frame it is heard in
+double audio_resampler_delay_micros(AudioResampler const*);
@@ -0,0 +1,270 @@
+// @language: c++14
+#include "uu_focus_audio_ring.hpp"
+
+#include "uu_focus_effects.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// # Ring
+
+struct AudioRing
+{
+    int channel_count;
+    uint32_t frame_capacity;
+    float* samples;
+
+    // each on its own cache line, written by one side only
+    char padding0[64];
+    std::atomic<uint64_t> write_frame_n;
+    char padding1[64 - sizeof(uint64_t)];
+    std::atomic<uint64_t> read_frame_n;
+    uint64_t underrun_n;
+    uint64_t underrun_frame_n;
+    char padding2[64 - 3*sizeof(uint64_t)];
+};
+
+AudioRing* audio_ring_make(int channel_count, uint32_t frame_capacity)
+{
+    auto _ring = new AudioRing();
+    auto& ring = *_ring;
+    ring.channel_count = channel_count;
+    ring.frame_capacity = frame_capacity;
+    ring.samples = new float[size_t(channel_count)*frame_capacity]();
+    return _ring;
+}
+
+void audio_ring_destroy(AudioRing* _ring)
+{
+    auto& ring = *_ring;
+    delete[] ring.samples;
+    delete &ring;
+}
+
+int audio_ring_channel_count(AudioRing const* ring)
+{
+    return ring->channel_count;
+}
+
+uint32_t audio_ring_write_available(AudioRing const* _ring)
+{
+    auto& ring = *_ring;
+    auto const write_frame_n = ring.write_frame_n.load(std::memory_order_relaxed);
+    auto const read_frame_n = ring.read_frame_n.load(std::memory_order_seq_cst);
+    return ring.frame_capacity - uint32_t(write_frame_n - read_frame_n);
+}
+
+uint32_t audio_ring_read_available(AudioRing const* _ring)
+{
+    auto& ring = *_ring;
+    auto const write_frame_n = ring.write_frame_n.load(std::memory_order_acquire);
+    auto const read_frame_n = ring.read_frame_n.load(std::memory_order_relaxed);
+    return uint32_t(write_frame_n - read_frame_n);
+}
+
+float* audio_ring_write_begin(AudioRing* _ring, uint32_t* _frame_count)
+{
+    auto& ring = *_ring;
+    auto const write_i = uint32_t(ring.write_frame_n.load(std::memory_order_relaxed) %
+                                  ring.frame_capacity);
+    auto frame_count = *_frame_count;
+    auto const available = audio_ring_write_available(&ring);
+    if (frame_count > available) frame_count = available;
+    if (frame_count > ring.frame_capacity - write_i) frame_count = ring.frame_capacity - write_i;
+    *_frame_count = frame_count;
+    return ring.samples + size_t(write_i)*ring.channel_count;
+}
+
+void audio_ring_write_end(AudioRing* _ring, uint32_t frame_count)
+{
+    auto& ring = *_ring;
+    auto const write_frame_n = ring.write_frame_n.load(std::memory_order_relaxed);
+    ring.write_frame_n.store(write_frame_n + frame_count, std::memory_order_release);
+}
+
+void audio_ring_read(AudioRing* _ring, float* frames, uint32_t frame_count)
+{
+    auto& ring = *_ring;
+    auto const channel_count = ring.channel_count;
+    auto read_frame_n = ring.read_frame_n.load(std::memory_order_relaxed);
+    auto const available = audio_ring_read_available(&ring);
+    auto const copied_frame_count = frame_count < available ? frame_count : available;
+
+    // in at most two parts, around the end of the ring
+    uint32_t copied = 0;
+    while (copied < copied_frame_count) {
+        auto const read_i = uint32_t((read_frame_n + copied) % ring.frame_capacity);
+        auto n = copied_frame_count - copied;
+        if (n > ring.frame_capacity - read_i) n = ring.frame_capacity - read_i;
+        std::memcpy(frames + size_t(copied)*channel_count,
+                    ring.samples + size_t(read_i)*channel_count,
+                    sizeof(float)*channel_count*n);
+        copied += n;
+    }
+    if (copied_frame_count < frame_count) {
+        auto const missing = frame_count - copied_frame_count;
+        std::memset(frames + size_t(copied_frame_count)*channel_count, 0,
+                    sizeof(float)*channel_count*missing);
+        ++ring.underrun_n;
+        ring.underrun_frame_n += missing;
+    }
+    // NOTE(nicolas): the silence delays what the producer renders next,
+    // rather than skipping it.
+    ring.read_frame_n.store(read_frame_n + copied_frame_count, std::memory_order_seq_cst);
+}
+
+AudioRingStats audio_ring_stats(AudioRing const* _ring)
+{
+    auto& ring = *_ring;
+    AudioRingStats stats;
+    stats.read_frame_n = ring.read_frame_n.load(std::memory_order_relaxed) + ring.underrun_frame_n;
+    stats.underrun_n = ring.underrun_n;
+    stats.underrun_frame_n = ring.underrun_frame_n;
+    return stats;
+}
+
+// # Render ahead
+
+struct AudioRenderAhead
+{
+    AudioEffect* audio;
+    AudioRing* ring;
+    uint32_t block_frames;
+    std::thread thread;
+
+    // the dsp thread waits for room, the device thread for the dsp thread
+    std::mutex mutex;
+    std::condition_variable room_available;
+    std::condition_variable producer_awake;
+    std::atomic<bool> is_producer_waiting;
+    std::atomic<bool> is_producer_parked;
+    uint64_t producer_wakeup_n; // under `mutex`
+    std::atomic<bool> must_quit;
+    // audio frame of the first frame written to the ring, as if it had
+    // always been written in order: it moves as the audio thread parks
+    std::atomic<uint64_t> frame_offset;
+};
+
+static void audio_render_ahead_wake_consumer(AudioRenderAhead* _ahead)
+{
+    auto& ahead = *_ahead;
+    {
+        std::lock_guard<std::mutex> lock(ahead.mutex);
+        ++ahead.producer_wakeup_n;
+    }
+    ahead.producer_awake.notify_one();
+}
+
+static void audio_render_ahead_main(AudioRenderAhead* _ahead)
+{
+    auto& ahead = *_ahead;
+    auto& ring = *ahead.ring;
+    auto const channel_count = audio_ring_channel_count(&ring);
+    while (!ahead.must_quit.load(std::memory_order_relaxed)) {
+        if (audio_ring_write_available(&ring) < ahead.block_frames) {
+            ahead.is_producer_waiting.store(true, std::memory_order_seq_cst);
+            std::unique_lock<std::mutex> lock(ahead.mutex);
+            ahead.room_available.wait(lock, [&]() {
+                return ahead.must_quit.load(std::memory_order_relaxed) ||
+                    audio_ring_write_available(&ring) >= ahead.block_frames;
+            });
+            ahead.is_producer_waiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        auto const frame_offset = audio_thread_frame_position(ahead.audio) -
+            ring.write_frame_n.load(std::memory_order_relaxed);
+        if (frame_offset != ahead.frame_offset.load(std::memory_order_relaxed)) {
+            ahead.frame_offset.store(frame_offset, std::memory_order_relaxed);
+        }
+        auto frame_count = ahead.block_frames;
+        auto const frames = audio_ring_write_begin(&ring, &frame_count);
+        audio_thread_render(ahead.audio, frames, channel_count, int(frame_count));
+        audio_ring_write_end(&ring, frame_count);
+
+        if (audio_thread_is_silent(ahead.audio)) {
+            ahead.is_producer_parked.store(true, std::memory_order_seq_cst);
+            audio_thread_park(ahead.audio);
+            ahead.is_producer_parked.store(false, std::memory_order_seq_cst);
+            audio_render_ahead_wake_consumer(&ahead);
+        }
+    }
+}
+
+AudioRenderAhead* audio_render_ahead_make(AudioEffect* audio, int channel_count,
+                                          uint32_t depth_frames, uint32_t block_frames)
+{
+    auto _ahead = new AudioRenderAhead();
+    auto& ahead = *_ahead;
+    ahead.audio = audio;
+    ahead.ring = audio_ring_make(channel_count, depth_frames);
+    ahead.block_frames = block_frames < depth_frames ? block_frames : depth_frames;
+    ahead.thread = std::thread(audio_render_ahead_main, _ahead);
+    return _ahead;
+}
+
+void audio_render_ahead_destroy(AudioRenderAhead* _ahead)
+{
+    auto& ahead = *_ahead;
+    {
+        std::lock_guard<std::mutex> lock(ahead.mutex);
+        ahead.must_quit.store(true, std::memory_order_relaxed);
+    }
+    ahead.room_available.notify_one();
+    audio_thread_unpark(ahead.audio);
+    ahead.thread.join();
+    audio_ring_destroy(ahead.ring);
+    delete &ahead;
+}
+
+AudioRing* audio_render_ahead_ring(AudioRenderAhead* ahead)
+{
+    return ahead->ring;
+}
+
+void audio_render_ahead_read(AudioRenderAhead* _ahead, float* frames, uint32_t frame_count)
+{
+    auto& ahead = *_ahead;
+    audio_ring_read(ahead.ring, frames, frame_count);
+    // NOTE(nicolas): only ever takes the lock when the dsp thread sleeps
+    if (ahead.is_producer_waiting.load(std::memory_order_seq_cst) &&
+        audio_ring_write_available(ahead.ring) >= ahead.block_frames) {
+        { std::lock_guard<std::mutex> lock(ahead.mutex); }
+        ahead.room_available.notify_one();
+    }
+}
+
+void audio_render_ahead_heard(AudioRenderAhead* _ahead, uint64_t micros, uint32_t queued_frames)
+{
+    auto& ahead = *_ahead;
+    auto& ring = *ahead.ring;
+    // NOTE(nicolas): the offset moves as the audio thread wakes up, maybe
+    // before we read the frames written before. Those are the silence it
+    // parked on, and audio_thread_heard ignores a few observations off.
+    auto const read_frame =
+        ring.read_frame_n.load(std::memory_order_relaxed) +
+        ahead.frame_offset.load(std::memory_order_relaxed);
+    audio_thread_heard(ahead.audio, read_frame - queued_frames, micros);
+}
+
+bool audio_render_ahead_is_idle(AudioRenderAhead* _ahead)
+{
+    auto& ahead = *_ahead;
+    return ahead.is_producer_parked.load(std::memory_order_seq_cst) &&
+        audio_ring_read_available(ahead.ring) == 0;
+}
+
+void audio_render_ahead_wait(AudioRenderAhead* _ahead)
+{
+    auto& ahead = *_ahead;
+    std::unique_lock<std::mutex> lock(ahead.mutex);
+    // NOTE(nicolas): it may have parked again by the time we look
+    auto const wakeup_n = ahead.producer_wakeup_n;
+    ahead.producer_awake.wait(lock, [&]() {
+        return !ahead.is_producer_parked.load(std::memory_order_seq_cst) ||
+            ahead.producer_wakeup_n != wakeup_n ||
+            ahead.must_quit.load(std::memory_order_relaxed);
+    });
+}
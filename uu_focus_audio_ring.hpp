@@ -0,0 +1,72 @@
+#pragma once
+#define UU_FOCUS_AUDIO_RING
+
+/*
+ * Rendering ahead of the device.
+ *
+ * A dsp thread renders the audio into a ring of interleaved float frames,
+ * as far ahead as the ring is deep. The device thread only copies frames
+ * out of it, so that it stays cheap, while the depth of the ring absorbs
+ * the hiccups of the dsp thread.
+ */
+
+#include <stdint.h>
+
+// # Ring
+//
+// Lock-free, for a single producer and a single consumer.
+
+struct AudioRing;
+
+AudioRing* audio_ring_make(int channel_count, uint32_t frame_capacity);
+void audio_ring_destroy(AudioRing*);
+int audio_ring_channel_count(AudioRing const*);
+
+// frames the producer may write, resp. the consumer may read
+uint32_t audio_ring_write_available(AudioRing const*);
+uint32_t audio_ring_read_available(AudioRing const*);
+
+// Producer: contiguous room for at most `*frame_count` frames, that it
+// writes then commits with audio_ring_write_end.
+float* audio_ring_write_begin(AudioRing*, uint32_t* frame_count);
+void audio_ring_write_end(AudioRing*, uint32_t frame_count);
+
+// Consumer: copies `frame_count` frames out of the ring. Frames the ring
+// does not hold yet are delivered silent, and counted as an underrun.
+void audio_ring_read(AudioRing*, float* frames, uint32_t frame_count);
+
+struct AudioRingStats
+{
+    uint64_t read_frame_n; // including the silent ones
+    uint64_t underrun_n; // reads that came short
+    uint64_t underrun_frame_n; // silent frames delivered
+};
+
+AudioRingStats audio_ring_stats(AudioRing const*);
+
+// # Render ahead
+
+struct AudioEffect;
+struct AudioRenderAhead;
+
+// Starts a dsp thread rendering `audio` in blocks of `block_frames` into a
+// ring of `depth_frames`. It is now the audio thread of `audio`, which
+// parks while the audio is silent.
+AudioRenderAhead* audio_render_ahead_make(AudioEffect* audio, int channel_count,
+                                          uint32_t depth_frames, uint32_t block_frames);
+void audio_render_ahead_destroy(AudioRenderAhead*);
+AudioRing* audio_render_ahead_ring(AudioRenderAhead*);
+
+// For the device thread: copies the next frames, waking up the dsp thread
+// once there is room for its next block.
+void audio_render_ahead_read(AudioRenderAhead*, float* frames, uint32_t frame_count);
+
+// For the device thread: tells the audio when what it read is heard, with
+// `queued_frames` of it not played yet at `micros` (see audio_thread_heard).
+void audio_render_ahead_heard(AudioRenderAhead*, uint64_t micros, uint32_t queued_frames);
+
+// True when the dsp thread is parked and the device played all it had
+// rendered: the device may stop, and its thread wait until the dsp thread
+// wakes up again.
+bool audio_render_ahead_is_idle(AudioRenderAhead*);
+void audio_render_ahead_wait(AudioRenderAhead*);
@@ -0,0 +1,192 @@
+#pragma once
+#define UU_FOCUS_DSP
+
+/*
+ * Compile-time dsp graphs.
+ *
+ * A chain of stages is declared as a type, `DspChain<A, B, C>`, and run
+ * for a block of frames either:
+ * - fused: all stages for one frame before the next frame, so that the
+ *   intermediate values stay in registers,
+ * - staged: one stage for all frames before the next stage, through a
+ *   scratch block in memory.
+ *
+ * Frames are `AudioFrame<G>`: G groups of AUDIO_LANES channels, one
+ * vector per group. A stage is any type with:
+ *
+ *   template <int G> void process(AudioFrame<G>* frame, int frame_i);
+ *   void finish(); // write back state kept in locals, at the end of a block
+ *
+ * Sources ignore the frame they are given, sinks leave it untouched.
+ */
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UU_FOCUS_DSP_SSE2 1
+#include <emmintrin.h>
+#else
+#define UU_FOCUS_DSP_SSE2 0
+#endif
+
+enum { AUDIO_LANES = 4 };
+
+// AUDIO_LANES floats, and AUDIO_LANES 32bit integers for generators:
+#if UU_FOCUS_DSP_SSE2
+struct AudioLanes { __m128 v; };
+struct AudioLanesBits { __m128i v; };
+
+inline AudioLanes audio_lanes_set1(float x) { return { _mm_set1_ps(x) }; }
+inline AudioLanes audio_lanes_load(float const* x) { return { _mm_loadu_ps(x) }; }
+inline void audio_lanes_store(float* dst, AudioLanes x) { _mm_storeu_ps(dst, x.v); }
+inline AudioLanes operator+(AudioLanes a, AudioLanes b) { return { _mm_add_ps(a.v, b.v) }; }
+inline AudioLanes operator*(AudioLanes a, AudioLanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+inline AudioLanesBits audio_lanes_bits_load(uint32_t const* x)
+{
+    return { _mm_loadu_si128(reinterpret_cast<__m128i const*>(x)) };
+}
+inline void audio_lanes_bits_store(uint32_t* dst, AudioLanesBits x)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), x.v);
+}
+inline AudioLanesBits operator^(AudioLanesBits a, AudioLanesBits b) { return { _mm_xor_si128(a.v, b.v) }; }
+inline AudioLanesBits operator<<(AudioLanesBits a, int n) { return { _mm_slli_epi32(a.v, n) }; }
+inline AudioLanesBits operator>>(AudioLanesBits a, int n) { return { _mm_srli_epi32(a.v, n) }; }
+// bits as signed integers, to float
+inline AudioLanes audio_lanes_from_int(AudioLanesBits x) { return { _mm_cvtepi32_ps(x.v) }; }
+// lanes 0,1,2,3 as 1,0,3,2
+inline AudioLanes audio_lanes_swap_pairs(AudioLanes x)
+{
+    return { _mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(2, 3, 0, 1)) };
+}
+#else
+struct AudioLanes { float x[AUDIO_LANES]; };
+struct AudioLanesBits { uint32_t x[AUDIO_LANES]; };
+
+#define UU_FOCUS_DSP_LANEWISE(result, expr) \
+    for (int lane = 0; lane < AUDIO_LANES; ++lane) { result.x[lane] = expr; }
+
+inline AudioLanes audio_lanes_set1(float x)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, x); return r;
+}
+inline AudioLanes audio_lanes_load(float const* x)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, x[lane]); return r;
+}
+inline void audio_lanes_store(float* dst, AudioLanes x)
+{
+    for (int lane = 0; lane < AUDIO_LANES; ++lane) dst[lane] = x.x[lane];
+}
+inline AudioLanes operator+(AudioLanes a, AudioLanes b)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, a.x[lane] + b.x[lane]); return r;
+}
+inline AudioLanes operator*(AudioLanes a, AudioLanes b)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, a.x[lane] * b.x[lane]); return r;
+}
+
+inline AudioLanesBits audio_lanes_bits_load(uint32_t const* x)
+{
+    AudioLanesBits r; UU_FOCUS_DSP_LANEWISE(r, x[lane]); return r;
+}
+inline void audio_lanes_bits_store(uint32_t* dst, AudioLanesBits x)
+{
+    for (int lane = 0; lane < AUDIO_LANES; ++lane) dst[lane] = x.x[lane];
+}
+inline AudioLanesBits operator^(AudioLanesBits a, AudioLanesBits b)
+{
+    AudioLanesBits r; UU_FOCUS_DSP_LANEWISE(r, a.x[lane] ^ b.x[lane]); return r;
+}
+inline AudioLanesBits operator<<(AudioLanesBits a, int n)
+{
+    AudioLanesBits r; UU_FOCUS_DSP_LANEWISE(r, a.x[lane] << n); return r;
+}
+inline AudioLanesBits operator>>(AudioLanesBits a, int n)
+{
+    AudioLanesBits r; UU_FOCUS_DSP_LANEWISE(r, a.x[lane] >> n); return r;
+}
+inline AudioLanes audio_lanes_from_int(AudioLanesBits x)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, float(int32_t(x.x[lane]))); return r;
+}
+inline AudioLanes audio_lanes_swap_pairs(AudioLanes x)
+{
+    AudioLanes r; UU_FOCUS_DSP_LANEWISE(r, x.x[lane ^ 1]); return r;
+}
+#undef UU_FOCUS_DSP_LANEWISE
+#endif
+
+template <int G>
+struct AudioFrame
+{
+    AudioLanes groups[G];
+};
+
+template <typename... Stages> struct DspChain;
+
+template <>
+struct DspChain<>
+{
+    template <int G> void process(AudioFrame<G>*, int) {}
+    template <int G> void process_block(AudioFrame<G>*, int) {}
+    void finish() {}
+};
+
+template <typename Stage, typename... Stages>
+struct DspChain<Stage, Stages...>
+{
+    Stage stage;
+    DspChain<Stages...> rest;
+
+    template <int G> void process(AudioFrame<G>* frame, int frame_i)
+    {
+        stage.process(frame, frame_i);
+        rest.process(frame, frame_i);
+    }
+
+    template <int G> void process_block(AudioFrame<G>* frames, int frame_count)
+    {
+        for (int frame_i = 0; frame_i < frame_count; ++frame_i) {
+            stage.process(&frames[frame_i], frame_i);
+        }
+        rest.process_block(frames, frame_count);
+    }
+
+    void finish()
+    {
+        stage.finish();
+        rest.finish();
+    }
+};
+
+inline DspChain<> dsp_chain() { return {}; }
+
+// Chains stages, in order.
+template <typename Stage, typename... Stages>
+DspChain<Stage, Stages...> dsp_chain(Stage stage, Stages... stages)
+{
+    return { stage, dsp_chain(stages...) };
+}
+
+template <int G, typename Chain>
+void dsp_run_fused(Chain* _chain, int frame_count)
+{
+    auto& chain = *_chain;
+    for (int frame_i = 0; frame_i < frame_count; ++frame_i) {
+        AudioFrame<G> frame;
+        chain.process(&frame, frame_i);
+    }
+    chain.finish();
+}
+
+// `scratch` holds at least frame_count frames
+template <int G, typename Chain>
+void dsp_run_staged(Chain* _chain, AudioFrame<G>* scratch, int frame_count)
+{
+    auto& chain = *_chain;
+    chain.process_block(scratch, frame_count);
+    chain.finish();
+}
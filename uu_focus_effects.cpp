@@ -2,288 +2,591 @@
 #include "uu_focus_effects.hpp"
 #include "uu_focus_effects_types.hpp"
 
+#include "uu_focus_audio_clock.hpp"
+#include "uu_focus_audio_module.hpp"
+
 #include "uu_focus_platform.hpp"
 
-#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <random>
 
-static double global_audio_amp_target = 0.0;
-static uint64_t global_audio_fade_remaining_samples = 0;
-
-enum AudioMode {
-    AudioMode_Noise,
-#if UU_FOCUS_INTERNAL
-    AudioMode_ReferenceTone,
-#endif
-    AudioMode_Last,
-};
-
-int global_audio_mode =
+std::atomic<int> global_audio_mode {
 #if UU_FOCUS_INTERNAL
     AudioMode_ReferenceTone
 #else
     AudioMode_Noise
 #endif
-    ;
+};
 int global_audio_mode_mod = AudioMode_Last;
+double global_audio_mode_crossfade_ms = 250.0;
 double global_separation_ms = 1.8;
 double global_separation_ms_min = 0.0;
 double global_separation_ms_max = 15.0;
 
-static void set_main_fade(double target, uint64_t duration_micros)
+// # Events
+//
+// The main thread talks to the audio thread through a single producer,
+// single consumer queue of events, timestamped in audio frames.
+
+enum { AUDIO_EVENT_CAPACITY = 64 /* power of two */ };
+struct AudioEventQueue
+{
+    AudioEvent events[AUDIO_EVENT_CAPACITY];
+    std::atomic<uint32_t> write_n;
+    std::atomic<uint32_t> read_n;
+    uint32_t dropped_n; // producer side
+};
+
+static bool audio_event_push(AudioEventQueue* _queue, AudioEvent event)
 {
-    global_audio_amp_target = target;
-    uint64_t micros_per_sample = 1'000'000/48000;
-    global_audio_fade_remaining_samples = duration_micros/micros_per_sample;
+    auto& queue = *_queue;
+    auto const write_n = queue.write_n.load(std::memory_order_relaxed);
+    if (write_n - queue.read_n.load(std::memory_order_acquire) == AUDIO_EVENT_CAPACITY) {
+        ++queue.dropped_n;
+        return false;
+    }
+    queue.events[write_n % AUDIO_EVENT_CAPACITY] = event;
+    queue.write_n.store(write_n + 1, std::memory_order_release);
+    return true;
 }
 
-static void audio_fade_in(uint64_t duration_micros)
+static bool audio_event_pop(AudioEventQueue* _queue, AudioEvent* _event)
 {
-    set_main_fade(1.0, duration_micros);
+    auto& queue = *_queue;
+    auto const read_n = queue.read_n.load(std::memory_order_relaxed);
+    if (read_n == queue.write_n.load(std::memory_order_acquire)) return false;
+    *_event = queue.events[read_n % AUDIO_EVENT_CAPACITY];
+    queue.read_n.store(read_n + 1, std::memory_order_release);
+    return true;
 }
 
-static void audio_fade_out(uint64_t duration_micros)
+// Position of the audio thread, published at every render so that other
+// threads may timestamp their events in frames.
+struct AudioClock
 {
-    set_main_fade(0.0, duration_micros);
+    std::atomic<uint32_t> sequence; // odd while being written
+    std::atomic<uint64_t> frame;
+    std::atomic<uint64_t> micros;
+};
+
+static void audio_clock_publish(AudioClock* _clock, uint64_t frame, uint64_t micros)
+{
+    auto& clock = *_clock;
+    auto const sequence = clock.sequence.load(std::memory_order_relaxed);
+    clock.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    clock.frame.store(frame, std::memory_order_relaxed);
+    clock.micros.store(micros, std::memory_order_relaxed);
+    clock.sequence.store(sequence + 2, std::memory_order_release);
 }
 
-void audio_start(AudioEffect*)
+// As a mapping that assumes the audio is heard as soon as it is rendered.
+static AudioClockMapping audio_clock_mapping(AudioClock const& clock)
 {
-    audio_fade_in(1'000'000);
+    uint64_t frame, clock_micros;
+    while (true) {
+        auto const sequence = clock.sequence.load(std::memory_order_acquire);
+        frame = clock.frame.load(std::memory_order_relaxed);
+        clock_micros = clock.micros.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(sequence & 1) && sequence == clock.sequence.load(std::memory_order_relaxed)) break;
+    }
+    AudioClockMapping mapping;
+    mapping.frame = frame;
+    mapping.micros = double(clock_micros);
+    mapping.period_micros = 1e6 / 48000;
+    mapping.observed_micros = 0;
+    return mapping;
 }
 
-void audio_stop(AudioEffect*)
+// Audio frame for the `micros` instant of the now_micros() clock.
+static uint64_t audio_clock_frame_at(AudioClock const& clock, uint64_t micros)
 {
-    audio_fade_out(1'000'000);
+    auto const mapping = audio_clock_mapping(clock);
+    auto const clock_micros = uint64_t(mapping.micros);
+    auto const frame = mapping.frame;
+    if (micros >= clock_micros) return frame + (micros - clock_micros)*48000/1'000'000;
+    auto const frames_ago = (clock_micros - micros)*48000/1'000'000;
+    return frames_ago < frame ? frame - frames_ago : 0;
 }
 
-static double
-db_to_amp (double volume_in_db)
+enum {
+    AUDIO_DSP_CROSSFADE_FRAMES = 1024,
+    AUDIO_MODE_CROSSFADE_FRAMES_MAX = 48000, // bounds the time spent rendering twice
+};
+
+struct AudioEffect
 {
-    return pow (exp (volume_in_db), log (10.0) / 20.0);
+    // owned by the audio thread:
+    uint64_t frame_position; // audio clock, runs on while parked
+    float chime_samples[AUDIO_CHIME_FRAME_COUNT];
+
+    AudioDspProcs dsp;
+    AudioDspState* dsp_state;
+    int mode; // rendered by dsp
+    // code or mode swapped out, rendered until the end of the crossfade
+    AudioDspProcs dsp_previous;
+    AudioDspState* dsp_previous_state; // null outside of crossfades
+    int mode_previous;
+    int crossfade_position; // -1 outside of crossfades
+    int crossfade_frame_count;
+    bool crossfade_is_dsp_swap;
+    bool dsp_swap_is_pending;
+    AudioDspProcs dsp_pending;
+    uint32_t mode_transition_n;
+
+    AudioEvent block_events[AUDIO_EVENT_CAPACITY];
+    // ticks of the countdown to ticks_end_micros, mixed over the dsp
+    float tick_samples[AUDIO_TICK_FRAME_COUNT];
+    uint64_t ticks_end_micros; // 0 when not ticking
+    uint64_t tick_second_n; // seconds before the end of the next tick, 0 to find out
+    int tick_position; // -1 when silent
+    uint64_t tick_n; // started
+    uint64_t tick_start_frame; // of the last one
+    uint64_t prewarm_end_frame; // renders until then, even when silent
+    bool is_start_pending; // until the first sound after a start
+    uint64_t start_sent_micros;
+    float crossfade_samples[AUDIO_CHUNK_FRAMES * AUDIO_CHANNEL_MAX];
+    alignas(16) unsigned char dsp_states[2][AUDIO_DSP_STATE_CAPACITY];
+
+    // shared with the main thread:
+    AudioEventQueue events;
+    AudioClock clock;
+    AudioClockCorrelation correlation; // fed by the device thread
+    std::atomic<uint64_t> start_latency_micros;
+    // owned by the main thread:
+    uint32_t prewarm_sent_n;
+    uint64_t prewarm_sent_micros;
+    double preset_amp; // audio_start fades in to it
+    std::atomic<uint32_t> dsp_swap_n;
+    // wakes the parked audio thread
+    std::mutex park_mutex;
+    std::condition_variable park_wakeup;
+    bool unpark_requested;
+};
+
+// Sends an event to the audio thread, waking it if it is parked.
+static void audio_send(AudioEffect* _audio, AudioEvent event)
+{
+    auto& audio = *_audio;
+    audio_event_push(&audio.events, event);
+    // NOTE(nicolas): taking the lock orders us with a thread about to
+    // park, which checks the queue with the lock held.
+    { std::lock_guard<std::mutex> lock(audio.park_mutex); }
+    audio.park_wakeup.notify_one();
 }
 
-static constexpr double TAU = 6.2831853071795864769252;
+AudioEffect* audio_make()
+{
+    auto _audio = new AudioEffect();
+    auto& audio = *_audio;
+    chime_synthesize(audio.chime_samples, AUDIO_CHIME_FRAME_COUNT);
+    tick_synthesize(audio.tick_samples, AUDIO_TICK_FRAME_COUNT);
+    audio.tick_position = -1;
+    audio_clock_publish(&audio.clock, 0, now_micros());
+    audio_correlation_init(&audio.correlation, 48000);
+    audio.dsp = { audio_dsp_render, audio_dsp_handover };
+    audio.dsp_state = reinterpret_cast<AudioDspState*>(audio.dsp_states[0]);
+    audio.dsp.handover(audio.dsp_state, nullptr, std::random_device{}());
+    audio.mode = global_audio_mode.load(std::memory_order_relaxed);
+    audio.preset_amp = 1.0;
+    audio.crossfade_position = -1;
+    return &audio;
+}
 
-static double white_noise_step()
+void audio_destroy(AudioEffect* _audio)
 {
-    static std::random_device rd;
-    static std::mt19937 g(rd());
-    static std::uniform_real_distribution<> d(-1.0, 1.0);
-    return d(g);
+    auto& audio = *_audio;
+    delete &audio;
 }
 
-struct PinkNoiseState
+static void audio_fade(AudioEffect* _audio, double amp_target, uint64_t duration_micros)
 {
-    double b0, b1, b2, b3, b4, b5, b6;
-    double pink;
-};
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_Fade;
+    event.amp_target = amp_target;
+    event.fade_frame_count = duration_micros*48000/1'000'000;
+    event.sent_micros = now_micros();
+    audio_send(&audio, event);
+}
+
+void audio_start(AudioEffect* audio)
+{
+    audio_fade(audio, audio->preset_amp, 1'000'000);
+}
+
+void audio_stop(AudioEffect* audio)
+{
+    audio_fade(audio, 0.0, 1'000'000);
+}
+
+void audio_preset(AudioEffect* _audio, AudioPreset preset)
+{
+    auto& audio = *_audio;
+    audio.preset_amp = preset.amp;
+    // NOTE(nicolas): the audio thread crossfades to the mode at its next
+    // block, as with the tweak of internal builds
+    global_audio_mode.store(preset.mode, std::memory_order_relaxed);
+}
 
-static void pink_noise_step(PinkNoiseState *_s, double const white)
-{
-    // Filter by Paul Kellet (pk3 = (Black))
-    // paul.kellett@maxim.abel.co.uk
-    //
-    // Filter to make pink noise from white  (updated March 2000)
-    // ------------------------------------
-    //
-    // This is an approximation to a -10dB/decade filter using a weighted sum
-    // of first order filters. It is accurate to within +/-0.05dB above 9.2Hz
-    // (44100Hz sampling rate). Unity gain is at Nyquist, but can be adjusted
-    // by scaling the numbers at the end of each line.
-    //
-    // If 'white' consists of uniform random numbers, such as those generated
-    // by the rand() function, 'pink' will have an almost gaussian level
-    // distribution.
-
-    auto& s = *_s;
-    s.b0 = 0.99886 * s.b0 + white * 0.0555179;
-    s.b1 = 0.99332 * s.b1 + white * 0.0750759;
-    s.b2 = 0.96900 * s.b2 + white * 0.1538520;
-    s.b3 = 0.86650 * s.b3 + white * 0.3104856;
-    s.b4 = 0.55000 * s.b4 + white * 0.5329522;
-    s.b5 = -0.7616 * s.b5 - white * 0.0168980;
-    s.pink = s.b0 + s.b1 + s.b2 + s.b3 + s.b4 + s.b5 + s.b6 + white * 0.5362;
-    s.b6 = white * 0.115926;
-}
-
-static void pink_noise_n(PinkNoiseState *_s, float* stereo_frames, int frame_count)
-{
-    auto& s = *_s;
-    for (int i = 0; i < frame_count; ++i) {
-        auto white = white_noise_step();
-        pink_noise_step(&s, white);
-        auto y = float(s.pink);
-        stereo_frames[2*i] = stereo_frames[2*i + 1] = y;
+void audio_prewarm(AudioEffect* _audio)
+{
+    auto& audio = *_audio;
+    auto const micros = now_micros();
+    // NOTE(nicolas): renewed halfway through, as the pointer keeps moving
+    if (audio.prewarm_sent_n &&
+        micros < audio.prewarm_sent_micros + AUDIO_PREWARM_MICROS/2) {
+        return;
     }
+    ++audio.prewarm_sent_n;
+    audio.prewarm_sent_micros = micros;
+    AudioEvent event = {};
+    event.type = AudioEventType_Prewarm;
+    event.frame = audio_clock_frame_at(audio.clock, micros + AUDIO_PREWARM_MICROS);
+    event.sent_micros = micros;
+    audio_send(&audio, event);
 }
 
-#if UU_FOCUS_INTERNAL
-static void reference_tone_n(float* stereo_frames, int frame_count)
+uint64_t audio_start_latency_micros(AudioEffect* audio)
 {
-    static const auto reference_hz = 1000;
-    static const auto reference_amp = db_to_amp(-20.0);
-    static double phase;
+    return audio->start_latency_micros.load(std::memory_order_relaxed);
+}
+
+// # Clock correlation
 
-    double phase_delta = reference_hz / 48000.0;
-    for (int i = 0; i < frame_count; ++i) {
-        float y = float(reference_amp * std::sin(TAU*phase));
-        stereo_frames[2*i] = stereo_frames[2*i + 1] = y;
-        phase += phase_delta;
+static AudioClockMapping audio_heard_mapping(AudioEffect* _audio)
+{
+    auto& audio = *_audio;
+    auto const micros = now_micros();
+    auto const mapping = audio_correlation_mapping(&audio.correlation);
+    if (mapping.observed_micros &&
+        micros < mapping.observed_micros + AUDIO_CORRELATION_STALE_MICROS) {
+        return mapping;
     }
+    // NOTE(nicolas): without a device to tell us, frames are heard as soon
+    // as they are rendered
+    return audio_clock_mapping(audio.clock);
+}
+
+uint64_t audio_frame_at(AudioEffect* audio, uint64_t micros)
+{
+    return audio_clock_mapping_frame_at(audio_heard_mapping(audio), micros);
+}
+
+uint64_t audio_micros_at(AudioEffect* audio, uint64_t frame)
+{
+    auto const micros = audio_clock_mapping_micros_at(audio_heard_mapping(audio), frame);
+    return micros > 0.0 ? uint64_t(micros + 0.5) : 0;
+}
+
+void audio_thread_heard(AudioEffect* audio, uint64_t frame, uint64_t micros)
+{
+    audio_correlation_observe(&audio->correlation, frame, micros);
 }
-#endif
 
-typedef struct delay_t
+void audio_chime_at(AudioEffect* _audio, uint64_t at_micros)
 {
-	float* buffer;
-	int length;
-	int index;
-} delay_t;
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_Chime;
+    event.frame = audio_frame_at(&audio, at_micros);
+    audio_send(&audio, event);
+}
 
-static int
-ceil_count_bits (int n)
+void audio_chime_cancel(AudioEffect* _audio)
 {
-    int bits = 1;
-    n--;
-    while ((n >>= 1) > 0) bits++;
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_ChimeCancel;
+    audio_send(&audio, event);
+}
 
-    return bits;
+void audio_ticks_until(AudioEffect* _audio, uint64_t end_micros)
+{
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_Ticks;
+    event.end_micros = end_micros;
+    audio_send(&audio, event);
 }
 
-static inline void
-delay_make (delay_t* self, const int length)
+void audio_ticks_cancel(AudioEffect* _audio)
 {
-	self->index = 0;
-	self->length = 1 << ceil_count_bits (length);
-	self->buffer = (float*)calloc (self->length, sizeof (float));
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_TicksCancel;
+    audio_send(&audio, event);
 }
 
-static inline void
-delay_free (delay_t* self)
+void audio_dsp_swap(AudioEffect* _audio, AudioDspProcs procs)
 {
-	if (self->buffer) {
-		free (self->buffer);
-	}
-    self->length = 0;
+    auto& audio = *_audio;
+    AudioEvent event = {};
+    event.type = AudioEventType_DspSwap;
+    event.dsp = procs;
+    audio_send(&audio, event);
 }
 
-static inline float
-delay_get (delay_t* self, const int time)
+uint32_t audio_dsp_swap_count(AudioEffect* _audio)
 {
-	return self->buffer[(self->index - time) & (self->length - 1)];
+    auto& audio = *_audio;
+    return audio.dsp_swap_n.load(std::memory_order_acquire);
 }
 
-static inline void
-delay_set (delay_t* self, const float val)
+// Hands the state over to `procs` in the other slot, the current code and
+// state becoming the previous ones until the end of the crossfade.
+static void audio_crossfade_begin(AudioEffect* _audio, AudioDspProcs procs, int frame_count)
 {
-	self->buffer[self->index] = val;
+    auto& audio = *_audio;
+    auto const next_state = reinterpret_cast<AudioDspState*>(
+        audio.dsp_state == reinterpret_cast<AudioDspState*>(audio.dsp_states[0]) ?
+        audio.dsp_states[1] : audio.dsp_states[0]);
+    auto const seed = uint32_t(audio.frame_position) * 0x9e3779b9u + 1;
+    procs.handover(next_state, audio.dsp_state, seed);
+    audio.dsp_previous = audio.dsp;
+    audio.dsp_previous_state = audio.dsp_state;
+    audio.mode_previous = audio.mode;
+    audio.dsp = procs;
+    audio.dsp_state = next_state;
+    audio.crossfade_position = 0;
+    audio.crossfade_frame_count = frame_count;
 }
 
-static inline void
-delay_advance (delay_t* self)
+// The new code takes over from a copy of the state of the current code.
+static void audio_dsp_swap_begin(AudioEffect* _audio)
 {
-	self->index++;
-	self->index &= (self->length - 1);
+    auto& audio = *_audio;
+    audio_crossfade_begin(&audio, audio.dsp_pending, AUDIO_DSP_CROSSFADE_FRAMES);
+    audio.crossfade_is_dsp_swap = true;
+    audio.dsp_swap_is_pending = false;
 }
 
-// Calculates next sample of the delay
-static inline float
-delay_next (delay_t* self, const float input, const int time)
+// The new mode starts from a copy of the state of the current one, so that
+// the two render side by side without sharing anything.
+static void audio_mode_transition_begin(AudioEffect* _audio, int mode)
 {
-	delay_set (self, input);
-	const float val = delay_get (self, time);
-	delay_advance (self);
-	return val;
+    auto& audio = *_audio;
+    auto frame_count = int(global_audio_mode_crossfade_ms * 48000 / 1000);
+    if (frame_count > AUDIO_MODE_CROSSFADE_FRAMES_MAX) frame_count = AUDIO_MODE_CROSSFADE_FRAMES_MAX;
+    if (frame_count < 1) frame_count = 1;
+    audio_crossfade_begin(&audio, audio.dsp, frame_count);
+    audio.crossfade_is_dsp_swap = false;
+    audio.mode = mode;
 }
 
-static void noise_render_n(float* stereo_samples, int sample_count)
+// Renders the current and the previous code or mode, from the old one to
+// the new one. Events are given to both.
+static void audio_dsp_crossfade(AudioEffect* _audio, AudioDspBlock block,
+                                float* frames, int channel_count, int frame_count)
 {
-    static PinkNoiseState pink[2] = {};
-    static delay_t delay_lines[2] = {};
-    static int separation_n_max = int(global_separation_ms_max*48000.0/1000.0);
-    for (int i = 0; i < 2; ++i) {
-        if (!delay_lines[i].buffer || delay_lines[i].length < separation_n_max) {
-            delay_free(&delay_lines[i]);
-            delay_make(&delay_lines[i], separation_n_max);
+    auto& audio = *_audio;
+    int const chunk_frame_max = int(AUDIO_CHUNK_FRAMES * AUDIO_CHANNEL_MAX) / channel_count;
+    auto previous_block = block;
+    previous_block.mode = audio.mode_previous;
+    while (frame_count > 0 && audio.crossfade_position >= 0) {
+        int chunk_frame_count = audio.crossfade_frame_count - audio.crossfade_position;
+        if (chunk_frame_count > frame_count) chunk_frame_count = frame_count;
+        if (chunk_frame_count > chunk_frame_max) chunk_frame_count = chunk_frame_max;
+
+        audio.dsp.render(audio.dsp_state, &block, frames, channel_count, chunk_frame_count);
+        audio.dsp_previous.render(audio.dsp_previous_state, &previous_block,
+                                  audio.crossfade_samples, channel_count, chunk_frame_count);
+        for (int frame_i = 0; frame_i < chunk_frame_count; ++frame_i) {
+            auto const gain = float(audio.crossfade_position + frame_i + 1) /
+                float(audio.crossfade_frame_count);
+            auto const y = frames + frame_i*channel_count;
+            auto const y_previous = audio.crossfade_samples + frame_i*channel_count;
+            for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+                y[channel_i] = y_previous[channel_i] + gain*(y[channel_i] - y_previous[channel_i]);
+            }
         }
+        block.events = previous_block.events = nullptr;
+        block.event_count = previous_block.event_count = 0;
+        block.frame_position += chunk_frame_count;
+        previous_block.frame_position = block.frame_position;
+        frames += chunk_frame_count * channel_count;
+        frame_count -= chunk_frame_count;
+        audio.crossfade_position += chunk_frame_count;
+        if (audio.crossfade_position == audio.crossfade_frame_count) {
+            // the previous code or mode is no longer used, nor its state
+            audio.crossfade_position = -1;
+            audio.dsp_previous_state = nullptr;
+            if (audio.crossfade_is_dsp_swap) {
+                audio.dsp_swap_n.fetch_add(1, std::memory_order_release);
+            } else {
+                ++audio.mode_transition_n;
+            }
+        }
+    }
+    if (frame_count > 0) {
+        audio.dsp.render(audio.dsp_state, &block, frames, channel_count, frame_count);
     }
+}
 
-    int separation_n = int(global_separation_ms*48000.0/1000.0);
-    if (separation_n >= separation_n_max) separation_n = separation_n_max - 1;
-    if (separation_n < 0) separation_n = 0;
-
-    auto pink_noise_amp = db_to_amp(-26);
-    for (int sample_i = 0; sample_i < sample_count; ++sample_i) {
-        auto output = stereo_samples + 2*sample_i;
-        for (int pink_i = 0; pink_i < 2; ++pink_i) {
-            auto& ps = pink[pink_i];
-            auto white = white_noise_step();
-            pink_noise_step(&ps, white);
-            auto y = float(ps.pink);
-            output[pink_i] = float(y * pink_noise_amp);
+// Mixes the ticks of the block over it: the tick of a second starts at
+// the frame heard as the countdown reaches that second.
+static void audio_ticks_render(AudioEffect* _audio, float* frames, int channel_count,
+                               int frame_count)
+{
+    auto& audio = *_audio;
+    auto const block_end_frame = audio.frame_position + uint64_t(frame_count);
+    int start_i = -1;
+    if (audio.ticks_end_micros) {
+        auto const mapping = audio_heard_mapping(&audio);
+        if (audio.tick_second_n == 0) {
+            // the next second to come after this block starts
+            auto const block_micros = audio_clock_mapping_micros_at(mapping, audio.frame_position);
+            auto const end_micros = double(audio.ticks_end_micros);
+            audio.tick_second_n = end_micros > block_micros + 1.0 ?
+                uint64_t((end_micros - block_micros - 1.0) / 1e6) : 0;
+            if (audio.tick_second_n == 0) audio.ticks_end_micros = 0;
+        }
+        while (audio.tick_second_n > 0) {
+            auto const tick_frame = audio_clock_mapping_frame_at(
+                mapping, audio.ticks_end_micros - audio.tick_second_n*1'000'000);
+            if (tick_frame >= block_end_frame) break;
+            // NOTE(nicolas): a tick we are late for by more than a block is
+            // out of step with the display, and skipped
+            if (tick_frame + uint64_t(frame_count) >= audio.frame_position) {
+                start_i = tick_frame > audio.frame_position ?
+                    int(tick_frame - audio.frame_position) : 0;
+                audio.tick_start_frame = audio.frame_position + uint64_t(start_i);
+                ++audio.tick_n;
+            }
+            if (--audio.tick_second_n == 0) audio.ticks_end_micros = 0;
         }
     }
 
-    // delayed crossfeed to shape image:
-    for (int sample_i = 0; sample_i < sample_count; ++sample_i) {
-        auto output = stereo_samples + 2*sample_i;
-        float a = delay_next(&delay_lines[0], output[0], separation_n);
-        float b = delay_next(&delay_lines[1], output[1], separation_n);
-        float l = output[0];
-        float r = output[1];
-        output[0] = output[0]*0.55f + 0.25f*b + 0.20f*r;
-        output[1] = output[1]*0.55f + 0.25f*a + 0.20f*l;
+    auto position = audio.tick_position;
+    for (int frame_i = 0; frame_i < frame_count; ++frame_i) {
+        if (frame_i == start_i) position = 0;
+        if (position < 0) continue;
+        auto const y = audio.tick_samples[position];
+        for (int channel_i = 0; channel_i < channel_count; ++channel_i) {
+            frames[frame_i*channel_count + channel_i] += y;
+        }
+        if (++position == AUDIO_TICK_FRAME_COUNT) position = -1;
     }
+    audio.tick_position = position;
 }
 
-void audio_thread_render(AudioEffect*, float* stereo_samples, int sample_count)
+void audio_thread_render(AudioEffect* _audio, float* frames, int channel_count, int frame_count)
 {
-    static double amp = 0.0;
-    auto& fade_remaining_samples = global_audio_fade_remaining_samples;
-    auto const amp_target = global_audio_amp_target;
-
-    double amp_inc = 0.0;
-    if (fade_remaining_samples != 0) {
-        amp_inc = double(amp_target - amp) / fade_remaining_samples;
+    auto& audio = *_audio;
+    if (channel_count <= 0) return;
+    audio_clock_publish(&audio.clock, audio.frame_position, now_micros());
+
+    AudioDspBlock block = {};
+    block.events = audio.block_events;
+    AudioEvent event;
+    while (audio_event_pop(&audio.events, &event)) {
+        if (event.type == AudioEventType_DspSwap) {
+            audio.dsp_pending = event.dsp;
+            audio.dsp_swap_is_pending = true;
+        } else if (event.type == AudioEventType_Prewarm) {
+            if (event.frame > audio.prewarm_end_frame) audio.prewarm_end_frame = event.frame;
+        } else if (event.type == AudioEventType_Ticks) {
+            audio.ticks_end_micros = event.end_micros;
+            audio.tick_second_n = 0;
+        } else if (event.type == AudioEventType_TicksCancel) {
+            audio.ticks_end_micros = 0;
+        } else {
+            if (event.type == AudioEventType_Fade && event.amp_target > 0.0 &&
+                !audio.is_start_pending) {
+                audio.is_start_pending = true;
+                audio.start_sent_micros = event.sent_micros;
+            }
+            audio.block_events[block.event_count++] = event;
+        }
+    }
+    // swaps and mode transitions happen one at a time, at the block
+    // boundary: no more than two states ever render together
+    if (audio.dsp_swap_is_pending && audio.crossfade_position < 0) {
+        audio_dsp_swap_begin(&audio);
+    }
+    auto const mode = global_audio_mode.load(std::memory_order_relaxed);
+    if (mode != audio.mode && audio.crossfade_position < 0) {
+        audio_mode_transition_begin(&audio, mode);
     }
 
-    if (fade_remaining_samples == 0 && amp_target == 0.0) {
-        memset(stereo_samples, 0, sample_count * 2 * sizeof(float));
+    block.frame_position = audio.frame_position;
+    block.chime_samples = audio.chime_samples;
+    block.chime_frame_count = AUDIO_CHIME_FRAME_COUNT;
+    block.mode = audio.mode;
+    block.separation_ms = global_separation_ms;
+    block.is_warming = audio.frame_position < audio.prewarm_end_frame;
+    if (audio.crossfade_position < 0) {
+        audio.dsp.render(audio.dsp_state, &block, frames, channel_count, frame_count);
     } else {
-        switch((AudioMode)global_audio_mode) {
-#if UU_FOCUS_INTERNAL
-            case AudioMode_ReferenceTone: {
-                reference_tone_n(stereo_samples, sample_count);
-            } break;
-#endif
-            case AudioMode_Noise: {
-                noise_render_n(stereo_samples, sample_count);
-            }
-
-            case AudioMode_Last: break;
-        }
-        for (int i = 0; i < sample_count; ++i) {
-            auto y = amp;
-            stereo_samples[2*i] *= float(y);
-            stereo_samples[2*i + 1] *= float(y);
-            if (fade_remaining_samples == 0) {
-                amp = amp_target;
-            } else if (fade_remaining_samples > 0) {
-                amp += amp_inc;
-                --fade_remaining_samples;
-            }
+        audio_dsp_crossfade(&audio, block, frames, channel_count, frame_count);
+    }
+    if (audio.ticks_end_micros || audio.tick_position >= 0) {
+        audio_ticks_render(&audio, frames, channel_count, frame_count);
+    }
+    audio.frame_position += frame_count;
+
+    if (audio.is_start_pending) {
+        auto const sample_count = channel_count*frame_count;
+        for (int sample_i = 0; sample_i < sample_count; ++sample_i) {
+            if (frames[sample_i] == 0.0f) continue;
+            audio.start_latency_micros.store(now_micros() - audio.start_sent_micros,
+                                             std::memory_order_relaxed);
+            audio.is_start_pending = false;
+            break;
         }
     }
 }
 
-static int const default_duration_s =
-#if UU_FOCUS_INTERNAL
-  5
-#else
-  25*60
-#endif
-  ;
+uint64_t audio_thread_frame_position(AudioEffect* audio)
+{
+    return audio->frame_position;
+}
+
+bool audio_thread_is_silent(AudioEffect* _audio)
+{
+    auto& audio = *_audio;
+    // the stable part of the state is the same for every version of the code
+    auto const& dsp = *reinterpret_cast<AudioDspStateStable const*>(audio.dsp_state);
+    bool const has_events = audio.events.read_n.load(std::memory_order_relaxed) !=
+        audio.events.write_n.load(std::memory_order_acquire);
+    return !has_events && audio.crossfade_position < 0 && !audio.dsp_swap_is_pending &&
+        audio.frame_position >= audio.prewarm_end_frame &&
+        audio.ticks_end_micros == 0 && audio.tick_position < 0 &&
+        dsp.amp == 0.0 && dsp.amp_target == 0.0 && dsp.fade_remaining_samples == 0 &&
+        dsp.chime_position < 0 && !dsp.chime_is_pending;
+}
+
+void audio_thread_park(AudioEffect* _audio)
+{
+    auto& audio = *_audio;
+    {
+        std::unique_lock<std::mutex> lock(audio.park_mutex);
+        audio.park_wakeup.wait(lock, [&]() {
+            return audio.unpark_requested ||
+                audio.events.read_n.load(std::memory_order_relaxed) !=
+                audio.events.write_n.load(std::memory_order_acquire);
+        });
+        audio.unpark_requested = false;
+    }
+    // the clock went on while we were away
+    auto const wake_micros = now_micros();
+    auto const wake_frame = audio_clock_frame_at(audio.clock, wake_micros);
+    if (wake_frame > audio.frame_position) audio.frame_position = wake_frame;
+    audio_clock_publish(&audio.clock, audio.frame_position, wake_micros);
+}
+
+void audio_thread_unpark(AudioEffect* _audio)
+{
+    auto& audio = *_audio;
+    {
+        std::lock_guard<std::mutex> lock(audio.park_mutex);
+        audio.unpark_requested = true;
+    }
+    audio.park_wakeup.notify_one();
+}
 
 TimerEffect* timer_make(Platform* platform)
 {
@@ -294,11 +597,11 @@ TimerEffect* timer_make(Platform* platform)
     return &timer;
 }
 
-void timer_start(TimerEffect* _timer)
+void timer_start(TimerEffect* _timer, uint64_t duration_micros)
 {
     auto& timer = *_timer;
     ++timer.on_count;
-    timer_reset(&timer);
+    timer_reset(&timer, duration_micros);
 
     auto start_time = platform_get_time_of_day();
     timer.start_time.hours = start_time.hh;
@@ -322,10 +625,16 @@ bool timer_is_active(TimerEffect* _timer)
     return timer.on_count > 0;
 }
 
-bool timer_expired(TimerEffect* _timer)
+uint64_t timer_end_micros(TimerEffect* _timer)
+{
+    auto const& timer = *_timer;
+    return timer.end_micros;
+}
+
+bool timer_expired(TimerEffect* _timer, uint64_t micros)
 {
     auto const& timer = *_timer;
-    return now_micros() >= timer.end_micros;
+    return micros >= timer.end_micros;
 }
 
 void timer_update_and_render(TimerEffect* _timer)
@@ -334,10 +643,10 @@ void timer_update_and_render(TimerEffect* _timer)
     platform_render_async(timer.platform);
 }
 
-void timer_reset(TimerEffect* _timer)
+void timer_reset(TimerEffect* _timer, uint64_t duration_micros)
 {
     auto& timer = *_timer;
-    timer.end_micros = timer.now_micros + default_duration_s*1'000'000;
+    timer.end_micros = timer.now_micros + duration_micros;
     timer_update_and_render(&timer);
 }
 
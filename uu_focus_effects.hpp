@@ -1,10 +1,17 @@
 #pragma once
 #define UU_FOCUS_EFFECTS
 
+#include <stdint.h>
+
+#include <atomic>
+
 #if UU_FOCUS_INTERNAL
 // internal, tweaking parameters
-extern int global_audio_mode;
+// read by the audio thread at every block:
+extern std::atomic<int> global_audio_mode;
 extern int global_audio_mode_mod;
+// from one mode to the next, rendering both
+extern double global_audio_mode_crossfade_ms;
 extern double global_separation_ms;
 extern double global_separation_ms_min;
 extern double global_separation_ms_max;
@@ -12,22 +19,93 @@ extern double global_separation_ms_max;
 
 struct Platform;
 
+// Speakers past this count are rendered silent.
+enum { AUDIO_CHANNEL_MAX = 8 };
+
 struct AudioEffect;
+AudioEffect* audio_make();
+void audio_destroy(AudioEffect*);
+
 void audio_start(AudioEffect*);
 void audio_stop(AudioEffect*);
 
-// meant to be called by platform layer
-void audio_thread_render(AudioEffect*, float* stereo_frames, int frame_count);
+// What the audio sounds like, from its next start: the mode, for all
+// streams, and the volume it fades in to.
+struct AudioPreset
+{
+    int mode; // AudioMode
+    float amp;
+};
+void audio_preset(AudioEffect*, AudioPreset preset);
+
+// Wakes the audio up and keeps it running silent, with its device, for
+// AUDIO_PREWARM_MICROS: a start within that time sounds at once. For when
+// the user is about to start, as the pointer hovers the window. Calls in
+// close succession send one event.
+enum { AUDIO_PREWARM_MICROS = 3'000'000 };
+void audio_prewarm(AudioEffect*);
+
+// From the last audio_start to the first sound out of audio_thread_render,
+// on the now_micros() clock. 0 until then.
+uint64_t audio_start_latency_micros(AudioEffect*);
+
+// Rings the celebration chime at the audio frame matching `at_micros`, on
+// the now_micros() clock. Scheduling again moves a pending chime.
+void audio_chime_at(AudioEffect*, uint64_t at_micros);
+void audio_chime_cancel(AudioEffect*);
+
+// Ticks softly at every second of the countdown to `end_micros`, on the
+// now_micros() clock, as its display changes: heard at the instant the
+// count goes down, the clock of the device and latency included. The last
+// tick is a second before the end. Scheduling again follows the new end.
+void audio_ticks_until(AudioEffect*, uint64_t end_micros);
+void audio_ticks_cancel(AudioEffect*);
+
+// The audio frame heard at `micros` on the now_micros() clock, and back.
+// While a device thread tells what it plays (audio_thread_heard), they
+// follow the clock of the device, latency included. Otherwise frames are
+// taken to be heard as they are rendered.
+uint64_t audio_frame_at(AudioEffect*, uint64_t micros);
+uint64_t audio_micros_at(AudioEffect*, uint64_t frame);
+
+// Replaces the dsp code (see uu_focus_audio_module.hpp). At its next
+// block, the audio thread hands the state over to the new code and
+// crossfades from the old code to the new one.
+struct AudioDspProcs;
+void audio_dsp_swap(AudioEffect*, AudioDspProcs procs);
+// Swaps done so far. Code swapped out is no longer used once counted.
+uint32_t audio_dsp_swap_count(AudioEffect*);
+
+// meant to be called by platform layer. Renders `frame_count` frames of
+// `channel_count` interleaved samples, every speaker playing its own
+// independent noise.
+void audio_thread_render(AudioEffect*, float* frames, int channel_count, int frame_count);
+// the frame audio_thread_render renders next
+uint64_t audio_thread_frame_position(AudioEffect*);
+
+// For the device thread: `frame` starts being heard at `micros`, on the
+// now_micros() clock (see uu_focus_audio_clock.hpp).
+void audio_thread_heard(AudioEffect*, uint64_t frame, uint64_t micros);
+
+// True when the audio is silent and stays so until the next event, such as
+// audio_start. The platform may then stop its device and park the audio
+// thread, until an event or audio_thread_unpark wakes it up.
+bool audio_thread_is_silent(AudioEffect*);
+void audio_thread_park(AudioEffect*);
+void audio_thread_unpark(AudioEffect*);
 
 struct TimerEffect;
 TimerEffect* timer_make(Platform* platform);
 void timer_destroy(TimerEffect*);
 
-void timer_start(TimerEffect*);
+// Timers count down `duration_micros` from their (re)start.
+void timer_start(TimerEffect*, uint64_t duration_micros);
 void timer_stop(TimerEffect*);
-void timer_reset(TimerEffect*);
+void timer_reset(TimerEffect*, uint64_t duration_micros);
 bool timer_is_active(TimerEffect*);
+uint64_t timer_end_micros(TimerEffect*);
 void timer_update_and_render(TimerEffect*);
 void timer_celebrate(TimerEffect*);
-bool timer_expired(TimerEffect*);
+// at `micros`, on the clock of the inputs of uu_focus_main
+bool timer_expired(TimerEffect*, uint64_t micros);
 
@@ -0,0 +1,165 @@
+// @language: c++14
+#include "uu_focus_journal.hpp"
+
+#include <cstring>
+
+static uint8_t const journal_header[JOURNAL_HEADER_SIZE] = { 'U', 'U', 'F', 'J', JOURNAL_VERSION };
+
+static void journal_reserve(Journal* _journal)
+{
+    auto& journal = *_journal;
+    if (journal.size + JOURNAL_RECORD_SIZE_MAX > JOURNAL_BUFFER_CAPACITY) journal_flush(&journal);
+}
+
+static void journal_varint(Journal* _journal, uint64_t x)
+{
+    auto& journal = *_journal;
+    while (x >= 0x80) {
+        journal.buffer[journal.size++] = uint8_t(x | 0x80);
+        x >>= 7;
+    }
+    journal.buffer[journal.size++] = uint8_t(x);
+}
+
+// a tag, and a time relative to the previous one
+static void journal_timed(Journal* _journal, uint8_t tag, uint64_t micros)
+{
+    auto& journal = *_journal;
+    journal_reserve(&journal);
+    journal.buffer[journal.size++] = tag;
+    auto const delta = int64_t(micros - journal.last_micros);
+    journal_varint(&journal, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+    journal.last_micros = micros;
+    ++journal.record_n;
+}
+
+void journal_init(Journal* _journal, JournalSink sink)
+{
+    auto& journal = *_journal;
+    journal.sink = sink;
+    journal.last_micros = 0;
+    journal.record_n = 0;
+    journal.byte_n = 0;
+    std::memcpy(journal.buffer, journal_header, JOURNAL_HEADER_SIZE);
+    journal.size = JOURNAL_HEADER_SIZE;
+}
+
+void journal_flush(Journal* _journal)
+{
+    auto& journal = *_journal;
+    if (journal.size == 0) return;
+    journal.sink.write(journal.sink.user, journal.buffer, journal.size);
+    journal.byte_n += journal.size;
+    journal.size = 0;
+}
+
+void journal_command(Journal* journal, CommandMsg command)
+{
+    journal_timed(journal, uint8_t(JournalTag_Command + command.type), command.time_micros);
+}
+
+void journal_call(Journal* journal, uint64_t time_micros)
+{
+    journal_timed(journal, JournalTag_Call, time_micros);
+}
+
+void journal_bool(Journal* _journal, JournalTag false_tag, bool y)
+{
+    auto& journal = *_journal;
+    journal_reserve(&journal);
+    journal.buffer[journal.size++] = uint8_t(false_tag + (y ? 1 : 0));
+    ++journal.record_n;
+}
+
+void journal_micros(Journal* journal, JournalTag tag, uint64_t micros)
+{
+    journal_timed(journal, uint8_t(tag), micros);
+}
+
+// # Replay
+
+static bool journal_replay_varint(JournalReplay* _replay, uint64_t* _x)
+{
+    auto& replay = *_replay;
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (replay.first == replay.last) break;
+        auto const byte = *replay.first++;
+        x |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *_x = x;
+            return true;
+        }
+    }
+    replay.is_diverging = true;
+    return false;
+}
+
+static uint64_t journal_replay_time(JournalReplay* _replay)
+{
+    auto& replay = *_replay;
+    uint64_t zigzag = 0;
+    journal_replay_varint(&replay, &zigzag);
+    auto const delta = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+    replay.last_micros += uint64_t(delta);
+    return replay.last_micros;
+}
+
+bool journal_replay_command(JournalReplay* _replay, CommandMsg* _command)
+{
+    auto& replay = *_replay;
+    auto& command = *_command;
+    if (replay.first == replay.last || *replay.first < JournalTag_Command) return false;
+    command.type = Command(*replay.first++ - JournalTag_Command);
+    command.time_micros = journal_replay_time(&replay);
+    return true;
+}
+
+bool journal_replay_bool(JournalReplay* _replay, JournalTag false_tag)
+{
+    auto& replay = *_replay;
+    if (replay.first == replay.last ||
+        (*replay.first != false_tag && *replay.first != false_tag + 1)) {
+        replay.is_diverging = true;
+        return false;
+    }
+    return *replay.first++ != false_tag;
+}
+
+uint64_t journal_replay_micros(JournalReplay* _replay, JournalTag tag)
+{
+    auto& replay = *_replay;
+    if (replay.first == replay.last || *replay.first != tag) {
+        replay.is_diverging = true;
+        return 0;
+    }
+    ++replay.first;
+    return journal_replay_time(&replay);
+}
+
+bool journal_replay(UUFocusMainCoroutine* _program, uint8_t const* bytes, size_t size,
+                    JournalReplay* _replay)
+{
+    auto& program = *_program;
+    auto& replay = *_replay;
+    replay = {};
+    if (size < JOURNAL_HEADER_SIZE || std::memcmp(bytes, journal_header, JOURNAL_HEADER_SIZE)) {
+        return false;
+    }
+    replay.first = bytes + JOURNAL_HEADER_SIZE;
+    replay.last = bytes + size;
+    program.replay = &replay;
+    while (replay.first != replay.last && !replay.is_diverging) {
+        auto const tag = *replay.first++;
+        if (tag == JournalTag_Call) {
+            program.input.time_micros = journal_replay_time(&replay);
+            uu_focus_main(&program);
+            ++replay.call_n;
+        } else {
+            // a command or an answer nobody asked for
+            replay.is_diverging = true;
+        }
+    }
+    program.replay = nullptr;
+    return !replay.is_diverging;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#define UU_FOCUS_JOURNAL
+
+/*
+ * Journal of everything uu_focus_main is given: the commands, the time of
+ * each call, and what the effects answered to its queries. Replaying a
+ * journal calls uu_focus_main the same way, answering the queries from the
+ * journal, so that the program takes the same steps and has the same
+ * effects, wherever the journal was recorded.
+ *
+ * The format is a header, then records of a tag byte and a payload:
+ *
+ *   Call:    varint time (input.time_micros)
+ *   Command: tag JournalTag_Command + type, varint time, within the call
+ *            that takes it from the queue
+ *   queries: booleans are in the tag, times are a varint
+ *
+ * Times are the zigzag varint of their difference with the previous time
+ * of the journal, a byte or three for most records. Records are written to
+ * a buffer, handed to the sink when full or flushed.
+ */
+
+#include "uu_focus_main.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    JOURNAL_VERSION = 2,
+    JOURNAL_HEADER_SIZE = 5, // "UUFJ", then the version
+    JOURNAL_BUFFER_CAPACITY = 4096,
+    JOURNAL_RECORD_SIZE_MAX = 1 + 10, // a tag, a varint
+};
+
+enum JournalTag
+{
+    JournalTag_Call = 1,
+    JournalTag_TimerIsActive_False,
+    JournalTag_TimerIsActive_True,
+    JournalTag_TimerExpired_False,
+    JournalTag_TimerExpired_True,
+    JournalTag_TimerEndMicros,
+    JournalTag_Command = 16, // + the type of the command, below 16
+};
+
+struct JournalSink
+{
+    void* user;
+    void (*write)(void* user, uint8_t const* bytes, size_t size);
+};
+
+struct Journal
+{
+    JournalSink sink;
+    uint64_t last_micros;
+    uint64_t record_n;
+    uint64_t byte_n; // handed to the sink
+    uint32_t size;
+    uint8_t buffer[JOURNAL_BUFFER_CAPACITY];
+};
+
+// Starts a journal with its header.
+void journal_init(Journal* journal, JournalSink sink);
+// Hands the buffered records to the sink.
+void journal_flush(Journal* journal);
+
+void journal_command(Journal* journal, CommandMsg command);
+void journal_call(Journal* journal, uint64_t time_micros);
+void journal_bool(Journal* journal, JournalTag false_tag, bool y);
+void journal_micros(Journal* journal, JournalTag tag, uint64_t micros);
+
+struct JournalReplay
+{
+    uint8_t const* first;
+    uint8_t const* last;
+    uint64_t last_micros;
+    uint64_t call_n;
+    bool is_diverging; // the program asked for something else than recorded
+};
+
+// Replays a whole journal into `program`, which must be in the state the
+// journal started from. Returns false for journals that are not ours, or
+// that the program did not follow.
+bool journal_replay(UUFocusMainCoroutine* program, uint8_t const* bytes, size_t size,
+                    JournalReplay* replay);
+
+// For uu_focus_main, while replaying: the commands it takes, when the
+// recorded call took one, and the answers to its queries.
+bool journal_replay_command(JournalReplay* replay, CommandMsg* command);
+bool journal_replay_bool(JournalReplay* replay, JournalTag false_tag);
+uint64_t journal_replay_micros(JournalReplay* replay, JournalTag tag);
@@ -1,8 +1,16 @@
 #include "uu_focus_main.hpp"
 
 #include "uu_focus_effects.hpp"
+#include "uu_focus_journal.hpp"
+#include "uu_focus_schedule.hpp"
 
+static CoroutineState uu_focus_main_resume(UUFocusMainCoroutine* _program);
+static CommandMsg const* peek_command(UUFocusMainCoroutine* _program);
 static CommandMsg pop_command(UUFocusMainCoroutine* _program);
+static bool query_timer_is_active(UUFocusMainCoroutine* _program);
+static bool query_timer_expired(UUFocusMainCoroutine* _program);
+static bool take_command(UUFocusMainCoroutine* _program);
+static uint64_t query_timer_end_micros(UUFocusMainCoroutine* _program);
 static void set(UUFocusMainCoroutine* _program, int step);
 static void jump(UUFocusMainCoroutine* _program, int step);
 
@@ -26,19 +34,65 @@ struct CounterScope
 };
 } // unnamed namespace
 
-// NOTE(Nicolas): main logic of the application.
+bool command_push(CommandQueue* _queue, CommandMsg command)
+{
+    auto& queue = *_queue;
+    if (queue.write_n - queue.read_n == COMMAND_QUEUE_CAPACITY) {
+        ++queue.overflow_n;
+        if (command.type != Command_application_stop) return false;
+        --queue.write_n;
+    }
+    queue.commands[queue.write_n % COMMAND_QUEUE_CAPACITY] = command;
+    ++queue.write_n;
+    return true;
+}
+
+// Resumes the program once per queued command, in order, and once more
+// without when there are none.
 CoroutineState uu_focus_main(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    if (program.journal) journal_call(program.journal, program.input.time_micros);
+    take_command(&program);
+    while (true) {
+        program.resume_micros = program.has_command ?
+            program.command.time_micros : program.input.time_micros;
+        auto const state = uu_focus_main_resume(&program);
+        // NOTE(nicolas): every resume that waits takes a command, but we
+        // would rather not spin if one did not
+        if (state != CoroutineState_Waiting || program.has_command || !take_command(&program)) {
+            return state;
+        }
+    }
+}
+
+bool uu_focus_main_is_resume_step(int step)
+{
+    // NOTE(nicolas): the cases of uu_focus_main_resume, but the end of the
+    // application
+    switch (step) {
+        case 0: case 10: case 20: return true;
+    }
+    return false;
+}
+
+// NOTE(Nicolas): main logic of the application.
+static CoroutineState uu_focus_main_resume(UUFocusMainCoroutine* _program)
 {
     auto& program = *_program;
 
     auto timer = program.timer_effect;
     auto audio = program.audio_effect;
     double const step_elapsed_micros =
-        double(program.input.time_micros - program.step_micros);
+        double(program.resume_micros - program.step_micros);
 
-    if (program.input.command.type == Command_application_stop) {
+    program.deadline_micros = 0;
+    auto const first_command = peek_command(&program);
+    if (first_command && first_command->type == Command_application_stop) {
         pop_command(&program);
-        if (timer_is_active(timer)) {
+        if (query_timer_is_active(&program)) {
+            audio_chime_cancel(audio);
+            audio_ticks_cancel(audio);
             audio_stop(audio);
             timer_stop(timer);
         }
@@ -52,34 +106,58 @@ CoroutineState uu_focus_main(UUFocusMainCoroutine* _program)
     switch(/* resume */ program.step) {
         // State automata mixed up with flow control:
         case 0:
+        if (!program.schedule) program.schedule = &schedule_classic;
 
         while(true) {
-            timer_reset(timer);
+            timer_reset(timer, program.schedule->phases[program.phase_i].duration_micros);
 
             set(&program, 10); case 10:
-            if (pop_command(&program).type != Command_timer_start) {
-                return CoroutineState_Waiting;
+            {
+                auto const command = pop_command(&program);
+                // NOTE(nicolas): so that starting sounds at once
+                if (command.type == Command_timer_prewarm) audio_prewarm(audio);
+                if (command.type != Command_timer_start) return CoroutineState_Waiting;
             }
 
-            timer_start(timer);
-            audio_start(audio);
+            {
+                auto const& phase = program.schedule->phases[program.phase_i];
+                timer_start(timer, phase.duration_micros);
+                audio_preset(audio, phase.audio);
+                audio_start(audio);
+            }
+            // NOTE(nicolas): the audio thread rings at the exact end of
+            // the session, whenever we get to run.
+            audio_chime_at(audio, query_timer_end_micros(&program));
+            if (program.tick_on) audio_ticks_until(audio, query_timer_end_micros(&program));
 
             set(&program, 20); case 20:
-            while (timer_is_active(timer) && !timer_expired(timer)) {
+            while (query_timer_is_active(&program) && !query_timer_expired(&program)) {
                 auto const command = pop_command(&program);
                 if (command.type == Command_timer_stop) {
+                    audio_chime_cancel(audio);
+                    audio_ticks_cancel(audio);
                     audio_stop(audio);
                     timer_stop(timer);
                     timer_update_and_render(timer);
                     jump(&program, 0); /* reset */
                     return CoroutineState_Waiting;
                 } else if(command.type == Command_timer_start) {
-                    timer_reset(timer);
+                    timer_reset(timer, program.schedule->phases[program.phase_i].duration_micros);
+                    audio_chime_at(audio, query_timer_end_micros(&program));
+                    if (program.tick_on) audio_ticks_until(audio, query_timer_end_micros(&program));
+                } else if (command.type == Command_timer_prewarm) {
+                    // NOTE(nicolas): the pointer moves over the window, with
+                    // the audio already on and nothing new to show
+                    program.deadline_micros = query_timer_end_micros(&program);
+                    return CoroutineState_Waiting;
                 }
                 timer_update_and_render(timer);
+                // NOTE(nicolas): nothing happens until the session expires
+                program.deadline_micros = query_timer_end_micros(&program);
                 return CoroutineState_Waiting;
             }
             ++program.timer_elapsed_n;
+            program.phase_i = (program.phase_i + 1) % program.schedule->phase_n;
             timer_celebrate(timer);
             audio_stop(audio);
             timer_update_and_render(timer);
@@ -91,19 +169,76 @@ CoroutineState uu_focus_main(UUFocusMainCoroutine* _program)
     return CoroutineState_Done;
 }
 
+// Takes the next command out of the queue, journaling it, or out of the
+// journal when replaying. Returns false when there is none.
+static bool take_command(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    auto& commands = program.input.commands;
+    if (program.has_command) return true;
+    if (program.replay) {
+        program.has_command = journal_replay_command(program.replay, &program.command);
+    } else if (commands.read_n != commands.write_n) {
+        program.command = commands.commands[commands.read_n++ % COMMAND_QUEUE_CAPACITY];
+        program.has_command = true;
+    }
+    if (program.has_command && program.journal) journal_command(program.journal, program.command);
+    return program.has_command;
+}
+
+static CommandMsg const* peek_command(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    return program.has_command ? &program.command : nullptr;
+}
+
 static CommandMsg pop_command(UUFocusMainCoroutine* _program)
 {
     auto& program = *_program;
-    auto command = program.input.command;
-    program.input.command = {};
-    return command;
+    if (!program.has_command) return {};
+    program.has_command = false;
+    return program.command;
+}
+
+// Queries of the effects go through the journal.
+
+static bool query_timer_is_active(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    auto const y = program.replay ?
+        journal_replay_bool(program.replay, JournalTag_TimerIsActive_False) :
+        timer_is_active(program.timer_effect);
+    if (program.journal) journal_bool(program.journal, JournalTag_TimerIsActive_False, y);
+    return y;
+}
+
+// At the time of the command being handled, rather than now: the commands
+// of a call may have waited in the queue.
+static bool query_timer_expired(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    auto const y = program.replay ?
+        journal_replay_bool(program.replay, JournalTag_TimerExpired_False) :
+        timer_expired(program.timer_effect, program.resume_micros);
+    if (program.journal) journal_bool(program.journal, JournalTag_TimerExpired_False, y);
+    return y;
+}
+
+static uint64_t query_timer_end_micros(UUFocusMainCoroutine* _program)
+{
+    auto& program = *_program;
+    auto const y = program.replay ?
+        journal_replay_micros(program.replay, JournalTag_TimerEndMicros) :
+        timer_end_micros(program.timer_effect);
+    if (program.journal) journal_micros(program.journal, JournalTag_TimerEndMicros, y);
+    return y;
 }
 
 static void set(UUFocusMainCoroutine* _program, int step)
 {
     auto& program = *_program;
     program.step = step;
-    program.step_micros = program.input.time_micros;
+    program.step_micros = program.resume_micros;
 }
 
 static void jump(UUFocusMainCoroutine* _program, int step)
@@ -11,6 +11,8 @@ enum CoroutineState
 };
 
 CoroutineState uu_focus_main(UUFocusMainCoroutine* program);
+// Whether the program may resume at `step`, as restored from elsewhere.
+bool uu_focus_main_is_resume_step(int step);
 
 
 #include <cstdint>
@@ -21,32 +23,65 @@ enum Command
     Command_application_stop,
     Command_timer_start,
     Command_timer_stop,
+    Command_timer_prewarm, // the user is about to start
 };
 
 struct CommandMsg
 {
     Command type;
+    std::uint64_t time_micros; // when it was issued
 };
 
+enum { COMMAND_QUEUE_CAPACITY = 32 /* power of two */ };
+
+// Commands for uu_focus_main, in the order they were issued. uu_focus_main
+// drains it on every call.
+struct CommandQueue
+{
+    CommandMsg commands[COMMAND_QUEUE_CAPACITY];
+    std::uint32_t write_n;
+    std::uint32_t read_n;
+    std::uint32_t overflow_n; // commands that did not fit
+};
+
+// Queues a command, unless the queue is full. A stop of the application
+// is never lost: it takes the place of the newest command instead.
+bool command_push(CommandQueue* queue, CommandMsg command);
+
 struct UUFocusMainCoroutine
 {
     // inputs:
     struct
     {
-        CommandMsg command;
+        CommandQueue commands;
         std::uint64_t time_micros;
     } input;
 
+    // settings:
+    bool tick_on; // ticks every second of the countdown
+    // the phases the sessions go through, schedule_classic when null
+    struct Schedule const* schedule;
+
     // results:
     unsigned int timer_elapsed_n; // wraps when reaching max
+    std::uint32_t phase_i; // of the schedule, running or next to start
+    // when the program must run again at the latest, on the clock of the
+    // inputs, or 0 when it only waits for commands
+    std::uint64_t deadline_micros;
 
     // effects:
     struct AudioEffect *audio_effect;
     struct TimerEffect *timer_effect;
+    struct Journal *journal; // records the inputs, when set
+    struct JournalReplay *replay; // answers the queries instead of the effects, when set
 
     // internal state:
     int entry_count;
     int step;
     std::uint64_t step_micros;
+    std::uint64_t resume_micros; // of the command being handled, or of the input
+    // taken from the queue, until handled
+    CommandMsg command;
+    bool has_command;
 };
 
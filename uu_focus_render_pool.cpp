@@ -0,0 +1,251 @@
+// @language: c++14
+#include "uu_focus_render_pool.hpp"
+
+#include "uu_focus_effects.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// # Deques
+//
+// Chase-Lev work stealing deques of stream indices. Tasks are only pushed
+// between blocks, while every worker is parked, so the owner only ever
+// pops from the bottom while thieves take from the top.
+
+struct RenderDeque
+{
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    int* tasks; // stream_max entries
+    char padding[64 - 2*sizeof(int64_t) - sizeof(int*)]; // a cache line each
+};
+
+static void render_deque_reset(RenderDeque* _deque)
+{
+    auto& deque = *_deque;
+    deque.top.store(0, std::memory_order_relaxed);
+    deque.bottom.store(0, std::memory_order_relaxed);
+}
+
+// not concurrent with pops and steals
+static void render_deque_push(RenderDeque* _deque, int task)
+{
+    auto& deque = *_deque;
+    auto const bottom = deque.bottom.load(std::memory_order_relaxed);
+    deque.tasks[bottom] = task;
+    deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+static bool render_deque_pop(RenderDeque* _deque, int* _task)
+{
+    auto& deque = *_deque;
+    auto const bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+    deque.bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = deque.top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        deque.bottom.store(top, std::memory_order_relaxed);
+        return false;
+    }
+    *_task = deque.tasks[bottom];
+    if (top == bottom) {
+        // last task, race against the thieves for it
+        bool const won = deque.top.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        deque.bottom.store(top + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+static bool render_deque_steal(RenderDeque* _deque, int* _task)
+{
+    auto& deque = *_deque;
+    auto top = deque.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto const bottom = deque.bottom.load(std::memory_order_acquire);
+    if (top >= bottom) return false;
+    auto const task = deque.tasks[top];
+    if (!deque.top.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return false;
+    }
+    *_task = task;
+    return true;
+}
+
+// # Pool
+
+enum { RENDER_POOL_WORKER_MAX = 64 };
+
+struct RenderPool
+{
+    int worker_count;
+    int stream_max;
+    RenderDeque deques[RENDER_POOL_WORKER_MAX];
+    int* task_storage;
+    std::thread threads[RENDER_POOL_WORKER_MAX];
+
+    // current block, published under `mutex` with `generation`
+    std::mutex mutex;
+    std::condition_variable block_started;
+    uint64_t generation;
+    bool quit_on;
+    RenderStream* streams;
+    int frame_count;
+    uint64_t deadline_micros;
+
+    char padding[64]; // keeps the counters off the lines read at every task
+    std::atomic<int> rendered_n;
+    std::atomic<int> late_n;
+    std::atomic<int> steal_n;
+    std::atomic<int> busy_worker_n; // not done with the current block
+};
+
+static void render_pool_run_task(RenderPool* _pool, int task)
+{
+    auto& pool = *_pool;
+    auto const& stream = pool.streams[task];
+    if (now_micros() > pool.deadline_micros) {
+        std::memset(stream.frames, 0,
+                    sizeof(float)*stream.channel_count*pool.frame_count);
+        pool.late_n.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    audio_thread_render(stream.audio, stream.frames, stream.channel_count, pool.frame_count);
+    pool.rendered_n.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void render_pool_run_block(RenderPool* _pool, int worker_i)
+{
+    auto& pool = *_pool;
+    int task;
+    int steal_n = 0;
+    while (true) {
+        if (render_deque_pop(&pool.deques[worker_i], &task)) {
+            render_pool_run_task(_pool, task);
+            continue;
+        }
+        // our deque is dry, visit the others once
+        bool stolen = false;
+        for (int i = 1; i < pool.worker_count && !stolen; ++i) {
+            auto const victim_i = (worker_i + i) % pool.worker_count;
+            stolen = render_deque_steal(&pool.deques[victim_i], &task);
+        }
+        if (!stolen) break;
+        ++steal_n;
+        render_pool_run_task(_pool, task);
+    }
+    pool.steal_n.fetch_add(steal_n, std::memory_order_relaxed);
+}
+
+static void render_pool_worker_main(RenderPool* _pool, int worker_i)
+{
+    auto& pool = *_pool;
+    uint64_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.block_started.wait(lock, [&]() {
+                return pool.quit_on || pool.generation != generation;
+            });
+            if (pool.quit_on) return;
+            generation = pool.generation;
+        }
+        render_pool_run_block(_pool, worker_i);
+        pool.busy_worker_n.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+RenderPool* render_pool_make(int worker_count, int stream_max)
+{
+    if (worker_count <= 0) worker_count = int(std::thread::hardware_concurrency());
+    if (worker_count <= 0) worker_count = 1;
+    if (worker_count > RENDER_POOL_WORKER_MAX) worker_count = RENDER_POOL_WORKER_MAX;
+
+    auto _pool = new RenderPool();
+    auto& pool = *_pool;
+    pool.worker_count = worker_count;
+    pool.stream_max = stream_max;
+    pool.task_storage = new int[size_t(worker_count)*size_t(stream_max)];
+    for (int worker_i = 0; worker_i < worker_count; ++worker_i) {
+        pool.deques[worker_i].tasks = pool.task_storage + worker_i*stream_max;
+    }
+    // worker 0 is the calling thread
+    for (int worker_i = 1; worker_i < worker_count; ++worker_i) {
+        pool.threads[worker_i] = std::thread(render_pool_worker_main, _pool, worker_i);
+    }
+    return _pool;
+}
+
+void render_pool_destroy(RenderPool* _pool)
+{
+    auto& pool = *_pool;
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.quit_on = true;
+    }
+    pool.block_started.notify_all();
+    for (int worker_i = 1; worker_i < pool.worker_count; ++worker_i) {
+        pool.threads[worker_i].join();
+    }
+    delete[] pool.task_storage;
+    delete &pool;
+}
+
+int render_pool_worker_count(RenderPool* pool)
+{
+    return pool->worker_count;
+}
+
+RenderPoolResult render_pool_render(RenderPool* _pool,
+                                    RenderStream* streams,
+                                    int stream_count,
+                                    int frame_count,
+                                    uint64_t deadline_micros)
+{
+    auto& pool = *_pool;
+    if (stream_count > pool.stream_max) stream_count = pool.stream_max;
+
+    // deal the streams out, workers are all parked at this point
+    for (int worker_i = 0; worker_i < pool.worker_count; ++worker_i) {
+        render_deque_reset(&pool.deques[worker_i]);
+    }
+    for (int task = 0; task < stream_count; ++task) {
+        render_deque_push(&pool.deques[task % pool.worker_count], task);
+    }
+    pool.rendered_n.store(0, std::memory_order_relaxed);
+    pool.late_n.store(0, std::memory_order_relaxed);
+    pool.steal_n.store(0, std::memory_order_relaxed);
+    pool.busy_worker_n.store(pool.worker_count - 1, std::memory_order_relaxed);
+
+    if (pool.worker_count > 1) {
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.streams = streams;
+            pool.frame_count = frame_count;
+            pool.deadline_micros = deadline_micros;
+            ++pool.generation;
+        }
+        pool.block_started.notify_all();
+    } else {
+        pool.streams = streams;
+        pool.frame_count = frame_count;
+        pool.deadline_micros = deadline_micros;
+    }
+
+    render_pool_run_block(_pool, 0);
+    // the others may still be busy with their last task
+    while (pool.busy_worker_n.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+
+    RenderPoolResult result;
+    result.rendered_n = pool.rendered_n.load(std::memory_order_relaxed);
+    result.late_n = pool.late_n.load(std::memory_order_relaxed);
+    result.steal_n = pool.steal_n.load(std::memory_order_relaxed);
+    return result;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#define UU_FOCUS_RENDER_POOL
+
+#include <stdint.h>
+
+/*
+ * Renders many independent audio streams on a pool of worker threads.
+ *
+ * Every block, each stream is one task. Tasks are dealt out to per-worker
+ * deques; a worker pops from its own deque and, once it runs dry, steals
+ * from the others. The calling thread takes part as worker 0.
+ */
+
+struct AudioEffect;
+
+struct RenderStream
+{
+    AudioEffect* audio;
+    float* frames; // frame_count frames of channel_count interleaved samples
+    int channel_count;
+};
+
+struct RenderPoolResult
+{
+    int rendered_n;
+    int late_n; // not started before the deadline, left silent
+    int steal_n;
+};
+
+struct RenderPool;
+
+// `worker_count` of 0 uses every core. Blocks hold at most `stream_max` streams.
+RenderPool* render_pool_make(int worker_count, int stream_max);
+void render_pool_destroy(RenderPool*);
+int render_pool_worker_count(RenderPool*);
+
+// Renders `frame_count` frames of every stream. Streams that could not be
+// started before `deadline_micros`, on the now_micros() clock, are written
+// silent instead so that the block is still delivered in time.
+RenderPoolResult render_pool_render(RenderPool*,
+                                    RenderStream* streams,
+                                    int stream_count,
+                                    int frame_count,
+                                    uint64_t deadline_micros);
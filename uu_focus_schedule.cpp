@@ -0,0 +1,96 @@
+// @language: c++14
+#include "uu_focus_schedule.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+static char const* const schedule_phase_kind_names[SchedulePhaseKind_Last] = {
+    "work",
+    "short_break",
+    "long_break",
+};
+
+static char const* const schedule_audio_mode_names[AudioMode_Last] = {
+    "noise",
+#if UU_FOCUS_INTERNAL
+    "reference_tone",
+#endif
+};
+
+char const* schedule_phase_kind_name(SchedulePhaseKind kind)
+{
+    return kind >= 0 && kind < SchedulePhaseKind_Last ? schedule_phase_kind_names[kind] : "";
+}
+
+// the index of `word` among `names`, or -1
+static int schedule_name_find(char const* const* names, int name_n, char const* word)
+{
+    for (int i = 0; i < name_n; ++i) {
+        if (0 == std::strcmp(names[i], word)) return i;
+    }
+    return -1;
+}
+
+// Reads a number that ends the word, or fails.
+static bool schedule_number_parse(char const* word, double* _x)
+{
+    char* last;
+    auto const x = std::strtod(word, &last);
+    if (last == word || *last != '\0' || !(x >= 0.0)) return false;
+    *_x = x;
+    return true;
+}
+
+static bool schedule_line_parse(char* line, SchedulePhase* _phase)
+{
+    auto& phase = *_phase;
+    enum { WORD_N = 4 };
+    char* words[WORD_N];
+    int word_n = 0;
+    for (char* word = std::strtok(line, " \t\r"); word; word = std::strtok(nullptr, " \t\r")) {
+        if (word_n == WORD_N) return false;
+        words[word_n++] = word;
+    }
+    if (word_n != WORD_N) return false;
+
+    auto const kind = schedule_name_find(schedule_phase_kind_names, SchedulePhaseKind_Last, words[0]);
+    auto const mode = schedule_name_find(schedule_audio_mode_names, AudioMode_Last, words[2]);
+    double minutes, volume;
+    if (kind < 0 || mode < 0 ||
+        !schedule_number_parse(words[1], &minutes) || minutes == 0.0 ||
+        !schedule_number_parse(words[3], &volume) || volume > 1.0) {
+        return false;
+    }
+    phase.kind = SchedulePhaseKind(kind);
+    phase.duration_micros = schedule_minutes(minutes);
+    phase.audio.mode = mode;
+    phase.audio.amp = float(volume);
+    return true;
+}
+
+bool schedule_parse(Schedule* _schedule, char const* text, size_t size)
+{
+    Schedule schedule = {};
+    auto const text_end = text + size;
+    while (text != text_end) {
+        auto line_end = static_cast<char const*>(std::memchr(text, '\n', size_t(text_end - text)));
+        if (!line_end) line_end = text_end;
+        enum { LINE_CAPACITY = 128 };
+        char line[LINE_CAPACITY];
+        auto const line_size = size_t(line_end - text);
+        if (line_size >= LINE_CAPACITY) return false;
+        std::memcpy(line, text, line_size);
+        line[line_size] = '\0';
+        text = line_end == text_end ? text_end : line_end + 1;
+
+        auto first = line;
+        while (*first == ' ' || *first == '\t' || *first == '\r') ++first;
+        if (*first == '\0' || *first == '#') continue;
+        if (schedule.phase_n == SCHEDULE_PHASE_CAPACITY) return false;
+        if (!schedule_line_parse(first, &schedule.phases[schedule.phase_n])) return false;
+        ++schedule.phase_n;
+    }
+    if (schedule.phase_n == 0) return false;
+    *_schedule = schedule;
+    return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#define UU_FOCUS_SCHEDULE
+
+/*
+ * Schedules of the sessions: a cycle of phases, of work then of short or
+ * long breaks, each of its duration and with its own sound.
+ *
+ * A schedule is a flat table, whether it was compiled in or loaded at
+ * runtime (schedule_parse). uu_focus_main indexes it with the phase it is
+ * in, and moves on to the next one modulo the length of the cycle, so that
+ * it does not look at what the schedule is made of as it resumes.
+ *
+ * The text of a schedule has a phase per line, of its kind, its duration
+ * in minutes, the mode and the volume of its sound:
+ *
+ *   # kind     minutes  mode   volume
+ *   work       25       noise  1.0
+ *   short_break 5       noise  0.4
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+#include "uu_focus_audio_module.hpp"
+#include "uu_focus_effects.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum { SCHEDULE_PHASE_CAPACITY = 16 };
+
+enum SchedulePhaseKind
+{
+    SchedulePhaseKind_Work,
+    SchedulePhaseKind_ShortBreak,
+    SchedulePhaseKind_LongBreak,
+    SchedulePhaseKind_Last,
+};
+
+struct SchedulePhase
+{
+    SchedulePhaseKind kind;
+    uint64_t duration_micros;
+    AudioPreset audio;
+};
+
+struct Schedule
+{
+    uint32_t phase_n; // at least one
+    SchedulePhase phases[SCHEDULE_PHASE_CAPACITY];
+};
+
+// NOTE(nicolas): in internal builds, minutes are seconds so that we see
+// whole cycles go by
+constexpr uint64_t schedule_minutes(double minutes)
+{
+#if UU_FOCUS_INTERNAL
+    return uint64_t(minutes * 1'000'000);
+#else
+    return uint64_t(minutes * 60'000'000);
+#endif
+}
+
+// Four sessions of work, with short breaks in between and a long one to
+// end the cycle.
+constexpr Schedule schedule_classic = {
+    8,
+    {
+        { SchedulePhaseKind_Work, schedule_minutes(25), { AudioMode_Noise, 1.0f } },
+        { SchedulePhaseKind_ShortBreak, schedule_minutes(5), { AudioMode_Noise, 0.4f } },
+        { SchedulePhaseKind_Work, schedule_minutes(25), { AudioMode_Noise, 1.0f } },
+        { SchedulePhaseKind_ShortBreak, schedule_minutes(5), { AudioMode_Noise, 0.4f } },
+        { SchedulePhaseKind_Work, schedule_minutes(25), { AudioMode_Noise, 1.0f } },
+        { SchedulePhaseKind_ShortBreak, schedule_minutes(5), { AudioMode_Noise, 0.4f } },
+        { SchedulePhaseKind_Work, schedule_minutes(25), { AudioMode_Noise, 1.0f } },
+        { SchedulePhaseKind_LongBreak, schedule_minutes(15), { AudioMode_Noise, 0.0f } },
+    },
+};
+
+// Sessions of work only, as before there were schedules.
+constexpr Schedule schedule_work_only = {
+    1,
+    {
+        { SchedulePhaseKind_Work, schedule_minutes(25), { AudioMode_Noise, 1.0f } },
+    },
+};
+
+// Reads the text of a schedule into `schedule`. Returns false, leaving it
+// alone, when the text is not a schedule or has too many phases.
+bool schedule_parse(Schedule* schedule, char const* text, size_t size);
+
+char const* schedule_phase_kind_name(SchedulePhaseKind kind);
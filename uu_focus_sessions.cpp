@@ -0,0 +1,190 @@
+// @language: c++14
+#include "uu_focus_sessions.hpp"
+
+#include "uu_focus_schedule.hpp"
+#include "uu_focus_timing_wheel.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SESSIONS_SSE2 1 // part of the instruction set
+#include <emmintrin.h>
+#else
+#define SESSIONS_SSE2 0
+#endif
+
+// NOTE(nicolas): arrays are padded to a whole number of vectors, with
+// sessions that are never due
+enum { SESSIONS_LANE_N = 8 };
+
+template <typename T>
+static T* sessions_array_make(uint32_t capacity)
+{
+    auto const y = new T[capacity];
+    std::memset(y, 0, capacity * sizeof *y);
+    return y;
+}
+
+void sessions_init(Sessions* _sessions, uint32_t capacity, Schedule const* schedule)
+{
+    auto& sessions = *_sessions;
+    auto const padded_capacity = (capacity + SESSIONS_LANE_N - 1) / SESSIONS_LANE_N * SESSIONS_LANE_N;
+    sessions = {};
+    sessions.capacity = capacity;
+    sessions.schedule = schedule ? schedule : &schedule_classic;
+    sessions.deadline_micros = sessions_array_make<double>(padded_capacity);
+    for (uint32_t i = 0; i < padded_capacity; ++i) {
+        sessions.deadline_micros[i] = sessions_no_deadline;
+    }
+    sessions.step = sessions_array_make<int32_t>(padded_capacity);
+    sessions.on_count = sessions_array_make<int32_t>(padded_capacity);
+    sessions.phase_i = sessions_array_make<uint32_t>(padded_capacity);
+    sessions.elapsed_n = sessions_array_make<uint32_t>(padded_capacity);
+    sessions.stop_n = sessions_array_make<uint32_t>(padded_capacity);
+    sessions.expired = sessions_array_make<uint32_t>(padded_capacity);
+}
+
+void sessions_destroy(Sessions* _sessions)
+{
+    auto& sessions = *_sessions;
+    delete[] sessions.deadline_micros;
+    delete[] sessions.step;
+    delete[] sessions.on_count;
+    delete[] sessions.phase_i;
+    delete[] sessions.elapsed_n;
+    delete[] sessions.stop_n;
+    delete[] sessions.expired;
+    sessions = {};
+}
+
+uint32_t sessions_add(Sessions* _sessions)
+{
+    auto& sessions = *_sessions;
+    if (sessions.count == sessions.capacity) return UINT32_MAX;
+    auto const i = sessions.count++;
+    sessions.deadline_micros[i] = sessions_no_deadline;
+    sessions.step[i] = SessionStep_Waiting;
+    sessions.on_count[i] = 0;
+    sessions.phase_i[i] = 0;
+    sessions.elapsed_n[i] = 0;
+    sessions.stop_n[i] = 0;
+    return i;
+}
+
+void sessions_command(Sessions* _sessions, uint32_t i, CommandMsg command)
+{
+    auto& sessions = *_sessions;
+    switch (command.type) {
+        case Command_timer_start: {
+            // a start while counting down restarts the phase
+            auto const& phase = sessions.schedule->phases[sessions.phase_i[i]];
+            sessions.step[i] = SessionStep_Counting;
+            sessions.on_count[i] = 1;
+            auto const deadline_micros = command.time_micros + phase.duration_micros;
+            sessions.deadline_micros[i] = double(deadline_micros);
+            if (sessions.wheel) timing_wheel_arm(sessions.wheel, i, deadline_micros);
+        } break;
+        case Command_timer_stop:
+        case Command_application_stop: {
+            if (sessions.step[i] != SessionStep_Counting) break;
+            sessions.step[i] = SessionStep_Waiting;
+            sessions.on_count[i] = 0;
+            sessions.deadline_micros[i] = sessions_no_deadline;
+            ++sessions.stop_n[i];
+            if (sessions.wheel) timing_wheel_cancel(sessions.wheel, i);
+        } break;
+        default: break;
+    }
+}
+
+// the session reached the end of its phase
+static void sessions_expire(Sessions* _sessions, uint32_t i)
+{
+    auto& sessions = *_sessions;
+    ++sessions.elapsed_n[i];
+    sessions.phase_i[i] = (sessions.phase_i[i] + 1) % sessions.schedule->phase_n;
+    sessions.step[i] = SessionStep_Waiting;
+    sessions.on_count[i] = 0;
+    sessions.deadline_micros[i] = sessions_no_deadline;
+    sessions.expired[sessions.expired_n++] = i;
+}
+
+// # Scans
+//
+// Both expire the sessions due at `now_micros`, and return the earliest
+// deadline of the others.
+
+static double sessions_scan_scalar(Sessions* _sessions, double now_micros)
+{
+    auto& sessions = *_sessions;
+    auto const deadlines = sessions.deadline_micros;
+    auto next = sessions_no_deadline;
+    for (uint32_t i = 0; i < sessions.count; ++i) {
+        if (deadlines[i] <= now_micros) sessions_expire(&sessions, i);
+        if (deadlines[i] < next) next = deadlines[i];
+    }
+    return next;
+}
+
+#if SESSIONS_SSE2
+static double sessions_scan_sse2(Sessions* _sessions, double now_micros)
+{
+    auto& sessions = *_sessions;
+    auto const deadlines = sessions.deadline_micros;
+    auto const count = sessions.count;
+    auto const now = _mm_set1_pd(now_micros);
+    // minimums that do not wait on each other, of a vector each
+    auto next0 = _mm_set1_pd(sessions_no_deadline);
+    auto next1 = next0;
+    auto next2 = next0;
+    auto next3 = next0;
+    static_assert(SESSIONS_LANE_N == 8, "four vectors of two per iteration");
+    for (uint32_t i = 0; i < count; i += SESSIONS_LANE_N) {
+        auto x0 = _mm_loadu_pd(deadlines + i);
+        auto x1 = _mm_loadu_pd(deadlines + i + 2);
+        auto x2 = _mm_loadu_pd(deadlines + i + 4);
+        auto x3 = _mm_loadu_pd(deadlines + i + 6);
+        auto const is_due = _mm_or_pd(_mm_or_pd(_mm_cmple_pd(x0, now), _mm_cmple_pd(x1, now)),
+                                      _mm_or_pd(_mm_cmple_pd(x2, now), _mm_cmple_pd(x3, now)));
+        if (_mm_movemask_pd(is_due)) {
+            // rarely: some are due
+            for (uint32_t session_i = i; session_i < i + SESSIONS_LANE_N; ++session_i) {
+                if (deadlines[session_i] <= now_micros) sessions_expire(&sessions, session_i);
+            }
+            x0 = _mm_loadu_pd(deadlines + i);
+            x1 = _mm_loadu_pd(deadlines + i + 2);
+            x2 = _mm_loadu_pd(deadlines + i + 4);
+            x3 = _mm_loadu_pd(deadlines + i + 6);
+        }
+        next0 = _mm_min_pd(next0, x0);
+        next1 = _mm_min_pd(next1, x1);
+        next2 = _mm_min_pd(next2, x2);
+        next3 = _mm_min_pd(next3, x3);
+    }
+    auto y = _mm_min_pd(_mm_min_pd(next0, next1), _mm_min_pd(next2, next3));
+    y = _mm_min_pd(y, _mm_unpackhi_pd(y, y));
+    return _mm_cvtsd_f64(y);
+}
+#endif
+
+uint64_t sessions_advance(Sessions* _sessions, uint64_t now_micros)
+{
+    auto& sessions = *_sessions;
+    sessions.expired_n = 0;
+    if (sessions.wheel) {
+        auto& wheel = *sessions.wheel;
+        timing_wheel_advance(&wheel, now_micros);
+        for (uint32_t expired_i = 0; expired_i < wheel.expired_n; ++expired_i) {
+            sessions_expire(&sessions, wheel.expired[expired_i]);
+        }
+        return timing_wheel_next_micros(&wheel);
+    }
+#if SESSIONS_SSE2
+    auto const next = sessions.scalar_on ?
+        sessions_scan_scalar(&sessions, double(now_micros)) :
+        sessions_scan_sse2(&sessions, double(now_micros));
+#else
+    auto const next = sessions_scan_scalar(&sessions, double(now_micros));
+#endif
+    return next == sessions_no_deadline ? 0 : uint64_t(next);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#define UU_FOCUS_SESSIONS
+
+/*
+ * Many focus sessions at once, for a host serving a whole team, where
+ * uu_focus_main runs a single one.
+ *
+ * Sessions go through the same steps as uu_focus_main: waiting for a
+ * start, then counting down to the end of the phase of their schedule.
+ * Their state is kept as arrays of each field rather than an array of
+ * sessions, so that finding the sessions that are due reads the deadlines
+ * and nothing else. sessions_advance scans them with SIMD, a couple of
+ * sessions per instruction, and moves every expired session on to its
+ * next phase in the same pass.
+ *
+ * With a timing wheel (uu_focus_timing_wheel.hpp), sessions_advance finds
+ * the expired sessions in the wheel instead, at a cost that does not grow
+ * with the sessions that are not due: starts arm the timer of the session,
+ * restarts re-arm it, stops cancel it.
+ *
+ * The engine has no effects: the host tells what expired, from `expired`,
+ * and wakes the engine up at the next deadline.
+ */
+
+#include "uu_focus_main.hpp"
+
+#include <stdint.h>
+
+struct Schedule;
+struct TimingWheel;
+
+enum SessionStep
+{
+    SessionStep_Waiting = 10, // for a start
+    SessionStep_Counting = 20, // down to the deadline
+};
+
+// NOTE(nicolas): deadlines are doubles, exact to the microsecond for
+// centuries, as SSE2 compares two of them and takes their minimum in an
+// instruction each, which it has no instruction for with 64 bit integers.
+static double const sessions_no_deadline = 1e300;
+
+struct Sessions
+{
+    uint32_t count;
+    uint32_t capacity;
+    Schedule const* schedule; // of every session
+
+    // per session, `capacity` of them:
+    double* deadline_micros; // sessions_no_deadline when none
+    int32_t* step; // SessionStep
+    int32_t* on_count;
+    uint32_t* phase_i;
+    uint32_t* elapsed_n;
+    uint32_t* stop_n;
+
+    // of the last sessions_advance:
+    uint32_t* expired; // the sessions that expired, in order
+    uint32_t expired_n;
+
+    bool scalar_on; // scans without SIMD, for comparisons
+    // when set, of a timer per session, finds the expired sessions
+    // instead of the scan
+    TimingWheel* wheel;
+};
+
+// `schedule`, when null, is schedule_classic.
+void sessions_init(Sessions* sessions, uint32_t capacity, Schedule const* schedule);
+void sessions_destroy(Sessions* sessions);
+
+// A new session waiting for a start. Returns its index, or UINT32_MAX when
+// there is no room left.
+uint32_t sessions_add(Sessions* sessions);
+
+// Handles a command of one session, as uu_focus_main does.
+void sessions_command(Sessions* sessions, uint32_t session_i, CommandMsg command);
+
+// Moves every session due at `now_micros` on to its next phase, listing
+// them in `expired`. Returns the next deadline, or 0 when no session
+// counts down. With a wheel, it may return an earlier time to advance at,
+// as timing_wheel_next_micros does.
+uint64_t sessions_advance(Sessions* sessions, uint64_t now_micros);
@@ -0,0 +1,93 @@
+// @language: c++14
+#include "uu_focus_sim.hpp"
+
+static uint64_t sim_virtual_clock_now(void* user)
+{
+    return static_cast<SimVirtualClock*>(user)->now_micros;
+}
+
+static void sim_virtual_clock_advance_to(void* user, uint64_t micros)
+{
+    auto& clock = *static_cast<SimVirtualClock*>(user);
+    if (micros > clock.now_micros) clock.now_micros = micros;
+}
+
+SimClock sim_virtual_clock(SimVirtualClock* clock)
+{
+    return { clock, sim_virtual_clock_now, sim_virtual_clock_advance_to };
+}
+
+// uniform in [0, 1)
+static double sim_random(uint32_t* _state)
+{
+    auto& x = *_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return double(x) / 4294967296.0;
+}
+
+SimStats sim_run(UUFocusMainCoroutine* _program, SimClock clock, SimUser user,
+                 uint64_t duration_micros)
+{
+    auto& program = *_program;
+    SimStats stats = {};
+    uint32_t random_state = user.seed ? user.seed : 1;
+    auto const start_micros = clock.now_micros(clock.user);
+    auto const end_micros = start_micros + duration_micros;
+    auto const elapsed_n = program.timer_elapsed_n;
+
+    bool has_command = false;
+    CommandMsg command = {};
+    Command last_type = Command_null;
+    uint64_t planned_deadline_micros = 0; // of the session the user made plans for
+    while (true) {
+        auto const now = clock.now_micros(clock.user);
+        auto const deadline_micros = program.deadline_micros;
+        if (!has_command && deadline_micros == 0) {
+            // away, then hovering, then starting
+            if (last_type == Command_timer_prewarm) {
+                command = { Command_timer_start, now + user.hover_micros };
+            } else {
+                auto const break_micros =
+                    uint64_t(double(user.break_micros) * (0.5 + sim_random(&random_state)));
+                command = { Command_timer_prewarm, now + break_micros };
+            }
+            has_command = true;
+        } else if (!has_command && deadline_micros != planned_deadline_micros) {
+            // maybe not focusing until the end of this one
+            planned_deadline_micros = deadline_micros;
+            auto const x = sim_random(&random_state);
+            auto const when_micros =
+                now + uint64_t(double(deadline_micros - now) * sim_random(&random_state));
+            if (x < user.stop_probability) {
+                command = { Command_timer_stop, when_micros };
+                has_command = true;
+            } else if (x < user.stop_probability + user.restart_probability) {
+                command = { Command_timer_start, when_micros };
+                has_command = true;
+            }
+        }
+
+        auto next_micros = has_command ? command.time_micros : deadline_micros;
+        if (deadline_micros && deadline_micros < next_micros) next_micros = deadline_micros;
+        if (next_micros > end_micros) break;
+
+        clock.advance_to(clock.user, next_micros);
+        program.input.time_micros = next_micros;
+        if (has_command && command.time_micros == next_micros) {
+            command_push(&program.input.commands, command);
+            ++stats.command_n;
+            if (command.type == Command_timer_stop) ++stats.stop_n;
+            if (command.type == Command_timer_start && deadline_micros) ++stats.restart_n;
+            last_type = command.type;
+            has_command = false;
+        }
+        uu_focus_main(&program);
+        ++stats.resume_n;
+    }
+    clock.advance_to(clock.user, end_micros);
+    stats.cycle_n = program.timer_elapsed_n - elapsed_n;
+    stats.simulated_micros = duration_micros;
+    return stats;
+}
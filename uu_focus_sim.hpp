@@ -0,0 +1,57 @@
+#pragma once
+#define UU_FOCUS_SIM
+
+/*
+ * Headless driver of uu_focus_main, on a clock of its own.
+ *
+ * A simulated user issues commands: away for a break, hovering over the
+ * window, then starting a session, which they may stop or restart before
+ * it expires. The driver jumps from one instant to the next, the next
+ * command of the user or the deadline of the program, without waiting in
+ * between: a session costs a handful of resumes, however long it lasts.
+ *
+ * The effects are whatever the unit links with, as long as they tell time
+ * with the clock given to the driver.
+ */
+
+#include "uu_focus_main.hpp"
+
+#include <stdint.h>
+
+struct SimClock
+{
+    void* user;
+    uint64_t (*now_micros)(void* user);
+    void (*advance_to)(void* user, uint64_t micros); // never backwards
+};
+
+// Time that only moves when the driver says so.
+struct SimVirtualClock
+{
+    uint64_t now_micros;
+};
+SimClock sim_virtual_clock(SimVirtualClock* clock);
+
+struct SimUser
+{
+    uint32_t seed;
+    uint64_t break_micros; // between sessions, from half to one and a half of it
+    uint64_t hover_micros; // from the pointer entering the window to the start
+    double stop_probability; // of giving up on a session
+    double restart_probability; // of starting over in a session
+};
+
+struct SimStats
+{
+    uint64_t resume_n; // calls to uu_focus_main
+    uint64_t command_n;
+    uint64_t cycle_n; // sessions gone to their end
+    uint64_t stop_n;
+    uint64_t restart_n;
+    uint64_t simulated_micros;
+};
+
+// Runs the program for `duration_micros` of the clock, from its current
+// state and time.
+SimStats sim_run(UUFocusMainCoroutine* program, SimClock clock, SimUser user,
+                 uint64_t duration_micros);
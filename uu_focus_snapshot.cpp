@@ -0,0 +1,109 @@
+// @language: c++14
+#include "uu_focus_snapshot.hpp"
+
+#include "uu_focus_schedule.hpp"
+
+// NOTE(nicolas): the fields of TimerEffect are those of the unit we are
+// compiled in, uu_focus_effects_types.hpp or the stub of the tests.
+
+#include <cstddef>
+#include <cstring>
+
+static uint8_t const snapshot_magic[4] = { 'U', 'U', 'F', 'S' };
+static size_t const snapshot_payload_offset = offsetof(UUFocusSnapshot, wall_micros);
+
+// fnv-1a
+static uint32_t snapshot_checksum(UUFocusSnapshot const* snapshot)
+{
+    auto const bytes = reinterpret_cast<uint8_t const*>(snapshot);
+    uint32_t hash = 2166136261u;
+    for (size_t i = snapshot_payload_offset; i < sizeof *snapshot; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool snapshot_is_valid(UUFocusSnapshot const* _snapshot)
+{
+    auto& snapshot = *_snapshot;
+    return std::memcmp(snapshot.magic, snapshot_magic, sizeof snapshot_magic) == 0 &&
+        snapshot.version == UU_FOCUS_SNAPSHOT_VERSION &&
+        snapshot.size == sizeof snapshot &&
+        snapshot.checksum == snapshot_checksum(&snapshot);
+}
+
+bool snapshot_update(UUFocusSnapshot* _snapshot, UUFocusMainCoroutine const* _program,
+                     TimerEffect const* _timer, uint64_t now_micros, uint64_t wall_micros)
+{
+    auto& snapshot = *_snapshot;
+    auto& program = *_program;
+    auto& timer = *_timer;
+    UUFocusSnapshot next = {};
+    std::memcpy(next.magic, snapshot_magic, sizeof snapshot_magic);
+    next.version = UU_FOCUS_SNAPSHOT_VERSION;
+    next.size = sizeof next;
+    next.step = program.step;
+    next.timer_elapsed_n = program.timer_elapsed_n;
+    next.step_micros = program.step_micros;
+    next.timer_on_count = timer.on_count;
+    next.timer_start_hours = timer.start_time.hours;
+    next.timer_start_minutes = timer.start_time.minutes;
+    next.phase_i = program.phase_i;
+    next.timer_start_micros = timer.start_micros;
+    next.timer_end_micros = timer.end_micros;
+
+    // NOTE(nicolas): the clocks of the snapshot change all the time, the
+    // state only on transitions
+    if (snapshot_is_valid(&snapshot) && snapshot.now_micros <= now_micros) {
+        next.wall_micros = snapshot.wall_micros;
+        next.now_micros = snapshot.now_micros;
+        if (std::memcmp(&next.step, &snapshot.step,
+                        sizeof next - offsetof(UUFocusSnapshot, step)) == 0) {
+            return false;
+        }
+    }
+    next.wall_micros = wall_micros;
+    next.now_micros = now_micros;
+    next.checksum = snapshot_checksum(&next);
+    snapshot = next;
+    return true;
+}
+
+bool snapshot_restore(UUFocusSnapshot const* _snapshot, UUFocusMainCoroutine* _program,
+                      TimerEffect* _timer, uint64_t now_micros, uint64_t wall_micros)
+{
+    auto const snapshot = *_snapshot; // it may be mapped, and change under us
+    auto& program = *_program;
+    auto& timer = *_timer;
+    if (!snapshot_is_valid(&snapshot)) return false;
+    // NOTE(nicolas): a step the code does not resume at, say from another
+    // build, would jump nowhere
+    if (!uu_focus_main_is_resume_step(snapshot.step)) return false;
+
+    // the instant it was written, on our clock
+    auto const down_micros =
+        wall_micros > snapshot.wall_micros ? int64_t(wall_micros - snapshot.wall_micros) : 0;
+    auto const written_micros = int64_t(now_micros) - down_micros;
+    auto const rebase = [&](uint64_t micros) {
+        auto const y = written_micros + (int64_t(micros) - int64_t(snapshot.now_micros));
+        return y > 0 ? uint64_t(y) : 0;
+    };
+    program.step = snapshot.step;
+    program.timer_elapsed_n = snapshot.timer_elapsed_n;
+    // NOTE(nicolas): the schedule may have changed in between
+    if (!program.schedule) program.schedule = &schedule_classic;
+    program.phase_i = snapshot.phase_i % program.schedule->phase_n;
+    program.step_micros = rebase(snapshot.step_micros);
+    timer.on_count = snapshot.timer_on_count;
+    timer.start_time.hours = snapshot.timer_start_hours;
+    timer.start_time.minutes = snapshot.timer_start_minutes;
+    timer.start_micros = rebase(snapshot.timer_start_micros);
+    timer.end_micros = rebase(snapshot.timer_end_micros);
+    timer.now_micros = now_micros;
+    return true;
+}
+
+void snapshot_clear(UUFocusSnapshot* snapshot)
+{
+    std::memset(snapshot, 0, sizeof *snapshot);
+}
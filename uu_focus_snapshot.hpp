@@ -0,0 +1,66 @@
+#pragma once
+#define UU_FOCUS_SNAPSHOT
+
+/*
+ * Snapshot of where the program and its timer are, so that a process that
+ * restarts mid-session resumes its countdown where it was.
+ *
+ * The snapshot has a fixed layout of fixed size fields, and lives in a
+ * file mapped in memory: writing it is writing a few words whenever the
+ * state changed, and the system persists it. A checksum covers all but
+ * the header, so that a snapshot torn by a crash is discarded rather than
+ * restored.
+ *
+ * Times of the now_micros() clock only make sense within a process. The
+ * snapshot keeps the instant it was written on both that clock and a wall
+ * clock, and restoring moves every time to the clock of the new process,
+ * the time spent down included.
+ */
+
+#include "uu_focus_main.hpp"
+
+#include <stdint.h>
+
+struct TimerEffect;
+
+enum { UU_FOCUS_SNAPSHOT_VERSION = 2 /* 2: phase_i */ };
+
+struct UUFocusSnapshot
+{
+    uint8_t magic[4]; // "UUFS"
+    uint32_t version;
+    uint32_t size;
+    uint32_t checksum; // of what follows
+
+    // when written
+    uint64_t wall_micros;
+    uint64_t now_micros;
+
+    // of UUFocusMainCoroutine
+    int32_t step;
+    uint32_t timer_elapsed_n;
+    uint64_t step_micros;
+
+    // of TimerEffect
+    int32_t timer_on_count;
+    int32_t timer_start_hours;
+    int32_t timer_start_minutes;
+    uint32_t phase_i; // of UUFocusMainCoroutine
+    uint64_t timer_start_micros;
+    uint64_t timer_end_micros;
+};
+static_assert(sizeof(UUFocusSnapshot) == 80, "the layout of the snapshot is fixed");
+
+// Writes the state into the snapshot, unless it is what the snapshot
+// already holds. Returns whether it wrote.
+bool snapshot_update(UUFocusSnapshot* snapshot, UUFocusMainCoroutine const* program,
+                     TimerEffect const* timer, uint64_t now_micros, uint64_t wall_micros);
+
+// Restores the state of a valid snapshot, on the clocks of this process,
+// in the schedule of `program`. Returns false, leaving the state alone, for
+// anything else.
+bool snapshot_restore(UUFocusSnapshot const* snapshot, UUFocusMainCoroutine* program,
+                      TimerEffect* timer, uint64_t now_micros, uint64_t wall_micros);
+
+// So that the next process starts afresh.
+void snapshot_clear(UUFocusSnapshot* snapshot);
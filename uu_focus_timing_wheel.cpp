@@ -0,0 +1,258 @@
+// @language: c++14
+#include "uu_focus_timing_wheel.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static uint64_t const timing_wheel_no_tick = UINT64_MAX;
+
+static int timing_wheel_lowest_bit(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long y;
+    _BitScanForward64(&y, x);
+    return int(y);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+static uint32_t timing_wheel_slot_list(int level, uint64_t tick)
+{
+    auto const slot = (tick >> (level * TIMING_WHEEL_SLOT_BITS)) & (TIMING_WHEEL_SLOT_N - 1);
+    return uint32_t(level * TIMING_WHEEL_SLOT_N + slot);
+}
+
+// the first occupied slot of `level` from `slot` on, or -1
+static int timing_wheel_occupied_from(TimingWheel const* _wheel, int level, int slot)
+{
+    auto const& wheel = *_wheel;
+    for (int word_i = slot / 64; word_i < TIMING_WHEEL_SLOT_N / 64; ++word_i) {
+        auto word = wheel.occupied[level][word_i];
+        if (word_i == slot / 64) word &= ~uint64_t(0) << (slot % 64);
+        if (word) return word_i * 64 + timing_wheel_lowest_bit(word);
+    }
+    return -1;
+}
+
+static void timing_wheel_push(TimingWheel* _wheel, uint32_t list, uint32_t i)
+{
+    auto& wheel = *_wheel;
+    auto const head = wheel.heads[list];
+    wheel.list[i] = list;
+    wheel.prev[i] = timing_wheel_none;
+    wheel.next[i] = head;
+    if (head != timing_wheel_none) wheel.prev[head] = i;
+    wheel.heads[list] = i;
+    if (list < TIMING_WHEEL_LIST_OVERFLOW) {
+        wheel.occupied[list / TIMING_WHEEL_SLOT_N][(list % TIMING_WHEEL_SLOT_N) / 64] |=
+            uint64_t(1) << (list % 64);
+    }
+}
+
+static void timing_wheel_unlink(TimingWheel* _wheel, uint32_t i)
+{
+    auto& wheel = *_wheel;
+    auto const list = wheel.list[i];
+    auto const next = wheel.next[i];
+    auto const prev = wheel.prev[i];
+    if (next != timing_wheel_none) wheel.prev[next] = prev;
+    if (prev != timing_wheel_none) {
+        wheel.next[prev] = next;
+    } else {
+        wheel.heads[list] = next;
+        if (next == timing_wheel_none && list < TIMING_WHEEL_LIST_OVERFLOW) {
+            wheel.occupied[list / TIMING_WHEEL_SLOT_N][(list % TIMING_WHEEL_SLOT_N) / 64] &=
+                ~(uint64_t(1) << (list % 64));
+        }
+    }
+    wheel.list[i] = timing_wheel_none;
+}
+
+// Into the finest level that holds its tick, relative to the current one.
+static void timing_wheel_place(TimingWheel* _wheel, uint32_t i)
+{
+    auto& wheel = *_wheel;
+    auto const tick = wheel.deadline_micros[i] / wheel.tick_micros;
+    if (tick < wheel.tick) {
+        timing_wheel_push(&wheel, TIMING_WHEEL_LIST_DUE, i);
+        return;
+    }
+    // NOTE(nicolas): the digits above the level are those of the current
+    // tick, the digit of the level is past the current one
+    auto const differing = tick ^ wheel.tick;
+    for (int level = 0; level < TIMING_WHEEL_LEVEL_N; ++level) {
+        if (differing < uint64_t(1) << ((level + 1) * TIMING_WHEEL_SLOT_BITS)) {
+            timing_wheel_push(&wheel, timing_wheel_slot_list(level, tick), i);
+            return;
+        }
+    }
+    timing_wheel_push(&wheel, TIMING_WHEEL_LIST_OVERFLOW, i);
+}
+
+// Places again every timer of a list, as its time has come.
+static void timing_wheel_cascade_list(TimingWheel* _wheel, uint32_t list)
+{
+    auto& wheel = *_wheel;
+    auto i = wheel.heads[list];
+    wheel.heads[list] = timing_wheel_none;
+    if (list < TIMING_WHEEL_LIST_OVERFLOW) {
+        wheel.occupied[list / TIMING_WHEEL_SLOT_N][(list % TIMING_WHEEL_SLOT_N) / 64] &=
+            ~(uint64_t(1) << (list % 64));
+    }
+    while (i != timing_wheel_none) {
+        auto const next = wheel.next[i];
+        timing_wheel_place(&wheel, i);
+        i = next;
+    }
+}
+
+// Cascades the slots whose time comes at `tick`, the coarsest first.
+static void timing_wheel_cascade(TimingWheel* _wheel, uint64_t tick)
+{
+    auto& wheel = *_wheel;
+    int const bits_n = TIMING_WHEEL_LEVEL_N * TIMING_WHEEL_SLOT_BITS;
+    if ((tick & ((uint64_t(1) << bits_n) - 1)) == 0) {
+        timing_wheel_cascade_list(&wheel, TIMING_WHEEL_LIST_OVERFLOW);
+    }
+    for (int level = TIMING_WHEEL_LEVEL_N - 1; level > 0; --level) {
+        auto const mask = (uint64_t(1) << (level * TIMING_WHEEL_SLOT_BITS)) - 1;
+        if ((tick & mask) == 0) timing_wheel_cascade_list(&wheel, timing_wheel_slot_list(level, tick));
+    }
+}
+
+static void timing_wheel_expire(TimingWheel* _wheel, uint32_t list, uint64_t now_micros)
+{
+    auto& wheel = *_wheel;
+    auto i = wheel.heads[list];
+    while (i != timing_wheel_none) {
+        auto const next = wheel.next[i];
+        if (wheel.deadline_micros[i] <= now_micros) {
+            timing_wheel_unlink(&wheel, i);
+            --wheel.armed_n;
+            wheel.expired[wheel.expired_n++] = i;
+        }
+        i = next;
+    }
+}
+
+// The next tick after the current one where a slot expires or cascades,
+// with the list of that slot when it is of level 0.
+static uint64_t timing_wheel_next_tick(TimingWheel const* _wheel, uint32_t* _list)
+{
+    auto const& wheel = *_wheel;
+    *_list = timing_wheel_none;
+    for (int level = 0; level < TIMING_WHEEL_LEVEL_N; ++level) {
+        auto const shift = level * TIMING_WHEEL_SLOT_BITS;
+        auto const digit = int((wheel.tick >> shift) & (TIMING_WHEEL_SLOT_N - 1));
+        if (digit + 1 == TIMING_WHEEL_SLOT_N) continue;
+        auto const slot = timing_wheel_occupied_from(&wheel, level, digit + 1);
+        if (slot < 0) continue;
+        auto const block_shift = shift + TIMING_WHEEL_SLOT_BITS;
+        if (level == 0) *_list = uint32_t(slot);
+        return ((wheel.tick >> block_shift) << block_shift) | (uint64_t(slot) << shift);
+    }
+    if (wheel.heads[TIMING_WHEEL_LIST_OVERFLOW] != timing_wheel_none) {
+        int const bits_n = TIMING_WHEEL_LEVEL_N * TIMING_WHEEL_SLOT_BITS;
+        return ((wheel.tick >> bits_n) + 1) << bits_n;
+    }
+    return timing_wheel_no_tick;
+}
+
+void timing_wheel_init(TimingWheel* _wheel, uint32_t capacity, uint64_t tick_micros,
+                       uint64_t now_micros)
+{
+    auto& wheel = *_wheel;
+    wheel = {};
+    wheel.tick_micros = tick_micros;
+    wheel.tick = now_micros / tick_micros;
+    wheel.capacity = capacity;
+    wheel.deadline_micros = new uint64_t[capacity];
+    wheel.list = new uint32_t[capacity];
+    wheel.next = new uint32_t[capacity];
+    wheel.prev = new uint32_t[capacity];
+    wheel.expired = new uint32_t[capacity];
+    for (uint32_t i = 0; i < capacity; ++i) wheel.list[i] = timing_wheel_none;
+    for (auto& head : wheel.heads) head = timing_wheel_none;
+}
+
+void timing_wheel_destroy(TimingWheel* _wheel)
+{
+    auto& wheel = *_wheel;
+    delete[] wheel.deadline_micros;
+    delete[] wheel.list;
+    delete[] wheel.next;
+    delete[] wheel.prev;
+    delete[] wheel.expired;
+    wheel = {};
+}
+
+void timing_wheel_arm(TimingWheel* _wheel, uint32_t i, uint64_t deadline_micros)
+{
+    auto& wheel = *_wheel;
+    if (wheel.list[i] != timing_wheel_none) {
+        timing_wheel_unlink(&wheel, i);
+    } else {
+        ++wheel.armed_n;
+    }
+    wheel.deadline_micros[i] = deadline_micros;
+    timing_wheel_place(&wheel, i);
+}
+
+void timing_wheel_cancel(TimingWheel* _wheel, uint32_t i)
+{
+    auto& wheel = *_wheel;
+    if (wheel.list[i] == timing_wheel_none) return;
+    timing_wheel_unlink(&wheel, i);
+    --wheel.armed_n;
+}
+
+bool timing_wheel_is_armed(TimingWheel const* wheel, uint32_t i)
+{
+    return wheel->list[i] != timing_wheel_none;
+}
+
+void timing_wheel_advance(TimingWheel* _wheel, uint64_t now_micros)
+{
+    auto& wheel = *_wheel;
+    wheel.expired_n = 0;
+    auto target = now_micros / wheel.tick_micros;
+    if (target < wheel.tick) target = wheel.tick;
+
+    timing_wheel_expire(&wheel, TIMING_WHEEL_LIST_DUE, now_micros);
+    timing_wheel_expire(&wheel, timing_wheel_slot_list(0, wheel.tick), now_micros);
+    while (true) {
+        uint32_t list;
+        auto const tick = timing_wheel_next_tick(&wheel, &list);
+        if (tick > target) break;
+        wheel.tick = tick;
+        timing_wheel_cascade(&wheel, tick);
+        timing_wheel_expire(&wheel, timing_wheel_slot_list(0, tick), now_micros);
+    }
+    wheel.tick = target;
+}
+
+uint64_t timing_wheel_next_micros(TimingWheel* _wheel)
+{
+    auto& wheel = *_wheel;
+    if (wheel.armed_n == 0) return 0;
+    // the timers of a level 0 slot are due within its tick
+    auto const min_deadline_micros = [&](uint32_t list) {
+        auto y = UINT64_MAX;
+        for (auto i = wheel.heads[list]; i != timing_wheel_none; i = wheel.next[i]) {
+            if (wheel.deadline_micros[i] < y) y = wheel.deadline_micros[i];
+        }
+        return y ? y : 1;
+    };
+    if (wheel.heads[TIMING_WHEEL_LIST_DUE] != timing_wheel_none) {
+        return min_deadline_micros(TIMING_WHEEL_LIST_DUE);
+    }
+    auto const current_list = timing_wheel_slot_list(0, wheel.tick);
+    if (wheel.heads[current_list] != timing_wheel_none) return min_deadline_micros(current_list);
+    uint32_t list;
+    auto const tick = timing_wheel_next_tick(&wheel, &list);
+    if (tick == timing_wheel_no_tick) return 0;
+    if (list != timing_wheel_none) return min_deadline_micros(list);
+    return tick * wheel.tick_micros;
+}
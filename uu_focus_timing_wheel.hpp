@@ -0,0 +1,74 @@
+#pragma once
+#define UU_FOCUS_TIMING_WHEEL
+
+/*
+ * Hierarchical timing wheel: many timers, each of a deadline, so that
+ * arming, re-arming and cancelling a timer is O(1), and finding the
+ * expired ones costs what expired rather than what is armed.
+ *
+ * Time is counted in ticks of `tick_micros`. The wheel has levels of 256
+ * slots, each slot a list of timers: level 0 has a slot per tick, level 1
+ * a slot per 256 ticks, and so on. Timers sit in the finest level that
+ * holds their tick. As the wheel turns, the slot of a coarser level is
+ * emptied into the finer ones when its time comes (a cascade), a timer
+ * moving at most once per level. Deadlines too far away for the levels
+ * wait in an overflow list, cascaded every 2^32 ticks.
+ *
+ * Occupied slots are marked in a bitmap per level, so that the wheel jumps
+ * from one occupied slot to the next rather than visiting each tick.
+ *
+ * Timers are identified by their index, below the capacity of the wheel.
+ * Lists are linked through arrays of those indices.
+ */
+
+#include <stdint.h>
+
+enum {
+    TIMING_WHEEL_LEVEL_N = 4,
+    TIMING_WHEEL_SLOT_BITS = 8,
+    TIMING_WHEEL_SLOT_N = 1 << TIMING_WHEEL_SLOT_BITS,
+    // lists, after those of the slots:
+    TIMING_WHEEL_LIST_OVERFLOW = TIMING_WHEEL_LEVEL_N * TIMING_WHEEL_SLOT_N,
+    TIMING_WHEEL_LIST_DUE, // armed in the past, expire at the next advance
+    TIMING_WHEEL_LIST_N,
+};
+
+static uint32_t const timing_wheel_none = UINT32_MAX;
+
+struct TimingWheel
+{
+    uint64_t tick_micros;
+    uint64_t tick; // current one, all before it were expired
+    uint32_t capacity;
+    uint32_t armed_n;
+
+    // per timer, `capacity` of them:
+    uint64_t* deadline_micros;
+    uint32_t* list; // timing_wheel_none when not armed
+    uint32_t* next;
+    uint32_t* prev;
+
+    uint32_t heads[TIMING_WHEEL_LIST_N];
+    uint64_t occupied[TIMING_WHEEL_LEVEL_N][TIMING_WHEEL_SLOT_N / 64];
+
+    // of the last timing_wheel_advance:
+    uint32_t* expired;
+    uint32_t expired_n;
+};
+
+void timing_wheel_init(TimingWheel* wheel, uint32_t capacity, uint64_t tick_micros,
+                       uint64_t now_micros);
+void timing_wheel_destroy(TimingWheel* wheel);
+
+// Arms the timer to expire at `deadline_micros`, wherever it was armed.
+void timing_wheel_arm(TimingWheel* wheel, uint32_t timer_i, uint64_t deadline_micros);
+void timing_wheel_cancel(TimingWheel* wheel, uint32_t timer_i);
+bool timing_wheel_is_armed(TimingWheel const* wheel, uint32_t timer_i);
+
+// Expires the timers due at `now_micros`, listing them in `expired`. Time
+// does not go backwards.
+void timing_wheel_advance(TimingWheel* wheel, uint64_t now_micros);
+
+// When to advance the wheel next: no later than the earliest deadline, and
+// exactly it when it is within 256 ticks. 0 when nothing is armed.
+uint64_t timing_wheel_next_micros(TimingWheel* wheel);
@@ -5,15 +5,21 @@
 kernel32 LoadKernel32()
 {
     kernel32 result = {};
+    result.CloseHandle = ::CloseHandle;
     result.CreateEventW = ::CreateEventW;
+    result.CreateFileMappingW = ::CreateFileMappingW;
+    result.CreateFileW = ::CreateFileW;
     result.CreateThread = ::CreateThread;
     result.GetProcAddress = ::GetProcAddress;
     result.GetLastError = ::GetLastError;
+    result.GetSystemTimeAsFileTime = ::GetSystemTimeAsFileTime;
     result.LoadLibraryA = ::LoadLibraryA;
+    result.MapViewOfFile = ::MapViewOfFile;
     result.MultiByteToWideChar = ::MultiByteToWideChar;
     result.QueryPerformanceCounter = ::QueryPerformanceCounter;
     result.QueryPerformanceFrequency = ::QueryPerformanceFrequency;
     result.SetEvent = ::SetEvent;
+    result.UnmapViewOfFile = ::UnmapViewOfFile;
     result.GetLocalTime = ::GetLocalTime;
     return result;
 }
@@ -4,12 +4,31 @@
 
 struct kernel32
 {
+    BOOL (WINAPI *CloseHandle)(_In_ HANDLE hObject);
+
     HANDLE (WINAPI *CreateEventW)(
         _In_opt_ LPSECURITY_ATTRIBUTES lpEventAttributes,
         _In_     BOOL                  bManualReset,
         _In_     BOOL                  bInitialState,
         _In_opt_ wchar_t const*        lpName);
 
+    HANDLE (WINAPI *CreateFileMappingW)(
+        _In_     HANDLE                hFile,
+        _In_opt_ LPSECURITY_ATTRIBUTES lpFileMappingAttributes,
+        _In_     DWORD                 flProtect,
+        _In_     DWORD                 dwMaximumSizeHigh,
+        _In_     DWORD                 dwMaximumSizeLow,
+        _In_opt_ wchar_t const*        lpName);
+
+    HANDLE (WINAPI *CreateFileW)(
+        _In_     wchar_t const*        lpFileName,
+        _In_     DWORD                 dwDesiredAccess,
+        _In_     DWORD                 dwShareMode,
+        _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes,
+        _In_     DWORD                 dwCreationDisposition,
+        _In_     DWORD                 dwFlagsAndAttributes,
+        _In_opt_ HANDLE                hTemplateFile);
+
     HANDLE (WINAPI *CreateThread)(
         _In_opt_  LPSECURITY_ATTRIBUTES  lpThreadAttributes,
         _In_      SIZE_T                 dwStackSize,
@@ -27,8 +46,17 @@ struct kernel32
 
     DWORD (WINAPI *GetLastError)(void);
 
+    void (WINAPI *GetSystemTimeAsFileTime)(_Out_ LPFILETIME lpSystemTimeAsFileTime);
+
     HMODULE (WINAPI *LoadLibraryA)(_In_ LPCSTR lpFileName);
 
+    LPVOID (WINAPI *MapViewOfFile)(
+        _In_ HANDLE hFileMappingObject,
+        _In_ DWORD  dwDesiredAccess,
+        _In_ DWORD  dwFileOffsetHigh,
+        _In_ DWORD  dwFileOffsetLow,
+        _In_ SIZE_T dwNumberOfBytesToMap);
+
     int (WINAPI *MultiByteToWideChar)(
         _In_      UINT   CodePage,
         _In_      DWORD  dwFlags,
@@ -45,6 +73,8 @@ struct kernel32
 
     BOOL (WINAPI *SetEvent)(
         _In_ HANDLE hevent);
+
+    BOOL (WINAPI *UnmapViewOfFile)(_In_ LPCVOID lpBaseAddress);
 };
 
 kernel32 LoadKernel32();
@@ -14,7 +14,7 @@
 #include <cstdint>
 
 // Module(win32_reloadable_modules)
-// Version(1.0.2)
+// Version(1.1.0)
 namespace win32_reloadable_modules
 {
 
@@ -79,6 +79,23 @@ win32_reloadable_modules_api ReloadAttemptResult
 load(ReloadableModule *module,
      ReloadAttemptResultDetails *error_details = nullptr);
 
+// Loads a new version of a module next to the version already loaded, for
+// callers that keep using the previous version for a while.
+//
+// Precondition(has_changed(module))
+//
+// On success, `previous_dll` receives the previous version, to be released
+// with `unload` once no longer in use. Versions are loaded from two
+// alternating copies of the DLL, so the previous version must be released
+// before the next call.
+win32_reloadable_modules_api ReloadAttemptResult
+load_side_by_side(ReloadableModule *module,
+                  void **previous_dll,
+                  ReloadAttemptResultDetails *error_details = nullptr);
+
+// Releases a version returned by `load_side_by_side`
+win32_reloadable_modules_api bool unload(void *dll);
+
 struct ReloadableModule {
         void *dll;
         uint32_t modification_time_low;
@@ -86,6 +103,8 @@ struct ReloadableModule {
         char *dll_path;
         char *loaded_dll_path;
         char *dll_lock_path;
+        char *loaded_dll_alt_path; // for side by side loading
+        bool is_loaded_from_alt;
         char buffer[4096];
 };
 
@@ -251,6 +270,57 @@ ReloadAttemptResult load(ReloadableModule *module,
         return result;
 }
 
+ReloadAttemptResult load_side_by_side(ReloadableModule *module,
+                                      void **previous_dll,
+                                      ReloadAttemptResultDetails *error_details_output)
+{
+        char *source_dll_path = module->dll_path;
+        char *loaded_dll_path = module->is_loaded_from_alt
+                                    ? module->loaded_dll_path
+                                    : module->loaded_dll_alt_path;
+        const char *error = nullptr;
+
+        ReloadAttemptResult result = ReloadAttemptResult::NoChange;
+        Winapi::FileAttributeData ignored;
+        if (!Winapi::GetFileAttributesExA(
+                module->dll_lock_path,
+                Winapi::GetFileExInfoLevels::GetFileExInfoStandard, &ignored)) {
+                auto file_time = win32_get_last_write_time(source_dll_path);
+                // NOTE(nicolas): the previous version stays loaded from the
+                // other copy, which we must not overwrite.
+                if (!Winapi::CopyFileA(source_dll_path, loaded_dll_path,
+                                       false)) {
+                        error = "could not copy dll";
+                } else {
+                        auto new_dll = Winapi::LoadLibraryA(loaded_dll_path);
+                        if (new_dll) {
+                                result = ReloadAttemptResult::Success;
+                                *previous_dll = module->dll;
+                                module->dll = new_dll;
+                                module->is_loaded_from_alt =
+                                    !module->is_loaded_from_alt;
+                                module->modification_time_low =
+                                    file_time.dwLowDateTime;
+                                module->modification_time_high =
+                                    file_time.dwHighDateTime;
+                        } else {
+                                error = "could not load dll";
+                        }
+                }
+        } else {
+                result = ReloadAttemptResult::IsLocked;
+        }
+        if (error_details_output) {
+                *error_details_output = {error};
+        }
+        return result;
+}
+
+bool unload(void *dll)
+{
+        return !dll || Winapi::FreeLibrary(Winapi::ModulePtr(dll));
+}
+
 void make_in_path(ReloadableModule *module,
                   StringSpan base_path,
                   StringSpan module_name)
@@ -273,6 +343,9 @@ void make_in_path(ReloadableModule *module,
             {
                 &module->dll_lock_path, "_dll.lock",
             },
+            {
+                &module->loaded_dll_alt_path, "_loaded_alt.dll",
+            },
         };
 
         for (auto const path : paths) {
@@ -0,0 +1,20 @@
+// @language: c++14
+// @os: win32
+//
+// The dsp code of the effects, as a DLL that the program swaps in while the
+// audio plays whenever it changes (see uu_focus_audio_module.hpp)
+
+#include "uu_focus_audio_module.hpp"
+#include "uu_focus_effects.hpp"
+
+UU_FOCUS_AUDIO_DSP_RENDER_PROC(win32_uu_focus_audio_render)
+{
+    audio_dsp_render(state, block, frames, channel_count, frame_count);
+}
+
+UU_FOCUS_AUDIO_DSP_HANDOVER_PROC(win32_uu_focus_audio_handover)
+{
+    audio_dsp_handover(dst, src, seed);
+}
+
+#include "uu_focus_audio_dsp.cpp"
@@ -20,11 +20,21 @@ static const wchar_t* const global_application_name = L"UUFocus";
 #define UU_FOCUS_FN_STATE static
 
 #include "uu_focus_main.hpp"
+#include "uu_focus_journal.hpp"
+#include "uu_focus_schedule.hpp"
+#include "uu_focus_snapshot.hpp"
+#include "uu_focus_audio_backend.hpp"
+#include "uu_focus_audio_clock.hpp"
+#include "uu_focus_audio_convert.hpp"
+#include "uu_focus_audio_resampler.hpp"
+#include "uu_focus_audio_ring.hpp"
 #include "uu_focus_effects.hpp"
 #include "uu_focus_effects_types.hpp"
+#include "uu_focus_audio_module.hpp"
 #include "uu_focus_platform.hpp"
 
 #include <sal.h>
+#include <cstdio>
 #include <stdint.h>
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
@@ -62,6 +72,7 @@ static const wchar_t* const global_application_name = L"UUFocus";
 
 static WIN32_WINDOW_PROC(main_window_proc);
 static uint64_t now_micros();
+static AudioBackend const* win32_wasapi_audio_backend();
 
 UU_FOCUS_GLOBAL kernel32 modules_kernel32;
 UU_FOCUS_GLOBAL user32 modules_user32;
@@ -70,12 +81,25 @@ UU_FOCUS_GLOBAL comctl32 modules_comctl32;
 UU_FOCUS_GLOBAL gdi32 modules_gdi32;
 
 UU_FOCUS_GLOBAL UUFocusMainCoroutine global_uu_focus_main;
+// of uu_focus.schedule, when there is one
+UU_FOCUS_GLOBAL Schedule global_schedule;
+#if UU_FOCUS_INTERNAL
+// of the session, to reproduce what happened in it
+UU_FOCUS_GLOBAL Journal global_journal;
+UU_FOCUS_GLOBAL FILE* global_journal_file;
+#endif
+// where we were, should we be restarted
+UU_FOCUS_GLOBAL HANDLE global_snapshot_file;
+UU_FOCUS_GLOBAL HANDLE global_snapshot_mapping;
+UU_FOCUS_GLOBAL UUFocusSnapshot* global_snapshot;
+
 UU_FOCUS_GLOBAL uint64_t global_qpf_hz;
 UU_FOCUS_GLOBAL uint64_t global_qpc_origin;
 
 UU_FOCUS_GLOBAL HANDLE global_sound_thread;
 UU_FOCUS_GLOBAL int32_t global_sound_thread_must_quit;
-UU_FOCUS_GLOBAL WasapiStream global_sound;
+UU_FOCUS_GLOBAL AudioStream global_sound;
+UU_FOCUS_GLOBAL AudioLatencyController global_sound_latency;
 
 UU_FOCUS_GLOBAL ID2D1Factory *global_d2d1factory;
 UU_FOCUS_GLOBAL IDWriteFactory* global_dwritefactory;
@@ -90,6 +114,13 @@ extern int global_palette_i;
 UU_FOCUS_GLOBAL win32_reloadable_modules::ReloadableModule global_ui_module;
 typedef UU_FOCUS_RENDER_UI_PROC(UUFocusRenderUIProc);
 UU_FOCUS_GLOBAL UUFocusRenderUIProc *global_uu_focus_ui_render;
+
+UU_FOCUS_GLOBAL win32_reloadable_modules::ReloadableModule global_audio_module;
+// still used by the audio thread until it is done with its swap
+UU_FOCUS_GLOBAL void* global_audio_module_previous_dll;
+UU_FOCUS_GLOBAL uint32_t global_audio_module_swap_n;
+
+static void win32_audio_module_reload();
 #endif
 
 struct Platform {
@@ -196,9 +227,10 @@ extern "C" int WINAPI WinMain(
     modules_comctl32 = LoadComctl32(kernel32);
 
     auto& sound = global_sound;
-    // NOTE(nicolas): dependency between the pink noise filter and 44.1khz
-    win32_wasapi_sound_open_stereo(&sound, 44100); // TODO(nicolas): how about opening/closing on demand
-    if (sound.header.error == WasapiStreamError_Success)
+    // NOTE(nicolas): every speaker of the device gets its own noise
+    // NOTE(nicolas): the audio thread closes it while the audio is silent
+    audio_stream_open(&sound, win32_wasapi_audio_backend(), 48000, 0);
+    if (sound.header.error == AudioStreamError_Success)
     {
         global_sound_thread = kernel32.CreateThread(
             /* thread attributes */nullptr,
@@ -218,11 +250,13 @@ extern "C" int WINAPI WinMain(
     }
 
     global_sound_thread_must_quit = 1;
+    audio_thread_unpark(global_uu_focus_main.audio_effect);
     if (WaitForSingleObject(global_sound_thread, INFINITE) != WAIT_OBJECT_0) {
         error = kernel32.GetLastError();
         return error;
     }
-    win32_wasapi_sound_close(&sound);
+    audio_stream_close(&sound);
+    audio_destroy(global_uu_focus_main.audio_effect);
 
     win32_platform_shutdown(&global_platform);
 
@@ -239,6 +273,56 @@ static uint64_t now_micros()
     return y;
 }
 
+// of the wall clock, that goes on while we are not running
+static uint64_t win32_wall_micros()
+{
+    FILETIME ft;
+    modules_kernel32.GetSystemTimeAsFileTime(&ft);
+    uint64_t const y = (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return y / 10;
+}
+
+static Schedule const* win32_schedule_load()
+{
+    auto const file = fopen("uu_focus.schedule", "rb");
+    if (!file) return &schedule_classic;
+    enum { TEXT_CAPACITY = 4096 };
+    char text[TEXT_CAPACITY];
+    auto const size = fread(text, 1, TEXT_CAPACITY, file);
+    auto const is_whole = feof(file) != 0;
+    fclose(file);
+    // NOTE(nicolas): a schedule we cannot read is as no schedule
+    if (!is_whole || !schedule_parse(&global_schedule, text, size)) return &schedule_classic;
+    return &global_schedule;
+}
+
+static void win32_snapshot_map()
+{
+    auto const& kernel32 = modules_kernel32;
+    global_snapshot_file = kernel32.CreateFileW(
+        L"uu_focus.snapshot", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (global_snapshot_file == INVALID_HANDLE_VALUE) return;
+    global_snapshot_mapping = kernel32.CreateFileMappingW(
+        global_snapshot_file, NULL, PAGE_READWRITE, 0, sizeof(UUFocusSnapshot), NULL);
+    if (!global_snapshot_mapping) return;
+    global_snapshot = static_cast<UUFocusSnapshot*>(kernel32.MapViewOfFile(
+        global_snapshot_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(UUFocusSnapshot)));
+}
+
+static void win32_snapshot_unmap()
+{
+    auto const& kernel32 = modules_kernel32;
+    if (global_snapshot) kernel32.UnmapViewOfFile(global_snapshot);
+    if (global_snapshot_mapping) kernel32.CloseHandle(global_snapshot_mapping);
+    if (global_snapshot_file && global_snapshot_file != INVALID_HANDLE_VALUE) {
+        kernel32.CloseHandle(global_snapshot_file);
+    }
+    global_snapshot = nullptr;
+    global_snapshot_mapping = NULL;
+    global_snapshot_file = NULL;
+}
+
 struct Ui;
 static void d2d1_render(HWND hwnd, Ui*);
 static void taskbar_progress_render(HWND hWnd, Ui* ui_);
@@ -250,14 +334,23 @@ struct Ui
     uint64_t validity_end_micros;
 };
 
+#if UU_FOCUS_INTERNAL
+static void win32_journal_write(void* user, uint8_t const* bytes, size_t size)
+{
+    fwrite(bytes, 1, size, static_cast<FILE*>(user));
+}
+#endif
+
 static WIN32_WINDOW_PROC(main_window_proc)
 {
     UU_FOCUS_FN_STATE const UINT_PTR refresh_timer_id = 1;
+    // resumes the program at its deadline
+    UU_FOCUS_FN_STATE const UINT_PTR deadline_timer_id = 2;
+    UU_FOCUS_FN_STATE uint64_t deadline_micros;
     UU_FOCUS_FN_STATE Ui ui;
 
     auto &main = global_uu_focus_main;
     auto const& user32 = modules_user32;
-    main.input.command = {};
     main.input.time_micros = now_micros();
 
     if (main.timer_effect) {
@@ -271,40 +364,99 @@ static WIN32_WINDOW_PROC(main_window_proc)
 
             auto &main_state = global_uu_focus_main;
             main_state.timer_effect = timer_make(&global_platform);
-            main_state.input.command = {};
+            main_state.audio_effect = audio_make();
             main_state.input.time_micros = now_micros();
+            main_state.schedule = win32_schedule_load();
+
+            // NOTE(nicolas): we may have been restarted in the middle of a
+            // session, that goes on. The program resumes where it was, its
+            // effects must be brought back to it.
+            win32_snapshot_map();
+            if (global_snapshot &&
+                snapshot_restore(global_snapshot, &main_state, main_state.timer_effect,
+                                 main_state.input.time_micros, win32_wall_micros()) &&
+                main_state.step == 20 && timer_is_active(main_state.timer_effect)) {
+                auto const end_micros = timer_end_micros(main_state.timer_effect);
+                audio_preset(main_state.audio_effect,
+                             main_state.schedule->phases[main_state.phase_i].audio);
+                audio_start(main_state.audio_effect);
+                audio_chime_at(main_state.audio_effect, end_micros);
+                if (main_state.tick_on) audio_ticks_until(main_state.audio_effect, end_micros);
+            }
+#if UU_FOCUS_INTERNAL
+            global_journal_file = fopen("uu_focus.journal", "wb");
+            if (global_journal_file) {
+                journal_init(&global_journal, { global_journal_file, win32_journal_write });
+                main_state.journal = &global_journal;
+            }
+#endif
 
             uu_focus_main(&main_state);
 
 #if UU_FOCUS_INTERNAL
             win32_reloadable_modules::make_in_path(&global_ui_module, "H:\\uu.focus\\builds", "uu_focus_ui");
+            win32_reloadable_modules::make_in_path(&global_audio_module, "H:\\uu.focus\\builds", "uu_focus_audio");
 #endif
         } break;
 
         case WM_DESTROY: {
             user32.KillTimer(hWnd, refresh_timer_id);
-            main.input.command.type = Command_application_stop;
+            user32.KillTimer(hWnd, deadline_timer_id);
+            command_push(&main.input.commands, { Command_application_stop, main.input.time_micros });
             uu_focus_main(&main);
+            // NOTE(nicolas): quitting ends the session, the next process
+            // starts afresh
+            if (global_snapshot) snapshot_clear(global_snapshot);
+            win32_snapshot_unmap();
+#if UU_FOCUS_INTERNAL
+            if (main.journal) {
+                journal_flush(main.journal);
+                fclose(global_journal_file);
+                main.journal = nullptr;
+            }
+#endif
             user32.PostQuitMessage(0);
         } break;
 
         case WM_LBUTTONDOWN: {
-            main.input.command.type = Command_timer_start;
+            command_push(&main.input.commands, { Command_timer_start, main.input.time_micros });
             uu_focus_main(&main);
             auto timer_period_ms = 60;
         } break;
 
         case WM_RBUTTONDOWN: {
-            main.input.command.type = Command_timer_stop;
+            command_push(&main.input.commands, { Command_timer_stop, main.input.time_micros });
             uu_focus_main(&main);
         } break;
 
+        case WM_MOUSEMOVE:
+        case WM_SETFOCUS: {
+            // NOTE(nicolas): only a start to come needs the audio warm, we
+            // leave the countdown alone on every mouse message
+            if (main.step == 10) {
+                command_push(&main.input.commands, { Command_timer_prewarm, main.input.time_micros });
+                uu_focus_main(&main);
+            }
+        } break;
+
 #if UU_FOCUS_INTERNAL
         case WM_KEYDOWN: {
             if (wParam == VK_RIGHT) {
                 global_palette_i = (global_palette_i + 1) % global_palettes_n;
+            } else if (wParam == 'T') {
+                main.tick_on = !main.tick_on;
+                // the running session follows, like a restored one
+                if (main.step == 20 && timer_is_active(main.timer_effect)) {
+                    if (main.tick_on) {
+                        audio_ticks_until(main.audio_effect, timer_end_micros(main.timer_effect));
+                    } else {
+                        audio_ticks_cancel(main.audio_effect);
+                    }
+                }
             } else {
-                global_audio_mode = (global_audio_mode + 1) % global_audio_mode_mod;
+                auto const mode = global_audio_mode.load(std::memory_order_relaxed);
+                global_audio_mode.store((mode + 1) % global_audio_mode_mod,
+                                        std::memory_order_relaxed);
             }
             platform_render_async(&global_platform);
         } break;
@@ -334,8 +486,13 @@ static WIN32_WINDOW_PROC(main_window_proc)
         } break;
 
         case WM_TIMER: {
-            uu_focus_main(&main);
-            if (!timer_is_active(main.timer_effect)) {
+            if (wParam == deadline_timer_id) {
+                // NOTE(nicolas): SetTimer timers repeat until killed, we arm
+                // it again below from the next deadline, if any
+                user32.KillTimer(hWnd, deadline_timer_id);
+                deadline_micros = 0; // it may be the same one again
+                uu_focus_main(&main);
+            } else if (!timer_is_active(main.timer_effect)) {
                 user32.KillTimer(hWnd, refresh_timer_id);
             }
             if (now_micros() > ui.validity_end_micros) {
@@ -343,6 +500,22 @@ static WIN32_WINDOW_PROC(main_window_proc)
             }
         } break;
     }
+    // NOTE(nicolas): the program needs no polling, we only wake it up
+    // when it asked for it, or for a command.
+    if (uMsg != WM_DESTROY && main.deadline_micros != deadline_micros) {
+        deadline_micros = main.deadline_micros;
+        if (deadline_micros) {
+            auto const now = now_micros();
+            auto const ms = deadline_micros > now ? (deadline_micros - now + 999)/1000 : 0;
+            user32.SetTimer(hWnd, deadline_timer_id, UINT(ms), NULL);
+        } else {
+            user32.KillTimer(hWnd, deadline_timer_id);
+        }
+    }
+    if (uMsg != WM_DESTROY && global_snapshot && main.timer_effect) {
+        snapshot_update(global_snapshot, &main, main.timer_effect, main.input.time_micros,
+                        win32_wall_micros());
+    }
 #if UU_FOCUS_INTERNAL
     if (win32_reloadable_modules::has_changed(&global_ui_module)) {
         auto reload_attempt = load(&global_ui_module);
@@ -350,6 +523,9 @@ static WIN32_WINDOW_PROC(main_window_proc)
                        "win32_uu_focus_ui_render");
         platform_render_async(&global_platform);
     }
+    if (main.audio_effect) {
+        win32_audio_module_reload();
+    }
 #endif
     return user32.DefWindowProcW(hWnd, uMsg, wParam, lParam);
 }
@@ -728,7 +904,7 @@ static void internal_ui_render(ID2D1HwndRenderTarget* rt_)
     auto text2_end = text2 + MAX_TEXT_SIZE;
     auto text2_last = text2;
     text2_last = string_push_zstring(text2_last, text2_end, "Audio Mode: ");
-    text2_last = string_push_i32(text2_last, text2_end, global_audio_mode, 2);
+    text2_last = string_push_i32(text2_last, text2_end, global_audio_mode.load(std::memory_order_relaxed), 2);
 
     UU_FOCUS_FN_STATE IDWriteTextFormat *global_text_format;
     auto &dwrite = *global_dwritefactory;
@@ -889,21 +1065,203 @@ static void win32_platform_shutdown(struct Platform* platform_)
     shell32.Shell_NotifyIconW(NIM_DELETE, &nid);
 }
 
+static AudioSampleFormat win32_audio_sample_format(WasapiSampleFormat x)
+{
+    switch (x) {
+        case WasapiSampleFormat_Float32: return AudioSampleFormat_F32;
+        case WasapiSampleFormat_Int16: return AudioSampleFormat_S16;
+        case WasapiSampleFormat_Int24Packed: return AudioSampleFormat_S24_Packed;
+        case WasapiSampleFormat_Int24In32: return AudioSampleFormat_S24_In32;
+        case WasapiSampleFormat_Int32: return AudioSampleFormat_S32;
+    }
+    return AudioSampleFormat_F32;
+}
+
+// # WASAPI audio backend
+
+static_assert(sizeof (WasapiStream) <= sizeof (AudioStream::data),
+              "AudioStream is too small");
+
+static WasapiStream* win32_wasapi_stream(AudioStream* stream)
+{
+    return reinterpret_cast<WasapiStream*>(stream->data);
+}
+
+static void win32_wasapi_header_update(AudioStream* stream)
+{
+    auto const& wasapi_header = win32_wasapi_stream(stream)->header;
+    auto& header = stream->header;
+    switch (wasapi_header.error) {
+        case WasapiStreamError_Success: header.error = AudioStreamError_Success; break;
+        case WasapiStreamError_Closed: header.error = AudioStreamError_Closed; break;
+        case WasapiStreamError_SystemError: header.error = AudioStreamError_SystemError; break;
+    }
+    header.error_string = wasapi_header.error_string;
+    header.sample_format = win32_audio_sample_format(wasapi_header.sample_format);
+    header.channel_count = wasapi_header.channel_count;
+    header.audio_hz = wasapi_header.audio_hz;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_OPEN_PROC(win32_wasapi_audio_open)
+{
+    // NOTE(nicolas): the device plays at its own rate, which we resample to
+    (void)audio_hz;
+    win32_wasapi_sound_open(win32_wasapi_stream(stream), channel_count);
+    win32_wasapi_header_update(stream);
+    return stream->header.error;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_CLOSE_PROC(win32_wasapi_audio_close)
+{
+    win32_wasapi_sound_close(win32_wasapi_stream(stream));
+    win32_wasapi_header_update(stream);
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_BLOCK_ACQUIRE_PROC(win32_wasapi_audio_buffer_block_acquire)
+{
+    auto const wasapi_buffer =
+        win32_wasapi_sound_buffer_block_acquire(win32_wasapi_stream(stream), max_frame_count);
+    win32_wasapi_header_update(stream);
+    AudioBuffer buffer;
+    buffer.bytes_first = wasapi_buffer.bytes_first;
+    buffer.frame_count = wasapi_buffer.frame_count;
+    buffer.padding_frames = wasapi_buffer.padding_frames;
+    return buffer;
+}
+
+static UU_FOCUS_AUDIO_BACKEND_BUFFER_RELEASE_PROC(win32_wasapi_audio_buffer_release)
+{
+    WasapiBuffer wasapi_buffer;
+    wasapi_buffer.bytes_first = buffer.bytes_first;
+    wasapi_buffer.frame_count = buffer.frame_count;
+    wasapi_buffer.padding_frames = 0;
+    win32_wasapi_sound_buffer_release(win32_wasapi_stream(stream), wasapi_buffer);
+    win32_wasapi_header_update(stream);
+}
+
+static AudioBackend const* win32_wasapi_audio_backend()
+{
+    UU_FOCUS_FN_STATE AudioBackend const backend = {
+        "wasapi",
+        nullptr,
+        win32_wasapi_audio_open,
+        win32_wasapi_audio_close,
+        win32_wasapi_audio_buffer_block_acquire,
+        win32_wasapi_audio_buffer_release,
+    };
+    return &backend;
+}
+
+#if UU_FOCUS_INTERNAL
+// Swaps the dsp code of the audio thread for the one of the audio module,
+// whenever it changes. The audio thread keeps using the code it had
+// during the crossfade, so its dll is only released once the swap is done.
+static void win32_audio_module_reload()
+{
+    using namespace win32_reloadable_modules;
+    auto const audio = global_uu_focus_main.audio_effect;
+    bool const is_swapping = audio_dsp_swap_count(audio) != global_audio_module_swap_n;
+    if (is_swapping) return;
+
+    unload(global_audio_module_previous_dll);
+    global_audio_module_previous_dll = nullptr;
+    if (!has_changed(&global_audio_module)) return;
+
+    void* previous_dll = nullptr;
+    if (load_side_by_side(&global_audio_module, &previous_dll) != ReloadAttemptResult::Success) {
+        return;
+    }
+    AudioDspProcs procs = {};
+    win32_proc_assign(&procs.render, (HMODULE)global_audio_module.dll,
+                      "win32_uu_focus_audio_render");
+    win32_proc_assign(&procs.handover, (HMODULE)global_audio_module.dll,
+                      "win32_uu_focus_audio_handover");
+    if (!procs.render || !procs.handover) {
+        // NOTE(nicolas): not a dll we can use, the previous one stays
+        unload(global_audio_module.dll);
+        global_audio_module.dll = previous_dll;
+        global_audio_module.is_loaded_from_alt = !global_audio_module.is_loaded_from_alt;
+        return;
+    }
+    audio_dsp_swap(audio, procs);
+    ++global_audio_module_swap_n;
+    global_audio_module_previous_dll = previous_dll;
+}
+#endif
+
 static THREAD_PROC(audio_thread_main)
 {
+    enum { FRAME_COUNT_MAX = 48000 / 10 }; // the most latency we would go for
+    // NOTE(nicolas): a dsp thread renders ahead of us, as much as absorbs
+    // its hiccups, while we only copy its frames to the device.
+    enum { RENDER_AHEAD_FRAMES = 48000 / 20, RENDER_AHEAD_BLOCK_FRAMES = 48000 / 200 };
+    // NOTE(nicolas): devices rejecting float get our own dithered conversion
+    // rather than an extra conversion stage from the OS.
+    UU_FOCUS_FN_STATE float render_samples[AUDIO_CHANNEL_MAX * FRAME_COUNT_MAX];
+    UU_FOCUS_FN_STATE AudioDitherState dither;
+    audio_dither_init(&dither, uint32_t(now_micros()), global_sound.header.channel_count);
+    // NOTE(nicolas): as little latency as this machine allows
+    audio_latency_init(&global_sound_latency, global_sound.header.audio_hz,
+                       48000 / 1000, FRAME_COUNT_MAX);
+    // NOTE(nicolas): we render at 48khz, whatever the rate of the device
+    auto resampler = audio_stream_resampler_update(&global_sound, nullptr, 48000);
+
+    auto const audio = global_uu_focus_main.audio_effect;
+    auto ahead = audio_render_ahead_make(audio, global_sound.header.channel_count,
+                                         RENDER_AHEAD_FRAMES, RENDER_AHEAD_BLOCK_FRAMES);
+    AudioStreamMigration migration;
+    audio_stream_migration_init(&migration, win32_wasapi_audio_backend(), 48000, 0);
+    // follows the device the stream was opened on
+    auto const stream_opened = [&]() {
+        resampler = audio_stream_resampler_update(&global_sound, resampler, 48000);
+        if (global_sound.header.audio_hz != global_sound_latency.audio_hz) {
+            // a device at another rate, whose frames last another time
+            audio_latency_init(&global_sound_latency, global_sound.header.audio_hz,
+                               48000 / 1000, FRAME_COUNT_MAX);
+        } else {
+            audio_latency_restart(&global_sound_latency);
+        }
+        if (global_sound.header.channel_count !=
+            audio_ring_channel_count(audio_render_ahead_ring(ahead))) {
+            // a device with another layout
+            audio_render_ahead_destroy(ahead);
+            ahead = audio_render_ahead_make(audio, global_sound.header.channel_count,
+                                            RENDER_AHEAD_FRAMES, RENDER_AHEAD_BLOCK_FRAMES);
+        }
+    };
     while (!global_sound_thread_must_quit) {
-        auto buffer = win32_wasapi_sound_buffer_block_acquire(&global_sound, 48000 / 60 + 2 * 48);
-        audio_thread_render(
-            nullptr,
-            reinterpret_cast<float*>(buffer.bytes_first),
-            buffer.frame_count);
-        win32_wasapi_sound_buffer_release(&global_sound, buffer);
-        if (global_sound.header.error == WasapiStreamError_Closed) {
-            if (win32_wasapi_sound_open_stereo(&global_sound, 48000)) {
-                global_sound.header.error = WasapiStreamError_Closed;
+        if (global_sound.header.error != AudioStreamError_Success) {
+            // NOTE(nicolas): the device went away, or another one became
+            // the default. The audio goes on while we look for the next.
+            if (!migration.is_migrating) audio_stream_migration_begin(&migration, now_micros());
+            while (auto const frame_count = audio_stream_migration_drop(&migration, now_micros(),
+                                                                        FRAME_COUNT_MAX)) {
+                if (audio_render_ahead_is_idle(ahead)) continue; // its clock runs on anyway
+                audio_render_ahead_read(ahead, render_samples, frame_count);
+            }
+            if (!audio_stream_migration_reopen(&global_sound, &migration, now_micros())) {
+                Sleep(AUDIO_STREAM_MIGRATION_RETRY_MIN_MICROS / 1000);
+                continue;
+            }
+            stream_opened();
+        }
+        audio_stream_copy(&global_sound, ahead, &global_sound_latency, resampler, &dither,
+                          render_samples, AUDIO_CHANNEL_MAX * FRAME_COUNT_MAX,
+                          FRAME_COUNT_MAX);
+        if (audio_render_ahead_is_idle(ahead)) {
+            // NOTE(nicolas): nothing to play until the next event: the
+            // device and this thread may sleep until then.
+            audio_stream_close(&global_sound);
+            audio_render_ahead_wait(ahead);
+            if (global_sound_thread_must_quit) break;
+            if (audio_stream_open(&global_sound, win32_wasapi_audio_backend(), 48000, 0) ==
+                AudioStreamError_Success) {
+                stream_opened();
             }
         }
     }
+    audio_render_ahead_destroy(ahead);
+    if (resampler) audio_resampler_destroy(resampler);
     return 0;
 }
 
@@ -929,7 +1287,16 @@ static void win32_abort_with_message(char const* pattern, ...)
 }
 
 #include "uu_focus_main.cpp"
+#include "uu_focus_journal.cpp"
+#include "uu_focus_schedule.cpp"
+#include "uu_focus_snapshot.cpp"
+#include "uu_focus_audio_convert.cpp"
+#include "uu_focus_audio_dsp.cpp"
 #include "uu_focus_effects.cpp"
+#include "uu_focus_audio_backend.cpp"
+#include "uu_focus_audio_ring.cpp"
+#include "uu_focus_audio_resampler.cpp"
+#include "uu_focus_audio_clock.cpp"
 #include "uu_focus_platform.cpp"
 
 #include "win32_wasapi_sound.cpp"
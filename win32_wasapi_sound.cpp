@@ -94,6 +94,83 @@ notification_client_get_default_device_version(WasapiEndpointNotificationClient*
 
 static WasapiDevices win32_wasapi_devices;
 
+static DWORD wasapi_channel_mask_default(int channel_count)
+{
+    switch (channel_count) {
+        case 1: return KSAUDIO_SPEAKER_MONO;
+        case 2: return KSAUDIO_SPEAKER_STEREO;
+        case 4: return KSAUDIO_SPEAKER_QUAD;
+        case 6: return KSAUDIO_SPEAKER_5POINT1;
+        case 8: return KSAUDIO_SPEAKER_7POINT1_SURROUND;
+    }
+    return 0; // unknown speaker positions
+}
+
+static void wasapi_formatex_make(WAVEFORMATEXTENSIBLE* _formatex,
+                                 int audio_hz,
+                                 int channel_count,
+                                 DWORD channel_mask,
+                                 WasapiSampleFormat sample_format)
+{
+    auto& formatex = *_formatex;
+    WORD container_bits = 32;
+    WORD valid_bits = 32;
+    GUID subformat = KSDATAFORMAT_SUBTYPE_PCM;
+    switch (sample_format) {
+        case WasapiSampleFormat_Float32: {
+            subformat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+        } break;
+        case WasapiSampleFormat_Int16: {
+            container_bits = valid_bits = 16;
+        } break;
+        case WasapiSampleFormat_Int24Packed: {
+            container_bits = valid_bits = 24;
+        } break;
+        case WasapiSampleFormat_Int24In32: {
+            valid_bits = 24;
+        } break;
+        case WasapiSampleFormat_Int32: break;
+    }
+    WORD const block_align = WORD(channel_count * container_bits / 8);
+
+    formatex = {};
+    formatex.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    formatex.Format.nChannels = WORD(channel_count);
+    formatex.Format.nSamplesPerSec = audio_hz;
+    formatex.Format.nAvgBytesPerSec = audio_hz * block_align;
+    formatex.Format.nBlockAlign = block_align;
+    formatex.Format.wBitsPerSample = container_bits;
+    formatex.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    formatex.Samples.wValidBitsPerSample = valid_bits;
+    formatex.dwChannelMask = channel_mask;
+    formatex.SubFormat = subformat;
+}
+
+static bool wasapi_sample_format_get(WAVEFORMATEXTENSIBLE const& formatex,
+                                     WasapiSampleFormat* _result)
+{
+    auto& result = *_result;
+    if (formatex.Format.wFormatTag != WAVE_FORMAT_EXTENSIBLE) return false;
+
+    auto const container_bits = formatex.Format.wBitsPerSample;
+    auto const valid_bits = formatex.Samples.wValidBitsPerSample;
+    if (formatex.SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) {
+        if (container_bits != 32) return false;
+        result = WasapiSampleFormat_Float32;
+        return true;
+    }
+    if (formatex.SubFormat != KSDATAFORMAT_SUBTYPE_PCM) return false;
+    switch (container_bits) {
+        case 16: result = WasapiSampleFormat_Int16; return true;
+        case 24: result = WasapiSampleFormat_Int24Packed; return true;
+        case 32: {
+            result = valid_bits == 24 ?
+                WasapiSampleFormat_Int24In32 : WasapiSampleFormat_Int32;
+        } return true;
+    }
+    return false;
+}
+
 static int win32_wasapi_devices_acquire(WasapiDevices* devices, char const** error)
 {
     *error = nullptr;
@@ -122,7 +199,13 @@ static void win32_wasapi_devices_release(WasapiDevices* devices)
 }
 
 WasapiStreamError
-win32_wasapi_sound_open_stereo(WasapiStream *_state, int const audio_hz)
+win32_wasapi_sound_open_stereo(WasapiStream *_state)
+{
+    return win32_wasapi_sound_open(_state, 2);
+}
+
+WasapiStreamError
+win32_wasapi_sound_open(WasapiStream *_state, int channel_count)
 {
     WasapiStreamValue state = {};
     memcpy(_state, &state, sizeof state);
@@ -175,54 +258,85 @@ win32_wasapi_sound_open_stereo(WasapiStream *_state, int const audio_hz)
         goto end_in_error;
     }
 
-    /* initialize formatex */
-    {
-        formatex.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
-        formatex.Format.nChannels = 2;
-        formatex.Format.nSamplesPerSec = audio_hz;
-        formatex.Format.nAvgBytesPerSec = audio_hz * sizeof(float) * 2;
-        formatex.Format.nBlockAlign = sizeof(float) * 2;
-        formatex.Format.wBitsPerSample = sizeof(float) * 8;
-        formatex.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
-        formatex.Samples.wValidBitsPerSample = sizeof(float) * 8;
-        formatex.dwChannelMask = SPEAKER_ALL;
-        formatex.SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+    // NOTE(nicolas): in shared mode the device plays at the rate of its
+    // mix. We resample to it ourselves rather than asking the audio engine
+    // to adjust its rate to ours.
+    int audio_hz;
+    DWORD channel_mask = wasapi_channel_mask_default(channel_count);
+    /* follow the rate, and unless asked otherwise the speakers, of the device */ {
+        WAVEFORMATEX *mix_format = nullptr;
+        hr = audio_client->GetMixFormat(&mix_format);
+        if (hr < 0 || !mix_format) {
+            cpu_debugbreak();
+            fail("could not get mix format");
+            goto end_in_error_with_audio_client;
+        }
+        audio_hz = int(mix_format->nSamplesPerSec);
+        if (channel_count == 0) {
+            channel_count = mix_format->nChannels;
+            channel_mask = wasapi_channel_mask_default(channel_count);
+            if (mix_format->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+                channel_mask = ((WAVEFORMATEXTENSIBLE *)mix_format)->dwChannelMask;
+            }
+        }
+        CoTaskMemFree(mix_format);
     }
+
     bool format_is_supported = false;
     WAVEFORMATEX *format = &formatex.Format;
-    WAVEFORMATEX *closest_format = nullptr;
-    hr = audio_client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, format,
-                                         &closest_format);
-    if (S_FALSE == hr) {
-        if (format->cbSize != closest_format->cbSize) {
-            cpu_debugbreak();
-            fail("unexpected format type");
+    /* negotiate format, preferring float */ {
+        WasapiSampleFormat const requested_formats[] = {
+            WasapiSampleFormat_Float32,
+            WasapiSampleFormat_Int16,
+        };
+        for (auto requested_format : requested_formats) {
+            wasapi_formatex_make(&formatex, audio_hz, channel_count, channel_mask,
+                                 requested_format);
+            WAVEFORMATEX *closest_format = nullptr;
+            hr = audio_client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, format,
+                                                 &closest_format);
+            if (S_FALSE == hr) {
+                if (format->cbSize != closest_format->cbSize) {
+                    cpu_debugbreak();
+                    fail("unexpected format type");
+                } else {
+                    formatex = *((WAVEFORMATEXTENSIBLE *)closest_format);
+                    format_is_supported = true;
+                }
+            } else if (hr == S_OK) {
+                format_is_supported = true;
+            } else if (hr != AUDCLNT_E_UNSUPPORTED_FORMAT) {
+                cpu_debugbreak();
+                fail("could not get supported format");
+            }
+
+            if (closest_format) {
+                CoTaskMemFree(closest_format);
+            }
+            if (format_is_supported) break;
+        }
+        if (!format_is_supported) {
+            if (!state_header.error_string) fail("could not get supported format");
+        } else if (!wasapi_sample_format_get(formatex, &state.header.sample_format)) {
+            fail("unsupported sample format");
+            format_is_supported = false;
         } else {
-            formatex = *((WAVEFORMATEXTENSIBLE *)closest_format);
-            format_is_supported = true;
+            state.header.channel_count = formatex.Format.nChannels;
+            state.header.audio_hz = int(formatex.Format.nSamplesPerSec);
         }
-    } else if (hr == S_OK) {
-        format_is_supported = true;
-    } else {
-        cpu_debugbreak();
-        fail("could not get supported format");
-    }
-
-    if (closest_format) {
-        CoTaskMemFree(closest_format);
     }
 
     if (!format_is_supported) {
         goto end_in_error_with_audio_client;
     }
 
-    DWORD demanded_audio_hz = DWORD(audio_hz);
-    DWORD stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
-    if (format->nSamplesPerSec != demanded_audio_hz) {
-        stream_flags |= AUDCLNT_STREAMFLAGS_RATEADJUST;
-    }
+    DWORD const stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
 
-    hr = audio_client->Initialize(AUDCLNT_SHAREMODE_SHARED, stream_flags, 0, 0,
+    // NOTE(nicolas): room for the latency controller of the audio thread,
+    // which only fills as much of it as it needs.
+    REFERENCE_TIME const buffer_duration_100ns = 100 * 10'000;
+    hr = audio_client->Initialize(AUDCLNT_SHAREMODE_SHARED, stream_flags,
+                                  buffer_duration_100ns, 0,
                                   format, NULL);
     if (hr < 0) {
         cpu_debugbreak();
@@ -230,30 +344,6 @@ win32_wasapi_sound_open_stereo(WasapiStream *_state, int const audio_hz)
         goto end_in_error_with_audio_client;
     }
 
-    bool stream_rate_adjusted = !(AUDCLNT_STREAMFLAGS_RATEADJUST & stream_flags);
-    if (!stream_rate_adjusted) {
-        IAudioClockAdjustment *clock_adjustment;
-
-        hr = audio_client->GetService(__uuidof(IAudioClockAdjustment),
-                                      (void **)&clock_adjustment);
-        if (hr < 0) {
-            cpu_debugbreak();
-            fail("could not get clock adjustment service");
-        } else {
-            hr = clock_adjustment->SetSampleRate((float)audio_hz);
-            if (hr < 0) {
-                cpu_debugbreak();
-                fail("could not adjust sample rate");
-            } else {
-                clock_adjustment->Release();
-                stream_rate_adjusted = true;
-            }
-        }
-    }
-    if (!stream_rate_adjusted) {
-        goto end_in_error_with_audio_client;
-    }
-
     UINT32 frame_count;
     hr = audio_client->GetBufferSize(&frame_count);
     if (hr < 0) {
@@ -262,7 +352,7 @@ win32_wasapi_sound_open_stereo(WasapiStream *_state, int const audio_hz)
         goto end_in_error_with_audio_client_started;
     }
     state.max_frame_count = frame_count;
-    state.audio_hz = demanded_audio_hz;
+    state.audio_hz = state.header.audio_hz;
     state.refill_event = CreateEvent(NULL, FALSE, FALSE, NULL);
     state.audio_client = audio_client;
     state.output_device_version = output_device_version;
@@ -343,6 +433,7 @@ wasapi_buffer_acquire(WasapiStreamHeader* _state_header, WasapiStreamValue const
         RETURN_ON_ERROR_WITH(
             OS_SUCCESS(hr) || FAIL_WITH("could not get frame start"), result);
 
+        result.padding_frames = frame_start;
         UINT32 frame_count = frame_end - frame_start;
         if (frame_count > max_buffer_frame_count) {
             frame_count = max_buffer_frame_count;
@@ -379,8 +470,11 @@ win32_wasapi_sound_buffer_block_acquire(WasapiStream *_state, uint32_t max_frame
     memcpy(&state, _state, sizeof state);
     if (state.header.error != WasapiStreamError_Success) return {};
 
+    // NOTE(nicolas): the device signals every period. A device silent for
+    // as long as its whole buffer takes to play is not playing anymore.
+    // (the frames we ask for depend on the latency we aim for instead)
     auto time_out_ms = INFINITE;
-    time_out_ms = 2*lrint(1000.0*double(max_frame_count)/double(state.audio_hz));
+    time_out_ms = 1 + lrint(1000.0*double(state.max_frame_count)/double(state.audio_hz));
     auto wait_res = WaitForSingleObject(state.refill_event, time_out_ms);
     bool missed_deadline = wait_res == WAIT_TIMEOUT;
 
@@ -582,13 +676,13 @@ db_to_amp (double volume_in_db)
     return pow (exp (volume_in_db), log (10.0) / 20.0);
 }
 
-static void reference_tone_n(float* stereo_frames, int frame_count)
+static void reference_tone_n(float* stereo_frames, int frame_count, int audio_hz)
 {
     static const auto reference_hz = 1000;
     static const auto reference_amp = db_to_amp(-20.0);
     static double phase;
 
-    double phase_delta = reference_hz / 48000.0;
+    double phase_delta = reference_hz / double(audio_hz);
     for (int i = 0; i < frame_count; ++i) {
         float y = float(reference_amp * std::sin(TAU*phase));
         stereo_frames[2*i] = stereo_frames[2*i + 1] = y;
@@ -601,21 +695,23 @@ int main(int argc, char** argv)
     (void) argc; (void) argv;
 
     WasapiStream stream;
-    auto audio_rate_hz = 48000;
-    auto result = win32_wasapi_sound_open_stereo(&stream, audio_rate_hz);
-    bool volatile is_running = result == WasapiStreamError_Success;
+    auto result = win32_wasapi_sound_open_stereo(&stream);
+    // the example only renders float samples
+    bool volatile is_running = result == WasapiStreamError_Success &&
+        stream.header.sample_format == WasapiSampleFormat_Float32;
     uint64_t frame_count = 0;
     while (is_running)
     {
         auto buffer = win32_wasapi_sound_buffer_block_acquire(&stream, 4096);
         frame_count += buffer.frame_count;
-        reference_tone_n((float*)buffer.bytes_first, buffer.frame_count);
+        reference_tone_n((float*)buffer.bytes_first, buffer.frame_count,
+                         stream.header.audio_hz);
         win32_wasapi_sound_buffer_release(&stream, buffer);
-        if (frame_count > audio_rate_hz*60) {
+        if (frame_count > uint64_t(stream.header.audio_hz)*60) {
             is_running = false;
         }
         if (stream.header.error == WasapiStreamError_Closed) {
-            if (win32_wasapi_sound_open_stereo(&stream, audio_rate_hz)) {
+            if (win32_wasapi_sound_open_stereo(&stream)) {
                 stream.header.error = WasapiStreamError_Closed;
             }
         }
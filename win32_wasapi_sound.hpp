@@ -1,7 +1,7 @@
 #pragma once
 
 /*
- * Playing a stereo stream on windows using WASAPI.
+ * Playing a multichannel stream on windows using WASAPI.
  */
 
 #include <stdint.h>
@@ -13,10 +13,22 @@ enum WasapiStreamError
     WasapiStreamError_SystemError,
 };
 
+enum WasapiSampleFormat
+{
+    WasapiSampleFormat_Float32,
+    WasapiSampleFormat_Int16,
+    WasapiSampleFormat_Int24Packed,
+    WasapiSampleFormat_Int24In32,
+    WasapiSampleFormat_Int32,
+};
+
 struct WasapiStreamHeader
 {
     WasapiStreamError error;
     char const * error_string;
+    WasapiSampleFormat sample_format; // as negotiated with the device
+    int channel_count; // interleaved samples per frame
+    int audio_hz; // the rate of the device mix
 };
 
 struct WasapiStream
@@ -29,10 +41,16 @@ struct WasapiBuffer
 {
     uint8_t* bytes_first;
     uint32_t frame_count;
+    uint32_t padding_frames; // queued in the device, not played yet
 };
 
+/* channel_count of 0 follows the speaker layout of the device.
+   The stream plays at the rate of the device, see the header. */
+WasapiStreamError
+win32_wasapi_sound_open(WasapiStream*, int channel_count);
+
 WasapiStreamError
-win32_wasapi_sound_open_stereo(WasapiStream*, int audio_hz);
+win32_wasapi_sound_open_stereo(WasapiStream*);
 
 void
 win32_wasapi_sound_close(WasapiStream*);